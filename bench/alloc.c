@@ -0,0 +1,239 @@
+/*
+ * lz_alloc against malloc()/free() on the allocation shapes of liblz: 24
+ * byte tailq heads, 64-120 byte kvmap entries and 30-200 byte paths.
+ *
+ *   churn: keep n live, free a random one and allocate (and write) another,
+ *          then free all of them
+ *   kvmap: n domain keys in a map with and without LZ_KVMAP_F_ALLOC: insert,
+ *          find + remove or add churn over twice as many keys, and free
+ *
+ *   bench_alloc [n ...]    (default: 1000 100000 1000000)
+ */
+
+#include "bench.h"
+
+#include <liblz.h>
+
+#define N_ROUNDS 3
+#define N_CHURN  4000000
+#define N_KVMAP  2000000
+#define KEY_SIZE 80
+
+static void  ** ptrs;
+static size_t * sizes;
+static char   * keys;
+
+static inline size_t
+shape_(uint64_t * rs)
+{
+    uint64_t r = bench_rand(rs);
+
+    switch (r & 7) {
+        case 0:
+            return 24;
+        case 1:
+        case 2:
+            return 30 + (r >> 8) % 170;
+        default:
+            return 64 + (r >> 8) % 56;
+    }
+}
+
+static void
+bench_churn(size_t n)
+{
+    static const char * names[] = { "malloc", "lz_alloc" };
+    uint64_t            rs;
+    uint64_t            t0;
+    size_t              i;
+    size_t              k;
+    int                 r;
+    int                 a;
+
+    for (a = 0; a < 2; a++)
+    {
+        double best = 1e30;
+        double t_free;
+
+        rs = 88172645463325252ULL;
+
+        for (i = 0; i < n; i++)
+        {
+            sizes[i] = shape_(&rs);
+            ptrs[i]  = a ? lz_alloc(sizes[i]) : malloc(sizes[i]);
+            memset(ptrs[i], 1, sizes[i]);
+        }
+
+        for (r = 0; r < N_ROUNDS; r++)
+        {
+            t0 = bench_now_ns();
+
+            for (k = 0; k < N_CHURN; k++)
+            {
+                i = bench_rand(&rs) % n;
+
+                if (a)
+                {
+                    lz_free(ptrs[i], sizes[i]);
+                    sizes[i] = shape_(&rs);
+                    ptrs[i]  = lz_alloc(sizes[i]);
+                } else {
+                    free(ptrs[i]);
+                    sizes[i] = shape_(&rs);
+                    ptrs[i]  = malloc(sizes[i]);
+                }
+
+                memset(ptrs[i], (int)k, sizes[i] < 64 ? sizes[i] : 64);
+            }
+
+            t0 = bench_now_ns() - t0;
+
+            if ((double)t0 / N_CHURN < best)
+            {
+                best = (double)t0 / N_CHURN;
+            }
+        }
+
+        t0 = bench_now_ns();
+
+        for (i = 0; i < n; i++)
+        {
+            if (a)
+            {
+                lz_free(ptrs[i], sizes[i]);
+            } else {
+                free(ptrs[i]);
+            }
+        }
+
+        t_free = (double)(bench_now_ns() - t0) / n;
+
+        printf("churn  n=%-8zu %-9s free + alloc + write %6.1f  teardown %6.1f  (ns/op)\n",
+               n, names[a], best, t_free);
+    }
+
+    lz_alloc_trim();
+}
+
+static void
+bench_kvmap(size_t n)
+{
+    static const char * names[] = { "malloc", "F_ALLOC" };
+    uint64_t            rs = 88172645463325252ULL;
+    uint64_t            t0;
+    size_t              i;
+    size_t              k;
+    int                 r;
+    int                 a;
+
+    /* the first n keys go in, all 2n take part in the churn */
+    for (i = 0; i < 2 * n; i++)
+    {
+        char * key = keys + i * KEY_SIZE;
+        size_t len = bench_dns_name(key, &rs);
+
+        snprintf(key + len, KEY_SIZE - len, ".%zu", i);
+    }
+
+    for (a = 0; a < 2; a++)
+    {
+        double t_add   = 1e30;
+        double t_churn = 1e30;
+        double t_free  = 1e30;
+        double t;
+
+        for (r = 0; r < N_ROUNDS; r++)
+        {
+            lz_kvmap * map = lz_kvmap_new_flags(n, a ? LZ_KVMAP_F_ALLOC : 0);
+
+            t0 = bench_now_ns();
+
+            for (i = 0; i < n; i++)
+            {
+                lz_kvmap_add(map, keys + i * KEY_SIZE, (void *)1, NULL);
+            }
+
+            if ((t = (double)(bench_now_ns() - t0) / n) < t_add)
+            {
+                t_add = t;
+            }
+
+            t0 = bench_now_ns();
+
+            for (k = 0; k < N_KVMAP; k++)
+            {
+                char * key = keys + (bench_rand(&rs) % (2 * n)) * KEY_SIZE;
+
+                if (lz_kvmap_find(map, key) != NULL)
+                {
+                    lz_kvmap_remove(map, key);
+                } else {
+                    lz_kvmap_add(map, key, (void *)1, NULL);
+                }
+            }
+
+            if ((t = (double)(bench_now_ns() - t0) / N_KVMAP) < t_churn)
+            {
+                t_churn = t;
+            }
+
+            t  = (double)lz_kvmap_get_size(map);
+            t0 = bench_now_ns();
+
+            lz_kvmap_free(map);
+
+            if ((t = (double)(bench_now_ns() - t0) / t) < t_free)
+            {
+                t_free = t;
+            }
+        }
+
+        printf("kvmap  n=%-8zu %-9s insert %6.1f  churn %6.1f  free %6.1f  (ns/op)\n",
+               n, names[a], t_add, t_churn, t_free);
+    }
+
+    lz_alloc_trim();
+}
+
+int
+main(int argc, char ** argv)
+{
+    size_t counts[16] = { 1000, 100000, 1000000 };
+    size_t n_counts   = 3;
+    size_t max_n      = 0;
+    size_t i;
+    int    a;
+
+    if (argc > 1)
+    {
+        for (n_counts = 0, a = 1; a < argc && n_counts < 16; a++)
+        {
+            counts[n_counts++] = strtoull(argv[a], NULL, 10);
+        }
+    }
+
+    for (i = 0; i < n_counts; i++)
+    {
+        max_n = counts[i] > max_n ? counts[i] : max_n;
+    }
+
+    ptrs  = bench_xmalloc(max_n * sizeof(void *));
+    sizes = bench_xmalloc(max_n * sizeof(size_t));
+    keys  = bench_xmalloc(2 * max_n * KEY_SIZE);
+
+    for (i = 0; i < n_counts; i++)
+    {
+        bench_churn(counts[i]);
+    }
+
+    for (i = 0; i < n_counts; i++)
+    {
+        bench_kvmap(counts[i]);
+    }
+
+    free(ptrs);
+    free(sizes);
+    free(keys);
+
+    return 0;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+/*
+ * helpers shared by the benchmarks: a monotonic clock, a small PRNG and key
+ * generators for the shapes liblz is used with.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static inline uint64_t
+bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* xorshift64, seeded per benchmark so runs are repeatable */
+static inline uint64_t
+bench_rand(uint64_t * state)
+{
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    return *state = x;
+}
+
+/*
+ * a DNS name of 2-4 random labels of 3-10 characters, NUL terminated,
+ * returns its length. buf needs room for 48 bytes.
+ */
+static inline size_t
+bench_dns_name(char * buf, uint64_t * state)
+{
+    size_t n_labels = 2 + bench_rand(state) % 3;
+    size_t len      = 0;
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < n_labels; i++)
+    {
+        size_t llen = 3 + bench_rand(state) % 8;
+
+        if (i > 0)
+        {
+            buf[len++] = '.';
+        }
+
+        for (j = 0; j < llen; j++)
+        {
+            buf[len++] = 'a' + bench_rand(state) % 26;
+        }
+    }
+
+    buf[len] = '\0';
+
+    return len;
+}
+
+static inline void *
+bench_xmalloc(size_t size)
+{
+    void * p;
+
+    if ((p = malloc(size)) == NULL)
+    {
+        fprintf(stderr, "out of memory (%zu bytes)\n", size);
+        exit(1);
+    }
+
+    return p;
+}
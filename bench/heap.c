@@ -0,0 +1,207 @@
+/*
+ * a plain lz_heap of 48 byte elements against malloc()/free():
+ *
+ *   bulk:  allocate n, then free all of them in random order
+ *   churn: keep n live, free a random one and allocate (and write) another
+ *
+ *   bench_heap [n ...]    (default: 1000 10000 50000 1000000)
+ */
+
+#include "bench.h"
+
+#include <liblz.h>
+
+#define ELEM_SIZE  48
+#define N_ROUNDS   5
+#define N_CHURN    5000000
+
+static void   ** ptrs;
+static uint32_t * perm;
+
+static void
+bench_bulk(size_t n)
+{
+    static const char * names[] = { "malloc", "lz_heap" };
+    lz_heap           * heap    = lz_heap_new(ELEM_SIZE, 1024);
+    double              best[2][2];
+    uint64_t            t0;
+    uint64_t            t1;
+    uint64_t            t2;
+    size_t              i;
+    int                 r;
+    int                 a;
+
+    for (a = 0; a < 2; a++)
+    {
+        best[a][0] = best[a][1] = 1e30;
+    }
+
+    for (r = 0; r < N_ROUNDS; r++)
+    {
+        for (a = 0; a < 2; a++)
+        {
+            t0 = bench_now_ns();
+
+            for (i = 0; i < n; i++)
+            {
+                ptrs[i] = a ? lz_heap_alloc(heap) : malloc(ELEM_SIZE);
+            }
+
+            t1 = bench_now_ns();
+
+            for (i = 0; i < n; i++)
+            {
+                if (a)
+                {
+                    lz_heap_free(heap, ptrs[perm[i]]);
+                } else {
+                    free(ptrs[perm[i]]);
+                }
+            }
+
+            t2 = bench_now_ns();
+
+            if ((double)(t1 - t0) / n < best[a][0])
+            {
+                best[a][0] = (double)(t1 - t0) / n;
+            }
+
+            if ((double)(t2 - t1) / n < best[a][1])
+            {
+                best[a][1] = (double)(t2 - t1) / n;
+            }
+        }
+    }
+
+    for (a = 0; a < 2; a++)
+    {
+        printf("bulk   n=%-8zu %-8s alloc %6.1f  free %6.1f  (ns/op)\n",
+               n, names[a], best[a][0], best[a][1]);
+    }
+
+    lz_heap_destroy(heap);
+}
+
+static void
+bench_churn(size_t n)
+{
+    static const char * names[] = { "malloc", "lz_heap" };
+    uint64_t            rs;
+    uint64_t            t0;
+    size_t              i;
+    size_t              k;
+    int                 r;
+    int                 a;
+
+    for (a = 0; a < 2; a++)
+    {
+        lz_heap * heap = lz_heap_new(ELEM_SIZE, 1024);
+        double    best = 1e30;
+
+        for (i = 0; i < n; i++)
+        {
+            ptrs[i] = a ? lz_heap_alloc(heap) : malloc(ELEM_SIZE);
+            memset(ptrs[i], 1, ELEM_SIZE);
+        }
+
+        for (r = 0; r < N_ROUNDS; r++)
+        {
+            rs = 0x9e3779b97f4a7c15ULL + r;
+            t0 = bench_now_ns();
+
+            for (k = 0; k < N_CHURN; k++)
+            {
+                i = bench_rand(&rs) % n;
+
+                if (a)
+                {
+                    lz_heap_free(heap, ptrs[i]);
+                    ptrs[i] = lz_heap_alloc(heap);
+                } else {
+                    free(ptrs[i]);
+                    ptrs[i] = malloc(ELEM_SIZE);
+                }
+
+                memset(ptrs[i], (int)k, ELEM_SIZE);
+            }
+
+            t0 = bench_now_ns() - t0;
+
+            if ((double)t0 / N_CHURN < best)
+            {
+                best = (double)t0 / N_CHURN;
+            }
+        }
+
+        printf("churn  n=%-8zu %-8s free + alloc + write %6.1f  (ns/pair)\n",
+               n, names[a], best);
+
+        for (i = 0; i < n; i++)
+        {
+            if (a)
+            {
+                lz_heap_free(heap, ptrs[i]);
+            } else {
+                free(ptrs[i]);
+            }
+        }
+
+        lz_heap_destroy(heap);
+    }
+}
+
+int
+main(int argc, char ** argv)
+{
+    size_t   sizes[16] = { 1000, 10000, 50000, 1000000 };
+    size_t   n_sizes   = 4;
+    size_t   max_n     = 0;
+    uint64_t rs        = 88172645463325252ULL;
+    size_t   i;
+    size_t   s;
+    int      a;
+
+    if (argc > 1)
+    {
+        for (n_sizes = 0, a = 1; a < argc && n_sizes < 16; a++)
+        {
+            sizes[n_sizes++] = strtoull(argv[a], NULL, 10);
+        }
+    }
+
+    for (i = 0; i < n_sizes; i++)
+    {
+        max_n = sizes[i] > max_n ? sizes[i] : max_n;
+    }
+
+    ptrs = bench_xmalloc(max_n * sizeof(void *));
+    perm = bench_xmalloc(max_n * sizeof(uint32_t));
+
+    for (s = 0; s < n_sizes; s++)
+    {
+        size_t n = sizes[s];
+
+        /* a fresh shuffle of 0..n-1 for the order of the frees */
+        for (i = 0; i < n; i++)
+        {
+            perm[i] = (uint32_t)i;
+        }
+
+        for (i = n - 1; i > 0; i--)
+        {
+            size_t   j = bench_rand(&rs) % (i + 1);
+            uint32_t t = perm[i];
+
+            perm[i] = perm[j];
+            perm[j] = t;
+        }
+
+        bench_bulk(n);
+        bench_churn(n);
+    }
+
+    free(ptrs);
+    free(perm);
+
+    return 0;
+}
@@ -0,0 +1,210 @@
+/*
+ * producer/consumer handoff of 48 byte elements: each producer allocates
+ * and passes the element through a ring to its consumer, which checks and
+ * frees it. malloc()/free() against a LZ_HEAP_F_MT heap and a plain heap
+ * behind a mutex.
+ *
+ *   bench_heap_mt [n_pairs ...]    (default: 1 4)
+ */
+
+#include "bench.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <liblz.h>
+
+#define ELEM_SIZE 48
+#define RING_SIZE 4096
+#define N_OPS     2000000
+#define N_ROUNDS  3
+#define MAX_PAIRS 64
+
+struct ring {
+    void * slot[RING_SIZE];
+    size_t head __attribute__((aligned(64)));
+    size_t tail __attribute__((aligned(64)));
+};
+
+enum { A_MALLOC, A_HEAP_MT, A_HEAP_MUTEX, A_MAX };
+
+static int             alloc_kind;
+static lz_heap       * heap;
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void *
+elem_alloc_(void)
+{
+    void * p;
+
+    switch (alloc_kind) {
+        case A_MALLOC:
+            return malloc(ELEM_SIZE);
+        case A_HEAP_MT:
+            return lz_heap_alloc(heap);
+        default:
+            pthread_mutex_lock(&heap_lock);
+            p = lz_heap_alloc(heap);
+            pthread_mutex_unlock(&heap_lock);
+
+            return p;
+    }
+}
+
+static inline void
+elem_free_(void * p)
+{
+    switch (alloc_kind) {
+        case A_MALLOC:
+            free(p);
+            break;
+        case A_HEAP_MT:
+            lz_heap_free(heap, p);
+            break;
+        default:
+            pthread_mutex_lock(&heap_lock);
+            lz_heap_free(heap, p);
+            pthread_mutex_unlock(&heap_lock);
+            break;
+    }
+}
+
+static void *
+producer_(void * arg)
+{
+    struct ring * ring = arg;
+    uint64_t      i;
+
+    for (i = 0; i < N_OPS; i++)
+    {
+        uint64_t * p = elem_alloc_();
+
+        p[0] = i;
+        p[5] = ~i;
+
+        while (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING_SIZE)
+        {
+            sched_yield();
+        }
+
+        ring->slot[ring->head % RING_SIZE] = p;
+        __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+static void *
+consumer_(void * arg)
+{
+    struct ring * ring = arg;
+    uint64_t      i;
+
+    for (i = 0; i < N_OPS; i++)
+    {
+        uint64_t * p;
+
+        while (ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+        {
+            sched_yield();
+        }
+
+        p = ring->slot[ring->tail % RING_SIZE];
+        __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+
+        if (p[0] != i || p[5] != ~i)
+        {
+            fprintf(stderr, "element %llu corrupted\n", (unsigned long long)i);
+            exit(1);
+        }
+
+        elem_free_(p);
+    }
+
+    return NULL;
+}
+
+static void
+bench_pairs(size_t n_pairs)
+{
+    static const char * names[] = { "malloc", "lz_heap F_MT", "lz_heap+mutex" };
+    pthread_t           threads[2 * MAX_PAIRS];
+    struct ring       * rings;
+    uint64_t            t0;
+    size_t              i;
+    int                 r;
+
+    for (alloc_kind = 0; alloc_kind < A_MAX; alloc_kind++)
+    {
+        double best = 1e30;
+
+        for (r = 0; r < N_ROUNDS; r++)
+        {
+            double t;
+
+            heap  = alloc_kind == A_HEAP_MT ? lz_heap_new_flags(ELEM_SIZE, 1024, LZ_HEAP_F_MT)
+                                            : lz_heap_new(ELEM_SIZE, 1024);
+            rings = aligned_alloc(64, n_pairs * sizeof(struct ring));
+
+            if (heap == NULL || rings == NULL)
+            {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+
+            memset(rings, 0, n_pairs * sizeof(struct ring));
+            t0 = bench_now_ns();
+
+            for (i = 0; i < n_pairs; i++)
+            {
+                pthread_create(&threads[2 * i], NULL, producer_, &rings[i]);
+                pthread_create(&threads[2 * i + 1], NULL, consumer_, &rings[i]);
+            }
+
+            for (i = 0; i < 2 * n_pairs; i++)
+            {
+                pthread_join(threads[i], NULL);
+            }
+
+            if ((t = (double)(bench_now_ns() - t0) / ((double)N_OPS * n_pairs)) < best)
+            {
+                best = t;
+            }
+
+            free(rings);
+            lz_heap_destroy(heap);
+        }
+
+        printf("%2zu pair(s)  %-14s %6.1f  (ns/handoff)\n", n_pairs, names[alloc_kind], best);
+    }
+}
+
+int
+main(int argc, char ** argv)
+{
+    size_t pairs[16] = { 1, 4 };
+    size_t n_pairs   = 2;
+    size_t i;
+    int    a;
+
+    if (argc > 1)
+    {
+        for (n_pairs = 0, a = 1; a < argc && n_pairs < 16; a++)
+        {
+            pairs[n_pairs++] = strtoull(argv[a], NULL, 10);
+        }
+    }
+
+    for (i = 0; i < n_pairs; i++)
+    {
+        if (pairs[i] == 0 || pairs[i] > MAX_PAIRS)
+        {
+            fprintf(stderr, "n_pairs must be 1-%d\n", MAX_PAIRS);
+            return 1;
+        }
+
+        bench_pairs(pairs[i]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * many threads hammering one heap: each allocates 8 elements of 48 bytes,
+ * writes and checks them, and frees them again. malloc()/free() against a
+ * LZ_HEAP_F_SHARED heap, a plain heap behind a mutex and a LZ_HEAP_F_MT
+ * heap, for 1 to 64 threads sharing a fixed amount of work.
+ *
+ *   bench_heap_shared [n_threads ...]    (default: 1 2 4 8 16 32 64)
+ */
+
+#include "bench.h"
+
+#include <pthread.h>
+
+#include <liblz.h>
+
+#define ELEM_SIZE   48
+#define N_BURST     8
+#define N_TOTAL     500000
+#define N_ROUNDS    3
+#define MAX_THREADS 64
+
+enum { A_MALLOC, A_HEAP_SHARED, A_HEAP_MUTEX, A_HEAP_MT, A_MAX };
+
+static int             alloc_kind;
+static lz_heap       * heap;
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t          n_per_thread;
+
+static inline void *
+elem_alloc_(void)
+{
+    void * p;
+
+    switch (alloc_kind) {
+        case A_MALLOC:
+            return malloc(ELEM_SIZE);
+        case A_HEAP_MUTEX:
+            pthread_mutex_lock(&heap_lock);
+            p = lz_heap_alloc(heap);
+            pthread_mutex_unlock(&heap_lock);
+
+            return p;
+        default:
+            return lz_heap_alloc(heap);
+    }
+}
+
+static inline void
+elem_free_(void * p)
+{
+    switch (alloc_kind) {
+        case A_MALLOC:
+            free(p);
+            break;
+        case A_HEAP_MUTEX:
+            pthread_mutex_lock(&heap_lock);
+            lz_heap_free(heap, p);
+            pthread_mutex_unlock(&heap_lock);
+            break;
+        default:
+            lz_heap_free(heap, p);
+            break;
+    }
+}
+
+static void *
+worker_(void * arg)
+{
+    uint64_t   id = (uintptr_t)arg;
+    uint64_t * p[N_BURST];
+    size_t     i;
+    int        k;
+
+    for (i = 0; i < n_per_thread; i++)
+    {
+        for (k = 0; k < N_BURST; k++)
+        {
+            p[k]    = elem_alloc_();
+            p[k][0] = id;
+            p[k][1] = i;
+        }
+
+        for (k = 0; k < N_BURST; k++)
+        {
+            if (p[k][0] != id || p[k][1] != i)
+            {
+                fprintf(stderr, "element of thread %llu corrupted\n", (unsigned long long)id);
+                exit(1);
+            }
+
+            elem_free_(p[k]);
+        }
+    }
+
+    return NULL;
+}
+
+static void
+bench_threads(size_t n_threads)
+{
+    pthread_t threads[MAX_THREADS];
+    uint64_t  t0;
+    size_t    i;
+    int       r;
+
+    n_per_thread = N_TOTAL / n_threads;
+
+    printf("%7zu", n_threads);
+
+    for (alloc_kind = 0; alloc_kind < A_MAX; alloc_kind++)
+    {
+        double best = 1e30;
+
+        for (r = 0; r < N_ROUNDS; r++)
+        {
+            double t;
+
+            switch (alloc_kind) {
+                case A_HEAP_SHARED:
+                    heap = lz_heap_new_flags(ELEM_SIZE, 1024, LZ_HEAP_F_SHARED);
+                    break;
+                case A_HEAP_MT:
+                    heap = lz_heap_new_flags(ELEM_SIZE, 1024, LZ_HEAP_F_MT);
+                    break;
+                default:
+                    heap = lz_heap_new(ELEM_SIZE, 1024);
+                    break;
+            }
+
+            t0 = bench_now_ns();
+
+            for (i = 0; i < n_threads; i++)
+            {
+                pthread_create(&threads[i], NULL, worker_, (void *)(uintptr_t)i);
+            }
+
+            for (i = 0; i < n_threads; i++)
+            {
+                pthread_join(threads[i], NULL);
+            }
+
+            t = (double)(bench_now_ns() - t0) / ((double)n_per_thread * n_threads * N_BURST);
+
+            if (t < best)
+            {
+                best = t;
+            }
+
+            lz_heap_destroy(heap);
+        }
+
+        printf(" %14.1f", best);
+    }
+
+    printf("\n");
+}
+
+int
+main(int argc, char ** argv)
+{
+    size_t counts[16] = { 1, 2, 4, 8, 16, 32, 64 };
+    size_t n_counts   = 7;
+    size_t i;
+    int    a;
+
+    if (argc > 1)
+    {
+        for (n_counts = 0, a = 1; a < argc && n_counts < 16; a++)
+        {
+            counts[n_counts++] = strtoull(argv[a], NULL, 10);
+        }
+    }
+
+    printf("threads %14s %14s %14s %14s  (ns per alloc + free, all threads)\n",
+           "malloc", "F_SHARED", "plain+mutex", "F_MT");
+
+    for (i = 0; i < n_counts; i++)
+    {
+        if (counts[i] == 0 || counts[i] > MAX_THREADS)
+        {
+            fprintf(stderr, "n_threads must be 1-%d\n", MAX_THREADS);
+            return 1;
+        }
+
+        bench_threads(counts[i]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * lz_imap against lz_kvmap with the integer key formatted into a string,
+ * random uint32_t keys, lookups only.
+ *
+ *   bench_imap [n_keys] [n_lookups]    (default: 1000000 4000000)
+ */
+
+#include "bench.h"
+
+#include <liblz.h>
+
+#define N_ROUNDS 3
+
+int
+main(int argc, char ** argv)
+{
+    size_t     n_keys    = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+    size_t     n_lookups = argc > 2 ? strtoull(argv[2], NULL, 10) : 4000000;
+    uint32_t * ikeys     = bench_xmalloc(n_keys * sizeof(uint32_t));
+    lz_imap  * imap      = lz_imap_new(n_keys);
+    lz_kvmap * kvmap     = lz_kvmap_new(n_keys);
+    double     t_kvmap   = 1e30;
+    double     t_imap    = 1e30;
+    uint64_t   rs        = 88172645463325252ULL;
+    uint64_t   t0;
+    size_t     found     = 0;
+    size_t     i;
+    char       buf[16];
+    int        len;
+    int        r;
+
+    for (i = 0; i < n_keys; i++)
+    {
+        ikeys[i] = (uint32_t)bench_rand(&rs);
+
+        len = snprintf(buf, sizeof(buf), "%u", ikeys[i]);
+
+        lz_imap_add(imap, ikeys[i], (void *)1, NULL);
+
+        if (lz_kvmap_find_wklen(kvmap, buf, len) == NULL)
+        {
+            lz_kvmap_add_wklen(kvmap, buf, len, (void *)1, NULL);
+        }
+    }
+
+    for (r = 0; r < N_ROUNDS; r++)
+    {
+        double t;
+
+        rs = 0x9e3779b97f4a7c15ULL + r;
+        t0 = bench_now_ns();
+
+        for (i = 0; i < n_lookups; i++)
+        {
+            len    = snprintf(buf, sizeof(buf), "%u", ikeys[bench_rand(&rs) % n_keys]);
+            found += lz_kvmap_find_wklen(kvmap, buf, len) != NULL;
+        }
+
+        if ((t = (double)(bench_now_ns() - t0) / n_lookups) < t_kvmap)
+        {
+            t_kvmap = t;
+        }
+
+        rs = 0x9e3779b97f4a7c15ULL + r;
+        t0 = bench_now_ns();
+
+        for (i = 0; i < n_lookups; i++)
+        {
+            found += lz_imap_find(imap, ikeys[bench_rand(&rs) % n_keys]) != NULL;
+        }
+
+        if ((t = (double)(bench_now_ns() - t0) / n_lookups) < t_imap)
+        {
+            t_imap = t;
+        }
+    }
+
+    if (found != n_lookups * N_ROUNDS * 2)
+    {
+        fprintf(stderr, "found %zu of %zu\n", found, n_lookups * N_ROUNDS * 2);
+        return 1;
+    }
+
+    printf("%zu random uint32 keys, %zu lookups (ns/op)\n", n_keys, n_lookups);
+    printf("lz_kvmap + sprintf  %6.1f\n", t_kvmap);
+    printf("lz_imap             %6.1f\n", t_imap);
+
+    lz_imap_free(imap);
+    lz_kvmap_free(kvmap);
+    free(ikeys);
+
+    return 0;
+}
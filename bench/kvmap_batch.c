@@ -0,0 +1,147 @@
+/*
+ * one lz_kvmap_find_wklen() per key vs lz_kvmap_find_batch(), random hits
+ * over a table meant to be larger than the last level cache.
+ *
+ *   bench_kvmap_batch [n_entries] [n_lookups]    (default: 8000000 4000000)
+ */
+
+#include "bench.h"
+
+#include <liblz.h>
+
+#define KEY_STRIDE 24
+#define N_ROUNDS   3
+#define BATCH_MAX  256
+
+static char * keys;
+static size_t n_keys;
+static size_t n_lookups;
+
+static double
+bench_single(lz_kvmap * map, uint64_t seed)
+{
+    uint64_t rs    = seed;
+    uint64_t t0    = bench_now_ns();
+    size_t   found = 0;
+    size_t   i;
+
+    for (i = 0; i < n_lookups; i++)
+    {
+        found += lz_kvmap_find_wklen(map, keys + (bench_rand(&rs) % n_keys) * KEY_STRIDE, 16) != NULL;
+    }
+
+    t0 = bench_now_ns() - t0;
+
+    if (found != n_lookups)
+    {
+        fprintf(stderr, "single: found %zu of %zu\n", found, n_lookups);
+        exit(1);
+    }
+
+    return (double)t0 / n_lookups;
+}
+
+static double
+bench_batched(lz_kvmap * map, uint64_t seed, size_t batch)
+{
+    const char * bkeys[BATCH_MAX];
+    size_t       blens[BATCH_MAX];
+    void       * out[BATCH_MAX];
+    uint64_t     rs    = seed;
+    uint64_t     t0    = bench_now_ns();
+    size_t       found = 0;
+    size_t       i;
+    size_t       j;
+
+    for (i = 0; i < n_lookups; i += batch)
+    {
+        size_t n = n_lookups - i < batch ? n_lookups - i : batch;
+
+        for (j = 0; j < n; j++)
+        {
+            bkeys[j] = keys + (bench_rand(&rs) % n_keys) * KEY_STRIDE;
+            blens[j] = 16;
+        }
+
+        found += lz_kvmap_find_batch(map, bkeys, blens, out, n);
+    }
+
+    t0 = bench_now_ns() - t0;
+
+    if (found != n_lookups)
+    {
+        fprintf(stderr, "batch %zu: found %zu of %zu\n", batch, found, n_lookups);
+        exit(1);
+    }
+
+    return (double)t0 / n_lookups;
+}
+
+static void
+bench_engine(const char * name, int flags)
+{
+    static const size_t batches[] = { 32, 256 };
+    lz_kvmap          * map;
+    size_t              b;
+    size_t              i;
+    int                 r;
+
+    map = lz_kvmap_new_flags(16, flags);
+
+    for (i = 0; i < n_keys; i++)
+    {
+        lz_kvmap_add_wklen(map, keys + i * KEY_STRIDE, 16, (void *)(uintptr_t)(i + 1), NULL);
+    }
+
+    for (b = 0; b < sizeof(batches) / sizeof(batches[0]); b++)
+    {
+        double t_single  = 1e30;
+        double t_batched = 1e30;
+
+        /* both see the same keys in the same order */
+        for (r = 0; r < N_ROUNDS; r++)
+        {
+            double t;
+
+            if ((t = bench_single(map, 0x9e3779b97f4a7c15ULL + r)) < t_single)
+            {
+                t_single = t;
+            }
+
+            if ((t = bench_batched(map, 0x9e3779b97f4a7c15ULL + r, batches[b])) < t_batched)
+            {
+                t_batched = t;
+            }
+        }
+
+        printf("%-6s batch %3zu:  single %6.1f  batched %6.1f  (%.2fx, ns/key)\n",
+               name, batches[b], t_single, t_batched, t_single / t_batched);
+    }
+
+    lz_kvmap_free(map);
+}
+
+int
+main(int argc, char ** argv)
+{
+    uint64_t rs = 88172645463325252ULL;
+    size_t   i;
+
+    n_keys    = argc > 1 ? strtoull(argv[1], NULL, 10) : 8000000;
+    n_lookups = argc > 2 ? strtoull(argv[2], NULL, 10) : 4000000;
+    keys      = bench_xmalloc(n_keys * KEY_STRIDE);
+
+    for (i = 0; i < n_keys; i++)
+    {
+        snprintf(keys + i * KEY_STRIDE, KEY_STRIDE, "%016llx", (unsigned long long)bench_rand(&rs));
+    }
+
+    printf("%zu entries, %zu random hits\n", n_keys, n_lookups);
+
+    bench_engine("chain", 0);
+    bench_engine("open", LZ_KVMAP_F_OPEN);
+
+    free(keys);
+
+    return 0;
+}
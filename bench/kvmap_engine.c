@@ -0,0 +1,131 @@
+/*
+ * chained vs open addressing lz_kvmap: insert, hit and miss cost at a few
+ * table sizes.
+ *
+ *   bench_kvmap_engine [n_entries ...]    (default: 1000 1000000)
+ */
+
+#include "bench.h"
+
+#include <liblz.h>
+
+#define KEY_STRIDE 24
+#define N_LOOKUPS  2000000
+#define N_ROUNDS   3
+
+static char * keys;
+static char * miss_keys;
+
+static void
+bench_engine(const char * name, int flags, size_t n)
+{
+    lz_kvmap * map;
+    uint64_t   rs;
+    uint64_t   t0;
+    double     t_insert;
+    double     t_hit  = 1e30;
+    double     t_miss = 1e30;
+    size_t     found  = 0;
+    size_t     i;
+    int        r;
+
+    map = lz_kvmap_new_flags(16, flags);
+
+    t0 = bench_now_ns();
+
+    for (i = 0; i < n; i++)
+    {
+        lz_kvmap_add_wklen(map, keys + i * KEY_STRIDE, 16, (void *)(uintptr_t)(i + 1), NULL);
+    }
+
+    t_insert = (double)(bench_now_ns() - t0) / n;
+
+    for (r = 0; r < N_ROUNDS; r++)
+    {
+        double t;
+
+        rs = 0x9e3779b97f4a7c15ULL + r;
+        t0 = bench_now_ns();
+
+        for (i = 0; i < N_LOOKUPS; i++)
+        {
+            found += lz_kvmap_find_wklen(map, keys + (bench_rand(&rs) % n) * KEY_STRIDE, 16) != NULL;
+        }
+
+        if ((t = (double)(bench_now_ns() - t0) / N_LOOKUPS) < t_hit)
+        {
+            t_hit = t;
+        }
+
+        t0 = bench_now_ns();
+
+        for (i = 0; i < N_LOOKUPS; i++)
+        {
+            found += lz_kvmap_find_wklen(map, miss_keys + (bench_rand(&rs) % n) * KEY_STRIDE, 16) != NULL;
+        }
+
+        if ((t = (double)(bench_now_ns() - t0) / N_LOOKUPS) < t_miss)
+        {
+            t_miss = t;
+        }
+    }
+
+    if (found != (size_t)N_LOOKUPS * N_ROUNDS)
+    {
+        fprintf(stderr, "%s: found %zu of %zu\n", name, found, (size_t)N_LOOKUPS * N_ROUNDS);
+        exit(1);
+    }
+
+    printf("%-10zu %-6s insert %7.1f  hit %7.1f  miss %7.1f  (ns/op)\n",
+           n, name, t_insert, t_hit, t_miss);
+
+    lz_kvmap_free(map);
+}
+
+int
+main(int argc, char ** argv)
+{
+    size_t   sizes[16] = { 1000, 1000000 };
+    size_t   n_sizes   = 2;
+    size_t   max_n     = 0;
+    uint64_t rs        = 88172645463325252ULL;
+    size_t   i;
+    int      a;
+
+    if (argc > 1)
+    {
+        for (n_sizes = 0, a = 1; a < argc && n_sizes < 16; a++)
+        {
+            sizes[n_sizes++] = strtoull(argv[a], NULL, 10);
+        }
+    }
+
+    for (i = 0; i < n_sizes; i++)
+    {
+        max_n = sizes[i] > max_n ? sizes[i] : max_n;
+    }
+
+    keys      = bench_xmalloc(max_n * KEY_STRIDE);
+    miss_keys = bench_xmalloc(max_n * KEY_STRIDE);
+
+    /* 16 hex digits; misses differ in their first character */
+    for (i = 0; i < max_n; i++)
+    {
+        uint64_t v = bench_rand(&rs);
+
+        snprintf(keys + i * KEY_STRIDE, KEY_STRIDE, "%016llx", (unsigned long long)v);
+        snprintf(miss_keys + i * KEY_STRIDE, KEY_STRIDE, "%016llx", (unsigned long long)v);
+        miss_keys[i * KEY_STRIDE] = 'x';
+    }
+
+    for (i = 0; i < n_sizes; i++)
+    {
+        bench_engine("chain", 0, sizes[i]);
+        bench_engine("open", LZ_KVMAP_F_OPEN, sizes[i]);
+    }
+
+    free(keys);
+    free(miss_keys);
+
+    return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * the built-in lz_kvmap hash functions on DNS-name sized keys: the hash on
+ * its own, and a find (hit) in a map small enough to stay in cache.
+ *
+ *   bench_kvmap_hash [n_keys]    (default: 10000)
+ */
+
+#include "bench.h"
+
+#include <liblz.h>
+
+#define NAME_STRIDE 48
+#define N_OPS       4000000
+#define N_ROUNDS    3
+
+static const struct {
+    const char            * name;
+    enum lz_kvmap_hash_type type;
+} hashes[] = {
+    { "wy",      LZ_KVMAP_HASH_WY      },
+    { "fnv",     LZ_KVMAP_HASH_FNV     },
+    { "crc32",   LZ_KVMAP_HASH_CRC32   },
+    { "murmur2", LZ_KVMAP_HASH_MURMUR2 },
+    { "jenkins", LZ_KVMAP_HASH_JENKINS },
+    { "djb2",    LZ_KVMAP_HASH_DJB2    },
+};
+
+int
+main(int argc, char ** argv)
+{
+    size_t   n     = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000;
+    char   * names = bench_xmalloc(n * NAME_STRIDE);
+    size_t * lens  = bench_xmalloc(n * sizeof(size_t));
+    uint64_t rs    = 88172645463325252ULL;
+    size_t   total = 0;
+    size_t   h;
+    size_t   i;
+
+    for (i = 0; i < n; i++)
+    {
+        lens[i] = bench_dns_name(names + i * NAME_STRIDE, &rs);
+        total  += lens[i];
+    }
+
+    printf("%zu random DNS names, %.1f bytes on average\n", n, (double)total / n);
+
+    for (h = 0; h < sizeof(hashes) / sizeof(hashes[0]); h++)
+    {
+        lz_kvmap_hashfn   hashfn = lz_kvmap_get_hashfn(hashes[h].type);
+        lz_kvmap        * map    = lz_kvmap_new_with_hash(n, 0, hashes[h].type, NULL);
+        volatile uint32_t sink   = 0;
+        size_t            found  = 0;
+        double            t_hash = 1e30;
+        double            t_find = 1e30;
+        int               r;
+
+        for (i = 0; i < n; i++)
+        {
+            lz_kvmap_add_wklen(map, names + i * NAME_STRIDE, lens[i], (void *)1, NULL);
+        }
+
+        for (r = 0; r < N_ROUNDS; r++)
+        {
+            uint64_t t0;
+            double   t;
+            size_t   k;
+
+            t0 = bench_now_ns();
+
+            for (i = 0, k = 0; i < N_OPS; i++, k = k + 1 == n ? 0 : k + 1)
+            {
+                sink += hashfn(names + k * NAME_STRIDE, lens[k]);
+            }
+
+            if ((t = (double)(bench_now_ns() - t0) / N_OPS) < t_hash)
+            {
+                t_hash = t;
+            }
+
+            rs = 0x9e3779b97f4a7c15ULL + r;
+            t0 = bench_now_ns();
+
+            for (i = 0; i < N_OPS; i++)
+            {
+                k      = bench_rand(&rs) % n;
+                found += lz_kvmap_find_wklen(map, names + k * NAME_STRIDE, lens[k]) != NULL;
+            }
+
+            if ((t = (double)(bench_now_ns() - t0) / N_OPS) < t_find)
+            {
+                t_find = t;
+            }
+        }
+
+        printf("%-8s hash %6.1f  find (hit, in cache) %6.1f  (ns)\n",
+               hashes[h].name, t_hash, t_find);
+
+        if (found != (size_t)N_OPS * N_ROUNDS)
+        {
+            fprintf(stderr, "%s: found %zu of %zu\n", hashes[h].name, found, (size_t)N_OPS * N_ROUNDS);
+            return 1;
+        }
+
+        lz_kvmap_free(map);
+    }
+
+    free(names);
+    free(lens);
+
+    return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * lz_kvmap_mt against one lz_kvmap behind a mutex, from 1 to N threads at
+ * several write ratios. Writes are upserts of existing keys, so the map
+ * keeps its size and every write retires an entry.
+ *
+ *   bench_kvmap_mt [max_threads] [n_keys] [ops_per_thread]
+ *                  (default: 32 100000 400000)
+ */
+
+#include "bench.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <liblz.h>
+
+#define KEY_STRIDE 24
+
+static const int write_pcts[] = { 0, 10, 50 };
+
+static char          * keys;
+static size_t          n_keys;
+static size_t          n_ops;
+static int             write_pct;
+
+static lz_kvmap_mt   * mt_map;
+static lz_kvmap      * mutex_map;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_barrier_t start;
+
+static void *
+run_mt_(void * arg)
+{
+    uint64_t rs    = (uintptr_t)arg * 0x9e3779b97f4a7c15ULL + 1;
+    size_t   found = 0;
+    size_t   i;
+
+    pthread_barrier_wait(&start);
+
+    for (i = 0; i < n_ops; i++)
+    {
+        uint64_t     r = bench_rand(&rs);
+        const char * k = keys + (r % n_keys) * KEY_STRIDE;
+
+        if ((int)((r >> 40) % 100) < write_pct)
+        {
+            lz_kvmap_mt_upsert(mt_map, k, 16, (void *)(uintptr_t)r, NULL, NULL);
+        } else {
+            found += lz_kvmap_mt_find(mt_map, k, 16) != NULL;
+        }
+    }
+
+    return (void *)found;
+}
+
+static void *
+run_mutex_(void * arg)
+{
+    uint64_t rs    = (uintptr_t)arg * 0x9e3779b97f4a7c15ULL + 1;
+    size_t   found = 0;
+    size_t   i;
+
+    pthread_barrier_wait(&start);
+
+    for (i = 0; i < n_ops; i++)
+    {
+        uint64_t     r = bench_rand(&rs);
+        const char * k = keys + (r % n_keys) * KEY_STRIDE;
+
+        pthread_mutex_lock(&mutex);
+
+        if ((int)((r >> 40) % 100) < write_pct)
+        {
+            lz_kvmap_upsert(mutex_map, k, 16, (void *)(uintptr_t)r, NULL, NULL);
+        } else {
+            found += lz_kvmap_find_wklen(mutex_map, k, 16) != NULL;
+        }
+
+        pthread_mutex_unlock(&mutex);
+    }
+
+    return (void *)found;
+}
+
+/* returns millions of operations per second, over all threads */
+static double
+run_(void * (* fn)(void *), int n_threads)
+{
+    pthread_t threads[n_threads];
+    uint64_t  t0;
+    long      i;
+
+    pthread_barrier_init(&start, NULL, n_threads + 1);
+
+    for (i = 0; i < n_threads; i++)
+    {
+        pthread_create(&threads[i], NULL, fn, (void *)(i + 1));
+    }
+
+    pthread_barrier_wait(&start);
+    t0 = bench_now_ns();
+
+    for (i = 0; i < n_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    t0 = bench_now_ns() - t0;
+
+    pthread_barrier_destroy(&start);
+
+    return (double)n_ops * n_threads * 1000.0 / t0;
+}
+
+int
+main(int argc, char ** argv)
+{
+    int      max_threads = argc > 1 ? atoi(argv[1]) : 32;
+    uint64_t rs          = 88172645463325252ULL;
+    size_t   w;
+    size_t   i;
+    int      t;
+
+    n_keys = argc > 2 ? strtoull(argv[2], NULL, 10) : 100000;
+    n_ops  = argc > 3 ? strtoull(argv[3], NULL, 10) : 400000;
+    keys   = bench_xmalloc(n_keys * KEY_STRIDE);
+
+    mt_map    = lz_kvmap_mt_new(0, 1024);
+    mutex_map = lz_kvmap_new(n_keys);
+
+    for (i = 0; i < n_keys; i++)
+    {
+        snprintf(keys + i * KEY_STRIDE, KEY_STRIDE, "%016llx", (unsigned long long)bench_rand(&rs));
+
+        lz_kvmap_mt_add(mt_map, keys + i * KEY_STRIDE, 16, (void *)1, NULL);
+        lz_kvmap_add_wklen(mutex_map, keys + i * KEY_STRIDE, 16, (void *)1, NULL);
+    }
+
+    printf("%zu keys, %zu ops per thread, %ld CPUs online (Mops/s, all threads)\n",
+           n_keys, n_ops, sysconf(_SC_NPROCESSORS_ONLN));
+
+    for (w = 0; w < sizeof(write_pcts) / sizeof(write_pcts[0]); w++)
+    {
+        write_pct = write_pcts[w];
+
+        /* powers of two, and max_threads itself */
+        for (t = 1; t <= max_threads; t = (t < max_threads && t * 2 > max_threads) ? max_threads : t * 2)
+        {
+            double mutex_mops = run_(run_mutex_, t);
+            double mt_mops    = run_(run_mt_, t);
+
+            printf("writes %2d%%  threads %3d  mutex %7.2f  kvmap_mt %7.2f\n",
+                   write_pct, t, mutex_mops, mt_mops);
+        }
+    }
+
+    lz_kvmap_mt_free(mt_map);
+    lz_kvmap_free(mutex_map);
+    free(keys);
+
+    return 0;
+}
@@ -0,0 +1,208 @@
+/*
+ * lz_omap against lz_kvmap for what an ordered map is for: a range of 1000
+ * keys and a full ordered walk, where lz_kvmap has to scan everything and
+ * sort, and for point finds, where it does not.
+ *
+ *   bench_omap [n_keys]    (default: 1000000)
+ */
+
+#include "bench.h"
+
+#include <liblz.h>
+
+#define KEY_STRIDE  24
+#define RANGE       1000
+#define N_RANGES    1000
+#define N_KV_RANGES 5
+#define N_FINDS     1000000
+
+static char        * keys;
+static const char ** sorted;
+static size_t        n_keys;
+
+struct collect {
+    const char  * lo;
+    const char  * hi;
+    const char ** out;
+    size_t        n;
+};
+
+static int
+cmp_key_(const void * a, const void * b)
+{
+    return memcmp(*(const char * const *)a, *(const char * const *)b, 16);
+}
+
+static int
+count_(const char * key, size_t klen, void * val, void * arg)
+{
+    (void)key;
+    (void)klen;
+    (void)val;
+
+    (*(size_t *)arg)++;
+
+    return 0;
+}
+
+static int
+collect_(lz_kvmap_ent * ent, void * arg)
+{
+    struct collect * c = arg;
+    const char     * k = lz_kvmap_ent_key(ent);
+
+    if ((c->lo == NULL || memcmp(k, c->lo, 16) >= 0) &&
+        (c->hi == NULL || memcmp(k, c->hi, 16) < 0))
+    {
+        c->out[c->n++] = k;
+    }
+
+    return 0;
+}
+
+/* every key of the map in [lo, hi), sorted: what a range costs without order */
+static size_t
+kvmap_range_(lz_kvmap * map, const char * lo, const char * hi, const char ** out)
+{
+    struct collect c = { lo, hi, out, 0 };
+    uint64_t       cursor = 0;
+
+    do {
+        cursor = lz_kvmap_scan(map, cursor, 1024, collect_, &c);
+    } while (cursor != 0);
+
+    qsort(out, c.n, sizeof(*out), cmp_key_);
+
+    return c.n;
+}
+
+int
+main(int argc, char ** argv)
+{
+    lz_omap     * omap;
+    lz_kvmap    * kvmap;
+    lz_omap_iter  it;
+    const char ** out;
+    uint64_t      rs = 88172645463325252ULL;
+    uint64_t      t0;
+    double        t_omap;
+    double        t_kvmap;
+    size_t        n;
+    size_t        found = 0;
+    size_t        i;
+
+    n_keys = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+    keys   = bench_xmalloc(n_keys * KEY_STRIDE);
+    sorted = bench_xmalloc(n_keys * sizeof(*sorted));
+    out    = bench_xmalloc(n_keys * sizeof(*out));
+    omap   = lz_omap_new();
+    kvmap  = lz_kvmap_new(n_keys);
+
+    for (i = 0; i < n_keys; i++)
+    {
+        snprintf(keys + i * KEY_STRIDE, KEY_STRIDE, "%016llx", (unsigned long long)bench_rand(&rs));
+        sorted[i] = keys + i * KEY_STRIDE;
+
+        lz_omap_add(omap, sorted[i], 16, (void *)1, NULL);
+        lz_kvmap_add_wklen(kvmap, sorted[i], 16, (void *)1, NULL);
+    }
+
+    qsort(sorted, n_keys, sizeof(*sorted), cmp_key_);
+
+    printf("%zu random keys\n", n_keys);
+
+    if (n_keys > RANGE)
+    {
+        /* [lo, hi) holds exactly RANGE keys */
+        rs = 0x9e3779b97f4a7c15ULL;
+        t0 = bench_now_ns();
+
+        for (i = 0; i < N_RANGES; i++)
+        {
+            size_t r = bench_rand(&rs) % (n_keys - RANGE);
+
+            n = 0;
+            lz_omap_range(omap, sorted[r], 16, sorted[r + RANGE], 16, count_, &n);
+            found += n;
+        }
+
+        t_omap = (double)(bench_now_ns() - t0) / N_RANGES;
+        t0     = bench_now_ns();
+
+        for (i = 0; i < N_KV_RANGES; i++)
+        {
+            size_t r = bench_rand(&rs) % (n_keys - RANGE);
+
+            found += kvmap_range_(kvmap, sorted[r], sorted[r + RANGE], out);
+        }
+
+        t_kvmap = (double)(bench_now_ns() - t0) / N_KV_RANGES;
+
+        if (found != RANGE * (N_RANGES + N_KV_RANGES))
+        {
+            fprintf(stderr, "range: found %zu\n", found);
+            return 1;
+        }
+
+        printf("range of %d       omap %10.1f us   kvmap scan + sort %10.1f us\n",
+               RANGE, t_omap / 1000, t_kvmap / 1000);
+    }
+
+    t0 = bench_now_ns();
+
+    for (n = 0, i = lz_omap_first(omap, &it); i == 0; i = lz_omap_iter_next(&it))
+    {
+        n++;
+    }
+
+    t_omap  = (double)(bench_now_ns() - t0);
+    t0      = bench_now_ns();
+    found   = kvmap_range_(kvmap, NULL, NULL, out);
+    t_kvmap = (double)(bench_now_ns() - t0);
+
+    if (n != n_keys || found != n_keys)
+    {
+        fprintf(stderr, "walk: %zu / %zu of %zu\n", n, found, n_keys);
+        return 1;
+    }
+
+    printf("ordered walk        omap %10.1f ms   kvmap scan + sort %10.1f ms\n",
+           t_omap / 1e6, t_kvmap / 1e6);
+
+    rs    = 0x9e3779b97f4a7c15ULL;
+    found = 0;
+    t0    = bench_now_ns();
+
+    for (i = 0; i < N_FINDS; i++)
+    {
+        found += lz_omap_find(omap, keys + (bench_rand(&rs) % n_keys) * KEY_STRIDE, 16) != NULL;
+    }
+
+    t_omap = (double)(bench_now_ns() - t0) / N_FINDS;
+    rs     = 0x9e3779b97f4a7c15ULL;
+    t0     = bench_now_ns();
+
+    for (i = 0; i < N_FINDS; i++)
+    {
+        found += lz_kvmap_find_wklen(kvmap, keys + (bench_rand(&rs) % n_keys) * KEY_STRIDE, 16) != NULL;
+    }
+
+    t_kvmap = (double)(bench_now_ns() - t0) / N_FINDS;
+
+    if (found != 2 * N_FINDS)
+    {
+        fprintf(stderr, "find: found %zu of %d\n", found, 2 * N_FINDS);
+        return 1;
+    }
+
+    printf("point find          omap %10.1f ns   kvmap             %10.1f ns\n",
+           t_omap, t_kvmap);
+
+    lz_omap_free(omap);
+    lz_kvmap_free(kvmap);
+    free(keys);
+    free(sorted);
+    free(out);
+
+    return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * longest-suffix rule matching on DNS names: lz_sfxtrie and its frozen form
+ * against lowercasing the name and looking up every suffix in an lz_kvmap,
+ * longest first. Half the queries are random names, half are rules with 1-5
+ * extra labels in front.
+ *
+ *   bench_sfxtrie [n_rules ...]    (default: 100000 1000000)
+ */
+
+#include "bench.h"
+
+#include <ctype.h>
+#include <unistd.h>
+
+#include <liblz.h>
+
+#define NAME_STRIDE 128
+#define N_QUERIES   1000000
+#define N_ROUNDS    5
+
+static char   * rules;
+static size_t * rule_lens;
+static char   * queries;
+static size_t * query_lens;
+
+static size_t
+kvmap_match_(lz_kvmap * map, const char * name, size_t len)
+{
+    char   buf[NAME_STRIDE];
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        buf[i] = tolower((unsigned char)name[i]);
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        if ((i == 0 || buf[i - 1] == '.') && lz_kvmap_find_wklen(map, buf + i, len - i) != NULL)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void
+bench_rules(size_t n_rules)
+{
+    static const char * val = "r";
+    lz_kvmap          * map;
+    lz_sfxtrie        * trie;
+    lz_sfxtrie_frozen * frozen;
+    char                path[64];
+    double              t_kvmap  = 1e30;
+    double              t_trie   = 1e30;
+    double              t_frozen = 1e30;
+    uint64_t            rs       = 88172645463325252ULL;
+    uint64_t            t0;
+    size_t              m_kvmap  = 0;
+    size_t              m_trie   = 0;
+    size_t              m_frozen = 0;
+    size_t              i;
+    int                 r;
+
+    map  = lz_kvmap_new(n_rules);
+    trie = lz_sfxtrie_new();
+
+    for (i = 0; i < n_rules; i++)
+    {
+        char * rule = rules + i * NAME_STRIDE;
+
+        rule_lens[i] = bench_dns_name(rule, &rs);
+
+        if (lz_kvmap_find_wklen(map, rule, rule_lens[i]) == NULL)
+        {
+            lz_kvmap_add_wklen(map, rule, rule_lens[i], (void *)val, NULL);
+        }
+
+        lz_sfxtrie_add(trie, rule, rule_lens[i], (void *)val, NULL);
+    }
+
+    for (i = 0; i < N_QUERIES; i++)
+    {
+        char * q = queries + i * NAME_STRIDE;
+
+        if (i & 1)
+        {
+            size_t n_extra = 1 + bench_rand(&rs) % 5;
+            size_t rule    = bench_rand(&rs) % n_rules;
+            size_t len     = 0;
+            size_t j;
+
+            for (j = 0; j < n_extra; j++)
+            {
+                len += snprintf(q + len, 12, "%.*s.", (int)(2 + bench_rand(&rs) % 8), "abcdefghij");
+            }
+
+            memcpy(q + len, rules + rule * NAME_STRIDE, rule_lens[rule] + 1);
+            query_lens[i] = len + rule_lens[rule];
+        } else {
+            query_lens[i] = bench_dns_name(q, &rs);
+        }
+    }
+
+    snprintf(path, sizeof(path), "/tmp/bench_sfxtrie.%d", (int)getpid());
+
+    if (lz_sfxtrie_freeze(trie, path, NULL, NULL) != 0 ||
+        (frozen = lz_sfxtrie_frozen_open(path)) == NULL)
+    {
+        fprintf(stderr, "freeze failed\n");
+        exit(1);
+    }
+
+    unlink(path);
+
+    for (r = 0; r < N_ROUNDS; r++)
+    {
+        double t;
+
+        m_kvmap = m_trie = m_frozen = 0;
+        t0      = bench_now_ns();
+
+        for (i = 0; i < N_QUERIES; i++)
+        {
+            m_kvmap += kvmap_match_(map, queries + i * NAME_STRIDE, query_lens[i]);
+        }
+
+        if ((t = (double)(bench_now_ns() - t0) / N_QUERIES) < t_kvmap)
+        {
+            t_kvmap = t;
+        }
+
+        t0 = bench_now_ns();
+
+        for (i = 0; i < N_QUERIES; i++)
+        {
+            m_trie += lz_sfxtrie_match(trie, queries + i * NAME_STRIDE, query_lens[i], NULL) != NULL;
+        }
+
+        if ((t = (double)(bench_now_ns() - t0) / N_QUERIES) < t_trie)
+        {
+            t_trie = t;
+        }
+
+        t0 = bench_now_ns();
+
+        for (i = 0; i < N_QUERIES; i++)
+        {
+            m_frozen += lz_sfxtrie_frozen_match(frozen, queries + i * NAME_STRIDE, query_lens[i], NULL, NULL) != NULL;
+        }
+
+        if ((t = (double)(bench_now_ns() - t0) / N_QUERIES) < t_frozen)
+        {
+            t_frozen = t;
+        }
+    }
+
+    if (m_kvmap != m_trie || m_kvmap != m_frozen)
+    {
+        fprintf(stderr, "matches differ: kvmap %zu trie %zu frozen %zu\n", m_kvmap, m_trie, m_frozen);
+        exit(1);
+    }
+
+    printf("%-8zu rules  kvmap per label %6.1f  trie %6.1f  frozen %6.1f  (ns/lookup, %zu matched)\n",
+           n_rules, t_kvmap, t_trie, t_frozen, m_trie);
+
+    lz_sfxtrie_frozen_close(frozen);
+    lz_sfxtrie_free(trie);
+    lz_kvmap_free(map);
+}
+
+int
+main(int argc, char ** argv)
+{
+    size_t sizes[16] = { 100000, 1000000 };
+    size_t n_sizes   = 2;
+    size_t max_n     = 0;
+    size_t i;
+    int    a;
+
+    if (argc > 1)
+    {
+        for (n_sizes = 0, a = 1; a < argc && n_sizes < 16; a++)
+        {
+            sizes[n_sizes++] = strtoull(argv[a], NULL, 10);
+        }
+    }
+
+    for (i = 0; i < n_sizes; i++)
+    {
+        max_n = sizes[i] > max_n ? sizes[i] : max_n;
+    }
+
+    rules      = bench_xmalloc(max_n * NAME_STRIDE);
+    rule_lens  = bench_xmalloc(max_n * sizeof(size_t));
+    queries    = bench_xmalloc((size_t)N_QUERIES * NAME_STRIDE);
+    query_lens = bench_xmalloc((size_t)N_QUERIES * sizeof(size_t));
+
+    for (i = 0; i < n_sizes; i++)
+    {
+        bench_rules(sizes[i]);
+    }
+
+    free(rules);
+    free(rule_lens);
+    free(queries);
+    free(query_lens);
+
+    return 0;
+}
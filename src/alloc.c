@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+/* every 16 bytes up to ALLOC_STEP_MAX, then four classes per power of two
+ * up to LZ_ALLOC_CLASS_MAX (2^15) */
+#define ALLOC_STEP_MAX  128
+#define ALLOC_N_STEP    (ALLOC_STEP_MAX / 16)
+#define ALLOC_N_CLASSES (ALLOC_N_STEP + (15 - 7) * 4)
+
+static lz_heap * alloc_heaps_[ALLOC_N_CLASSES];
+
+/* allocations over LZ_ALLOC_CLASS_MAX */
+static size_t alloc_large_bytes_;
+static size_t alloc_large_peak_;
+static size_t alloc_large_n_;
+
+static inline unsigned
+alloc_class_(size_t size)
+{
+    unsigned b;
+
+    if (size <= ALLOC_STEP_MAX)
+    {
+        return size ? (size - 1) >> 4 : 0;
+    }
+
+    /* the top bit of size - 1 picks the power of two, the two below it the
+     * quarter within it */
+    b = (sizeof(unsigned long) * 8 - 1) - __builtin_clzl(size - 1);
+
+    return ALLOC_N_STEP + (b - 7) * 4 + (((size - 1) >> (b - 2)) & 3);
+}
+
+static inline size_t
+alloc_class_size_(unsigned idx)
+{
+    if (idx < ALLOC_N_STEP)
+    {
+        return (idx + 1) << 4;
+    }
+
+    idx -= ALLOC_N_STEP;
+
+    return (size_t)(5 + (idx & 3)) << (idx / 4 + 5);
+}
+
+static inline size_t
+alloc_large_size_(size_t size)
+{
+    static size_t page_size = 0;
+    size_t        ps        = __atomic_load_n(&page_size, __ATOMIC_RELAXED);
+
+    if (lz_unlikely(ps == 0))
+    {
+        ps = (size_t)sysconf(_SC_PAGESIZE);
+        __atomic_store_n(&page_size, ps, __ATOMIC_RELAXED);
+    }
+
+    return lz_align(size, ps);
+}
+
+/*
+ * the heap of a size class, created by whichever thread gets there first
+ */
+static lz_heap *
+alloc_heap_(unsigned idx)
+{
+    lz_heap * heap = __atomic_load_n(&alloc_heaps_[idx], __ATOMIC_ACQUIRE);
+    lz_heap * new_heap;
+
+    if (lz_likely(heap != NULL))
+    {
+        return heap;
+    }
+
+    if ((new_heap = lz_heap_new_flags(alloc_class_size_(idx), 0, LZ_HEAP_F_MT)) == NULL)
+    {
+        return NULL;
+    }
+
+    if (!__atomic_compare_exchange_n(&alloc_heaps_[idx], &heap, new_heap, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        /* lost the race, heap is the winner's */
+        lz_heap_destroy(new_heap);
+        return heap;
+    }
+
+    return new_heap;
+}
+
+static void *
+alloc_large_(size_t size)
+{
+    void * p;
+    size_t cur;
+    size_t peak;
+
+    if (lz_unlikely(size > SIZE_MAX / 2))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    size = alloc_large_size_(size);
+
+    if ((p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    __atomic_fetch_add(&alloc_large_n_, 1, __ATOMIC_RELAXED);
+
+    cur  = __atomic_add_fetch(&alloc_large_bytes_, size, __ATOMIC_RELAXED);
+    peak = __atomic_load_n(&alloc_large_peak_, __ATOMIC_RELAXED);
+
+    while (cur > peak &&
+           !__atomic_compare_exchange_n(&alloc_large_peak_, &peak, cur, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+
+    return p;
+}
+
+static void *
+alloc_(size_t size)
+{
+    lz_heap * heap;
+
+    if (lz_unlikely(size > LZ_ALLOC_CLASS_MAX))
+    {
+        return alloc_large_(size);
+    }
+
+    if (lz_unlikely((heap = alloc_heap_(alloc_class_(size))) == NULL))
+    {
+        return NULL;
+    }
+
+    return lz_heap_alloc(heap);
+}
+
+static void
+free_(void * p, size_t size)
+{
+    if (lz_unlikely(p == NULL))
+    {
+        return;
+    }
+
+    if (lz_unlikely(size > LZ_ALLOC_CLASS_MAX))
+    {
+        size = alloc_large_size_(size);
+
+        munmap(p, size);
+
+        __atomic_fetch_sub(&alloc_large_bytes_, size, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&alloc_large_n_, 1, __ATOMIC_RELAXED);
+
+        return;
+    }
+
+    /* the heap exists, p came out of it */
+    lz_heap_free(alloc_heaps_[alloc_class_(size)], p);
+}
+
+static size_t
+alloc_size_(size_t size)
+{
+    if (size > LZ_ALLOC_CLASS_MAX)
+    {
+        return alloc_large_size_(size);
+    }
+
+    return alloc_class_size_(alloc_class_(size));
+}
+
+static void *
+realloc_(void * p, size_t old_size, size_t new_size)
+{
+    void * n;
+
+    if (p == NULL)
+    {
+        return alloc_(new_size);
+    }
+
+    if (alloc_size_(old_size) == alloc_size_(new_size))
+    {
+        return p;
+    }
+
+    if ((n = alloc_(new_size)) == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(n, p, old_size < new_size ? old_size : new_size);
+    free_(p, old_size);
+
+    return n;
+}
+
+static size_t
+alloc_trim_(void)
+{
+    lz_heap * heap;
+    unsigned  i;
+    size_t    released = 0;
+
+    for (i = 0; i < ALLOC_N_CLASSES; i++)
+    {
+        if ((heap = __atomic_load_n(&alloc_heaps_[i], __ATOMIC_ACQUIRE)) != NULL)
+        {
+            released += lz_heap_trim(heap, 0);
+        }
+    }
+
+    return released;
+}
+
+static int
+alloc_get_stats_(struct lz_alloc_stats * stats)
+{
+    struct lz_heap_stats hstats;
+    lz_heap            * heap;
+    unsigned             i;
+
+    if (stats == NULL)
+    {
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+
+    for (i = 0; i < ALLOC_N_CLASSES; i++)
+    {
+        if ((heap = __atomic_load_n(&alloc_heaps_[i], __ATOMIC_ACQUIRE)) == NULL ||
+            lz_heap_get_stats(heap, &hstats) == -1)
+        {
+            continue;
+        }
+
+        stats->bytes          += hstats.bytes;
+        stats->bytes_peak     += hstats.bytes_peak;
+        stats->bytes_retained += hstats.bytes_retained;
+    }
+
+    stats->bytes_large = __atomic_load_n(&alloc_large_bytes_, __ATOMIC_RELAXED);
+    stats->n_large     = __atomic_load_n(&alloc_large_n_, __ATOMIC_RELAXED);
+    stats->bytes      += stats->bytes_large;
+    stats->bytes_peak += __atomic_load_n(&alloc_large_peak_, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+lz_alias(alloc_, lz_alloc);
+lz_alias(free_, lz_free);
+lz_alias(realloc_, lz_realloc);
+lz_alias(alloc_size_, lz_alloc_size);
+lz_alias(alloc_trim_, lz_alloc_trim);
+lz_alias(alloc_get_stats_, lz_alloc_get_stats);
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <liblz.h>
+
+/*
+ * lz_alloc: a general-purpose allocator built on lz_heap.
+ *
+ * Requests of up to LZ_ALLOC_CLASS_MAX bytes are rounded up to one of 40 size
+ * classes: every 16 bytes up to 128, then four classes per power of two, so
+ * no more than a quarter of an element is wasted. Each class is a
+ * LZ_HEAP_F_MT lz_heap, created on first use: allocating and freeing are
+ * O(1) and lock-free from any thread, and memory may be freed on another
+ * thread than the one that allocated it. Larger requests are mapped on their
+ * own with mmap.
+ *
+ * Frees are sized, the caller passes back the size it asked for, which lets
+ * small elements go without a header. Memory is 16 byte aligned.
+ */
+
+#define LZ_ALLOC_CLASS_MAX (32 * 1024)
+
+
+/**
+ * @brief allocates size bytes, which are not zeroed
+ *
+ * @return NULL on error
+ */
+LZ_EXPORT void * lz_alloc(size_t size);
+
+
+/**
+ * @brief frees memory returned by lz_alloc() or lz_realloc()
+ *
+ * @param p may be NULL
+ * @param size the size it was allocated with
+ */
+LZ_EXPORT void lz_free(void * p, size_t size);
+
+
+/**
+ * @brief resizes p, which was allocated with old_size bytes, keeping its
+ *        contents. p stays put while the new size is in the same class.
+ *
+ * @return the new address, NULL on error (p is left alone)
+ */
+LZ_EXPORT void * lz_realloc(void * p, size_t old_size, size_t new_size);
+
+
+/**
+ * @return the bytes lz_alloc() really hands out for a request of size
+ */
+LZ_EXPORT size_t lz_alloc_size(size_t size);
+
+
+/**
+ * @brief returns the free slabs of every size class to the system, see
+ *        lz_heap_trim(): the calling thread's and those of exited threads.
+ *
+ * @return the number of bytes released
+ */
+LZ_EXPORT size_t lz_alloc_trim(void);
+
+
+struct lz_alloc_stats {
+    size_t bytes;          /* currently mapped, size classes and large */
+    size_t bytes_peak;     /* sum of each class's peak, plus the large peak */
+    size_t bytes_retained; /* of bytes, held in free class elements */
+    size_t bytes_large;    /* of bytes, in allocations over LZ_ALLOC_CLASS_MAX */
+    size_t n_large;
+};
+
+/**
+ * @return 0 on success, -1 on error
+ */
+LZ_EXPORT int lz_alloc_get_stats(struct lz_alloc_stats * stats);
@@ -0,0 +1,465 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define CACHE_LINE       64
+
+/* keys up to this length live inside the node */
+#define CACHE_INLINE_KEY 32
+
+/*
+ * one cache line: everything a hit looks at (hash, key, value) and the only
+ * thing it writes (ref).
+ */
+struct cache_node {
+    uint32_t hash;
+    uint32_t klen;
+    void   * val;
+    uint8_t  ref;
+    uint8_t  used;
+    char   * key;   /* ikey, or a separate allocation for long keys */
+    char     ikey[CACHE_INLINE_KEY];
+} __attribute__((aligned(CACHE_LINE)));
+
+/*
+ * the index is open addressed with linear probing and kept at most half
+ * full. Slots hold the node's hash so most mismatches are rejected without
+ * touching the node; node is the node index + 1, 0 for an empty slot.
+ */
+struct cache_slot {
+    uint32_t hash;
+    uint32_t node;
+};
+
+struct lz_cache_s {
+    struct cache_node * nodes;
+    size_t            * sizes;     /* per node, only used on put / evict */
+    uint32_t          * free_nodes;
+    uint32_t            n_free;
+    uint32_t            n_nodes;   /* nodes handed out so far */
+    uint32_t            max_entries;
+    uint32_t            n_entries;
+    uint32_t            hand;
+
+    struct cache_slot * index;
+    uint32_t            index_mask;
+
+    size_t              max_bytes;
+    size_t              n_bytes;
+
+    lz_cache_evictfn    evictfn;
+    void              * arg;
+
+    uint64_t            hits;
+    uint64_t            misses;
+    uint64_t            inserts;
+    uint64_t            evictions;
+};
+
+static inline uint32_t
+cache_hash_(const char * k, size_t l)
+{
+    return (uint32_t)lz_kvmap_hash64(k, l, 0);
+}
+
+static inline int
+cache_node_eq_(struct cache_node * node, const char * k, size_t l, uint32_t hash)
+{
+    return node->hash == hash && node->klen == l && !memcmp(node->key, k, l);
+}
+
+/**
+ * @brief returns the index slot holding the key, or the empty slot ending
+ *        its probe sequence.
+ */
+static inline uint32_t
+cache_index_find_(lz_cache * cache, const char * k, size_t l, uint32_t hash)
+{
+    uint32_t i = hash & cache->index_mask;
+
+    for (;; i = (i + 1) & cache->index_mask)
+    {
+        struct cache_slot * slot = &cache->index[i];
+
+        if (slot->node == 0)
+        {
+            return i;
+        }
+
+        if (slot->hash == hash && cache_node_eq_(&cache->nodes[slot->node - 1], k, l, hash))
+        {
+            return i;
+        }
+    }
+}
+
+static inline uint32_t
+cache_index_of_node_(lz_cache * cache, uint32_t node)
+{
+    uint32_t i = cache->nodes[node].hash & cache->index_mask;
+
+    while (cache->index[i].node != node + 1)
+    {
+        i = (i + 1) & cache->index_mask;
+    }
+
+    return i;
+}
+
+/**
+ * @brief empties an index slot, shifting back any entry further down the
+ *        probe sequence that may no longer be reachable, so no tombstones
+ *        are needed.
+ */
+static void
+cache_index_delete_(lz_cache * cache, uint32_t i)
+{
+    uint32_t j = i;
+
+    for (;;)
+    {
+        uint32_t home;
+
+        j = (j + 1) & cache->index_mask;
+
+        if (cache->index[j].node == 0)
+        {
+            break;
+        }
+
+        home = cache->index[j].hash & cache->index_mask;
+
+        /* can the entry at j be moved back to i? only if its home is not
+         * cyclically within (i, j] */
+        if ((i <= j) ? (home <= i || home > j) : (home <= i && home > j))
+        {
+            cache->index[i] = cache->index[j];
+            i = j;
+        }
+    }
+
+    cache->index[i].node = 0;
+}
+
+/**
+ * @brief unlinks a node from the index and returns it to the free list,
+ *        after handing its value to evictfn.
+ */
+static void
+cache_drop_(lz_cache * cache, uint32_t n, uint32_t slot, enum lz_cache_drop_reason reason)
+{
+    struct cache_node * node = &cache->nodes[n];
+
+    cache_index_delete_(cache, slot);
+
+    if (cache->evictfn)
+    {
+        (cache->evictfn)(node->key, node->klen, node->val, reason, cache->arg);
+    }
+
+    if (node->key != node->ikey)
+    {
+        free(node->key);
+    }
+
+    node->used     = 0;
+    node->val      = NULL;
+    cache->n_bytes   -= cache->sizes[n];
+    cache->n_entries -= 1;
+
+    cache->free_nodes[cache->n_free++] = n;
+}
+
+/**
+ * @brief advances the clock hand to the first unreferenced entry, clearing
+ *        reference bits on the way, and evicts it.
+ */
+static void
+cache_evict_one_(lz_cache * cache)
+{
+    for (;;)
+    {
+        struct cache_node * node;
+        uint32_t            n = cache->hand;
+
+        cache->hand = (cache->hand + 1) % cache->n_nodes;
+        node        = &cache->nodes[n];
+
+        if (!node->used)
+        {
+            continue;
+        }
+
+        if (node->ref)
+        {
+            node->ref = 0;
+            continue;
+        }
+
+        cache_drop_(cache, n, cache_index_of_node_(cache, n), LZ_CACHE_EVICTED);
+        cache->evictions += 1;
+
+        return;
+    }
+}
+
+static lz_cache *
+cache_new_(size_t max_entries, size_t max_bytes, lz_cache_evictfn evictfn, void * arg)
+{
+    lz_cache * cache;
+    uint32_t   index_size;
+
+    if (max_entries == 0 || max_entries > UINT32_MAX / 4)
+    {
+        return NULL;
+    }
+
+    if (!(cache = calloc(1, sizeof(lz_cache))))
+    {
+        return NULL;
+    }
+
+    for (index_size = 16; index_size < max_entries * 2; index_size <<= 1)
+    {
+    }
+
+    if (posix_memalign((void **)&cache->nodes, CACHE_LINE,
+                       sizeof(struct cache_node) * max_entries) != 0)
+    {
+        cache->nodes = NULL;
+        goto error;
+    }
+
+    cache->sizes      = calloc(max_entries, sizeof(size_t));
+    cache->free_nodes = malloc(sizeof(uint32_t) * max_entries);
+    cache->index      = calloc(index_size, sizeof(struct cache_slot));
+
+    if (!cache->sizes || !cache->free_nodes || !cache->index)
+    {
+        goto error;
+    }
+
+    memset(cache->nodes, 0, sizeof(struct cache_node) * max_entries);
+
+    cache->max_entries = (uint32_t)max_entries;
+    cache->index_mask  = index_size - 1;
+    cache->max_bytes   = max_bytes;
+    cache->evictfn     = evictfn;
+    cache->arg         = arg;
+
+    return cache;
+error:
+    free(cache->nodes);
+    free(cache->sizes);
+    free(cache->free_nodes);
+    free(cache->index);
+    free(cache);
+
+    return NULL;
+} /* cache_new_ */
+
+static void
+cache_clear_(lz_cache * cache)
+{
+    uint32_t n;
+
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    for (n = 0; n < cache->n_nodes; n++)
+    {
+        if (cache->nodes[n].used)
+        {
+            cache_drop_(cache, n, cache_index_of_node_(cache, n), LZ_CACHE_REMOVED);
+        }
+    }
+
+    /* start handing out nodes from the front again */
+    cache->n_free  = 0;
+    cache->n_nodes = 0;
+    cache->hand    = 0;
+}
+
+static void
+cache_free_(lz_cache * cache)
+{
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    cache_clear_(cache);
+
+    free(cache->nodes);
+    free(cache->sizes);
+    free(cache->free_nodes);
+    free(cache->index);
+    free(cache);
+}
+
+static void *
+cache_get_(lz_cache * cache, const char * k, size_t l)
+{
+    struct cache_slot * slot;
+    struct cache_node * node;
+
+    slot = &cache->index[cache_index_find_(cache, k, l, cache_hash_(k, l))];
+
+    if (slot->node == 0)
+    {
+        cache->misses += 1;
+        return NULL;
+    }
+
+    node = &cache->nodes[slot->node - 1];
+
+    /* avoid dirtying the line when it is already set */
+    if (!node->ref)
+    {
+        node->ref = 1;
+    }
+
+    cache->hits += 1;
+
+    return node->val;
+}
+
+static int
+cache_put_(lz_cache * cache, const char * k, size_t l, void * val, size_t size)
+{
+    struct cache_node * node;
+    uint32_t            hash;
+    uint32_t            slot;
+    uint32_t            n;
+
+    if (cache->max_bytes && size > cache->max_bytes)
+    {
+        return -1;
+    }
+
+    if (l > UINT32_MAX)
+    {
+        return -1;
+    }
+
+    hash = cache_hash_(k, l);
+    slot = cache_index_find_(cache, k, l, hash);
+
+    if (cache->index[slot].node != 0)
+    {
+        n    = cache->index[slot].node - 1;
+        node = &cache->nodes[n];
+
+        if (cache->evictfn && node->val != val)
+        {
+            (cache->evictfn)(node->key, node->klen, node->val, LZ_CACHE_REMOVED, cache->arg);
+        }
+
+        node->val       = val;
+        node->ref       = 1;
+        cache->n_bytes += size - cache->sizes[n];
+        cache->sizes[n] = size;
+
+        while (cache->max_bytes && cache->n_bytes > cache->max_bytes)
+        {
+            cache_evict_one_(cache);
+        }
+
+        return 0;
+    }
+
+    /* make room first, evicting changes the index under `slot` */
+    while (cache->n_entries == cache->max_entries ||
+           (cache->max_bytes && cache->n_bytes + size > cache->max_bytes))
+    {
+        cache_evict_one_(cache);
+    }
+
+    if (cache->n_free > 0)
+    {
+        n = cache->free_nodes[--cache->n_free];
+    } else {
+        n = cache->n_nodes++;
+    }
+
+    node = &cache->nodes[n];
+
+    if (l < CACHE_INLINE_KEY)
+    {
+        node->key = node->ikey;
+    } else if (!(node->key = malloc(l + 1)))
+    {
+        cache->free_nodes[cache->n_free++] = n;
+        return -1;
+    }
+
+    memcpy(node->key, k, l);
+
+    node->key[l]    = '\0';
+    node->klen      = (uint32_t)l;
+    node->hash      = hash;
+    node->val       = val;
+    node->ref       = 0;
+    node->used      = 1;
+
+    cache->sizes[n] = size;
+    cache->n_bytes += size;
+    cache->n_entries += 1;
+    cache->inserts   += 1;
+
+    slot = cache_index_find_(cache, k, l, hash);
+
+    cache->index[slot].hash = hash;
+    cache->index[slot].node = n + 1;
+
+    return 0;
+} /* cache_put_ */
+
+static int
+cache_remove_(lz_cache * cache, const char * k, size_t l)
+{
+    uint32_t slot;
+
+    slot = cache_index_find_(cache, k, l, cache_hash_(k, l));
+
+    if (cache->index[slot].node == 0)
+    {
+        return -1;
+    }
+
+    cache_drop_(cache, cache->index[slot].node - 1, slot, LZ_CACHE_REMOVED);
+
+    return 0;
+}
+
+static size_t
+cache_get_size_(lz_cache * cache)
+{
+    return cache ? cache->n_entries : 0;
+}
+
+static void
+cache_get_stats_(lz_cache * cache, struct lz_cache_stats * stats)
+{
+    stats->hits      = cache->hits;
+    stats->misses    = cache->misses;
+    stats->inserts   = cache->inserts;
+    stats->evictions = cache->evictions;
+    stats->n_entries = cache->n_entries;
+    stats->n_bytes   = cache->n_bytes;
+}
+
+lz_alias(cache_new_, lz_cache_new);
+lz_alias(cache_free_, lz_cache_free);
+lz_alias(cache_get_, lz_cache_get);
+lz_alias(cache_put_, lz_cache_put);
+lz_alias(cache_remove_, lz_cache_remove);
+lz_alias(cache_clear_, lz_cache_clear);
+lz_alias(cache_get_size_, lz_cache_get_size);
+lz_alias(cache_get_stats_, lz_cache_get_stats);
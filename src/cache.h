@@ -0,0 +1,83 @@
+#pragma once
+
+#include <liblz.h>
+
+/*
+ * lz_cache: a bounded key/value cache with CLOCK eviction.
+ *
+ * All entries are allocated up front. A hit only sets the entry's reference
+ * bit (no list to relink, no allocation), and the entry itself is a single
+ * cache line with short keys stored inline. When the cache is full, a clock
+ * hand sweeps the entries: referenced ones get their bit cleared and a second
+ * chance, the first unreferenced one is evicted.
+ */
+
+struct lz_cache_s;
+
+typedef struct lz_cache_s lz_cache;
+
+enum lz_cache_drop_reason {
+    LZ_CACHE_EVICTED = 0, /* pushed out to make room */
+    LZ_CACHE_REMOVED,     /* replaced, removed, cleared, or cache freed */
+};
+
+/**
+ * @brief called whenever the cache lets go of a value
+ */
+typedef void (* lz_cache_evictfn)(const char * key, size_t klen, void * val,
+    enum lz_cache_drop_reason reason, void * arg);
+
+struct lz_cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t evictions;
+    size_t   n_entries;
+    size_t   n_bytes;
+};
+
+
+/**
+ * @brief creates a new cache
+ *
+ * @param max_entries the number of entries, allocated up front, must be > 0
+ * @param max_bytes the total of the sizes given to lz_cache_put(), 0 for no
+ *                  limit other than max_entries
+ * @param evictfn called for each value dropped by the cache, may be NULL
+ * @param arg passed to evictfn
+ *
+ * @return NULL on error
+ */
+LZ_EXPORT lz_cache * lz_cache_new(size_t max_entries, size_t max_bytes,
+    lz_cache_evictfn evictfn, void * arg);
+
+LZ_EXPORT void lz_cache_free(lz_cache * cache);
+
+
+/**
+ * @brief looks up a key, a hit marks the entry as recently used.
+ *
+ * @return the value, NULL on a miss
+ */
+LZ_EXPORT void * lz_cache_get(lz_cache * cache, const char * k, size_t l);
+
+
+/**
+ * @brief inserts or replaces a key. New entries start out unreferenced, so
+ *        a key that is never looked up again is the first to go.
+ *
+ * @param size what the value counts against max_bytes
+ *
+ * @return 0 on success, -1 on error (size alone is larger than max_bytes)
+ */
+LZ_EXPORT int lz_cache_put(lz_cache * cache, const char * k, size_t l, void * val, size_t size);
+
+
+/**
+ * @return 0 on success, -1 if not found
+ */
+LZ_EXPORT int  lz_cache_remove(lz_cache * cache, const char * k, size_t l);
+LZ_EXPORT void lz_cache_clear(lz_cache * cache);
+
+LZ_EXPORT size_t lz_cache_get_size(lz_cache * cache);
+LZ_EXPORT void   lz_cache_get_stats(lz_cache * cache, struct lz_cache_stats * stats);
@@ -15,65 +15,94 @@
 #include <liblz.h>
 #include <liblz/lzapi.h>
 
-#include "ffile.h"
+/*
+ * the buffer needed to join prefix and postfix: both, the '/' separator and
+ * the terminator. 0 if either is too long.
+ */
+static size_t
+file_concat_size_(const char * prefix, const char * postfix)
+{
+    size_t prefix_sz;
+    size_t postfix_sz;
+
+    if ((prefix_sz = strlen(prefix)) >= PATH_MAX)
+    {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+
+    if ((postfix_sz = strlen(postfix)) >= NAME_MAX)
+    {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+
+    return prefix_sz + postfix_sz + 2;
+}
 
 static int
-file_concat_(char ** out, const char * prefix, const char * postfix)
+file_concat_fmt_(char * buf, size_t buf_sz, const char * prefix, const char * postfix)
 {
     const char * fmt;
-    char       * concated;
-    size_t       concated_sz;
-    size_t       prefix_sz;
-    size_t       postfix_sz;
     int          res;
 
-    if (lz_unlikely(!out || !postfix))
+    fmt = "%s/%s";
+
+    if (prefix[0] == '/' && prefix[1] == '\0')
     {
-        return -1;
+        fmt = "%s%s";
     }
 
-    if ((prefix_sz = strlen(prefix)) >= PATH_MAX)
+    res = snprintf(buf, buf_sz, fmt, prefix, postfix);
+
+    if (res >= buf_sz || res < 0)
     {
-        errno = ENAMETOOLONG;
         return -1;
     }
 
-    if ((postfix_sz = strlen(postfix)) >= NAME_MAX)
+    return 0;
+}
+
+static int
+file_concat_(char ** out, const char * prefix, const char * postfix)
+{
+    char * concated;
+    size_t concated_sz;
+
+    if (lz_unlikely(!out || !prefix || !postfix))
     {
-        errno = ENAMETOOLONG;
         return -1;
     }
 
-    concated_sz = prefix_sz + postfix_sz + 1;
-
-    if (!(concated = calloc(concated_sz, 1)))
+    if ((concated_sz = file_concat_size_(prefix, postfix)) == 0)
     {
         return -1;
     }
 
-    fmt = "%s/%s";
-
-    if (prefix[0] == '/' && prefix[1] == '\0')
+    if (!(concated = malloc(concated_sz)))
     {
-        fmt = "%s%s";
+        return -1;
     }
 
-    res = snprintf(concated, concated_sz, fmt, prefix, postfix);
-
-    if (res >= concated_sz || res < 0)
+    if (file_concat_fmt_(concated, concated_sz, prefix, postfix) == -1)
     {
         lz_safe_free(concated, free);
 
         return -1;
     }
+
+    *out = concated;
+
+    return 0;
 } /* file_concat_ */
 
 static int
-file_readdir_(const char * path, lz_file_readdir_iter iter, void * arg)
+file_readdir_flags_(const char * path, lz_file_readdir_iter iter, void * arg, int flags)
 {
     struct dirent * dent;
     DIR           * directory;
     char          * file_concat;
+    size_t          file_concat_sz;
     int             res;
 
     if (lz_unlikely(!path || !iter))
@@ -90,48 +119,73 @@ file_readdir_(const char * path, lz_file_readdir_iter iter, void * arg)
 
     while ((dent = readdir(directory)))
     {
-        file_concat = NULL;
-
         /* check for "." and "..", and ignore them. */
         if (dent->d_name[0] == '.')
         {
-            if (dent->d_name[1] == '.')
+            if (dent->d_name[1] == '\0' ||
+                (dent->d_name[1] == '.' && dent->d_name[2] == '\0'))
             {
                 continue;
             }
         }
 
-        if ((res = file_concat_(&file_concat, path, dent->d_name)) == -1)
+        if ((file_concat_sz = file_concat_size_(path, dent->d_name)) == 0)
         {
+            res = -1;
             break;
         }
 
-        if ((res = (iter)(dent, path, file_concat, arg)) != 0)
+        /* the path only lives for the callback */
+        if (flags & LZ_FILE_F_ALLOC)
         {
-            lz_safe_free(file_concat, free);
+            file_concat = lz_alloc(file_concat_sz);
+        } else {
+            file_concat = malloc(file_concat_sz);
+        }
+
+        if (file_concat == NULL)
+        {
+            res = -1;
             break;
         }
 
-        lz_safe_free(file_concat, free);
-    }
+        if ((res = file_concat_fmt_(file_concat, file_concat_sz, path, dent->d_name)) == 0)
+        {
+            res = (iter)(dent, path, file_concat, arg);
+        }
 
-    if (file_concat != NULL)
-    {
-        lz_safe_free(file_concat, free);
+        if (flags & LZ_FILE_F_ALLOC)
+        {
+            lz_free(file_concat, file_concat_sz);
+        } else {
+            lz_safe_free(file_concat, free);
+        }
+
+        if (res != 0)
+        {
+            break;
+        }
     }
 
     closedir(directory);
 
     return res;
+} /* file_readdir_flags_ */
+
+static int
+file_readdir_(const char * path, lz_file_readdir_iter iter, void * arg)
+{
+    return file_readdir_flags_(path, iter, arg, 0);
 } /* lz_file_readdir */
 
 struct f_dat__ {
     lz_file_readdir_iter og_iter;
     void               * og_args;
+    int                  flags;
 };
 
 /**
- * @brief function executed by file_readdir_().
+ * @brief function executed by file_readdir_flags_().
  * @note  there is a private structure `sturct f_dat__`
  *        which contains the original user-specified
  *        directory walk callback.
@@ -172,19 +226,20 @@ file_readdir_iter_(struct dirent * dent, const char * path, const char * path_an
 
     if (dent->d_type == DT_DIR)
     {
-        return file_readdir_(path_and_basename, file_readdir_iter_, args);
+        return file_readdir_flags_(path_and_basename, file_readdir_iter_, args, filectx->flags);
     }
 
     return 0;
 }
 
 static int
-file_recursive_readdir_(const char * path, lz_file_readdir_iter iter, void * args)
+file_recursive_readdir_flags_(const char * path, lz_file_readdir_iter iter, void * args, int flags)
 {
     int            res;
     struct f_dat__ file_dat = {
         .og_iter = iter,
-        .og_args = args
+        .og_args = args,
+        .flags   = flags
     };
 
 
@@ -193,7 +248,7 @@ file_recursive_readdir_(const char * path, lz_file_readdir_iter iter, void * arg
         return -1;
     }
 
-    if ((res = file_readdir_(path, file_readdir_iter_, &file_dat)) != 0)
+    if ((res = file_readdir_flags_(path, file_readdir_iter_, &file_dat, flags)) != 0)
     {
         return res;
     }
@@ -201,6 +256,14 @@ file_recursive_readdir_(const char * path, lz_file_readdir_iter iter, void * arg
     return 0;
 }
 
+static int
+file_recursive_readdir_(const char * path, lz_file_readdir_iter iter, void * args)
+{
+    return file_recursive_readdir_flags_(path, iter, args, 0);
+}
+
 lz_alias(file_recursive_readdir_, lz_file_recursive_readdir);
 lz_alias(file_concat_, lz_file_concat);
 lz_alias(file_readdir_, lz_file_readdir);
+lz_alias(file_recursive_readdir_flags_, lz_file_recursive_readdir_flags);
+lz_alias(file_readdir_flags_, lz_file_readdir_flags);
@@ -10,6 +10,14 @@ typedef int (* lz_file_readdir_iter)(struct dirent *,
     const char *,
     const char *, void *);
 
+enum lz_file_flags {
+    /* the full path handed to the callback comes from the size classes of
+     * lz_alloc() instead of malloc(). One is built and freed per entry, so
+     * large walks churn less. The memory stays with lz_alloc until
+     * lz_alloc_trim() */
+    LZ_FILE_F_ALLOC = (1 << 0),
+};
+
 
 /**
  * @brief read a directory recursively, each time calling
@@ -21,9 +29,17 @@ typedef int (* lz_file_readdir_iter)(struct dirent *,
  *
  * @return 0 on success, -1 on error
  */
-int lz_file_recursive_readdir(const char * path,
-    lz_file_readdir_iter                   iter,
-    void                                 * arg);
+LZ_EXPORT int lz_file_recursive_readdir(const char * path,
+    lz_file_readdir_iter                             iter,
+    void                                           * arg);
+
+/**
+ * @brief lz_file_recursive_readdir() with lz_file_flags
+ */
+LZ_EXPORT int lz_file_recursive_readdir_flags(const char * path,
+    lz_file_readdir_iter                                   iter,
+    void                                                 * arg,
+    int                                                    flags);
 
 
 /**
@@ -35,9 +51,17 @@ int lz_file_recursive_readdir(const char * path,
  *
  * @return 0 on success, -1 on error
  */
-int lz_file_readdir(const char * path,
-    lz_file_readdir_iter         iter,
-    void                       * arg);
+LZ_EXPORT int lz_file_readdir(const char * path,
+    lz_file_readdir_iter                   iter,
+    void                                 * arg);
+
+/**
+ * @brief lz_file_readdir() with lz_file_flags
+ */
+LZ_EXPORT int lz_file_readdir_flags(const char * path,
+    lz_file_readdir_iter                         iter,
+    void                                       * arg,
+    int                                          flags);
 
 
 /**
@@ -45,12 +69,12 @@ int lz_file_readdir(const char * path,
  * @example lz_file_concat(&buffer, "/home/ellzey" "passwords.txt"
  *          creates: "/home/ellzey/passwords.txt"
  *
- * @param[out] out a pre-allocated buffer to store the data
+ * @param[out] out set to the joined path, malloc'd, free() it
  * @param[in] prefix the basepath
  * @param[in] postfix the filename
  *
  * @return 0 on success, -1 on error
  */
-int lz_file_concat(char ** out,
-    const char           * prefix,
-    const char           * postfix);
+LZ_EXPORT int lz_file_concat(char ** out,
+    const char                     * prefix,
+    const char                     * postfix);
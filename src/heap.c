@@ -5,115 +5,1057 @@
 #include <errno.h>
 #include <assert.h>
 #include <stddef.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/queue.h>
 
 #include <liblz.h>
 #include <liblz/lzapi.h>
 
-struct lz_heap_page_s;
-typedef struct lz_heap_page_s lz_heap_page;
+/* slabs are aligned to their size, a power of two no smaller than this,
+ * and no larger than HEAP_SLAB_MAX unless HEAP_SLAB_MIN elements need it */
+#define HEAP_SLAB_SIZE    (64 * 1024)
+#define HEAP_SLAB_MAX     (1024 * 1024)
+#define HEAP_SLAB_MIN     4
 
-struct lz_heap_page_s {
-    SLIST_ENTRY(lz_heap_page_s) next;
-    char data[];
+/* frees of another thread's elements are handed back this many at a time */
+#define HEAP_REMOTE_BATCH 32
+
+/* the LZ_HEAP_F_SHARED free list is a pointer and a tag swapped together
+ * with a double-width CAS; without one it falls back to a lock */
+#if UINTPTR_MAX == UINT32_MAX && defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_8)
+#define HEAP_HAVE_DCAS
+typedef uint64_t          heap_dword;
+#elif UINTPTR_MAX == UINT64_MAX && defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+#define HEAP_HAVE_DCAS
+typedef unsigned __int128 heap_dword;
+#endif
+
+struct lz_heap_slab_s;
+struct lz_heap_tc_s;
+typedef struct lz_heap_slab_s lz_heap_slab;
+typedef struct lz_heap_tc_s   lz_heap_tc;
+
+struct lz_heap_free_s {
+    struct lz_heap_free_s * next;
+};
+
+/*
+ * elements are carved from slabs: one mapping, aligned to its size, holding
+ * n_elts elements back to back, so an element's slab is found by masking its
+ * address. A slab is handed out front to back (next_elt) the first time
+ * around, so its memory is only touched as it is used; after that, freed
+ * elements go on the slab's free list (or the cache's local one), which is
+ * threaded through the elements themselves. A slab whose elements are all free again can be
+ * unmapped on the spot.
+ */
+struct lz_heap_slab_s {
+    LIST_ENTRY(lz_heap_slab_s) next;    /* the owner's avail list */
+    LIST_ENTRY(lz_heap_slab_s) link;    /* all of the owner's slabs */
+    lz_heap_tc            * owner;      /* the cache that allocates from it */
+    struct lz_heap_free_s * free_list;
+    char                  * next_elt;
+    char                  * end_elt;
+    size_t                  n_free;     /* on free_list or not carved yet */
+    size_t                  n_elts;
+    char                    data[] __attribute__((aligned(16)));
+};
+
+/*
+ * the head of a LZ_HEAP_F_SHARED free list. Every push and pop bumps the
+ * tag, so a pop that read head and head->next, and lost the CPU while the
+ * head was popped and pushed back (ABA), fails its CAS instead of
+ * installing a stale next.
+ */
+union lz_heap_tagged_u {
+    struct {
+        struct lz_heap_free_s * ptr;
+        uintptr_t               tag;
+    };
+#ifdef HEAP_HAVE_DCAS
+    heap_dword word;
+#endif
+} __attribute__((aligned(2 * sizeof(void *))));
+
+/*
+ * the slabs a heap allocates from. A plain heap has a single cache; a
+ * LZ_HEAP_F_MT heap has one per thread, which only that thread allocates
+ * from. Elements owned by a cache and freed by another thread are pushed
+ * onto its remote list, and taken back in one go once its slabs run dry.
+ */
+struct lz_heap_tc_s {
+    lz_heap_slab          * cur;        /* allocated from until it runs dry */
+    LIST_HEAD(, lz_heap_slab_s) avail;  /* other slabs with free elements */
+    LIST_HEAD(, lz_heap_slab_s) slabs;  /* all of them */
+    size_t                  n_free;     /* over all slabs, and local */
+
+    /* elements freed while nothing is released, handed out again first and
+     * put back on their slabs only by lz_heap_trim(), so a free does not
+     * have to touch its slab */
+    struct lz_heap_free_s * local;
+
+    /* this thread's frees of elements owned by batch_owner, not yet pushed */
+    lz_heap_tc            * batch_owner;
+    struct lz_heap_free_s * batch_head;
+    struct lz_heap_free_s * batch_tail;
+    size_t                  batch_len;
+
+    lz_heap               * heap;
+    SLIST_ENTRY(lz_heap_tc_s) next;      /* heap->tcs */
+    SLIST_ENTRY(lz_heap_tc_s) next_idle; /* heap->idle, once its thread exits */
+
+    /* written by other threads, kept off the cache line of the above */
+    struct lz_heap_free_s * remote __attribute__((aligned(64)));
 };
 
 struct lz_heap_s {
-    size_t page_size;             /* page size */
+    size_t          page_size;  /* element size, rounded up for alignment */
+    size_t          slab_elts;  /* elements in a slab */
+    size_t          slab_size;  /* bytes in a slab */
+    size_t          release_at; /* lz_heap_set_release(), SIZE_MAX when off */
+    int             flags;
+
+    lz_heap_tc      tc;         /* the one cache of a plain heap, holds the
+                                 * slabs of a LZ_HEAP_F_SHARED one */
 
-    SLIST_HEAD(, lz_heap_page_s) page_list_free;
-    SLIST_HEAD(, lz_heap_page_s) page_list_used;
+    /* LZ_HEAP_F_MT */
+    pthread_key_t   tc_key;
+    pthread_mutex_t lock;       /* guards tcs, idle and the byte counts;
+                                 * growing a LZ_HEAP_F_SHARED heap */
+    SLIST_HEAD(, lz_heap_tc_s) tcs;
+    SLIST_HEAD(, lz_heap_tc_s) idle;
+
+    size_t          n_slabs;
+    size_t          bytes;
+    size_t          bytes_peak;
+    size_t          bytes_released;
+
+    /* LZ_HEAP_F_SHARED, on its own cache line */
+    union lz_heap_tagged_u shared __attribute__((aligned(64)));
+#ifndef HEAP_HAVE_DCAS
+    pthread_mutex_t        shared_lock;
+#endif
 };
 
+#define HEAP_LOCKED(heap)      ((heap)->flags & (LZ_HEAP_F_MT | LZ_HEAP_F_SHARED))
+#define HEAP_SLAB_OF(heap, p)  ((lz_heap_slab *)((uintptr_t)(p) & ~(uintptr_t)((heap)->slab_size - 1)))
+
+/* n_free is only written by the thread owning the cache (atomically by all
+ * of them on a LZ_HEAP_F_SHARED heap), but is read by lz_heap_get_stats() */
+#define heap_tc_count_(tc, n) \
+    __atomic_store_n(&(tc)->n_free, (tc)->n_free + (n), __ATOMIC_RELAXED)
 
-static lz_heap_page *
-heap_page_new_(lz_heap * heap)
+
+static lz_heap_slab *
+heap_slab_new_(lz_heap * heap, lz_heap_tc * tc)
 {
-    lz_heap_page * page;
+    lz_heap_slab * slab;
+    char         * p;
+    uintptr_t      a;
+    size_t         size = heap->slab_size;
 
-    if (!(page = malloc(heap->page_size + sizeof(lz_heap_page))))
+    /* over-map by a slab, and unmap what sticks out on either side of the
+     * aligned one */
+    if ((p = mmap(NULL, size * 2, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
     {
         return NULL;
     }
 
-    SLIST_INSERT_HEAD(&heap->page_list_free, page, next);
+    a = lz_align((uintptr_t)p, (uintptr_t)size);
 
-    return page;
-};
+    if (a > (uintptr_t)p)
+    {
+        munmap(p, a - (uintptr_t)p);
+    }
+
+    munmap((char *)a + size, (uintptr_t)p + size - a);
+
+    slab            = (lz_heap_slab *)a;
+    slab->owner     = tc;
+    slab->free_list = NULL;
+    slab->n_elts    = heap->slab_elts;
+    slab->n_free    = heap->slab_elts;
+    slab->next_elt  = slab->data;
+    slab->end_elt   = slab->data + heap->page_size * heap->slab_elts;
+
+    LIST_INSERT_HEAD(&tc->slabs, slab, link);
+
+    if (heap->flags & LZ_HEAP_F_SHARED)
+    {
+        __atomic_fetch_add(&tc->n_free, slab->n_elts, __ATOMIC_RELAXED);
+    } else {
+        heap_tc_count_(tc, slab->n_elts);
+    }
+
+    /* LZ_HEAP_F_SHARED heaps only grow with the lock held */
+    if (heap->flags & LZ_HEAP_F_MT)
+    {
+        pthread_mutex_lock(&heap->lock);
+    }
+
+    heap->n_slabs += 1;
+    heap->bytes   += size;
+
+    if (heap->bytes > heap->bytes_peak)
+    {
+        heap->bytes_peak = heap->bytes;
+    }
+
+    if (heap->flags & LZ_HEAP_F_MT)
+    {
+        pthread_mutex_unlock(&heap->lock);
+    }
+
+    return slab;
+} /* heap_slab_new_ */
+
+/*
+ * unmaps a slab whose elements are all free, which is on the avail list.
+ * The caller holds the heap lock where there is one.
+ */
+static void
+heap_slab_release_(lz_heap * heap, lz_heap_tc * tc, lz_heap_slab * slab)
+{
+    LIST_REMOVE(slab, next);
+    LIST_REMOVE(slab, link);
+
+    heap_tc_count_(tc, -slab->n_elts);
+
+    heap->n_slabs        -= 1;
+    heap->bytes          -= heap->slab_size;
+    heap->bytes_released += heap->slab_size;
+
+    munmap(slab, heap->slab_size);
+}
+
+/*
+ * puts a free element back on its slab, returns 1 if that left the slab with
+ * no live element (and it is not the one being allocated from).
+ */
+static inline int
+heap_slab_put_(lz_heap_tc * tc, lz_heap_slab * slab, struct lz_heap_free_s * elt)
+{
+    elt->next       = slab->free_list;
+    slab->free_list = elt;
+
+    heap_tc_count_(tc, 1);
+
+    /* a full slab is on no list, and goes on the avail one once there is
+     * something to allocate from it again */
+    if (lz_unlikely(slab->n_free++ == 0) && slab != tc->cur)
+    {
+        LIST_INSERT_HEAD(&tc->avail, slab, next);
+    }
+
+    return slab->n_free == slab->n_elts && slab != tc->cur;
+}
 
+static void
+heap_tc_collect_(lz_heap * heap, lz_heap_tc * tc)
+{
+    struct lz_heap_free_s * elt;
+    struct lz_heap_free_s * next;
+
+    /* the cache's local list back onto the slabs, already counted */
+    for (elt = tc->local; elt != NULL; elt = next)
+    {
+        next = elt->next;
+        heap_tc_count_(tc, -1);
+        heap_slab_put_(tc, HEAP_SLAB_OF(heap, elt), elt);
+    }
+
+    tc->local = NULL;
+
+    if (!(heap->flags & LZ_HEAP_F_MT))
+    {
+        return;
+    }
+
+    /* elements other threads freed */
+    for (elt = __atomic_exchange_n(&tc->remote, NULL, __ATOMIC_ACQUIRE); elt != NULL; elt = next)
+    {
+        next = elt->next;
+        heap_slab_put_(tc, HEAP_SLAB_OF(heap, elt), elt);
+    }
+}
+
+/*
+ * returns the cache's slabs that hold no live element to the system,
+ * keeping at least keep free elements. The caller holds the heap lock where
+ * there is one.
+ */
+static size_t
+heap_tc_trim_(lz_heap * heap, lz_heap_tc * tc, size_t keep)
+{
+    lz_heap_slab * slab;
+    lz_heap_slab * next;
+    size_t         released = 0;
+
+    heap_tc_collect_(heap, tc);
+
+    for (slab = LIST_FIRST(&tc->avail); slab != NULL; slab = next)
+    {
+        next = LIST_NEXT(slab, next);
+
+        if (slab->n_free == slab->n_elts && tc->n_free >= keep + slab->n_elts)
+        {
+            heap_slab_release_(heap, tc, slab);
+            released += heap->slab_size;
+        }
+    }
+
+    return released;
+}
+
+static void
+heap_remote_push_(lz_heap_tc * owner, struct lz_heap_free_s * head, struct lz_heap_free_s * tail)
+{
+    struct lz_heap_free_s * old;
+
+    /* the owner only ever takes the entire list, so a head that was taken
+     * and pushed again in between (ABA) does no harm here */
+    old = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+
+    do {
+        tail->next = old;
+    } while (!__atomic_compare_exchange_n(&owner->remote, &old, head,
+                                          1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void
+heap_tc_flush_(lz_heap_tc * tc)
+{
+    if (tc->batch_len == 0)
+    {
+        return;
+    }
+
+    heap_remote_push_(tc->batch_owner, tc->batch_head, tc->batch_tail);
+
+    tc->batch_head = NULL;
+    tc->batch_tail = NULL;
+    tc->batch_len  = 0;
+}
+
+static void
+heap_tc_detach_(void * arg)
+{
+    lz_heap_tc * tc   = arg;
+    lz_heap    * heap = tc->heap;
+
+    /* the thread is exiting: its slabs and free elements stay with the
+     * cache, which the next thread to use the heap picks up */
+    heap_tc_flush_(tc);
+
+    pthread_mutex_lock(&heap->lock);
+    SLIST_INSERT_HEAD(&heap->idle, tc, next_idle);
+    pthread_mutex_unlock(&heap->lock);
+}
+
+static lz_heap_tc *
+heap_tc_attach_(lz_heap * heap)
+{
+    lz_heap_tc * tc;
+
+    pthread_mutex_lock(&heap->lock);
+
+    if ((tc = SLIST_FIRST(&heap->idle)) != NULL)
+    {
+        SLIST_REMOVE_HEAD(&heap->idle, next_idle);
+    } else if (posix_memalign((void **)&tc, 64, sizeof(lz_heap_tc)) == 0)
+    {
+        memset(tc, 0, sizeof(lz_heap_tc));
+
+        LIST_INIT(&tc->avail);
+        LIST_INIT(&tc->slabs);
+
+        tc->heap = heap;
+        SLIST_INSERT_HEAD(&heap->tcs, tc, next);
+    } else {
+        tc = NULL;
+    }
+
+    pthread_mutex_unlock(&heap->lock);
+
+    if (tc != NULL && pthread_setspecific(heap->tc_key, tc) != 0)
+    {
+        heap_tc_detach_(tc);
+        return NULL;
+    }
+
+    return tc;
+}
+
+static inline lz_heap_tc *
+heap_tc_get_(lz_heap * heap)
+{
+    lz_heap_tc * tc;
+
+    if (!(heap->flags & LZ_HEAP_F_MT))
+    {
+        return &heap->tc;
+    }
+
+    if (lz_unlikely((tc = pthread_getspecific(heap->tc_key)) == NULL))
+    {
+        return heap_tc_attach_(heap);
+    }
+
+    return tc;
+}
+
+/*
+ * the slab being allocated from ran dry: move on to one with free elements,
+ * taking back remote frees first and mapping a new slab last.
+ */
+static lz_heap_slab *
+heap_tc_refill_(lz_heap * heap, lz_heap_tc * tc)
+{
+    lz_heap_slab * slab;
+
+    tc->cur = NULL;
+
+    heap_tc_collect_(heap, tc);
+
+    if ((slab = LIST_FIRST(&tc->avail)) != NULL)
+    {
+        LIST_REMOVE(slab, next);
+    } else if ((slab = heap_slab_new_(heap, tc)) == NULL)
+    {
+        return NULL;
+    }
+
+    tc->cur = slab;
+
+    return slab;
+}
+
+static inline void
+heap_shared_load_(lz_heap * heap, union lz_heap_tagged_u * head)
+{
+    /* the tag first: if the head changes between the two loads, the tag
+     * read is older than the pointer and the CAS fails */
+    head->tag = __atomic_load_n(&heap->shared.tag, __ATOMIC_ACQUIRE);
+    head->ptr = __atomic_load_n(&heap->shared.ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline int
+heap_shared_cas_(lz_heap * heap, union lz_heap_tagged_u * old, struct lz_heap_free_s * ptr)
+{
+    union lz_heap_tagged_u head = { { ptr, old->tag + 1 } };
+
+#ifdef HEAP_HAVE_DCAS
+    return __sync_bool_compare_and_swap(&heap->shared.word, old->word, head.word);
+#else
+    int res = 0;
+
+    pthread_mutex_lock(&heap->shared_lock);
+
+    if (heap->shared.ptr == old->ptr && heap->shared.tag == old->tag)
+    {
+        heap->shared = head;
+        res          = 1;
+    }
+
+    pthread_mutex_unlock(&heap->shared_lock);
+
+    return res;
+#endif
+}
+
+static void
+heap_shared_push_(lz_heap * heap, struct lz_heap_free_s * first, struct lz_heap_free_s * last)
+{
+    union lz_heap_tagged_u head;
+
+    do {
+        heap_shared_load_(heap, &head);
+        /* a racing alloc may still be reading the next of an element it
+         * popped before this one freed it */
+        __atomic_store_n(&last->next, head.ptr, __ATOMIC_RELAXED);
+    } while (!heap_shared_cas_(heap, &head, first));
+}
+
+static void
+heap_shared_push_slab_(lz_heap * heap, lz_heap_slab * slab)
+{
+    char * elt = slab->data;
+    char * end = slab->end_elt - heap->page_size;
+
+    /* a shared heap can not carve lazily, link the whole slab and push it
+     * in one go */
+    for (; elt < end; elt += heap->page_size)
+    {
+        ((struct lz_heap_free_s *)elt)->next = (struct lz_heap_free_s *)(elt + heap->page_size);
+    }
+
+    /* every shared slab sits on the avail list, which nothing allocates
+     * from, for lz_heap_trim() */
+    slab->next_elt = slab->end_elt;
+    LIST_INSERT_HEAD(&heap->tc.avail, slab, next);
+
+    heap_shared_push_(heap, (struct lz_heap_free_s *)slab->data, (struct lz_heap_free_s *)end);
+}
+
+static int
+heap_shared_grow_(lz_heap * heap)
+{
+    lz_heap_slab * slab;
+    int            res = 0;
+
+    pthread_mutex_lock(&heap->lock);
+
+    /* another thread may have grown the heap while this one waited */
+    if (__atomic_load_n(&heap->shared.ptr, __ATOMIC_ACQUIRE) == NULL)
+    {
+        if ((slab = heap_slab_new_(heap, &heap->tc)) != NULL)
+        {
+            heap_shared_push_slab_(heap, slab);
+        } else {
+            res = -1;
+        }
+    }
+
+    pthread_mutex_unlock(&heap->lock);
+
+    return res;
+}
+
+/*
+ * the speculative read of a popped element's next: the element may already
+ * be in use by the thread that won it, which the tag check catches. It is
+ * kept out of ThreadSanitizer's view, as it can only ever see it as a race
+ * with that thread's writes.
+ */
+__attribute__((no_sanitize_thread))
+static inline struct lz_heap_free_s *
+heap_shared_next_(struct lz_heap_free_s * elt)
+{
+    return __atomic_load_n(&elt->next, __ATOMIC_RELAXED);
+}
+
+static void *
+heap_shared_alloc_(lz_heap * heap)
+{
+    union lz_heap_tagged_u head;
+
+    for (;;)
+    {
+        heap_shared_load_(heap, &head);
+
+        if (lz_unlikely(head.ptr == NULL))
+        {
+            if (heap_shared_grow_(heap) == -1)
+            {
+                return NULL;
+            }
+
+            continue;
+        }
+
+        /* head.ptr may already be someone else's element by now, in which
+         * case next is garbage and the tag check makes the CAS fail. The
+         * memory itself stays mapped: a shared heap is only trimmed while
+         * no other thread uses it. */
+        if (heap_shared_cas_(heap, &head, heap_shared_next_(head.ptr)))
+        {
+            __atomic_fetch_sub(&heap->tc.n_free, 1, __ATOMIC_RELAXED);
+
+            return head.ptr;
+        }
+    }
+}
+
+static size_t
+heap_shared_trim_(lz_heap * heap, size_t keep)
+{
+    struct lz_heap_free_s * elt;
+    struct lz_heap_free_s * next;
+    struct lz_heap_free_s * head = NULL;
+    lz_heap_slab          * slab;
+    lz_heap_slab          * snext;
+    size_t                  released = 0;
+
+    /* sort the free list out by slab, like a plain heap keeps it */
+    LIST_FOREACH(slab, &heap->tc.avail, next)
+    {
+        slab->free_list = NULL;
+        slab->n_free    = 0;
+    }
+
+    for (elt = heap->shared.ptr; elt != NULL; elt = next)
+    {
+        next            = elt->next;
+        slab            = HEAP_SLAB_OF(heap, elt);
+        elt->next       = slab->free_list;
+        slab->free_list = elt;
+        slab->n_free++;
+    }
+
+    for (slab = LIST_FIRST(&heap->tc.avail); slab != NULL; slab = snext)
+    {
+        snext = LIST_NEXT(slab, next);
+
+        if (slab->n_free == slab->n_elts && heap->tc.n_free >= keep + slab->n_elts)
+        {
+            heap_slab_release_(heap, &heap->tc, slab);
+            released += heap->slab_size;
+
+            continue;
+        }
+
+        /* and put the rest back together */
+        while ((elt = slab->free_list) != NULL)
+        {
+            slab->free_list = elt->next;
+            elt->next       = head;
+            head            = elt;
+        }
+    }
+
+    heap->shared.ptr  = head;
+    heap->shared.tag += 1;
+
+    return released;
+} /* heap_shared_trim_ */
+
+static void
+heap_tc_unmap_(lz_heap * heap, lz_heap_tc * tc)
+{
+    lz_heap_slab * slab;
+
+    while ((slab = LIST_FIRST(&tc->slabs)) != NULL)
+    {
+        LIST_REMOVE(slab, link);
+        munmap(slab, heap->slab_size);
+    }
+}
 
 static lz_heap *
-heap_new_(size_t elts, size_t size)
+heap_new_flags_(size_t size, size_t nelem, int flags)
 {
-    lz_heap * heap;
+    lz_heap      * heap;
+    lz_heap_slab * slab;
+    size_t         n;
 
-    if (!(heap = malloc(sizeof(lz_heap))))
+    if ((flags & LZ_HEAP_F_MT) && (flags & LZ_HEAP_F_SHARED))
     {
         return NULL;
     }
 
-    heap->page_size = size;
+    if (posix_memalign((void **)&heap, 64, sizeof(lz_heap)) != 0)
+    {
+        return NULL;
+    }
+
+    memset(heap, 0, sizeof(lz_heap));
+
+    /* every element must be able to hold a free list link, and is aligned
+     * the way malloc() would align it */
+    if (size < sizeof(struct lz_heap_free_s))
+    {
+        size = sizeof(struct lz_heap_free_s);
+    }
+
+    heap->flags      = flags;
+    heap->page_size  = size < 16 ? lz_align(size, sizeof(void *)) : lz_align(size, 16);
+    heap->release_at = SIZE_MAX;
+
+    /* slabs big enough for nelem elements within [HEAP_SLAB_SIZE,
+     * HEAP_SLAB_MAX], and for HEAP_SLAB_MIN of them regardless */
+    n               = nelem > HEAP_SLAB_MIN ? nelem : HEAP_SLAB_MIN;
+    heap->slab_size = HEAP_SLAB_SIZE;
+
+    while (heap->slab_size < sizeof(lz_heap_slab) + heap->page_size * n &&
+           heap->slab_size < HEAP_SLAB_MAX)
+    {
+        heap->slab_size <<= 1;
+    }
+
+    while (heap->slab_size < sizeof(lz_heap_slab) + heap->page_size * HEAP_SLAB_MIN)
+    {
+        heap->slab_size <<= 1;
+    }
+
+    heap->slab_elts = (heap->slab_size - sizeof(lz_heap_slab)) / heap->page_size;
+
+    LIST_INIT(&heap->tc.avail);
+    LIST_INIT(&heap->tc.slabs);
+    SLIST_INIT(&heap->tcs);
+    SLIST_INIT(&heap->idle);
+
+    if (HEAP_LOCKED(heap))
+    {
+        pthread_mutex_init(&heap->lock, NULL);
+    }
 
-    SLIST_INIT(&heap->page_list_free);
-    SLIST_INIT(&heap->page_list_used);
+#ifndef HEAP_HAVE_DCAS
+    if (flags & LZ_HEAP_F_SHARED)
+    {
+        pthread_mutex_init(&heap->shared_lock, NULL);
+    }
+#endif
 
-    while (elts-- > 0)
+    if (flags & LZ_HEAP_F_MT)
     {
-        if (heap_page_new_(heap) == NULL)
+        /* every thread maps its own slabs, nothing is reserved up front */
+        if (pthread_key_create(&heap->tc_key, heap_tc_detach_) != 0)
         {
+            pthread_mutex_destroy(&heap->lock);
+            free(heap);
             return NULL;
         }
+
+        return heap;
     }
 
+    /* reserve the elements asked for: the slabs are mapped, but their pages
+     * are only touched as they are carved */
+    n = 0;
+
+    do {
+        if ((slab = heap_slab_new_(heap, &heap->tc)) == NULL)
+        {
+            heap_tc_unmap_(heap, &heap->tc);
+
+            if (HEAP_LOCKED(heap))
+            {
+                pthread_mutex_destroy(&heap->lock);
+            }
+
+            free(heap);
+            return NULL;
+        }
+
+        if (flags & LZ_HEAP_F_SHARED)
+        {
+            heap_shared_push_slab_(heap, slab);
+        } else if (heap->tc.cur == NULL)
+        {
+            heap->tc.cur = slab;
+        } else {
+            LIST_INSERT_HEAD(&heap->tc.avail, slab, next);
+        }
+
+        n += heap->slab_elts;
+    } while (n < nelem);
+
     return heap;
-} /* _lz_heap_new */
+} /* heap_new_flags_ */
+
+static lz_heap *
+heap_new_(size_t size, size_t nelem)
+{
+    return heap_new_flags_(size, nelem, 0);
+}
+
+static void
+heap_destroy_(lz_heap * heap)
+{
+    lz_heap_tc * tc;
+
+    if (heap == NULL)
+    {
+        return;
+    }
+
+    if (heap->flags & LZ_HEAP_F_MT)
+    {
+        /* no thread exit may touch the heap from here on */
+        pthread_key_delete(heap->tc_key);
+
+        while ((tc = SLIST_FIRST(&heap->tcs)) != NULL)
+        {
+            SLIST_REMOVE_HEAD(&heap->tcs, next);
+            heap_tc_unmap_(heap, tc);
+            free(tc);
+        }
+    } else {
+        heap_tc_unmap_(heap, &heap->tc);
+    }
+
+    if (HEAP_LOCKED(heap))
+    {
+        pthread_mutex_destroy(&heap->lock);
+    }
+
+#ifndef HEAP_HAVE_DCAS
+    if (heap->flags & LZ_HEAP_F_SHARED)
+    {
+        pthread_mutex_destroy(&heap->shared_lock);
+    }
+#endif
+
+    free(heap);
+} /* heap_destroy_ */
+
+static size_t
+heap_trim_(lz_heap * heap, size_t keep)
+{
+    lz_heap_tc * tc;
+    size_t       released = 0;
+
+    if (heap == NULL)
+    {
+        return 0;
+    }
+
+    if (!HEAP_LOCKED(heap))
+    {
+        return heap_tc_trim_(heap, &heap->tc, keep);
+    }
+
+    pthread_mutex_lock(&heap->lock);
+
+    if (heap->flags & LZ_HEAP_F_SHARED)
+    {
+        released = heap_shared_trim_(heap, keep);
+    } else {
+        if ((tc = pthread_getspecific(heap->tc_key)) != NULL)
+        {
+            released += heap_tc_trim_(heap, tc, keep);
+        }
+
+        SLIST_FOREACH(tc, &heap->idle, next_idle)
+        {
+            /* nothing allocates from an idle cache's slab, it can go too */
+            if (tc->cur != NULL && tc->cur->n_free > 0)
+            {
+                LIST_INSERT_HEAD(&tc->avail, tc->cur, next);
+            }
+
+            tc->cur   = NULL;
+            released += heap_tc_trim_(heap, tc, keep);
+        }
+    }
+
+    pthread_mutex_unlock(&heap->lock);
+
+    return released;
+} /* heap_trim_ */
+
+static void
+heap_set_release_(lz_heap * heap, size_t max_idle)
+{
+    if (heap == NULL || (heap->flags & LZ_HEAP_F_SHARED))
+    {
+        return;
+    }
+
+    __atomic_store_n(&heap->release_at, max_idle ? max_idle : SIZE_MAX, __ATOMIC_RELAXED);
+}
+
+static int
+heap_get_stats_(lz_heap * heap, struct lz_heap_stats * stats)
+{
+    lz_heap_tc * tc;
+    size_t       n_free = 0;
+
+    if (heap == NULL || stats == NULL)
+    {
+        return -1;
+    }
+
+    if (HEAP_LOCKED(heap))
+    {
+        pthread_mutex_lock(&heap->lock);
+    }
+
+    if (heap->flags & LZ_HEAP_F_MT)
+    {
+        SLIST_FOREACH(tc, &heap->tcs, next)
+        {
+            n_free += __atomic_load_n(&tc->n_free, __ATOMIC_RELAXED);
+        }
+    } else {
+        n_free = __atomic_load_n(&heap->tc.n_free, __ATOMIC_RELAXED);
+    }
+
+    stats->elt_size       = heap->page_size;
+    stats->n_slabs        = heap->n_slabs;
+    stats->bytes          = heap->bytes;
+    stats->bytes_peak     = heap->bytes_peak;
+    stats->bytes_retained = n_free * heap->page_size;
+    stats->bytes_released = heap->bytes_released;
+
+    if (HEAP_LOCKED(heap))
+    {
+        pthread_mutex_unlock(&heap->lock);
+    }
+
+    return 0;
+} /* heap_get_stats_ */
+
+/*
+ * frees an element into the cache owning it
+ */
+static inline void
+heap_tc_put_(lz_heap * heap, lz_heap_tc * tc, struct lz_heap_free_s * elt)
+{
+    lz_heap_slab * slab;
+    size_t         release_at = __atomic_load_n(&heap->release_at, __ATOMIC_RELAXED);
+
+    if (lz_likely(release_at == SIZE_MAX))
+    {
+        elt->next = tc->local;
+        tc->local = elt;
+        heap_tc_count_(tc, 1);
+
+        return;
+    }
+
+    slab = HEAP_SLAB_OF(heap, elt);
+
+    if (lz_unlikely(tc->local != NULL))
+    {
+        /* release was turned on since the last free */
+        if (HEAP_LOCKED(heap))
+        {
+            pthread_mutex_lock(&heap->lock);
+        }
+
+        heap_tc_trim_(heap, tc, release_at);
+
+        if (HEAP_LOCKED(heap))
+        {
+            pthread_mutex_unlock(&heap->lock);
+        }
+    }
+
+    if (lz_likely(!heap_slab_put_(tc, slab, elt)) || tc->n_free <= release_at)
+    {
+        return;
+    }
+
+    if (HEAP_LOCKED(heap))
+    {
+        pthread_mutex_lock(&heap->lock);
+    }
+
+    heap_slab_release_(heap, tc, slab);
+
+    if (HEAP_LOCKED(heap))
+    {
+        pthread_mutex_unlock(&heap->lock);
+    }
+} /* heap_tc_put_ */
 
 static void
 heap_free_(lz_heap * heap, void * d)
 {
-    lz_heap_page * page;
+    struct lz_heap_free_s * elt = d;
+    lz_heap_slab          * slab;
+    lz_heap_tc            * tc;
 
     if (lz_unlikely(!heap || !d))
     {
         return;
     }
 
-    page = (lz_heap_page *)((char *)(d - offsetof(lz_heap_page, data)));
+    if (heap->flags & LZ_HEAP_F_SHARED)
+    {
+        heap_shared_push_(heap, elt, elt);
+        __atomic_fetch_add(&heap->tc.n_free, 1, __ATOMIC_RELAXED);
+
+        return;
+    }
+
+    if (!(heap->flags & LZ_HEAP_F_MT))
+    {
+        heap_tc_put_(heap, &heap->tc, elt);
+        return;
+    }
+
+    slab = HEAP_SLAB_OF(heap, d);
 
-    /* NOTE: we should return something to designate errors like this */
-    if (!page || !(page->data == d))
+    if (lz_unlikely((tc = heap_tc_get_(heap)) == NULL))
     {
+        /* no cache for this thread, hand it straight back */
+        heap_remote_push_(slab->owner, elt, elt);
         return;
     }
 
-    SLIST_REMOVE(&heap->page_list_used, page, lz_heap_page_s, next);
-    SLIST_INSERT_HEAD(&heap->page_list_free, page, next);
-}
+    if (lz_likely(slab->owner == tc))
+    {
+        heap_tc_put_(heap, tc, elt);
+        return;
+    }
+
+    if (tc->batch_owner != slab->owner)
+    {
+        heap_tc_flush_(tc);
+        tc->batch_owner = slab->owner;
+    }
+
+    elt->next      = tc->batch_head;
+    tc->batch_head = elt;
+
+    if (tc->batch_tail == NULL)
+    {
+        tc->batch_tail = elt;
+    }
+
+    if (++tc->batch_len == HEAP_REMOTE_BATCH)
+    {
+        heap_tc_flush_(tc);
+    }
+} /* heap_free_ */
 
 static void *
 heap_alloc_(lz_heap * heap)
 {
-    lz_heap_page * page;
+    lz_heap_tc            * tc;
+    lz_heap_slab          * slab;
+    struct lz_heap_free_s * elt;
+
+    if (heap->flags & LZ_HEAP_F_SHARED)
+    {
+        return heap_shared_alloc_(heap);
+    }
+
+    if (lz_unlikely((tc = heap_tc_get_(heap)) == NULL))
+    {
+        return NULL;
+    }
+
+    if ((elt = tc->local) != NULL)
+    {
+        tc->local = elt->next;
+        heap_tc_count_(tc, -1);
+
+        return elt;
+    }
 
-    if (SLIST_EMPTY(&heap->page_list_free))
+    slab = tc->cur;
+
+    if (lz_unlikely(slab == NULL || slab->n_free == 0))
     {
-        if (!heap_page_new_(heap))
+        if ((slab = heap_tc_refill_(heap, tc)) == NULL)
         {
             return NULL;
         }
     }
 
-    if (!(page = SLIST_FIRST(&heap->page_list_free)))
+    if ((elt = slab->free_list) != NULL)
     {
-        return NULL;
+        slab->free_list = elt->next;
+    } else {
+        elt = (struct lz_heap_free_s *)slab->next_elt;
+        slab->next_elt += heap->page_size;
     }
 
-    SLIST_REMOVE(&heap->page_list_free, page, lz_heap_page_s, next);
-    SLIST_INSERT_HEAD(&heap->page_list_used, page, next);
+    slab->n_free -= 1;
+    heap_tc_count_(tc, -1);
 
-    return page->data;
-}
+    return elt;
+} /* heap_alloc_ */
 
 lz_alias(heap_alloc_, lz_heap_alloc);
 lz_alias(heap_new_, lz_heap_new);
+lz_alias(heap_new_flags_, lz_heap_new_flags);
 lz_alias(heap_free_, lz_heap_free);
+lz_alias(heap_destroy_, lz_heap_destroy);
+lz_alias(heap_trim_, lz_heap_trim);
+lz_alias(heap_set_release_, lz_heap_set_release);
+lz_alias(heap_get_stats_, lz_heap_get_stats);
@@ -6,17 +6,40 @@ struct lz_heap_s;
 
 typedef struct lz_heap_s lz_heap;
 
+enum lz_heap_flags {
+    /* the heap may be used from any number of threads, and an element may be
+     * freed on a different thread than the one that allocated it. Every
+     * thread allocates from its own cache of slabs without locking; elements
+     * freed by another thread are handed back to the owning cache in
+     * batches through a lock-free list. */
+    LZ_HEAP_F_MT     = (1 << 0),
+    /* the heap may be used from any number of threads, through one free
+     * list shared by all of them: a lock-free stack whose head carries an
+     * ABA tag, swapped with a double-width CAS. Alloc and free are a single
+     * CAS when uncontended; only growing the heap takes a lock. Suits pools
+     * with many short-lived threads, where LZ_HEAP_F_MT would keep a cache
+     * per thread. Can not be combined with LZ_HEAP_F_MT. */
+    LZ_HEAP_F_SHARED = (1 << 1),
+};
 
 /**
- * @brief creates a new heap context
+ * @brief creates a new heap context. Elements are carved from large
+ *        contiguous slabs, and allocating or freeing one is O(1).
  *
  * @param size the size of the data to be allocated
- * @param nelem the number of elements allocated with the size
+ * @param nelem the number of elements to reserve up front, the heap grows
+ *        past it a slab at a time
  *
  * @return NULL on error
  */
 LZ_EXPORT lz_heap * lz_heap_new(size_t size, size_t nelem);
 
+/**
+ * @brief lz_heap_new() with lz_heap_flags. With LZ_HEAP_F_MT, nelem only
+ *        sizes the slabs each thread carves, nothing is allocated up front.
+ */
+LZ_EXPORT lz_heap * lz_heap_new_flags(size_t size, size_t nelem, int flags);
+
 
 /**
  * @brief returns a single pre-allocated segment of memory from the heap list,
@@ -31,9 +54,60 @@ LZ_EXPORT void * lz_heap_alloc(lz_heap * heap);
 
 
 /**
- * @brief removes the data entry, and places it back into a unused queue.
+ * @brief places the data entry back on the heap's free list, to be handed
+ *        out again by lz_heap_alloc(). Memory only goes back to the system
+ *        through lz_heap_trim() or lz_heap_set_release().
  *
  * @param heap
  * @param d data that was returned from lz_heap_alloc()
  */
 LZ_EXPORT void lz_heap_free(lz_heap * heap, void * d);
+
+
+/**
+ * @brief frees the heap and every element in it. No other thread may be
+ *        using the heap.
+ */
+LZ_EXPORT void lz_heap_destroy(lz_heap * heap);
+
+
+/**
+ * @brief returns slabs that hold no live element to the system (munmap),
+ *        keeping at least keep free elements around.
+ *
+ *        A LZ_HEAP_F_MT heap trims the calling thread's cache and those left
+ *        by threads that have exited. A LZ_HEAP_F_SHARED heap may only be
+ *        trimmed while no other thread is using it.
+ *
+ * @return the number of bytes released
+ */
+LZ_EXPORT size_t lz_heap_trim(lz_heap * heap, size_t keep);
+
+
+/**
+ * @brief releases memory automatically: while a cache (the heap, or a
+ *        thread's with LZ_HEAP_F_MT) holds more than max_idle free elements,
+ *        a slab is unmapped as soon as its last live element is freed.
+ *        Below the mark, empty slabs are kept around for reuse.
+ *
+ *        0 (the default) turns it off. Not available with LZ_HEAP_F_SHARED.
+ */
+LZ_EXPORT void lz_heap_set_release(lz_heap * heap, size_t max_idle);
+
+
+struct lz_heap_stats {
+    size_t elt_size;       /* element size, after rounding for alignment */
+    size_t n_slabs;
+    size_t bytes;          /* currently mapped for slabs */
+    size_t bytes_peak;     /* the most ever mapped at once */
+    size_t bytes_retained; /* of bytes, held in free (or not yet used) elements */
+    size_t bytes_released; /* returned to the system by trimming, in total */
+};
+
+/**
+ * @brief fills stats. With LZ_HEAP_F_MT, elements freed by another thread
+ *        than their owner's count as retained once the owner takes them back.
+ *
+ * @return 0 on success, -1 on error
+ */
+LZ_EXPORT int lz_heap_get_stats(lz_heap * heap, struct lz_heap_stats * stats);
@@ -0,0 +1,481 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define IMAP_MIN_SLOTS 16
+#define IMAP_MAX_SLOTS (1U << 31)
+
+/* grow above 3/4 full, shrink below 1/8 */
+#define IMAP_GROW(n)   ((n) - ((n) >> 2))
+#define IMAP_SHRINK(n) ((n) >> 3)
+
+/*
+ * a slot with key 0 is empty; the key 0 itself is kept on the side in
+ * map->zero so every other key can live in the slot array.
+ */
+struct imap_slot {
+    uint64_t key;
+    void   * val;
+    void  (* freefn)(void *);
+};
+
+struct lz_imap_s {
+    struct imap_slot * slots;
+    uint32_t           n_slots;  /* power of two */
+    uint32_t           shift;    /* 64 - log2(n_slots) */
+    uint32_t           n_entries;
+    uint32_t           min_slots;
+    uint32_t           iterating;
+    uint32_t           has_zero;
+    struct imap_slot   zero;
+};
+
+/*
+ * fibonacci hashing: the top bits of key * 2^64 / phi depend on every bit of
+ * the key, so sequential keys (fds, ids, addresses in a subnet) spread evenly.
+ */
+static inline uint32_t
+imap_home_(lz_imap * map, uint64_t key)
+{
+    return (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> map->shift);
+}
+
+static inline void
+imap_release_(struct imap_slot * slot)
+{
+    if (slot->freefn)
+    {
+        (slot->freefn)(slot->val);
+    }
+}
+
+static struct imap_slot *
+imap_slot_find_(lz_imap * map, uint64_t key)
+{
+    uint32_t mask = map->n_slots - 1;
+    uint32_t i    = imap_home_(map, key);
+
+    if (key == 0)
+    {
+        return map->has_zero ? &map->zero : NULL;
+    }
+
+    for (;; i = (i + 1) & mask)
+    {
+        struct imap_slot * slot = &map->slots[i];
+
+        if (slot->key == key)
+        {
+            return slot;
+        }
+
+        if (slot->key == 0)
+        {
+            return NULL;
+        }
+    }
+}
+
+/**
+ * @brief places a key known not to be in the map, returns its slot.
+ */
+static struct imap_slot *
+imap_slot_place_(lz_imap * map, uint64_t key)
+{
+    uint32_t mask = map->n_slots - 1;
+    uint32_t i    = imap_home_(map, key);
+
+    while (map->slots[i].key != 0)
+    {
+        i = (i + 1) & mask;
+    }
+
+    map->slots[i].key = key;
+
+    return &map->slots[i];
+}
+
+static int
+imap_resize_(lz_imap * map, uint32_t n_slots)
+{
+    struct imap_slot * old   = map->slots;
+    uint32_t           n_old = map->n_slots;
+    struct imap_slot * slots;
+    uint32_t           i;
+
+    if (!(slots = calloc(n_slots, sizeof(struct imap_slot))))
+    {
+        return -1;
+    }
+
+    map->slots   = slots;
+    map->n_slots = n_slots;
+    map->shift   = 64 - __builtin_ctz(n_slots);
+
+    for (i = 0; i < n_old; i++)
+    {
+        if (old[i].key != 0)
+        {
+            struct imap_slot * slot = imap_slot_place_(map, old[i].key);
+
+            slot->val    = old[i].val;
+            slot->freefn = old[i].freefn;
+        }
+    }
+
+    free(old);
+
+    return 0;
+}
+
+/**
+ * @brief empties slot i, shifting back any entry further down the probe
+ *        sequence that would otherwise become unreachable.
+ */
+static void
+imap_slot_delete_(lz_imap * map, uint32_t i)
+{
+    uint32_t mask = map->n_slots - 1;
+    uint32_t j    = i;
+
+    for (;;)
+    {
+        uint32_t home;
+
+        j = (j + 1) & mask;
+
+        if (map->slots[j].key == 0)
+        {
+            break;
+        }
+
+        home = imap_home_(map, map->slots[j].key);
+
+        /* the entry at j may move to i unless its home lies in (i, j] */
+        if ((i <= j) ? (home <= i || home > j) : (home <= i && home > j))
+        {
+            map->slots[i] = map->slots[j];
+            i = j;
+        }
+    }
+
+    memset(&map->slots[i], 0, sizeof(struct imap_slot));
+}
+
+static lz_imap *
+imap_new_(uint32_t n_entries)
+{
+    lz_imap * map;
+    uint32_t  n_slots;
+
+    /* the slot count has to fit a uint32_t */
+    if (n_entries > IMAP_GROW(IMAP_MAX_SLOTS))
+    {
+        return NULL;
+    }
+
+    if (!(map = calloc(1, sizeof(lz_imap))))
+    {
+        return NULL;
+    }
+
+    for (n_slots = IMAP_MIN_SLOTS; IMAP_GROW(n_slots) < n_entries; n_slots <<= 1)
+    {
+    }
+
+    map->min_slots = n_slots;
+
+    if (imap_resize_(map, n_slots) == -1)
+    {
+        free(map);
+        return NULL;
+    }
+
+    return map;
+}
+
+static int
+imap_clear_(lz_imap * map)
+{
+    uint32_t i;
+
+    if (map == NULL)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < map->n_slots && map->n_entries > map->has_zero; i++)
+    {
+        if (map->slots[i].key != 0)
+        {
+            imap_release_(&map->slots[i]);
+            map->n_entries -= 1;
+        }
+    }
+
+    if (map->has_zero)
+    {
+        imap_release_(&map->zero);
+        memset(&map->zero, 0, sizeof(map->zero));
+    }
+
+    memset(map->slots, 0, sizeof(struct imap_slot) * map->n_slots);
+
+    map->has_zero  = 0;
+    map->n_entries = 0;
+
+    return 0;
+}
+
+static void
+imap_free_(lz_imap * map)
+{
+    if (map == NULL)
+    {
+        return;
+    }
+
+    imap_clear_(map);
+
+    free(map->slots);
+    free(map);
+}
+
+static int
+imap_add_(lz_imap * map, uint64_t key, void * val, void (* freefn)(void *))
+{
+    struct imap_slot * slot;
+
+    if (lz_unlikely(map == NULL))
+    {
+        return -1;
+    }
+
+    if ((slot = imap_slot_find_(map, key)) != NULL)
+    {
+        if (slot->val != val)
+        {
+            imap_release_(slot);
+        }
+
+        slot->val    = val;
+        slot->freefn = freefn;
+
+        return 0;
+    }
+
+    if (key == 0)
+    {
+        slot           = &map->zero;
+        map->has_zero  = 1;
+    } else {
+        if (map->n_entries - map->has_zero + 1 > IMAP_GROW(map->n_slots))
+        {
+            if (map->n_slots == IMAP_MAX_SLOTS ||
+                imap_resize_(map, map->n_slots * 2) == -1)
+            {
+                return -1;
+            }
+        }
+
+        slot = imap_slot_place_(map, key);
+    }
+
+    slot->val       = val;
+    slot->freefn    = freefn;
+    map->n_entries += 1;
+
+    return 0;
+}
+
+static void *
+imap_find_(lz_imap * map, uint64_t key)
+{
+    struct imap_slot * slot;
+
+    if (lz_unlikely(map == NULL))
+    {
+        return NULL;
+    }
+
+    slot = imap_slot_find_(map, key);
+
+    return slot ? slot->val : NULL;
+}
+
+static int
+imap_contains_(lz_imap * map, uint64_t key)
+{
+    return map != NULL && imap_slot_find_(map, key) != NULL;
+}
+
+static int
+imap_remove_(lz_imap * map, uint64_t key)
+{
+    struct imap_slot * slot;
+
+    if (lz_unlikely(map == NULL))
+    {
+        return -1;
+    }
+
+    /* like lz_kvmap_remove(), a key that is not there is not an error */
+    if (!(slot = imap_slot_find_(map, key)))
+    {
+        return 0;
+    }
+
+    imap_release_(slot);
+    map->n_entries -= 1;
+
+    if (key == 0)
+    {
+        memset(&map->zero, 0, sizeof(map->zero));
+        map->has_zero = 0;
+
+        return 0;
+    }
+
+    imap_slot_delete_(map, (uint32_t)(slot - map->slots));
+
+    /* a failed shrink just leaves the map larger than it needs to be */
+    if (!map->iterating && map->n_slots > map->min_slots &&
+        map->n_entries < IMAP_SHRINK(map->n_slots))
+    {
+        imap_resize_(map, map->n_slots / 2);
+    }
+
+    return 0;
+}
+
+static int
+imap_for_each_(lz_imap * map, lz_imap_iterfn iterfn, void * arg)
+{
+    uint32_t mask;
+    uint32_t start;
+    uint32_t i;
+    int      res = 0;
+
+    if (map == NULL || iterfn == NULL)
+    {
+        return -1;
+    }
+
+    map->iterating += 1;
+
+    if (map->has_zero)
+    {
+        res = (iterfn)(0, map->zero.val, arg);
+    }
+
+    /*
+     * walk backwards from an empty slot: removing the current key only ever
+     * shifts entries from further down its run (already visited) back into
+     * it, so no entry is skipped or visited twice.
+     */
+    mask  = map->n_slots - 1;
+    start = 0;
+
+    while (map->slots[start].key != 0)
+    {
+        start++;
+    }
+
+    for (i = (start - 1) & mask; i != start && res == 0; i = (i - 1) & mask)
+    {
+        if (map->slots[i].key != 0)
+        {
+            res = (iterfn)(map->slots[i].key, map->slots[i].val, arg);
+        }
+    }
+
+    map->iterating -= 1;
+
+    return res;
+} /* imap_for_each_ */
+
+/*
+ * it is 0 before the first entry, 1 + the next slot to look at afterwards;
+ * key 0 comes first, from its side slot.
+ */
+static int
+imap_next_(lz_imap * map, lz_imap_iter * it, uint64_t * key, void ** val)
+{
+    struct imap_slot * slot = NULL;
+    uint32_t           i;
+
+    if (map == NULL || it == NULL)
+    {
+        return 0;
+    }
+
+    if (*it == 0)
+    {
+        *it = 1;
+
+        if (map->has_zero)
+        {
+            slot = &map->zero;
+        }
+    }
+
+    for (i = *it - 1; slot == NULL && i < map->n_slots; i++)
+    {
+        if (map->slots[i].key != 0)
+        {
+            slot = &map->slots[i];
+            *it  = i + 2;
+        }
+    }
+
+    if (slot == NULL)
+    {
+        *it = map->n_slots + 1;
+        return 0;
+    }
+
+    if (key != NULL)
+    {
+        *key = slot->key;
+    }
+
+    if (val != NULL)
+    {
+        *val = slot->val;
+    }
+
+    return 1;
+} /* imap_next_ */
+
+static int
+imap_first_(lz_imap * map, lz_imap_iter * it, uint64_t * key, void ** val)
+{
+    if (it != NULL)
+    {
+        *it = 0;
+    }
+
+    return imap_next_(map, it, key, val);
+}
+
+static size_t
+imap_get_size_(lz_imap * map)
+{
+    return map ? map->n_entries : 0;
+}
+
+lz_alias(imap_new_, lz_imap_new);
+lz_alias(imap_free_, lz_imap_free);
+lz_alias(imap_add_, lz_imap_add);
+lz_alias(imap_find_, lz_imap_find);
+lz_alias(imap_contains_, lz_imap_contains);
+lz_alias(imap_remove_, lz_imap_remove);
+lz_alias(imap_for_each_, lz_imap_for_each);
+lz_alias(imap_first_, lz_imap_first);
+lz_alias(imap_next_, lz_imap_next);
+lz_alias(imap_clear_, lz_imap_clear);
+lz_alias(imap_get_size_, lz_imap_get_size);
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <liblz.h>
+
+/*
+ * lz_imap: a map keyed by integers (uint32_t / uint64_t, IPv4 addresses,
+ * ids, fds...), for when formatting keys into strings for lz_kvmap would be
+ * the most expensive part of a lookup.
+ *
+ * Keys and values are stored inline in one flat, open addressed slot array,
+ * so a lookup is an integer multiply and usually a single cache line, with no
+ * per-entry allocation. Values are released with their freefn when they are
+ * replaced or removed, or the map is cleared or freed, just like lz_kvmap.
+ *
+ * Where it differs from lz_kvmap:
+ *  - lz_imap_add() replaces the value of a key already in the map, like
+ *    lz_kvmap_upsert(), it never adds a second entry for the same key.
+ *  - there are no entry handles: iteration hands out keys and values, and
+ *    lz_imap_first() / lz_imap_next() keep their position in an
+ *    lz_imap_iter.
+ *  - the lz_imap_for_each() callback may only remove the key it is called
+ *    with, not any other.
+ */
+
+struct lz_imap_s;
+
+typedef struct lz_imap_s lz_imap;
+
+typedef int (* lz_imap_iterfn)(uint64_t key, void * val, void * arg);
+
+/* a position for lz_imap_first() / lz_imap_next() */
+typedef uint32_t lz_imap_iter;
+
+
+/**
+ * @brief creates a new integer map
+ *
+ * @param n_entries the number of entries expected, the map grows past it
+ *
+ * @return NULL on error, or if n_entries would need more than 2^31 slots
+ */
+LZ_EXPORT lz_imap * lz_imap_new(uint32_t n_entries);
+LZ_EXPORT void      lz_imap_free(lz_imap * map);
+
+
+/**
+ * @brief adds the key, or replaces its value if it is already in the map.
+ *        A replaced value is released with its freefn, unless it is the
+ *        same value.
+ *
+ * @return 0 on success, -1 on error, or if the map is at its maximum of
+ *         2^31 slots
+ */
+LZ_EXPORT int lz_imap_add(lz_imap * map, uint64_t key, void * val, void (* freefn)(void *));
+
+
+/**
+ * @return the value of key, NULL if not found
+ */
+LZ_EXPORT void * lz_imap_find(lz_imap * map, uint64_t key);
+
+/**
+ * @return 1 if the key is in the map, for maps that store NULL values
+ */
+LZ_EXPORT int lz_imap_contains(lz_imap * map, uint64_t key);
+
+
+/**
+ * @brief removes the key, releasing its value with its freefn. As with
+ *        lz_kvmap_remove(), a key that is not in the map is not an error,
+ *        use lz_imap_contains() to tell.
+ *
+ * @return 0 on success, -1 on error
+ */
+LZ_EXPORT int lz_imap_remove(lz_imap * map, uint64_t key);
+
+
+/**
+ * @brief calls iterfn for each entry, in no particular order, until it
+ *        returns non-zero. iterfn may remove the key it is called with, but
+ *        must not add keys or remove any other key.
+ *
+ * @return the first non-zero value returned by iterfn, or 0
+ */
+LZ_EXPORT int lz_imap_for_each(lz_imap * map, lz_imap_iterfn iterfn, void * arg);
+
+
+/**
+ * @brief walks the map like lz_kvmap_first() / lz_kvmap_next(), in no
+ *        particular order. The map must not be modified during the walk,
+ *        use lz_imap_for_each() to remove entries while iterating.
+ *
+ * @param[in,out] it the position, set up by lz_imap_first()
+ * @param[out] key if not NULL, set to the entry's key
+ * @param[out] val if not NULL, set to the entry's value
+ *
+ * @return 1 if an entry was returned, 0 once there are no more
+ */
+LZ_EXPORT int lz_imap_first(lz_imap * map, lz_imap_iter * it, uint64_t * key, void ** val);
+LZ_EXPORT int lz_imap_next(lz_imap * map, lz_imap_iter * it, uint64_t * key, void ** val);
+
+LZ_EXPORT int    lz_imap_clear(lz_imap * map);
+LZ_EXPORT size_t lz_imap_get_size(lz_imap * map);
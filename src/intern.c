@@ -0,0 +1,469 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define INTERN_MIN_SLOTS  16
+#define INTERN_CHUNK_SIZE (64 * 1024)
+
+/* strings larger than this get a chunk of their own */
+#define INTERN_CHUNK_MAX  (INTERN_CHUNK_SIZE / 4)
+
+/* grow above 3/4 full, strings are never removed so there is no shrinking */
+#define INTERN_GROW(n)    ((n) - ((n) >> 2))
+
+/*
+ * the id directory is made of segments that double in size, the first
+ * holding 1 << INTERN_SEG_SHIFT ids, so it grows without ever moving an entry
+ * a reader may be looking at. INTERN_N_SEGS of them cover every 32-bit id.
+ */
+#define INTERN_SEG_SHIFT  10
+#define INTERN_N_SEGS     23
+
+#define intern_load_(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define intern_store_(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+/* every string is stored right after its id and length */
+struct intern_str {
+    uint32_t id;
+    uint32_t len;
+    char     data[];
+};
+
+#define intern_str_hdr_(str) \
+    ((const struct intern_str *)((str) - offsetof(struct intern_str, data)))
+
+struct intern_chunk {
+    struct intern_chunk * next;
+    size_t                size;
+    size_t                used;
+    char                  data[];
+};
+
+/*
+ * a slot is 0 when empty, otherwise the top 32 bits of the string's hash
+ * followed by its id + 1, so a probe only touches the string on a likely
+ * match. Slots are published with a single release store.
+ */
+struct intern_tbl {
+    struct intern_tbl * retired_next;
+    uint64_t            mask;
+    uint64_t            slots[];
+};
+
+struct lz_intern_s {
+    struct intern_tbl   * tbl;                  /* read without locks */
+    const char         ** segs[INTERN_N_SEGS];  /* read without locks */
+    uint32_t              n_strings;            /* read without locks */
+
+    pthread_mutex_t       lock;                 /* serializes writers */
+    struct intern_chunk * chunks;               /* the one being filled first */
+    struct intern_tbl   * retired;
+    size_t                n_bytes;
+};
+
+static inline uint32_t
+intern_seg_(uint32_t id, uint32_t * off)
+{
+    uint64_t n   = ((uint64_t)id + (1U << INTERN_SEG_SHIFT)) >> INTERN_SEG_SHIFT;
+    uint32_t seg = 63 - __builtin_clzll(n);
+
+    *off = (uint32_t)((uint64_t)id + (1U << INTERN_SEG_SHIFT) - ((uint64_t)1 << (seg + INTERN_SEG_SHIFT)));
+
+    return seg;
+}
+
+static inline const char *
+intern_dir_(lz_intern * intern, uint32_t id)
+{
+    const char ** seg;
+    uint32_t      off;
+
+    seg = intern_load_(&intern->segs[intern_seg_(id, &off)]);
+
+    return intern_load_(&seg[off]);
+}
+
+static inline uint64_t
+intern_hash_(const char * s, size_t len)
+{
+    return lz_kvmap_hash64(s, len, 0);
+}
+
+/**
+ * @brief finds the id of a string in the current table, lock free
+ */
+static uint32_t
+intern_lookup_(lz_intern * intern, const char * s, size_t len, uint64_t hash)
+{
+    struct intern_tbl * tbl = intern_load_(&intern->tbl);
+    uint64_t            tag = hash >> 32;
+    uint64_t            i;
+
+    for (i = hash & tbl->mask;; i = (i + 1) & tbl->mask)
+    {
+        uint64_t slot = intern_load_(&tbl->slots[i]);
+
+        if (slot == 0)
+        {
+            return LZ_INTERN_ID_NONE;
+        }
+
+        if ((slot >> 32) == tag)
+        {
+            uint32_t     id  = (uint32_t)slot - 1;
+            const char * str = intern_dir_(intern, id);
+
+            if (intern_str_hdr_(str)->len == len && !memcmp(str, s, len))
+            {
+                return id;
+            }
+        }
+    }
+}
+
+static void
+intern_place_(struct intern_tbl * tbl, uint64_t hash, uint32_t id)
+{
+    uint64_t i;
+
+    for (i = hash & tbl->mask; tbl->slots[i] != 0; i = (i + 1) & tbl->mask)
+    {
+    }
+
+    intern_store_(&tbl->slots[i], (hash >> 32) << 32 | ((uint64_t)id + 1));
+}
+
+static struct intern_tbl *
+intern_tbl_new_(uint64_t n_slots)
+{
+    struct intern_tbl * tbl;
+
+    if (!(tbl = calloc(1, sizeof(*tbl) + n_slots * sizeof(uint64_t))))
+    {
+        return NULL;
+    }
+
+    tbl->mask = n_slots - 1;
+
+    return tbl;
+}
+
+/**
+ * @brief rehashes every string into a table twice the size, and publishes
+ *        it. Readers may still be probing the old table, which is kept
+ *        until the interning table is freed: with doubling, all of the old
+ *        tables together are never larger than the current one.
+ */
+static int
+intern_grow_(lz_intern * intern)
+{
+    struct intern_tbl * old = intern->tbl;
+    struct intern_tbl * tbl;
+    uint32_t            id;
+
+    if (!(tbl = intern_tbl_new_((old->mask + 1) * 2)))
+    {
+        return -1;
+    }
+
+    for (id = 0; id < intern->n_strings; id++)
+    {
+        const char * str = intern_dir_(intern, id);
+
+        intern_place_(tbl, intern_hash_(str, intern_str_hdr_(str)->len), id);
+    }
+
+    intern_store_(&intern->tbl, tbl);
+
+    old->retired_next = intern->retired;
+    intern->retired   = old;
+    intern->n_bytes  += sizeof(*tbl) + (tbl->mask + 1) * sizeof(uint64_t);
+
+    return 0;
+}
+
+/**
+ * @brief copies a string into the chunks
+ */
+static const char *
+intern_copy_(lz_intern * intern, const char * s, size_t len, uint32_t id)
+{
+    struct intern_chunk * chunk = intern->chunks;
+    struct intern_str   * str;
+    size_t                need  = lz_align(sizeof(struct intern_str) + len + 1, 8);
+
+    if (chunk == NULL || chunk->size - chunk->used < need)
+    {
+        size_t size = need > INTERN_CHUNK_MAX ? need : INTERN_CHUNK_SIZE;
+
+        if (!(chunk = malloc(sizeof(struct intern_chunk) + size)))
+        {
+            return NULL;
+        }
+
+        chunk->size = size;
+        chunk->used = 0;
+
+        /* a large string is put behind the chunk being filled, which keeps
+         * its room for the next strings */
+        if (size > INTERN_CHUNK_SIZE && intern->chunks != NULL)
+        {
+            chunk->next          = intern->chunks->next;
+            intern->chunks->next = chunk;
+        } else {
+            chunk->next    = intern->chunks;
+            intern->chunks = chunk;
+        }
+
+        intern->n_bytes += sizeof(struct intern_chunk) + size;
+    }
+
+    str = (struct intern_str *)(chunk->data + chunk->used);
+    str->id  = id;
+    str->len = (uint32_t)len;
+
+    memcpy(str->data, s, len);
+    str->data[len] = '\0';
+
+    chunk->used += need;
+
+    return str->data;
+}
+
+static lz_intern *
+intern_new_(size_t n_strings)
+{
+    lz_intern * intern;
+    uint64_t    n_slots;
+
+    if (!(intern = calloc(1, sizeof(lz_intern))))
+    {
+        return NULL;
+    }
+
+    for (n_slots = INTERN_MIN_SLOTS; INTERN_GROW(n_slots) < n_strings; n_slots <<= 1)
+    {
+    }
+
+    if (!(intern->tbl = intern_tbl_new_(n_slots)))
+    {
+        free(intern);
+        return NULL;
+    }
+
+    intern->n_bytes = sizeof(lz_intern) + sizeof(struct intern_tbl) + n_slots * sizeof(uint64_t);
+
+    pthread_mutex_init(&intern->lock, NULL);
+
+    return intern;
+}
+
+static void
+intern_free_(lz_intern * intern)
+{
+    uint32_t i;
+
+    if (intern == NULL)
+    {
+        return;
+    }
+
+    while (intern->chunks != NULL)
+    {
+        struct intern_chunk * chunk = intern->chunks;
+
+        intern->chunks = chunk->next;
+        free(chunk);
+    }
+
+    while (intern->retired != NULL)
+    {
+        struct intern_tbl * tbl = intern->retired;
+
+        intern->retired = tbl->retired_next;
+        free(tbl);
+    }
+
+    for (i = 0; i < INTERN_N_SEGS; i++)
+    {
+        free(intern->segs[i]);
+    }
+
+    pthread_mutex_destroy(&intern->lock);
+
+    free(intern->tbl);
+    free(intern);
+}
+
+static uint32_t
+intern_id_(lz_intern * intern, const char * s, size_t len)
+{
+    const char * str;
+    uint64_t     hash;
+    uint32_t     id;
+    uint32_t     seg;
+    uint32_t     off;
+
+    if (lz_unlikely(intern == NULL) || (s == NULL && len > 0) || len > UINT32_MAX)
+    {
+        return LZ_INTERN_ID_NONE;
+    }
+
+    hash = intern_hash_(s, len);
+
+    if ((id = intern_lookup_(intern, s, len, hash)) != LZ_INTERN_ID_NONE)
+    {
+        return id;
+    }
+
+    pthread_mutex_lock(&intern->lock);
+
+    /* another writer may have added it since, or grown the table */
+    if ((id = intern_lookup_(intern, s, len, hash)) != LZ_INTERN_ID_NONE)
+    {
+        goto end;
+    }
+
+    if ((id = intern->n_strings) == LZ_INTERN_ID_NONE)
+    {
+        goto end;
+    }
+
+    if (intern->n_strings + 1 > INTERN_GROW(intern->tbl->mask + 1) && intern_grow_(intern) == -1)
+    {
+        id = LZ_INTERN_ID_NONE;
+        goto end;
+    }
+
+    if (intern->segs[seg = intern_seg_(id, &off)] == NULL)
+    {
+        size_t        size = sizeof(const char *) << (seg + INTERN_SEG_SHIFT);
+        const char ** new;
+
+        /* zeroed: lz_intern_get_str() takes a NULL entry as not there yet */
+        if (!(new = calloc(1, size)))
+        {
+            id = LZ_INTERN_ID_NONE;
+            goto end;
+        }
+
+        intern_store_(&intern->segs[seg], new);
+        intern->n_bytes += size;
+    }
+
+    if (!(str = intern_copy_(intern, s, len, id)))
+    {
+        id = LZ_INTERN_ID_NONE;
+        goto end;
+    }
+
+    /* directory entry, slot, then count: whoever sees the slot can get the
+     * string by id, whoever sees the count can also find it by name */
+    intern_store_(&intern->segs[seg][off], str);
+    intern_place_(intern->tbl, hash, id);
+    intern_store_(&intern->n_strings, id + 1);
+end:
+    pthread_mutex_unlock(&intern->lock);
+
+    return id;
+} /* intern_id_ */
+
+static const char *
+intern_str_(lz_intern * intern, const char * s, size_t len)
+{
+    uint32_t id = intern_id_(intern, s, len);
+
+    return id != LZ_INTERN_ID_NONE ? intern_dir_(intern, id) : NULL;
+}
+
+static uint32_t
+intern_find_id_(lz_intern * intern, const char * s, size_t len)
+{
+    if (lz_unlikely(intern == NULL) || (s == NULL && len > 0))
+    {
+        return LZ_INTERN_ID_NONE;
+    }
+
+    return intern_lookup_(intern, s, len, intern_hash_(s, len));
+}
+
+static const char *
+intern_find_(lz_intern * intern, const char * s, size_t len)
+{
+    uint32_t id = intern_find_id_(intern, s, len);
+
+    return id != LZ_INTERN_ID_NONE ? intern_dir_(intern, id) : NULL;
+}
+
+static const char *
+intern_get_str_(lz_intern * intern, uint32_t id)
+{
+    const char ** seg;
+    uint32_t      off;
+
+    if (lz_unlikely(intern == NULL))
+    {
+        return NULL;
+    }
+
+    /* not checked against the count, which is published last */
+    if ((seg = intern_load_(&intern->segs[intern_seg_(id, &off)])) == NULL)
+    {
+        return NULL;
+    }
+
+    return intern_load_(&seg[off]);
+}
+
+static uint32_t
+intern_get_id_(const char * str)
+{
+    return str ? intern_str_hdr_(str)->id : LZ_INTERN_ID_NONE;
+}
+
+static size_t
+intern_get_len_(const char * str)
+{
+    return str ? intern_str_hdr_(str)->len : 0;
+}
+
+static size_t
+intern_get_size_(lz_intern * intern)
+{
+    return intern ? intern_load_(&intern->n_strings) : 0;
+}
+
+static size_t
+intern_get_bytes_(lz_intern * intern)
+{
+    size_t n_bytes;
+
+    if (intern == NULL)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&intern->lock);
+    n_bytes = intern->n_bytes;
+    pthread_mutex_unlock(&intern->lock);
+
+    return n_bytes;
+}
+
+lz_alias(intern_new_, lz_intern_new);
+lz_alias(intern_free_, lz_intern_free);
+lz_alias(intern_str_, lz_intern_str);
+lz_alias(intern_id_, lz_intern_id);
+lz_alias(intern_find_, lz_intern_find);
+lz_alias(intern_find_id_, lz_intern_find_id);
+lz_alias(intern_get_str_, lz_intern_get_str);
+lz_alias(intern_get_id_, lz_intern_get_id);
+lz_alias(intern_get_len_, lz_intern_get_len);
+lz_alias(intern_get_size_, lz_intern_get_size);
+lz_alias(intern_get_bytes_, lz_intern_get_bytes);
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <liblz.h>
+
+/*
+ * lz_intern: a string interning table.
+ *
+ * Interning a string returns the one stored copy of it, so that two interned
+ * strings are equal exactly when their pointers (or ids) are. Each string
+ * also gets a dense 32-bit id, numbered from 0 in the order strings were
+ * first interned, for tables that would rather store 4 bytes than a pointer.
+ *
+ * Strings are never removed: their bytes are packed one after the other in
+ * large append-only chunks, and stay valid and at the same address until
+ * lz_intern_free(). They are hashed with lz_kvmap_hash64().
+ *
+ * Lookups (lz_intern_find*, lz_intern_get_str) take no lock and may run on
+ * any number of threads while other threads intern new strings. Interning
+ * itself looks the string up first, and only takes the writer lock when the
+ * string is new. A new string can be found by name and by id before
+ * lz_intern_get_size() counts it, so every id below the size is there.
+ */
+
+#define LZ_INTERN_ID_NONE UINT32_MAX
+
+struct lz_intern_s;
+
+typedef struct lz_intern_s lz_intern;
+
+
+/**
+ * @brief creates a new interning table
+ *
+ * @param n_strings the number of strings expected, the table grows past it
+ *
+ * @return NULL on error
+ */
+LZ_EXPORT lz_intern * lz_intern_new(size_t n_strings);
+
+
+/**
+ * @brief frees the table and every string in it. No other thread may be
+ *        using the table.
+ */
+LZ_EXPORT void lz_intern_free(lz_intern * intern);
+
+
+/**
+ * @brief interns len bytes of s. The stored copy is NUL terminated, s does
+ *        not have to be.
+ *
+ * @return the stored copy, NULL on error
+ */
+LZ_EXPORT const char * lz_intern_str(lz_intern * intern, const char * s, size_t len);
+
+
+/**
+ * @brief lz_intern_str(), returning the id of the string
+ *
+ * @return the id, LZ_INTERN_ID_NONE on error
+ */
+LZ_EXPORT uint32_t lz_intern_id(lz_intern * intern, const char * s, size_t len);
+
+
+/**
+ * @brief looks up a string without interning it
+ *
+ * @return the stored copy, NULL if the string was never interned
+ */
+LZ_EXPORT const char * lz_intern_find(lz_intern * intern, const char * s, size_t len);
+
+/**
+ * @return the id of the string, LZ_INTERN_ID_NONE if it was never interned
+ */
+LZ_EXPORT uint32_t lz_intern_find_id(lz_intern * intern, const char * s, size_t len);
+
+
+/**
+ * @return the string with this id, NULL if there is none
+ */
+LZ_EXPORT const char * lz_intern_get_str(lz_intern * intern, uint32_t id);
+
+
+/**
+ * @brief the id and length of an interned string, read from just in front of
+ *        it. str must have been returned by this API.
+ */
+LZ_EXPORT uint32_t lz_intern_get_id(const char * str);
+LZ_EXPORT size_t   lz_intern_get_len(const char * str);
+
+/**
+ * @return the number of strings interned
+ */
+LZ_EXPORT size_t lz_intern_get_size(lz_intern * intern);
+
+/**
+ * @return the bytes held by the table: chunks, slots and the id directory
+ */
+LZ_EXPORT size_t lz_intern_get_bytes(lz_intern * intern);
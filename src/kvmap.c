@@ -3,115 +3,1375 @@
 #include <string.h>
 #include <stdint.h>
 #include <errno.h>
-#include <sys/queue.h>
 #include <assert.h>
+#include <time.h>
 
-#include "lzapi.h"
-#include "kvmap.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+static inline uint32_t _wy_hash(const char * data, size_t len);
+static inline uint32_t _fnv_hash(const char * data, size_t len);
+static inline uint32_t _crc32_hash(const char * data, size_t len);
+static inline uint32_t _murmur_hash2(const char * data, size_t len);
+static uint32_t        _jenkins_hash(const char * data, size_t len);
+static inline uint32_t _djb2_hash(const char * key, size_t len);
+
+static const lz_kvmap_hashfn _lz_kvmap_hashfns[] = {
+    [LZ_KVMAP_HASH_DEFAULT] = _wy_hash,
+    [LZ_KVMAP_HASH_WY]      = _wy_hash,
+    [LZ_KVMAP_HASH_FNV]     = _fnv_hash,
+    [LZ_KVMAP_HASH_CRC32]   = _crc32_hash,
+    [LZ_KVMAP_HASH_MURMUR2] = _murmur_hash2,
+    [LZ_KVMAP_HASH_JENKINS] = _jenkins_hash,
+    [LZ_KVMAP_HASH_DJB2]    = _djb2_hash,
+};
+
+struct lz_kvmap_ent_s {
+    uint32_t       hash;
+    uint32_t       didx;   /* position in the map's dense array */
+    uint32_t       tidx;   /* position in the map's ttl heap, or LZ_KVMAP_NO_TTL */
+    void           (* freefn)(void *);
+    lz_kvmap_ent * next;
+    lz_kvmap_ent * prev;
+    lz_kvmap     * map;
+
+    size_t klen;
+    void * val;
+    char   key[];
+};
+
+/* open addressing: slots per probe group */
+#define LZ_KVMAP_GROUP 16
+
+/*
+ * open addressing (LZ_KVMAP_F_OPEN) slots are probed in groups of 16. Each
+ * slot has one control byte: the top 7 bits of the hash for a used slot, or
+ * one of the EMPTY / DELETED markers, so a whole group can be matched with a
+ * single SSE2 compare. The control bytes sit right in front of the slots they
+ * describe so a probe usually stays within the same couple of cache lines.
+ */
+struct lz_kvmap_group {
+    uint8_t        ctrl[LZ_KVMAP_GROUP];
+    lz_kvmap_ent * ents[LZ_KVMAP_GROUP];
+};
+
+/*
+ * a single bucket array; while a resize is in progress the map holds two of
+ * these and entries are migrated from tbls[0] to tbls[1] a few buckets at a
+ * time by _lz_kvmap_rehash_step(). Chained maps use `ents` as the bucket
+ * heads, open addressing maps use `groups` instead.
+ */
+struct lz_kvmap_tbl {
+    uint32_t                n_buckets;
+    uint32_t                n_used; /* open: slots that are not EMPTY */
+    lz_kvmap_ent         ** ents;
+    struct lz_kvmap_group * groups;
+};
+
+/*
+ * LZ_KVMAP_F_ARENA maps carve entries (and their inline keys) out of these
+ * instead of calling malloc for each one.
+ */
+struct lz_kvmap_slab {
+    struct lz_kvmap_slab * next;
+    size_t                 size;
+    size_t                 used;
+    char                   data[] __attribute__((aligned(sizeof(void *))));
+};
+
+struct lz_kvmap_s {
+    int                 flags;
+    lz_kvmap_hashfn     hashfn;
+    uint32_t            n_entries;
+    uint32_t            min_buckets; /* never shrink below what the user asked for */
+    int64_t             rehash_idx;  /* next tbls[0] bucket (or group) to migrate, -1 if idle */
+    struct lz_kvmap_tbl tbls[2];
+
+    /*
+     * every entry in insertion order. Removing an entry leaves a NULL hole
+     * behind, which keeps removal O(1); the holes are squeezed out once they
+     * make up most of the array.
+     */
+    lz_kvmap_ent ** dense;
+    uint32_t        n_dense;     /* used slots, including holes */
+    uint32_t        dense_size;  /* allocated slots */
+    uint32_t        n_holes;
+    uint32_t        iterating;   /* lz_kvmap_for_each depth, holds off compaction */
+
+    /*
+     * bumped whenever entries move within the dense array. dense_moved is
+     * how far down the last compaction moved any entry (UINT32_MAX when the
+     * array was emptied), which lets a lz_kvmap_scan() cursor from the
+     * previous generation rewind just far enough not to miss anything.
+     */
+    uint32_t        dense_gen;
+    uint32_t        dense_moved;
+
+    /*
+     * arena mode: the current slab is at the head of the list. n_freefn counts
+     * the entries with a value to release, when it is zero clearing the map
+     * does not need to look at the entries at all.
+     */
+    struct lz_kvmap_slab * slabs;
+    uint32_t               n_freefn;
+
+    /*
+     * entries with a ttl, as a binary min-heap on their expiry time so the
+     * next entry to expire is always ttls[0].
+     */
+    struct lz_kvmap_ttl * ttls;
+    uint32_t              n_ttls;
+    uint32_t              ttls_size;
+    lz_kvmap_clockfn      clockfn;
+    void                * clockarg;
+
+    /* optional negative lookup filter, see lz_kvmap_filter_enable() */
+    struct lz_kvmap_filter * filter;
+
+    /* resizes started, by kind, and the LZ_KVMAP_STATS counters */
+    uint32_t                 n_grows;
+    uint32_t                 n_shrinks;
+    uint32_t                 n_purges;
+    struct lz_kvmap_counters counters;
+};
+
+struct lz_kvmap_ttl {
+    uint64_t       expire;
+    lz_kvmap_ent * ent;
+};
+
+#define LZ_KVMAP_NO_TTL UINT32_MAX
+
+/*
+ * blocked bloom filter: each key sets all of its bits within a single 512 bit
+ * block, so a lookup costs one cache line however many bits are tested.
+ * Filters cannot forget keys; removed ones are counted as stale and the
+ * filter is rebuilt from the dense array once they pile up.
+ */
+#define LZ_KVMAP_FILTER_BLOCK_WORDS 8
+
+struct lz_kvmap_filter {
+    uint64_t * blocks;
+    uint32_t   n_blocks;
+    uint32_t   n_hashes;
+    uint32_t   capacity;  /* keys it was sized for */
+    uint32_t   n_keys;    /* keys added since it was built, stale ones included */
+    uint32_t   n_stale;
+    double     fp_rate;
+    size_t     max_bytes;
+
+    uint64_t   negatives;
+    uint64_t   positives;
+    uint64_t   false_positives;
+};
+
+/* grow once the average chain holds more than one entry */
+#define LZ_KVMAP_GROW_LOAD    1
+/* shrink once less than 1/8th of the buckets would be in use */
+#define LZ_KVMAP_SHRINK_LOAD  8
+/* number of non-empty buckets migrated per add/find/remove */
+#define LZ_KVMAP_REHASH_STEP  1
+/* upper bound of empty buckets skipped per migrated bucket */
+#define LZ_KVMAP_REHASH_SKIP  10
+
+/* arena mode: slab size, and the largest entry carved from a shared slab */
+#define LZ_KVMAP_SLAB_SIZE    (64 * 1024)
+#define LZ_KVMAP_SLAB_MAX_ENT (LZ_KVMAP_SLAB_SIZE / 4)
+
+/* initial dense array size */
+#define LZ_KVMAP_DENSE_MIN    16
+
+/* open addressing: the max fill (7/8) */
+#define LZ_KVMAP_OPEN_LOAD(n) ((n) - ((n) >> 3))
+
+#define LZ_KVMAP_CTRL_EMPTY   ((uint8_t)0x80)
+#define LZ_KVMAP_CTRL_DELETED ((uint8_t)0xfe)
+
+#define _lz_kvmap_h2(hash)       ((uint8_t)((hash) >> 25))
+#define _lz_kvmap_is_open(map)   ((map)->flags & LZ_KVMAP_F_OPEN)
+#define _lz_kvmap_is_arena(map)  ((map)->flags & LZ_KVMAP_F_ARENA)
+#define _lz_kvmap_is_alloc(map)  ((map)->flags & LZ_KVMAP_F_ALLOC)
+#define _lz_kvmap_is_rehashing(map) ((map)->rehash_idx != -1)
+
+#ifdef LZ_KVMAP_STATS
+#define _lz_kvmap_count(map, counter, n) ((map)->counters.counter += (n))
+#else
+#define _lz_kvmap_count(map, counter, n) ((void)(map))
+#endif
+
+/* keys are compared as length + bytes, so they may contain NULs */
+#define _lz_kvmap_ent_eq(ent, k, kl, h) \
+    ((ent)->hash == (h) && (ent)->klen == (kl) && memcmp((ent)->key, (k), (kl)) == 0)
+
+/* the default hash is called directly so it can be inlined */
+#define _lz_kvmap_hash(map, key, klen)                   \
+    (lz_likely((map)->hashfn == _wy_hash) ?              \
+     _wy_hash((key), (klen)) : (map)->hashfn((key), (klen)))
+
+static inline uint32_t
+_align_buckets(uint32_t n) {
+    if (n <= 1) {
+        return 1;
+    }
+
+    return 1 << ((sizeof(n) * 8) - __builtin_clz(n - 1));
+}
+
+/*
+ * group matching: each returns a bitmask with bit `i` set if slot `i` of the
+ * 16 slot group starting at `ctrl` satisfies the test.
+ */
+#ifdef __SSE2__
+static inline uint32_t
+_lz_kvmap_group_match(const uint8_t * ctrl, uint8_t h2) {
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)h2)));
+}
+
+/* EMPTY and DELETED are the only control bytes with the high bit set */
+static inline uint32_t
+_lz_kvmap_group_match_free(const uint8_t * ctrl) {
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+}
+
+#else
+static inline uint32_t
+_lz_kvmap_group_match(const uint8_t * ctrl, uint8_t h2) {
+    uint32_t mask = 0;
+    int      i;
+
+    for (i = 0; i < LZ_KVMAP_GROUP; i++) {
+        mask |= (uint32_t)(ctrl[i] == h2) << i;
+    }
+
+    return mask;
+}
+
+static inline uint32_t
+_lz_kvmap_group_match_free(const uint8_t * ctrl) {
+    uint32_t mask = 0;
+    int      i;
+
+    for (i = 0; i < LZ_KVMAP_GROUP; i++) {
+        mask |= (uint32_t)(ctrl[i] >> 7) << i;
+    }
+
+    return mask;
+}
+
+#endif
+
+#define _lz_kvmap_group_match_empty(ctrl) \
+    _lz_kvmap_group_match(ctrl, LZ_KVMAP_CTRL_EMPTY)
+
+#define _lz_kvmap_group_match_full(ctrl) \
+    (~_lz_kvmap_group_match_free(ctrl) & 0xffff)
+
+/*
+ * groups are probed quadratically (g, g+1, g+3, g+6, ...) which visits every
+ * group of a power of two sized table exactly once.
+ */
+#define _lz_kvmap_for_each_group(tbl, hash, g, i)                                    \
+    for ((i) = 0, (g) = (hash) & ((tbl)->n_buckets / LZ_KVMAP_GROUP - 1);            \
+         (i) < (tbl)->n_buckets / LZ_KVMAP_GROUP;                                    \
+         (i)++, (g) = ((g) + (i)) & ((tbl)->n_buckets / LZ_KVMAP_GROUP - 1))
+
+static void
+_lz_kvmap_groups_clear(struct lz_kvmap_group * groups, uint32_t n_groups) {
+    uint32_t i;
+
+    for (i = 0; i < n_groups; i++) {
+        memset(groups[i].ctrl, LZ_KVMAP_CTRL_EMPTY, LZ_KVMAP_GROUP);
+        memset(groups[i].ents, 0, sizeof(groups[i].ents));
+    }
+}
+
+static int
+_lz_kvmap_tbl_init(lz_kvmap * map, struct lz_kvmap_tbl * tbl, uint32_t n_buckets) {
+    memset(tbl, 0, sizeof(*tbl));
+
+    if (!_lz_kvmap_is_open(map)) {
+        if (!(tbl->ents = calloc(sizeof(lz_kvmap_ent *), n_buckets))) {
+            return -1;
+        }
+    } else {
+        uint32_t n_groups = n_buckets / LZ_KVMAP_GROUP;
+
+        if (!(tbl->groups = malloc(sizeof(struct lz_kvmap_group) * n_groups))) {
+            return -1;
+        }
+
+        _lz_kvmap_groups_clear(tbl->groups, n_groups);
+    }
+
+    tbl->n_buckets = n_buckets;
+
+    return 0;
+}
+
+static void
+_lz_kvmap_tbl_reset(struct lz_kvmap_tbl * tbl) {
+    free(tbl->ents);
+    free(tbl->groups);
+
+    memset(tbl, 0, sizeof(*tbl));
+}
+
+#define LZ_KVMAP_NO_SLOT UINT32_MAX
+
+/**
+ * @brief probes for `key`; if `ins` is not NULL it is set to the first free
+ *        slot (group * 16 + slot) seen on the way, so a miss can be followed
+ *        by an insert without probing again.
+ */
+static lz_kvmap_ent *
+_lz_kvmap_open_find(lz_kvmap * map, struct lz_kvmap_tbl * tbl, const char * key, size_t klen,
+                    uint32_t hash, uint32_t * ins) {
+    uint8_t  h2 = _lz_kvmap_h2(hash);
+    uint32_t g;
+    uint32_t i;
+
+    if (ins != NULL) {
+        *ins = LZ_KVMAP_NO_SLOT;
+    }
+
+    _lz_kvmap_for_each_group(tbl, hash, g, i) {
+        struct lz_kvmap_group * group = &tbl->groups[g];
+        uint32_t                mask  = _lz_kvmap_group_match(group->ctrl, h2);
+
+        _lz_kvmap_count(map, probes, 1);
+
+        if (ins != NULL && *ins == LZ_KVMAP_NO_SLOT) {
+            uint32_t free_mask = _lz_kvmap_group_match_free(group->ctrl);
+
+            if (free_mask) {
+                *ins = g * LZ_KVMAP_GROUP + __builtin_ctz(free_mask);
+            }
+        }
+
+        while (mask) {
+            lz_kvmap_ent * ent = group->ents[__builtin_ctz(mask)];
+
+            if (_lz_kvmap_ent_eq(ent, key, klen, hash)) {
+                return ent;
+            }
+
+            mask &= mask - 1;
+        }
+
+        /* an EMPTY slot terminates the probe sequence */
+        if (_lz_kvmap_group_match_empty(group->ctrl)) {
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+static inline void
+_lz_kvmap_open_place(struct lz_kvmap_tbl * tbl, uint32_t idx, lz_kvmap_ent * ent) {
+    struct lz_kvmap_group * group = &tbl->groups[idx / LZ_KVMAP_GROUP];
+    uint32_t                slot  = idx % LZ_KVMAP_GROUP;
+
+    if (group->ctrl[slot] == LZ_KVMAP_CTRL_EMPTY) {
+        tbl->n_used += 1;
+    }
+
+    group->ctrl[slot] = _lz_kvmap_h2(ent->hash);
+    group->ents[slot] = ent;
+}
+
+static int
+_lz_kvmap_open_insert(struct lz_kvmap_tbl * tbl, lz_kvmap_ent * ent) {
+    uint32_t g;
+    uint32_t i;
+
+    _lz_kvmap_for_each_group(tbl, ent->hash, g, i) {
+        uint32_t mask = _lz_kvmap_group_match_free(tbl->groups[g].ctrl);
+
+        if (mask == 0) {
+            continue;
+        }
+
+        _lz_kvmap_open_place(tbl, g * LZ_KVMAP_GROUP + __builtin_ctz(mask), ent);
+
+        return 0;
+    }
+
+    return -1;
+}
+
+static int
+_lz_kvmap_open_unlink(struct lz_kvmap_tbl * tbl, lz_kvmap_ent * ent) {
+    uint8_t  h2 = _lz_kvmap_h2(ent->hash);
+    uint32_t g;
+    uint32_t i;
+
+    _lz_kvmap_for_each_group(tbl, ent->hash, g, i) {
+        struct lz_kvmap_group * group = &tbl->groups[g];
+        uint32_t                mask  = _lz_kvmap_group_match(group->ctrl, h2);
+
+        while (mask) {
+            uint32_t slot = __builtin_ctz(mask);
+
+            if (group->ents[slot] == ent) {
+                group->ents[slot] = NULL;
+
+                /*
+                 * if the group still has an EMPTY slot no probe sequence can
+                 * run through it, so this slot can become EMPTY again rather
+                 * than leaving a tombstone behind.
+                 */
+                if (_lz_kvmap_group_match_empty(group->ctrl)) {
+                    group->ctrl[slot] = LZ_KVMAP_CTRL_EMPTY;
+                    tbl->n_used      -= 1;
+                } else {
+                    group->ctrl[slot] = LZ_KVMAP_CTRL_DELETED;
+                }
+
+                return 0;
+            }
+
+            mask &= mask - 1;
+        }
+
+        if (_lz_kvmap_group_match_empty(group->ctrl)) {
+            return -1;
+        }
+    }
+
+    return -1;
+} /* _lz_kvmap_open_unlink */
+
+static inline lz_kvmap_ent *
+_lz_kvmap_chain_find(lz_kvmap * map, struct lz_kvmap_tbl * tbl, const char * key, size_t klen, uint32_t hash) {
+    lz_kvmap_ent * ent;
+
+    ent = tbl->ents[hash & (tbl->n_buckets - 1)];
+
+    while (ent != NULL) {
+        _lz_kvmap_count(map, probes, 1);
+
+        if (_lz_kvmap_ent_eq(ent, key, klen, hash)) {
+            return ent;
+        }
+
+        ent = ent->next;
+    }
+
+    return NULL;
+}
+
+static inline void
+_lz_kvmap_chain_insert(struct lz_kvmap_tbl * tbl, lz_kvmap_ent * ent) {
+    uint32_t bucket = ent->hash & (tbl->n_buckets - 1);
+
+    ent->prev = NULL;
+    ent->next = tbl->ents[bucket];
+
+    if (ent->next != NULL) {
+        ent->next->prev = ent;
+    }
+
+    tbl->ents[bucket] = ent;
+}
+
+static inline lz_kvmap_ent *
+_lz_kvmap_tbl_find(lz_kvmap * map, struct lz_kvmap_tbl * tbl,
+                   const char * key, size_t klen, uint32_t hash) {
+    if (_lz_kvmap_is_open(map)) {
+        return _lz_kvmap_open_find(map, tbl, key, klen, hash, NULL);
+    }
+
+    return _lz_kvmap_chain_find(map, tbl, key, klen, hash);
+}
+
+/**
+ * @brief migrates up to `n` non-empty buckets from the old table into the
+ *        new one, and swaps the tables once the old one has been drained.
+ *        For open addressing maps a "bucket" is a group of 16 slots.
+ */
+static void
+_lz_kvmap_rehash_step(lz_kvmap * map, int n) {
+    struct lz_kvmap_tbl * old;
+    struct lz_kvmap_tbl * new;
+    uint32_t              n_units;
+    int                   empty_visits;
+
+    if (!_lz_kvmap_is_rehashing(map)) {
+        return;
+    }
+
+    old          = &map->tbls[0];
+    new          = &map->tbls[1];
+    n_units      = _lz_kvmap_is_open(map) ? old->n_buckets / LZ_KVMAP_GROUP : old->n_buckets;
+    empty_visits = n * LZ_KVMAP_REHASH_SKIP;
+
+    while (n-- > 0 && map->rehash_idx < n_units) {
+        if (_lz_kvmap_is_open(map)) {
+            struct lz_kvmap_group * group;
+            uint32_t                mask;
+
+            while (1) {
+                group = &old->groups[map->rehash_idx];
+
+                if ((mask = _lz_kvmap_group_match_full(group->ctrl))) {
+                    break;
+                }
+
+                map->rehash_idx += 1;
+
+                if (map->rehash_idx == n_units || --empty_visits == 0) {
+                    goto done;
+                }
+            }
+
+            while (mask) {
+                uint32_t slot = __builtin_ctz(mask);
+
+                /*
+                 * the new table is always sized so this cannot fail; the old
+                 * slot becomes a tombstone so probe sequences that run through
+                 * this group in the old table are left intact.
+                 */
+                _lz_kvmap_open_insert(new, group->ents[slot]);
+
+                group->ents[slot] = NULL;
+                group->ctrl[slot] = LZ_KVMAP_CTRL_DELETED;
+                mask             &= mask - 1;
+            }
+        } else {
+            lz_kvmap_ent * ent;
+            lz_kvmap_ent * save;
+
+            while (old->ents[map->rehash_idx] == NULL) {
+                map->rehash_idx += 1;
+
+                if (map->rehash_idx == n_units || --empty_visits == 0) {
+                    goto done;
+                }
+            }
+
+            for (ent = old->ents[map->rehash_idx]; ent; ent = save) {
+                save = ent->next;
+
+                _lz_kvmap_chain_insert(new, ent);
+            }
+
+            old->ents[map->rehash_idx] = NULL;
+        }
+
+        map->rehash_idx += 1;
+    }
+
+done:
+    if (map->rehash_idx < n_units) {
+        return;
+    }
+
+    free(old->ents);
+    free(old->groups);
+
+    map->tbls[0]    = map->tbls[1];
+    map->rehash_idx = -1;
+
+    memset(&map->tbls[1], 0, sizeof(map->tbls[1]));
+} /* _lz_kvmap_rehash_step */
+
+/**
+ * @brief starts an incremental resize into a table of `n_buckets`. If the new
+ *        table cannot be allocated the map simply keeps its current size.
+ */
+static void
+_lz_kvmap_resize(lz_kvmap * map, uint32_t n_buckets) {
+    if (_lz_kvmap_is_rehashing(map)) {
+        return;
+    }
+
+    if (_lz_kvmap_tbl_init(map, &map->tbls[1], n_buckets) == -1) {
+        return;
+    }
+
+    if (n_buckets > map->tbls[0].n_buckets) {
+        map->n_grows += 1;
+    } else if (n_buckets < map->tbls[0].n_buckets) {
+        map->n_shrinks += 1;
+    } else {
+        map->n_purges += 1;
+    }
+
+    map->rehash_idx = 0;
+}
+
+static inline void
+_lz_kvmap_check_grow(lz_kvmap * map) {
+    struct lz_kvmap_tbl * tbl;
+
+    if (!_lz_kvmap_is_open(map)) {
+        if (_lz_kvmap_is_rehashing(map)) {
+            return;
+        }
+
+        if (map->n_entries > map->tbls[0].n_buckets * LZ_KVMAP_GROW_LOAD) {
+            _lz_kvmap_resize(map, map->tbls[0].n_buckets * 2);
+        }
+
+        return;
+    }
+
+    /*
+     * an open addressing table must never fill up. The new table of a resize
+     * is sized to outlast the migration, but if it does fill first, finish
+     * the migration now so another resize can be started.
+     */
+    if (_lz_kvmap_is_rehashing(map)) {
+        if (map->tbls[1].n_used < LZ_KVMAP_OPEN_LOAD(map->tbls[1].n_buckets)) {
+            return;
+        }
+
+        while (_lz_kvmap_is_rehashing(map)) {
+            _lz_kvmap_rehash_step(map, LZ_KVMAP_GROUP);
+        }
+    }
+
+    tbl = &map->tbls[0];
+
+    if (tbl->n_used < LZ_KVMAP_OPEN_LOAD(tbl->n_buckets)) {
+        return;
+    }
+
+    /* mostly tombstones: rebuild at the same size to purge them */
+    if (map->n_entries <= LZ_KVMAP_OPEN_LOAD(tbl->n_buckets) / 2) {
+        _lz_kvmap_resize(map, tbl->n_buckets);
+    } else {
+        _lz_kvmap_resize(map, tbl->n_buckets * 2);
+    }
+} /* _lz_kvmap_check_grow */
+
+static inline void
+_lz_kvmap_check_shrink(lz_kvmap * map) {
+    uint32_t n_buckets;
+
+    if (_lz_kvmap_is_rehashing(map)) {
+        return;
+    }
+
+    n_buckets = map->tbls[0].n_buckets;
+
+    if (n_buckets <= map->min_buckets) {
+        return;
+    }
+
+    if (map->n_entries >= n_buckets / LZ_KVMAP_SHRINK_LOAD) {
+        return;
+    }
+
+    n_buckets = _align_buckets(map->n_entries * 2);
+
+    if (n_buckets < map->min_buckets) {
+        n_buckets = map->min_buckets;
+    }
+
+    _lz_kvmap_resize(map, n_buckets);
+}
+
+inline lz_kvmap *
+lz_kvmap_new_with_hash(uint32_t n_buckets, int flags,
+                       enum lz_kvmap_hash_type type, lz_kvmap_hashfn hashfn) {
+    lz_kvmap * map;
+
+    if (type == LZ_KVMAP_HASH_CUSTOM) {
+        if (hashfn == NULL) {
+            return NULL;
+        }
+    } else if ((int)type < 0 || type > LZ_KVMAP_HASH_CUSTOM) {
+        return NULL;
+    } else {
+        hashfn = _lz_kvmap_hashfns[type];
+    }
+
+    if (!(map = malloc(sizeof(lz_kvmap)))) {
+        return NULL;
+    }
+
+    if (flags & LZ_KVMAP_F_OPEN) {
+        /* `n_buckets` is the expected entry count, size for a 7/8th fill */
+        n_buckets += n_buckets / 7;
+
+        if (n_buckets < LZ_KVMAP_GROUP) {
+            n_buckets = LZ_KVMAP_GROUP;
+        }
+    }
+
+    n_buckets        = _align_buckets(n_buckets);
+
+    map->flags       = flags;
+    map->hashfn      = hashfn;
+    map->n_entries   = 0;
+    map->min_buckets = n_buckets;
+    map->rehash_idx  = -1;
+
+    memset(map->tbls, 0, sizeof(map->tbls));
+
+    map->dense       = NULL;
+    map->n_dense     = 0;
+    map->dense_size  = 0;
+    map->n_holes     = 0;
+    map->iterating   = 0;
+    map->dense_gen   = 0;
+    map->dense_moved = 0;
+    map->slabs       = NULL;
+    map->n_freefn    = 0;
+    map->ttls        = NULL;
+    map->n_ttls      = 0;
+    map->ttls_size   = 0;
+    map->clockfn     = NULL;
+    map->clockarg    = NULL;
+    map->filter      = NULL;
+    map->n_grows     = 0;
+    map->n_shrinks   = 0;
+    map->n_purges    = 0;
+
+    memset(&map->counters, 0, sizeof(map->counters));
+
+    if (_lz_kvmap_tbl_init(map, &map->tbls[0], n_buckets) == -1) {
+        free(map);
+        return NULL;
+    }
+
+    return map;
+}
+
+inline lz_kvmap *
+lz_kvmap_new_flags(uint32_t n_buckets, int flags) {
+    return lz_kvmap_new_with_hash(n_buckets, flags, LZ_KVMAP_HASH_DEFAULT, NULL);
+}
+
+inline lz_kvmap *
+lz_kvmap_new(uint32_t n_buckets) {
+    return lz_kvmap_new_flags(n_buckets, 0);
+}
+
+static void *
+_lz_kvmap_arena_alloc(lz_kvmap * map, size_t size) {
+    struct lz_kvmap_slab * slab;
+    size_t                 slab_size;
+
+    size = lz_align(size, sizeof(void *));
+    slab = map->slabs;
+
+    if (lz_likely(slab != NULL && slab->size - slab->used >= size)) {
+        void * p = slab->data + slab->used;
+
+        slab->used += size;
+
+        return p;
+    }
+
+    /*
+     * large entries get a slab of their own, which goes behind the current
+     * one so its free space is not abandoned.
+     */
+    slab_size = size > LZ_KVMAP_SLAB_MAX_ENT ? size : LZ_KVMAP_SLAB_SIZE;
+
+    if (!(slab = malloc(sizeof(struct lz_kvmap_slab) + slab_size))) {
+        return NULL;
+    }
+
+    slab->size = slab_size;
+    slab->used = size;
+
+    if (slab_size == size && map->slabs != NULL) {
+        slab->next       = map->slabs->next;
+        map->slabs->next = slab;
+    } else {
+        slab->next       = map->slabs;
+        map->slabs       = slab;
+    }
+
+    return slab->data;
+} /* _lz_kvmap_arena_alloc */
+
+/**
+ * @brief releases the map's slabs. With keep_one the current slab is kept
+ *        and rewound so the next batch of entries reuses it.
+ */
+static void
+_lz_kvmap_arena_reset(lz_kvmap * map, int keep_one) {
+    struct lz_kvmap_slab * slab;
+    struct lz_kvmap_slab * save;
+
+    if (map->slabs == NULL) {
+        return;
+    }
+
+    slab = keep_one ? map->slabs->next : map->slabs;
+
+    for (; slab != NULL; slab = save) {
+        save = slab->next;
+        free(slab);
+    }
+
+    if (keep_one && map->slabs->size == LZ_KVMAP_SLAB_SIZE) {
+        map->slabs->next = NULL;
+        map->slabs->used = 0;
+    } else {
+        if (keep_one) {
+            free(map->slabs);
+        }
+
+        map->slabs = NULL;
+    }
+}
+
+static inline void
+_lz_kvmap_ent_free(lz_kvmap_ent * ent) {
+    if (lz_unlikely(ent == NULL)) {
+        return;
+    }
+
+    if (ent->freefn) {
+        (ent->freefn)(ent->val);
+    }
+
+    /* arena entries are released with their slab */
+    if (_lz_kvmap_is_arena(ent->map)) {
+        return;
+    }
+
+    if (_lz_kvmap_is_alloc(ent->map)) {
+        lz_free(ent, sizeof(lz_kvmap_ent) + ent->klen + 1);
+    } else {
+        free(ent);
+    }
+}
+
+static inline void
+_lz_kvmap_ent_set_freefn(lz_kvmap_ent * ent, void (* freefn)(void *)) {
+    ent->map->n_freefn += (freefn != NULL) - (ent->freefn != NULL);
+    ent->freefn         = freefn;
+}
+
+/**
+ * @brief squeezes the holes out of the dense array. Entries keep their
+ *        relative order, so a lz_kvmap_first()/next() walk carries on from
+ *        the right place.
+ */
+static void
+_lz_kvmap_dense_compact(lz_kvmap * map) {
+    uint32_t i;
+    uint32_t n;
+
+    for (i = 0, n = 0; i < map->n_dense; i++) {
+        lz_kvmap_ent * ent = map->dense[i];
+
+        if (ent == NULL) {
+            continue;
+        }
+
+        ent->didx       = n;
+        map->dense[n++] = ent;
+    }
+
+    map->dense_moved = map->n_dense - n;
+    map->dense_gen  += 1;
+    map->n_dense     = n;
+    map->n_holes     = 0;
+}
+
+static inline void
+_lz_kvmap_dense_append(lz_kvmap * map, lz_kvmap_ent * ent) {
+    if (lz_unlikely(map->n_dense == map->dense_size)) {
+        if (map->n_holes >= map->n_dense / 2 && !map->iterating) {
+            _lz_kvmap_dense_compact(map);
+        }
+
+        if (map->n_dense == map->dense_size) {
+            uint32_t        size  = map->dense_size ? map->dense_size * 2 : LZ_KVMAP_DENSE_MIN;
+            lz_kvmap_ent ** dense = realloc(map->dense, sizeof(lz_kvmap_ent *) * size);
+
+            lz_alloc_assert(dense);
+
+            map->dense      = dense;
+            map->dense_size = size;
+        }
+    }
+
+    ent->map                   = map;
+    ent->didx                  = map->n_dense;
+    map->dense[map->n_dense++] = ent;
+}
+
+static inline void
+_lz_kvmap_dense_remove(lz_kvmap * map, lz_kvmap_ent * ent) {
+    map->dense[ent->didx] = NULL;
+    map->n_holes         += 1;
+
+    /* trailing holes can simply be dropped */
+    while (map->n_dense > 0 && map->dense[map->n_dense - 1] == NULL) {
+        map->n_dense -= 1;
+        map->n_holes -= 1;
+    }
+
+    if (map->n_holes > LZ_KVMAP_DENSE_MIN && map->n_holes > map->n_dense - map->n_dense / 4 &&
+        !map->iterating) {
+        _lz_kvmap_dense_compact(map);
+    }
+}
+
+static inline uint64_t *
+_lz_kvmap_filter_block(struct lz_kvmap_filter * filter, uint32_t hash, uint32_t * h1, uint32_t * h2) {
+    /* remix: the map only relies on the low bits of weaker hashes */
+    uint64_t h = (uint64_t)hash * 0x9e3779b97f4a7c15ULL;
+    uint64_t g = (h ^ (h >> 29)) * 0xbf58476d1ce4e5b9ULL;
+
+    *h1 = (uint32_t)h;
+    *h2 = (uint32_t)(g >> 32) | 1;
+
+    return &filter->blocks[(((h >> 32) * filter->n_blocks) >> 32) * LZ_KVMAP_FILTER_BLOCK_WORDS];
+}
+
+static inline void
+_lz_kvmap_filter_add(struct lz_kvmap_filter * filter, uint32_t hash) {
+    uint64_t * block;
+    uint32_t   h1;
+    uint32_t   h2;
+    uint32_t   i;
+
+    block = _lz_kvmap_filter_block(filter, hash, &h1, &h2);
+
+    for (i = 0; i < filter->n_hashes; i++, h1 += h2) {
+        block[h1 >> 29] |= 1ULL << ((h1 >> 23) & 63);
+    }
+
+    filter->n_keys += 1;
+}
+
+static inline int
+_lz_kvmap_filter_check(struct lz_kvmap_filter * filter, uint32_t hash) {
+    uint64_t * block;
+    uint32_t   h1;
+    uint32_t   h2;
+    uint32_t   i;
+
+    block = _lz_kvmap_filter_block(filter, hash, &h1, &h2);
+
+    for (i = 0; i < filter->n_hashes; i++, h1 += h2) {
+        if (!(block[h1 >> 29] & (1ULL << ((h1 >> 23) & 63)))) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief (re)builds the filter for `capacity` keys from the entries in the
+ *        map. If the new bit array cannot be allocated the old one is kept,
+ *        it is still correct, only fuller than intended.
+ */
+static int
+_lz_kvmap_filter_build(lz_kvmap * map, struct lz_kvmap_filter * filter, uint32_t capacity) {
+    uint64_t * blocks;
+    double     bits;
+    double     p;
+    uint32_t   n_hashes;
+    uint32_t   n_blocks;
+    uint32_t   i;
+
+    /* k = log2(1 / fp) hashes at k / ln 2 bits per key */
+    for (n_hashes = 0, p = 1.0; p > filter->fp_rate && n_hashes < 16; p /= 2) {
+        n_hashes += 1;
+    }
+
+    bits     = (double)capacity * n_hashes * 1.4427;
+    n_blocks = (uint32_t)(bits / (LZ_KVMAP_FILTER_BLOCK_WORDS * 64) + 1);
+
+    if (filter->max_bytes && (size_t)n_blocks * 64 > filter->max_bytes) {
+        n_blocks = filter->max_bytes / 64 ? (uint32_t)(filter->max_bytes / 64) : 1;
+
+        /* fewer bits per key than planned: use the optimal k for what is left */
+        n_hashes = (uint32_t)((double)n_blocks * 512 / capacity * 0.6931 + 0.5);
+
+        if (n_hashes < 1) {
+            n_hashes = 1;
+        }
+    }
+
+    if (posix_memalign((void **)&blocks, 64, (size_t)n_blocks * 64) != 0) {
+        return -1;
+    }
+
+    memset(blocks, 0, (size_t)n_blocks * 64);
+    free(filter->blocks);
+
+    filter->blocks   = blocks;
+    filter->n_blocks = n_blocks;
+    filter->n_hashes = n_hashes;
+    filter->capacity = capacity;
+    filter->n_keys   = 0;
+    filter->n_stale  = 0;
+
+    for (i = 0; i < map->n_dense; i++) {
+        if (map->dense[i] != NULL) {
+            _lz_kvmap_filter_add(filter, map->dense[i]->hash);
+        }
+    }
+
+    return 0;
+} /* _lz_kvmap_filter_build */
+
+static inline void
+_lz_kvmap_filter_insert(lz_kvmap * map, uint32_t hash) {
+    struct lz_kvmap_filter * filter = map->filter;
+
+    if (lz_unlikely(filter->n_keys >= filter->capacity)) {
+        uint32_t capacity = filter->capacity;
+
+        /* mostly stale bits: rebuild at the same size, otherwise grow */
+        if (filter->n_stale < filter->n_keys / 2 && capacity < UINT32_MAX / 2) {
+            capacity *= 2;
+        }
+
+        if (_lz_kvmap_filter_build(map, filter, capacity) == -1) {
+            filter->capacity += filter->capacity / 2;
+        }
+    }
+
+    _lz_kvmap_filter_add(filter, hash);
+}
+
+static inline lz_kvmap_ent *
+_lz_kvmap_ent_new(lz_kvmap * map, const char * key, size_t klen, uint32_t hash,
+                  void * val, void (* freefn)(void *)) {
+    lz_kvmap_ent * ent;
+
+    if (_lz_kvmap_is_arena(map)) {
+        ent = _lz_kvmap_arena_alloc(map, sizeof(lz_kvmap_ent) + klen + 1);
+    } else if (_lz_kvmap_is_alloc(map)) {
+        ent = lz_alloc(sizeof(lz_kvmap_ent) + klen + 1);
+    } else {
+        ent = malloc(sizeof(lz_kvmap_ent) + klen + 1);
+    }
+
+    lz_alloc_assert(ent);
+
+    ent->key[klen] = '\0';
+    memcpy(ent->key, key, klen);
+
+    ent->klen      = klen;
+    ent->val       = val;
+    ent->hash      = hash;
+    ent->freefn    = freefn;
+    ent->tidx      = LZ_KVMAP_NO_TTL;
+
+    /* before the append: a rebuild in here adds every entry in dense */
+    if (map->filter != NULL) {
+        _lz_kvmap_filter_insert(map, hash);
+    }
+
+    _lz_kvmap_dense_append(map, ent);
+
+    if (freefn != NULL) {
+        map->n_freefn += 1;
+    }
+
+    _lz_kvmap_count(map, inserts, 1);
+
+    ent->next      = NULL;
+    ent->prev      = NULL;
+
+    return ent;
+}
+
+static inline uint64_t
+_lz_kvmap_now(lz_kvmap * map) {
+    struct timespec ts;
+
+    if (map->clockfn != NULL) {
+        return (map->clockfn)(map->clockarg);
+    }
+
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* the clock is only read for entries that have a ttl */
+static inline int
+_lz_kvmap_ent_expired(lz_kvmap * map, lz_kvmap_ent * ent) {
+    if (lz_likely(ent->tidx == LZ_KVMAP_NO_TTL)) {
+        return 0;
+    }
+
+    return map->ttls[ent->tidx].expire <= _lz_kvmap_now(map);
+}
+
+static inline void
+_lz_kvmap_ttl_place(lz_kvmap * map, uint32_t i, struct lz_kvmap_ttl ttl) {
+    map->ttls[i]  = ttl;
+    ttl.ent->tidx = i;
+}
+
+static void
+_lz_kvmap_ttl_sift_up(lz_kvmap * map, uint32_t i) {
+    struct lz_kvmap_ttl ttl = map->ttls[i];
+
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+
+        if (map->ttls[parent].expire <= ttl.expire) {
+            break;
+        }
+
+        _lz_kvmap_ttl_place(map, i, map->ttls[parent]);
+        i = parent;
+    }
+
+    _lz_kvmap_ttl_place(map, i, ttl);
+}
+
+static void
+_lz_kvmap_ttl_sift_down(lz_kvmap * map, uint32_t i) {
+    struct lz_kvmap_ttl ttl = map->ttls[i];
+
+    for (;;) {
+        uint32_t child = i * 2 + 1;
+
+        if (child >= map->n_ttls) {
+            break;
+        }
+
+        if (child + 1 < map->n_ttls && map->ttls[child + 1].expire < map->ttls[child].expire) {
+            child += 1;
+        }
+
+        if (ttl.expire <= map->ttls[child].expire) {
+            break;
+        }
+
+        _lz_kvmap_ttl_place(map, i, map->ttls[child]);
+        i = child;
+    }
+
+    _lz_kvmap_ttl_place(map, i, ttl);
+}
+
+static void
+_lz_kvmap_ttl_del(lz_kvmap * map, lz_kvmap_ent * ent) {
+    lz_kvmap_ent * moved;
+    uint32_t       i = ent->tidx;
+
+    ent->tidx = LZ_KVMAP_NO_TTL;
+
+    if (i == --map->n_ttls) {
+        return;
+    }
+
+    /* move the last node into the hole, it may need to go either way */
+    moved = map->ttls[map->n_ttls].ent;
+
+    _lz_kvmap_ttl_place(map, i, map->ttls[map->n_ttls]);
+    _lz_kvmap_ttl_sift_up(map, i);
+    _lz_kvmap_ttl_sift_down(map, moved->tidx);
+}
+
+static void
+_lz_kvmap_ttl_set(lz_kvmap * map, lz_kvmap_ent * ent, uint64_t expire) {
+    if (ent->tidx != LZ_KVMAP_NO_TTL) {
+        uint64_t old = map->ttls[ent->tidx].expire;
+
+        map->ttls[ent->tidx].expire = expire;
+
+        if (expire < old) {
+            _lz_kvmap_ttl_sift_up(map, ent->tidx);
+        } else {
+            _lz_kvmap_ttl_sift_down(map, ent->tidx);
+        }
+
+        return;
+    }
 
-typedef uint32_t (* hash_fn)(const char * key, size_t len);
+    if (map->n_ttls == map->ttls_size) {
+        uint32_t              size = map->ttls_size ? map->ttls_size * 2 : LZ_KVMAP_DENSE_MIN;
+        struct lz_kvmap_ttl * ttls = realloc(map->ttls, sizeof(struct lz_kvmap_ttl) * size);
 
-static inline uint32_t _fnv_hash(const char * data, size_t len);
-static inline uint32_t _crc32_hash(const char * data, size_t len);
-static inline uint32_t _murmur_hash2(const char * data, size_t len);
-static inline uint32_t _jenkins_hash(const char * data, size_t len);
-static inline uint32_t _djb2_hash(const char * key, size_t len);
+        lz_alloc_assert(ttls);
 
-static hash_fn hashfn = _djb2_hash;
+        map->ttls      = ttls;
+        map->ttls_size = size;
+    }
 
-struct lz_kvmap_ent_s {
-    uint32_t       hash;
-    void           (* freefn)(void *);
-    lz_kvmap_ent * next;
-    lz_kvmap_ent * prev;
+    map->ttls[map->n_ttls].expire = expire;
+    map->ttls[map->n_ttls].ent    = ent;
 
-    SLIST_ENTRY(lz_kvmap_ent_s) list_next;
+    _lz_kvmap_ttl_sift_up(map, map->n_ttls++);
+}
 
-    size_t klen;
-    void * val;
-    char   key[];
-};
+static inline lz_kvmap_ent *
+_lz_kvmap_add_wkhash(lz_kvmap * map, const char * key, size_t klen, uint32_t hash,
+                     void * val, void (* freefn)(void *)) {
+    struct lz_kvmap_tbl * tbl;
+    lz_kvmap_ent        * ent;
 
-struct lz_kvmap_s {
-    uint32_t        n_buckets;
-    uint32_t        n_entries;
-    lz_kvmap_ent ** ents;
+    _lz_kvmap_rehash_step(map, LZ_KVMAP_REHASH_STEP);
 
-    SLIST_HEAD(, lz_kvmap_ent_s) ent_list;
-};
+    ent = _lz_kvmap_ent_new(map, key, klen, hash, val, freefn);
 
-static inline uint32_t
-_align_buckets(uint32_t n) {
-    return 1 << ((sizeof(n) * 8) - __builtin_clz(n - 1));
-}
+    /* while resizing, new entries always go into the new table */
+    tbl = &map->tbls[_lz_kvmap_is_rehashing(map) ? 1 : 0];
 
-inline lz_kvmap *
-lz_kvmap_new(uint32_t n_buckets) {
-    lz_kvmap * map;
+    if (_lz_kvmap_is_open(map)) {
+        /* only fails if the table could not be grown when it had to be */
+        int res = _lz_kvmap_open_insert(tbl, ent);
 
-    if (!(map = malloc(sizeof(lz_kvmap)))) {
-        return NULL;
+        lz_alloc_assert(res == 0);
+    } else {
+        _lz_kvmap_chain_insert(tbl, ent);
     }
 
-    n_buckets      = _align_buckets(n_buckets);
+    map->n_entries += 1;
 
-    map->n_buckets = n_buckets;
-    map->n_entries = 0;
-    map->ents      = calloc(sizeof(lz_kvmap_ent *), n_buckets);
+    _lz_kvmap_check_grow(map);
 
-    SLIST_INIT(&map->ent_list);
+    return ent;
+} /* _lz_kvmap_add_wkhash */
+
+/**
+ * @brief looks `key` up and inserts an entry with a NULL value if it is not
+ *        there, hashing the key once and probing the table once.
+ */
+static lz_kvmap_ent *
+_lz_kvmap_find_or_insert(lz_kvmap * map, const char * key, size_t klen,
+                         uint32_t hash, int * created) {
+    struct lz_kvmap_tbl * tbl;
+    lz_kvmap_ent        * ent;
+    uint32_t              ins;
+
+    _lz_kvmap_rehash_step(map, LZ_KVMAP_REHASH_STEP);
+    _lz_kvmap_count(map, lookups, 1);
+
+    tbl = &map->tbls[0];
+
+    if (_lz_kvmap_is_rehashing(map)) {
+        if ((ent = _lz_kvmap_tbl_find(map, tbl, key, klen, hash))) {
+            goto found;
+        }
 
-    return map;
-}
+        tbl = &map->tbls[1];
+    }
 
-static inline void
-_lz_kvmap_ent_free(lz_kvmap_ent * ent) {
-    if (lz_unlikely(ent == NULL)) {
-        return;
+    if (_lz_kvmap_is_open(map)) {
+        ent = _lz_kvmap_open_find(map, tbl, key, klen, hash, &ins);
+    } else {
+        ent = _lz_kvmap_chain_find(map, tbl, key, klen, hash);
     }
 
-    if (ent->freefn) {
-        (ent->freefn)(ent->val);
+    if (ent != NULL) {
+        goto found;
     }
 
-    free(ent);
-}
+    ent = _lz_kvmap_ent_new(map, key, klen, hash, NULL, NULL);
 
-static inline lz_kvmap_ent *
-_lz_kvmap_add(lz_kvmap * map, const char * key, size_t klen, void * val, void (* freefn)(void *)) {
-    lz_kvmap_ent * ent;
-    uint32_t       hash;
-    uint32_t       bucket;
+    if (_lz_kvmap_is_open(map)) {
+        lz_alloc_assert(ins != LZ_KVMAP_NO_SLOT);
 
-    hash           = hashfn(key, klen);
-    bucket         = hash & (map->n_buckets - 1);
+        _lz_kvmap_open_place(tbl, ins, ent);
+    } else {
+        _lz_kvmap_chain_insert(tbl, ent);
+    }
 
-    ent            = malloc(sizeof(lz_kvmap_ent) + klen + 1);
-    lz_alloc_assert(ent);
+    map->n_entries += 1;
 
-    ent->key[klen] = '\0';
-    memcpy(ent->key, key, klen);
+    _lz_kvmap_check_grow(map);
 
-    ent->klen      = klen;
-    ent->val       = val;
-    ent->hash      = hash;
-    ent->freefn    = freefn;
+    if (created) {
+        *created = 1;
+    }
 
-    SLIST_INSERT_HEAD(&map->ent_list, ent, list_next);
+    return ent;
 
-    ent->next      = NULL;
-    ent->prev      = NULL;
+found:
+    /* an expired entry is replaced by a fresh one */
+    if (_lz_kvmap_ent_expired(map, ent)) {
+        lz_kvmap_remove_ent(map, ent);
 
-    if (map->ents[bucket] != NULL) {
-        ent->next       = map->ents[bucket];
-        ent->next->prev = ent;
+        return _lz_kvmap_find_or_insert(map, key, klen, hash, created);
+    }
+
+    _lz_kvmap_count(map, hits, 1);
+
+    if (created) {
+        *created = 0;
+    }
+
+    return ent;
+} /* _lz_kvmap_find_or_insert */
+
+lz_kvmap_ent *
+lz_kvmap_find_or_insert_wkhash(lz_kvmap * map, const char * k, size_t l,
+                               uint32_t hash, int * created) {
+    if (map == NULL || k == NULL) {
+        return NULL;
+    }
+
+    return _lz_kvmap_find_or_insert(map, k, l, hash, created);
+}
+
+lz_kvmap_ent *
+lz_kvmap_find_or_insert(lz_kvmap * map, const char * k, size_t l, int * created) {
+    if (map == NULL || k == NULL) {
+        return NULL;
+    }
+
+    return _lz_kvmap_find_or_insert(map, k, l, _lz_kvmap_hash(map, k, l), created);
+}
+
+lz_kvmap_ent *
+lz_kvmap_upsert(lz_kvmap * map, const char * k, size_t l, void * val,
+                void (* freefn)(void *), int * created) {
+    lz_kvmap_ent * ent;
+
+    if (!(ent = lz_kvmap_find_or_insert(map, k, l, created))) {
+        return NULL;
+    }
+
+    /* replacing a value releases the old one, unless it is the same one */
+    if (ent->freefn && ent->val != val) {
+        (ent->freefn)(ent->val);
     }
 
-    map->ents[bucket] = ent;
-    map->n_entries   += 1;
+    ent->val = val;
+
+    _lz_kvmap_ent_set_freefn(ent, freefn);
 
     return ent;
-} /* _lz_kvmap_add */
+}
+
+void
+lz_kvmap_ent_set_val(lz_kvmap_ent * ent, void * val, void (* freefn)(void *)) {
+    if (ent == NULL) {
+        return;
+    }
+
+    ent->val = val;
+
+    _lz_kvmap_ent_set_freefn(ent, freefn);
+}
+
+static inline lz_kvmap_ent *
+_lz_kvmap_add(lz_kvmap * map, const char * key, size_t klen, void * val, void (* freefn)(void *)) {
+    return _lz_kvmap_add_wkhash(map, key, klen, _lz_kvmap_hash(map, key, klen), val, freefn);
+}
 
 inline lz_kvmap_ent *
 lz_kvmap_add(lz_kvmap * map, const char * key, void * val, void (* freefn)(void *)) {
@@ -131,48 +1391,131 @@ lz_kvmap_add_wklen(lz_kvmap * map, const char * k, size_t l, void * val,
 
 #endif
 
+lz_kvmap_ent *
+lz_kvmap_add_wkhash(lz_kvmap * map, const char * k, size_t l, uint32_t hash,
+                    void * val, void (* freefn)(void *)) {
+    return _lz_kvmap_add_wkhash(map, k, l, hash, val, freefn);
+}
+
 int
 lz_kvmap_remove_ent(lz_kvmap * map, lz_kvmap_ent * ent) {
-    uint32_t bucket;
+    int i;
 
     if (!map || !ent) {
         return -1;
     }
 
-    bucket = ent->hash & (map->n_buckets - 1); /* ent->hash % map->n_buckets; */
+    if (_lz_kvmap_is_open(map)) {
+        /* the entry may live in either table while a resize is in progress */
+        if (_lz_kvmap_open_unlink(&map->tbls[0], ent) == -1) {
+            _lz_kvmap_open_unlink(&map->tbls[1], ent);
+        }
+    } else {
+        if (ent->next) {
+            ent->next->prev = ent->prev;
+        }
 
-    if (ent->next) {
-        ent->next->prev = ent->prev;
-    }
+        if (ent->prev) {
+            ent->prev->next = ent->next;
+        }
 
-    if (ent->prev) {
-        ent->prev->next = ent->next;
-    }
+        for (i = 0; i < 2; i++) {
+            struct lz_kvmap_tbl * tbl = &map->tbls[i];
+            uint32_t              bucket;
+
+            if (tbl->ents == NULL) {
+                continue;
+            }
+
+            bucket = ent->hash & (tbl->n_buckets - 1); /* ent->hash % n_buckets; */
 
-    if (map->ents[bucket] == ent) {
-        map->ents[bucket] = ent->prev ? ent->prev : ent->next;
+            if (tbl->ents[bucket] == ent) {
+                tbl->ents[bucket] = ent->prev ? ent->prev : ent->next;
+            }
+        }
     }
 
     map->n_entries -= 1;
 
-    SLIST_REMOVE(&map->ent_list, ent, lz_kvmap_ent_s, list_next);
+    _lz_kvmap_count(map, removes, 1);
+
+    if (ent->freefn != NULL) {
+        map->n_freefn -= 1;
+    }
+
+    if (ent->tidx != LZ_KVMAP_NO_TTL) {
+        _lz_kvmap_ttl_del(map, ent);
+    }
+
+    if (map->filter != NULL) {
+        map->filter->n_stale += 1;
+    }
 
+    _lz_kvmap_dense_remove(map, ent);
     _lz_kvmap_ent_free(ent);
 
+    _lz_kvmap_check_shrink(map);
+
     return 0;
+} /* lz_kvmap_remove_ent */
+
+/**
+ * @brief the table probe of lz_kvmap_ent_find_wkhash(), for removes: it is
+ *        not counted as a lookup, hit or filter query, and leaves expired
+ *        entries to the caller.
+ */
+static lz_kvmap_ent *
+_lz_kvmap_ent_probe(lz_kvmap * map, const char * key, size_t klen, uint32_t hash) {
+    lz_kvmap_ent * ent;
+
+    _lz_kvmap_rehash_step(map, LZ_KVMAP_REHASH_STEP);
+
+    if (map->filter != NULL && !_lz_kvmap_filter_check(map->filter, hash)) {
+        return NULL;
+    }
+
+    if (!(ent = _lz_kvmap_tbl_find(map, &map->tbls[0], key, klen, hash)) &&
+        _lz_kvmap_is_rehashing(map)) {
+        ent = _lz_kvmap_tbl_find(map, &map->tbls[1], key, klen, hash);
+    }
+
+    return ent;
 }
 
 int
-lz_kvmap_remove(lz_kvmap * map, const char * key) {
+lz_kvmap_remove_wkhash(lz_kvmap * map, const char * key, size_t klen, uint32_t hash) {
     lz_kvmap_ent * ent;
 
-    if (!(ent = lz_kvmap_ent_find(map, key))) {
+    if (map == NULL || key == NULL) {
+        return 0;
+    }
+
+    /* an expired entry is removed all the same */
+    if (!(ent = _lz_kvmap_ent_probe(map, key, klen, hash))) {
         return 0;
     }
 
     return lz_kvmap_remove_ent(map, ent);
 }
 
+int
+lz_kvmap_remove_wklen(lz_kvmap * map, const char * key, size_t klen) {
+    if (map == NULL || key == NULL) {
+        return 0;
+    }
+
+    return lz_kvmap_remove_wkhash(map, key, klen, _lz_kvmap_hash(map, key, klen));
+}
+
+int
+lz_kvmap_remove(lz_kvmap * map, const char * key) {
+    if (key == NULL) {
+        return 0;
+    }
+
+    return lz_kvmap_remove_wklen(map, key, strlen(key));
+}
+
 inline void *
 lz_kvmap_ent_val(lz_kvmap_ent * ent) {
     if (ent) {
@@ -191,109 +1534,450 @@ lz_kvmap_ent_key(lz_kvmap_ent * ent) {
     return NULL;
 }
 
+uint32_t
+lz_kvmap_hash_key(lz_kvmap * map, const char * key, size_t klen) {
+    return _lz_kvmap_hash(map, key, klen);
+}
+
 inline lz_kvmap_ent *
-lz_kvmap_ent_find(lz_kvmap * map, const char * key) {
+lz_kvmap_ent_find_wkhash(lz_kvmap * map, const char * key, size_t klen, uint32_t hash) {
     lz_kvmap_ent * ent;
-    uint32_t       hash;
-    uint32_t       bucket;
-    size_t         klen;
 
     if (map == NULL || key == NULL) {
         return NULL;
     }
 
-    klen   = strlen(key);
-    hash   = hashfn(key, klen);
-    bucket = hash & (map->n_buckets - 1);
+    _lz_kvmap_rehash_step(map, LZ_KVMAP_REHASH_STEP);
+    _lz_kvmap_count(map, lookups, 1);
+
+    if (map->filter != NULL) {
+        if (!_lz_kvmap_filter_check(map->filter, hash)) {
+            map->filter->negatives += 1;
+            return NULL;
+        }
+
+        map->filter->positives += 1;
+    }
+
+    if (!(ent = _lz_kvmap_tbl_find(map, &map->tbls[0], key, klen, hash))) {
+        if (_lz_kvmap_is_rehashing(map)) {
+            ent = _lz_kvmap_tbl_find(map, &map->tbls[1], key, klen, hash);
+        }
+
+        if (ent == NULL) {
+            if (map->filter != NULL) {
+                map->filter->false_positives += 1;
+            }
+
+            return NULL;
+        }
+    }
+
+    /* lazy expiry, the entry is reclaimed by whoever finds it expired */
+    if (_lz_kvmap_ent_expired(map, ent)) {
+        lz_kvmap_remove_ent(map, ent);
+        return NULL;
+    }
+
+    _lz_kvmap_count(map, hits, 1);
+
+    return ent;
+}
+
+inline lz_kvmap_ent *
+lz_kvmap_ent_find_wklen(lz_kvmap * map, const char * key, size_t klen) {
+    if (map == NULL || key == NULL) {
+        return NULL;
+    }
+
+    return lz_kvmap_ent_find_wkhash(map, key, klen, _lz_kvmap_hash(map, key, klen));
+}
+
+inline lz_kvmap_ent *
+lz_kvmap_ent_find(lz_kvmap * map, const char * key) {
+    if (key == NULL) {
+        return NULL;
+    }
+
+    return lz_kvmap_ent_find_wklen(map, key, strlen(key));
+}
+
+void *
+lz_kvmap_find_wkhash(lz_kvmap * map, const char * key, size_t klen, uint32_t hash) {
+    lz_kvmap_ent * ent;
 
-    if (map->ents[bucket] == NULL) {
+    if (!(ent = lz_kvmap_ent_find_wkhash(map, key, klen, hash))) {
         return NULL;
     }
 
-    ent = map->ents[bucket];
+    return ent->val;
+}
 
-    while (ent != NULL) {
-        if (ent->hash == hash) {
-            if (strncmp(ent->key, key, klen) == 0) {
-                return ent;
+void *
+lz_kvmap_find_wklen(lz_kvmap * map, const char * key, size_t klen) {
+    lz_kvmap_ent * ent;
+
+    if (!(ent = lz_kvmap_ent_find_wklen(map, key, klen))) {
+        return NULL;
+    }
+
+    return ent->val;
+}
+
+void *
+lz_kvmap_find(lz_kvmap * map, const char * key) {
+    lz_kvmap_ent * ent;
+
+    if (!(ent = lz_kvmap_ent_find(map, key))) {
+        return NULL;
+    }
+
+    return ent->val;
+}
+
+/* number of keys in flight at once in lz_kvmap_ent_find_batch() */
+#define LZ_KVMAP_BATCH 32
+
+/**
+ * @brief first stage of a batched lookup: prefetch the bucket head (chained)
+ *        or the control bytes of the home group (open addressing).
+ */
+static inline void
+_lz_kvmap_batch_prefetch_slot(lz_kvmap * map, struct lz_kvmap_tbl * tbl, uint32_t hash) {
+    if (_lz_kvmap_is_open(map)) {
+        __builtin_prefetch(&tbl->groups[hash & (tbl->n_buckets / LZ_KVMAP_GROUP - 1)]);
+    } else {
+        __builtin_prefetch(&tbl->ents[hash & (tbl->n_buckets - 1)]);
+    }
+}
+
+/**
+ * @brief second stage: the slot is (hopefully) in cache by now, prefetch the
+ *        first entry it points at, including the start of its key.
+ */
+static inline void
+_lz_kvmap_batch_prefetch_ent(lz_kvmap * map, struct lz_kvmap_tbl * tbl, uint32_t hash) {
+    lz_kvmap_ent * ent;
+
+    if (_lz_kvmap_is_open(map)) {
+        struct lz_kvmap_group * group = &tbl->groups[hash & (tbl->n_buckets / LZ_KVMAP_GROUP - 1)];
+        uint32_t                mask  = _lz_kvmap_group_match(group->ctrl, _lz_kvmap_h2(hash));
+
+        if (mask == 0) {
+            return;
+        }
+
+        ent = group->ents[__builtin_ctz(mask)];
+    } else {
+        ent = tbl->ents[hash & (tbl->n_buckets - 1)];
+    }
+
+    if (ent != NULL) {
+        __builtin_prefetch(ent);
+        __builtin_prefetch(ent->key);
+    }
+}
+
+size_t
+lz_kvmap_ent_find_batch(lz_kvmap * map, const char * const * keys, const size_t * lens,
+                        lz_kvmap_ent ** out, size_t n) {
+    struct lz_kvmap_tbl * tbl;
+    uint32_t              hashes[LZ_KVMAP_BATCH];
+    size_t                klens[LZ_KVMAP_BATCH];
+    uint8_t               skip[LZ_KVMAP_BATCH];
+    size_t                found = 0;
+    size_t                base;
+    size_t                i;
+
+    if (map == NULL || keys == NULL || out == NULL) {
+        return 0;
+    }
+
+    _lz_kvmap_rehash_step(map, LZ_KVMAP_REHASH_STEP);
+
+    /*
+     * only the table holding most of the entries is prefetched, keys that
+     * are still waiting to be migrated are looked up in tbls[1] as usual.
+     */
+    tbl = &map->tbls[0];
+
+    for (base = 0; base < n; base += LZ_KVMAP_BATCH) {
+        size_t cnt = n - base < LZ_KVMAP_BATCH ? n - base : LZ_KVMAP_BATCH;
+
+        for (i = 0; i < cnt; i++) {
+            const char * key = keys[base + i];
+
+            klens[i]  = key ? (lens ? lens[base + i] : strlen(key)) : 0;
+            hashes[i] = key ? _lz_kvmap_hash(map, key, klens[i]) : 0;
+            skip[i]   = key == NULL;
+
+            /* definite misses never touch the table */
+            if (key != NULL && map->filter != NULL) {
+                if (!_lz_kvmap_filter_check(map->filter, hashes[i])) {
+                    map->filter->negatives += 1;
+                    skip[i] = 1;
+                } else {
+                    map->filter->positives += 1;
+                }
+            }
+
+            if (!skip[i]) {
+                _lz_kvmap_batch_prefetch_slot(map, tbl, hashes[i]);
+            }
+        }
+
+        for (i = 0; i < cnt; i++) {
+            if (!skip[i]) {
+                _lz_kvmap_batch_prefetch_ent(map, tbl, hashes[i]);
+            }
+        }
+
+        for (i = 0; i < cnt; i++) {
+            const char   * key = keys[base + i];
+            lz_kvmap_ent * ent = NULL;
+
+            if (!skip[i]) {
+                ent = _lz_kvmap_tbl_find(map, tbl, key, klens[i], hashes[i]);
+
+                if (ent == NULL && _lz_kvmap_is_rehashing(map)) {
+                    ent = _lz_kvmap_tbl_find(map, &map->tbls[1], key, klens[i], hashes[i]);
+                }
+
+                if (ent == NULL && map->filter != NULL) {
+                    map->filter->false_positives += 1;
+                }
+
+                if (ent != NULL && _lz_kvmap_ent_expired(map, ent)) {
+                    lz_kvmap_remove_ent(map, ent);
+                    ent = NULL;
+                }
             }
+
+            out[base + i] = ent;
+            found        += ent != NULL;
+
+            _lz_kvmap_count(map, lookups, keys[base + i] != NULL);
+            _lz_kvmap_count(map, hits, ent != NULL);
         }
+    }
+
+    return found;
+} /* lz_kvmap_ent_find_batch */
+
+size_t
+lz_kvmap_find_batch(lz_kvmap * map, const char * const * keys, const size_t * lens,
+                    void ** out, size_t n) {
+    lz_kvmap_ent * ents[LZ_KVMAP_BATCH];
+    size_t         found = 0;
+    size_t         base;
+    size_t         i;
+
+    if (out == NULL) {
+        return 0;
+    }
+
+    for (base = 0; base < n; base += LZ_KVMAP_BATCH) {
+        size_t cnt = n - base < LZ_KVMAP_BATCH ? n - base : LZ_KVMAP_BATCH;
+
+        found += lz_kvmap_ent_find_batch(map, keys + base, lens ? lens + base : NULL, ents, cnt);
 
-        ent = ent->next;
+        for (i = 0; i < cnt; i++) {
+            out[base + i] = ents[i] ? ents[i]->val : NULL;
+        }
     }
 
-    return NULL;
+    return found;
 }
 
-void *
-lz_kvmap_find(lz_kvmap * map, const char * key) {
-    lz_kvmap_ent * ent;
+static void
+_lz_kvmap_free_ents(lz_kvmap * map, int keep_slab) {
+    uint32_t i;
 
-    if (!(ent = lz_kvmap_ent_find(map, key))) {
-        return NULL;
+    /* arena entries without values to release go away with their slabs */
+    if (!_lz_kvmap_is_arena(map) || map->n_freefn > 0) {
+        for (i = 0; i < map->n_dense; i++) {
+            _lz_kvmap_ent_free(map->dense[i]);
+        }
     }
 
-    return ent->val;
+    if (_lz_kvmap_is_arena(map)) {
+        _lz_kvmap_arena_reset(map, keep_slab);
+    }
+
+    map->n_dense     = 0;
+    map->n_holes     = 0;
+    map->n_freefn    = 0;
+    map->n_ttls      = 0;
+    map->dense_moved = UINT32_MAX;
+    map->dense_gen  += 1;
 }
 
 int
 lz_kvmap_clear(lz_kvmap * map) {
-    lz_kvmap_ent * ent;
-    lz_kvmap_ent * save;
+    if (!map) {
+        return -1;
+    }
 
-    for (ent = SLIST_FIRST(&map->ent_list); ent; ent = save) {
-        save = SLIST_NEXT(ent, list_next);
+    _lz_kvmap_free_ents(map, 1);
 
-        map->ents[ent->hash & (map->n_buckets - 1)] = NULL;
+    /* abandon any resize in flight, the current table size is kept */
+    if (_lz_kvmap_is_rehashing(map)) {
+        _lz_kvmap_tbl_reset(&map->tbls[1]);
 
-        SLIST_REMOVE(&map->ent_list, ent, lz_kvmap_ent_s, list_next);
+        map->rehash_idx = -1;
+    }
 
-        _lz_kvmap_ent_free(ent);
+    if (_lz_kvmap_is_open(map)) {
+        _lz_kvmap_groups_clear(map->tbls[0].groups, map->tbls[0].n_buckets / LZ_KVMAP_GROUP);
+        map->tbls[0].n_used = 0;
+    } else {
+        memset(map->tbls[0].ents, 0, sizeof(lz_kvmap_ent *) * map->tbls[0].n_buckets);
     }
 
     map->n_entries = 0;
 
+    if (map->filter != NULL) {
+        memset(map->filter->blocks, 0, (size_t)map->filter->n_blocks * 64);
+        map->filter->n_keys  = 0;
+        map->filter->n_stale = 0;
+    }
+
     return 0;
 }
 
+/* how far ahead of the iterator entries are prefetched */
+#define LZ_KVMAP_ITER_PREFETCH 4
+
 int
 lz_kvmap_for_each(lz_kvmap * map, lz_kvmap_iterfn iterfn, void * arg) {
-    lz_kvmap_ent * ent;
+    uint32_t i;
+    int      sres;
 
     if (!map || !iterfn) {
         return -1;
     }
 
-    SLIST_FOREACH(ent, &map->ent_list, list_next) {
-        int sres;
+    /*
+     * the callback may remove entries (including the current one), which
+     * only leaves holes as long as compaction is held off.
+     */
+    map->iterating += 1;
+    sres            = 0;
+
+    for (i = 0; i < map->n_dense; i++) {
+        lz_kvmap_ent * ent = map->dense[i];
+
+        if (i + LZ_KVMAP_ITER_PREFETCH < map->n_dense) {
+            __builtin_prefetch(map->dense[i + LZ_KVMAP_ITER_PREFETCH]);
+        }
+
+        if (ent == NULL) {
+            continue;
+        }
 
         if ((sres = (iterfn)(ent, arg)) != 0) {
-            return sres;
+            break;
         }
     }
 
-    return 0;
+    map->iterating -= 1;
+
+    return sres;
 }
 
+/* empty dense slots a scan may skip over per entry it is allowed to return */
+#define LZ_KVMAP_SCAN_SKIP 10
+
+uint64_t
+lz_kvmap_scan(lz_kvmap * map, uint64_t cursor, size_t count,
+              lz_kvmap_iterfn iterfn, void * arg) {
+    uint32_t idx;
+    uint32_t gen;
+    size_t   empty_visits;
+
+    if (!map || !iterfn) {
+        return 0;
+    }
+
+    /*
+     * the cursor is (dense generation << 32 | dense index). Resizes never
+     * move entries within the dense array, and the holes removals leave
+     * behind stay put, so only a compaction invalidates a position. After
+     * one compaction, everything that was at or past idx is now at or past
+     * idx - dense_moved; after more than one, start over.
+     */
+    gen = (uint32_t)(cursor >> 32);
+    idx = (uint32_t)cursor;
+
+    if (gen != map->dense_gen) {
+        if (gen + 1 == map->dense_gen && idx > map->dense_moved) {
+            idx -= map->dense_moved;
+        } else {
+            idx = 0;
+        }
+    }
+
+    if (count == 0) {
+        count = 1;
+    }
+
+    empty_visits    = count * LZ_KVMAP_SCAN_SKIP;
+    map->iterating += 1;
+
+    while (idx < map->n_dense) {
+        lz_kvmap_ent * ent = map->dense[idx++];
+
+        if (idx + LZ_KVMAP_ITER_PREFETCH < map->n_dense) {
+            __builtin_prefetch(map->dense[idx + LZ_KVMAP_ITER_PREFETCH]);
+        }
+
+        if (ent == NULL) {
+            if (--empty_visits == 0) {
+                break;
+            }
+
+            continue;
+        }
+
+        if ((iterfn)(ent, arg) != 0 || --count == 0) {
+            break;
+        }
+    }
+
+    map->iterating -= 1;
+
+    if (idx >= map->n_dense) {
+        return 0;
+    }
+
+    return ((uint64_t)map->dense_gen << 32) | idx;
+} /* lz_kvmap_scan */
+
 void
 lz_kvmap_free(lz_kvmap * map) {
-    lz_kvmap_ent * ent;
-    lz_kvmap_ent * save;
-
     if (!map) {
         return;
     }
 
-    for (ent = SLIST_FIRST(&map->ent_list); ent; ent = save) {
-        save = SLIST_NEXT(ent, list_next);
+    _lz_kvmap_free_ents(map, 0);
 
-        SLIST_REMOVE(&map->ent_list, ent, lz_kvmap_ent_s, list_next);
+    _lz_kvmap_tbl_reset(&map->tbls[0]);
+    _lz_kvmap_tbl_reset(&map->tbls[1]);
+    free(map->dense);
+    free(map->ttls);
+    lz_kvmap_filter_disable(map);
+    free(map);
+}
 
-        _lz_kvmap_ent_free(ent);
+static inline lz_kvmap_ent *
+_lz_kvmap_dense_next(lz_kvmap * map, uint32_t idx) {
+    for (; idx < map->n_dense; idx++) {
+        if (map->dense[idx] != NULL) {
+            return map->dense[idx];
+        }
     }
 
-    free(map->ents);
-    free(map);
+    return NULL;
 }
 
 lz_kvmap_ent *
@@ -302,7 +1986,7 @@ lz_kvmap_first(lz_kvmap * map) {
         return NULL;
     }
 
-    return SLIST_FIRST(&map->ent_list);
+    return _lz_kvmap_dense_next(map, 0);
 }
 
 lz_kvmap_ent *
@@ -311,7 +1995,7 @@ lz_kvmap_next(lz_kvmap_ent * ent) {
         return NULL;
     }
 
-    return SLIST_NEXT(ent, list_next);
+    return _lz_kvmap_dense_next(ent->map, ent->didx + 1);
 }
 
 size_t
@@ -332,6 +2016,73 @@ lz_kvmap_get_size(lz_kvmap * map) {
     return map->n_entries;
 }
 
+void
+lz_kvmap_set_clock(lz_kvmap * map, lz_kvmap_clockfn clockfn, void * arg) {
+    if (!map) {
+        return;
+    }
+
+    map->clockfn  = clockfn;
+    map->clockarg = arg;
+}
+
+void
+lz_kvmap_ent_set_ttl(lz_kvmap_ent * ent, uint64_t ttl) {
+    lz_kvmap * map;
+
+    if (!ent) {
+        return;
+    }
+
+    map = ent->map;
+
+    if (ttl == 0) {
+        if (ent->tidx != LZ_KVMAP_NO_TTL) {
+            _lz_kvmap_ttl_del(map, ent);
+        }
+
+        return;
+    }
+
+    _lz_kvmap_ttl_set(map, ent, _lz_kvmap_now(map) + ttl);
+}
+
+int64_t
+lz_kvmap_ent_get_ttl(lz_kvmap_ent * ent) {
+    uint64_t expire;
+    uint64_t now;
+
+    if (!ent || ent->tidx == LZ_KVMAP_NO_TTL) {
+        return -1;
+    }
+
+    expire = ent->map->ttls[ent->tidx].expire;
+    now    = _lz_kvmap_now(ent->map);
+
+    return expire > now ? (int64_t)(expire - now) : 0;
+}
+
+size_t
+lz_kvmap_expire(lz_kvmap * map, size_t max) {
+    uint64_t now;
+    size_t   n = 0;
+
+    if (!map || map->n_ttls == 0) {
+        return 0;
+    }
+
+    now = _lz_kvmap_now(map);
+
+    /* the heap root is always the next entry due, so nothing that is still
+     * live is ever looked at */
+    while (n < max && map->n_ttls > 0 && map->ttls[0].expire <= now) {
+        lz_kvmap_remove_ent(map, map->ttls[0].ent);
+        n += 1;
+    }
+
+    return n;
+}
+
 /* magic numbers from http://www.isthe.com/chongo/tech/comp/fnv/ */
 static const uint32_t InitialFNV  = 2166136261U;
 static const uint32_t FNVMultiple = 16777619;
@@ -456,8 +2207,10 @@ _murmur_hash2(const char * data, size_t len) {
     switch (len) {
         case 3:
             h ^= data[2] << 16;
+        /* fallthrough */
         case 2:
             h ^= data[1] << 8;
+        /* fallthrough */
         case 1:
             h ^= data[0];
             h *= 0x5bd1e995;
@@ -488,11 +2241,400 @@ _jenkins_hash(const char * key, size_t len) {
 static inline uint32_t
 _djb2_hash(const char * str, size_t len) {
     uint32_t hash = 5381;
-    int      c;
 
-    while ((c = *str++)) {
-        hash = ((hash << 5) + hash) + c;
+    while (len--) {
+        hash = ((hash << 5) + hash) + *str++;
     }
 
     return hash;
 }
+
+/*
+ * wyhash (https://github.com/wangyi-fudan/wyhash, public domain): reads the
+ * key 8 bytes at a time and folds it with 64x64->128 bit multiplies. Keys of
+ * up to 16 bytes, most DNS labels and short names, are hashed without a loop.
+ */
+static const uint64_t _wyp[4] = {
+    0xa0761d6478bd642full, 0xe7037ed1a0b428dbull,
+    0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+};
+
+static inline void
+_wymum(uint64_t * a, uint64_t * b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)*a * *b;
+
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t  = rl + (rm0 << 32);
+    uint64_t c  = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+
+    c += lo < t;
+
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t
+_wymix(uint64_t a, uint64_t b) {
+    _wymum(&a, &b);
+
+    return a ^ b;
+}
+
+static inline uint64_t
+_wyr8(const uint8_t * p) {
+    uint64_t v;
+
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t
+_wyr4(const uint8_t * p) {
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t
+_wyr3(const uint8_t * p, size_t k) {
+    return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+
+uint64_t
+lz_kvmap_hash64(const void * key, size_t len, uint64_t seed) {
+    const uint8_t * p = (const uint8_t *)key;
+    uint64_t        a;
+    uint64_t        b;
+
+    seed ^= _wymix(seed ^ _wyp[0], _wyp[1]);
+
+    if (lz_likely(len <= 16)) {
+        if (lz_likely(len >= 4)) {
+            a = (_wyr4(p) << 32) | _wyr4(p + ((len >> 3) << 2));
+            b = (_wyr4(p + len - 4) << 32) | _wyr4(p + len - 4 - ((len >> 3) << 2));
+        } else if (lz_likely(len > 0)) {
+            a = _wyr3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+
+        if (lz_unlikely(i > 48)) {
+            uint64_t see1 = seed;
+            uint64_t see2 = seed;
+
+            do {
+                seed = _wymix(_wyr8(p) ^ _wyp[1], _wyr8(p + 8) ^ seed);
+                see1 = _wymix(_wyr8(p + 16) ^ _wyp[2], _wyr8(p + 24) ^ see1);
+                see2 = _wymix(_wyr8(p + 32) ^ _wyp[3], _wyr8(p + 40) ^ see2);
+                p   += 48;
+                i   -= 48;
+            } while (lz_likely(i > 48));
+
+            seed ^= see1 ^ see2;
+        }
+
+        while (lz_unlikely(i > 16)) {
+            seed = _wymix(_wyr8(p) ^ _wyp[1], _wyr8(p + 8) ^ seed);
+            i   -= 16;
+            p   += 16;
+        }
+
+        a = _wyr8(p + i - 16);
+        b = _wyr8(p + i - 8);
+    }
+
+    a ^= _wyp[1];
+    b ^= seed;
+
+    _wymum(&a, &b);
+
+    return _wymix(a ^ _wyp[0] ^ len, b ^ _wyp[1]);
+} /* lz_kvmap_hash64 */
+
+static inline uint32_t
+_wy_hash(const char * data, size_t len) {
+    uint64_t h = lz_kvmap_hash64(data, len, 0);
+
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+lz_kvmap_hashfn
+lz_kvmap_get_hashfn(enum lz_kvmap_hash_type type) {
+    if ((int)type < 0 || type >= LZ_KVMAP_HASH_CUSTOM) {
+        return NULL;
+    }
+
+    return _lz_kvmap_hashfns[type];
+}
+
+int
+lz_kvmap_filter_enable(lz_kvmap * map, double fp_rate, size_t max_bytes) {
+    struct lz_kvmap_filter * filter;
+    uint32_t                 capacity;
+
+    if (!map || !(fp_rate > 0.0 && fp_rate < 1.0)) {
+        return -1;
+    }
+
+    if (!(filter = calloc(1, sizeof(*filter)))) {
+        return -1;
+    }
+
+    /* room to grow before the first rebuild */
+    capacity          = map->n_entries > map->min_buckets ? map->n_entries : map->min_buckets;
+    capacity          = _align_buckets(capacity < 512 ? 1024 : capacity * 2);
+
+    filter->fp_rate   = fp_rate;
+    filter->max_bytes = max_bytes;
+
+    if (_lz_kvmap_filter_build(map, filter, capacity) == -1) {
+        free(filter);
+        return -1;
+    }
+
+    lz_kvmap_filter_disable(map);
+
+    map->filter = filter;
+
+    return 0;
+}
+
+void
+lz_kvmap_filter_disable(lz_kvmap * map) {
+    if (!map || !map->filter) {
+        return;
+    }
+
+    free(map->filter->blocks);
+    free(map->filter);
+
+    map->filter = NULL;
+}
+
+int
+lz_kvmap_filter_get_stats(lz_kvmap * map, struct lz_kvmap_filter_stats * stats) {
+    struct lz_kvmap_filter * filter;
+
+    if (!map || !stats || !(filter = map->filter)) {
+        return -1;
+    }
+
+    stats->negatives       = filter->negatives;
+    stats->positives       = filter->positives;
+    stats->false_positives = filter->false_positives;
+    stats->n_bytes         = (size_t)filter->n_blocks * 64;
+    stats->n_hashes        = filter->n_hashes;
+    stats->capacity        = filter->capacity;
+    stats->n_stale         = filter->n_stale;
+
+    return 0;
+}
+
+/**
+ * @return the number of groups probed to reach `ent` in an open addressing
+ *         table, 1 when it sits in its home group
+ */
+static uint32_t
+_lz_kvmap_open_dist(struct lz_kvmap_tbl * tbl, lz_kvmap_ent * ent) {
+    uint8_t  h2 = _lz_kvmap_h2(ent->hash);
+    uint32_t g;
+    uint32_t i;
+
+    _lz_kvmap_for_each_group(tbl, ent->hash, g, i) {
+        uint32_t mask = _lz_kvmap_group_match(tbl->groups[g].ctrl, h2);
+
+        while (mask) {
+            if (tbl->groups[g].ents[__builtin_ctz(mask)] == ent) {
+                return i + 1;
+            }
+
+            mask &= mask - 1;
+        }
+    }
+
+    return i;
+}
+
+static int
+_lz_kvmap_stats_hash_cmp(const void * a, const void * b) {
+    const lz_kvmap_ent * ea = *(lz_kvmap_ent * const *)a;
+    const lz_kvmap_ent * eb = *(lz_kvmap_ent * const *)b;
+
+    return (ea->hash > eb->hash) - (ea->hash < eb->hash);
+}
+
+/**
+ * @brief counts entries sharing a hash, and among those, entries sharing a
+ *        key, by sorting the entries on their hash
+ */
+static int
+_lz_kvmap_stats_dups(lz_kvmap * map, struct lz_kvmap_stats * stats) {
+    lz_kvmap_ent ** ents;
+    uint32_t        n = 0;
+    uint32_t        i;
+    uint32_t        j;
+    uint32_t        k;
+
+    if (map->n_entries == 0) {
+        return 0;
+    }
+
+    if (!(ents = malloc(sizeof(lz_kvmap_ent *) * map->n_entries))) {
+        return -1;
+    }
+
+    for (i = 0; i < map->n_dense && n < map->n_entries; i++) {
+        if (map->dense[i] != NULL) {
+            ents[n++] = map->dense[i];
+        }
+    }
+
+    qsort(ents, n, sizeof(lz_kvmap_ent *), _lz_kvmap_stats_hash_cmp);
+
+    for (i = 0; i < n; i = j) {
+        for (j = i + 1; j < n && ents[j]->hash == ents[i]->hash; j++) {
+            stats->n_collisions += 1;
+
+            for (k = i; k < j; k++) {
+                if (_lz_kvmap_ent_eq(ents[k], ents[j]->key, ents[j]->klen, ents[j]->hash)) {
+                    stats->n_dup_keys += 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    free(ents);
+
+    return 0;
+}
+
+int
+lz_kvmap_get_stats(lz_kvmap * map, struct lz_kvmap_stats * stats) {
+    struct lz_kvmap_slab * slab;
+    uint64_t               total     = 0;
+    uint32_t               non_empty = 0;
+    uint32_t               t;
+    uint32_t               b;
+
+    if (!map || !stats) {
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+
+    for (t = 0; t < 2; t++) {
+        struct lz_kvmap_tbl * tbl = &map->tbls[t];
+
+        if (tbl->n_buckets == 0) {
+            continue;
+        }
+
+        stats->n_buckets += tbl->n_buckets;
+
+        if (_lz_kvmap_is_open(map)) {
+            stats->n_bytes += sizeof(struct lz_kvmap_group) * (tbl->n_buckets / LZ_KVMAP_GROUP);
+
+            for (b = 0; b < tbl->n_buckets; b++) {
+                struct lz_kvmap_group * group = &tbl->groups[b / LZ_KVMAP_GROUP];
+                uint8_t                 ctrl  = group->ctrl[b % LZ_KVMAP_GROUP];
+                uint32_t                dist;
+
+                if (ctrl == LZ_KVMAP_CTRL_EMPTY) {
+                    stats->n_empty += 1;
+                    continue;
+                }
+
+                if (ctrl == LZ_KVMAP_CTRL_DELETED) {
+                    stats->n_tombstones += 1;
+                    continue;
+                }
+
+                dist   = _lz_kvmap_open_dist(tbl, group->ents[b % LZ_KVMAP_GROUP]);
+                total += dist;
+
+                stats->max_chain = dist > stats->max_chain ? dist : stats->max_chain;
+                stats->chain_hist[dist < LZ_KVMAP_STATS_HIST ? dist : LZ_KVMAP_STATS_HIST - 1] += 1;
+            }
+        } else {
+            stats->n_bytes += sizeof(lz_kvmap_ent *) * tbl->n_buckets;
+
+            for (b = 0; b < tbl->n_buckets; b++) {
+                lz_kvmap_ent * ent;
+                uint32_t       len = 0;
+
+                for (ent = tbl->ents[b]; ent != NULL; ent = ent->next) {
+                    len += 1;
+                }
+
+                if (len == 0) {
+                    stats->n_empty += 1;
+                } else {
+                    non_empty += 1;
+                    total     += len;
+                }
+
+                stats->max_chain = len > stats->max_chain ? len : stats->max_chain;
+                stats->chain_hist[len < LZ_KVMAP_STATS_HIST ? len : LZ_KVMAP_STATS_HIST - 1] += 1;
+            }
+        }
+    }
+
+    if (_lz_kvmap_is_open(map)) {
+        non_empty = map->n_entries;
+    }
+
+    stats->avg_chain = non_empty ? (double)total / non_empty : 0.0;
+
+    if (_lz_kvmap_stats_dups(map, stats) == -1) {
+        return -1;
+    }
+
+    stats->n_bytes += sizeof(lz_kvmap) + sizeof(lz_kvmap_ent *) * map->dense_size;
+    stats->n_bytes += sizeof(struct lz_kvmap_ttl) * map->ttls_size;
+
+    if (_lz_kvmap_is_arena(map)) {
+        for (slab = map->slabs; slab != NULL; slab = slab->next) {
+            stats->n_bytes += sizeof(struct lz_kvmap_slab) + slab->size;
+        }
+    } else {
+        for (b = 0; b < map->n_dense; b++) {
+            if (map->dense[b] != NULL) {
+                stats->n_bytes += sizeof(lz_kvmap_ent) + map->dense[b]->klen + 1;
+            }
+        }
+    }
+
+    if (map->filter != NULL) {
+        stats->n_bytes += sizeof(struct lz_kvmap_filter) + (size_t)map->filter->n_blocks * 64;
+    }
+
+    stats->n_entries = map->n_entries;
+    stats->n_grows   = map->n_grows;
+    stats->n_shrinks = map->n_shrinks;
+    stats->n_purges  = map->n_purges;
+    stats->rehashing = _lz_kvmap_is_rehashing(map);
+    stats->counters  = map->counters;
+
+    return 0;
+} /* lz_kvmap_get_stats */
+
+void
+lz_kvmap_reset_counters(lz_kvmap * map) {
+    if (!map) {
+        return;
+    }
+
+    memset(&map->counters, 0, sizeof(map->counters));
+}
@@ -7,8 +7,39 @@ typedef struct lz_kvmap_s     lz_kvmap;
 typedef struct lz_kvmap_ent_s lz_kvmap_ent;
 
 typedef int (* lz_kvmap_iterfn)(lz_kvmap_ent * ent, void * arg);
+typedef uint32_t (* lz_kvmap_hashfn)(const char * key, size_t len);
+typedef uint64_t (* lz_kvmap_clockfn)(void * arg);
+
+enum lz_kvmap_flags {
+    /* open addressing with SIMD probed metadata instead of bucket chains,
+     * n_buckets passed to lz_kvmap_new_flags() is then the expected size */
+    LZ_KVMAP_F_OPEN  = (1 << 0),
+    /* entries and keys are carved from slabs owned by the map. Removed
+     * entries are only reclaimed by lz_kvmap_clear() / lz_kvmap_free(), which
+     * release whole slabs: meant for maps that are built, queried and
+     * thrown away */
+    LZ_KVMAP_F_ARENA = (1 << 1),
+    /* entries and keys come from the size classes of lz_alloc() instead of
+     * malloc(): cheaper to churn and to free in bulk, but the memory stays
+     * with lz_alloc until lz_alloc_trim(). Ignored with LZ_KVMAP_F_ARENA */
+    LZ_KVMAP_F_ALLOC = (1 << 2),
+};
+
+enum lz_kvmap_hash_type {
+    LZ_KVMAP_HASH_DEFAULT = 0, /* currently LZ_KVMAP_HASH_WY */
+    LZ_KVMAP_HASH_WY,
+    LZ_KVMAP_HASH_FNV,
+    LZ_KVMAP_HASH_CRC32,
+    LZ_KVMAP_HASH_MURMUR2,
+    LZ_KVMAP_HASH_JENKINS,
+    LZ_KVMAP_HASH_DJB2,
+    LZ_KVMAP_HASH_CUSTOM,      /* user supplied lz_kvmap_hashfn */
+};
 
 LZ_EXPORT lz_kvmap     * lz_kvmap_new(uint32_t n_buckets);
+LZ_EXPORT lz_kvmap     * lz_kvmap_new_flags(uint32_t n_buckets, int flags);
+LZ_EXPORT lz_kvmap     * lz_kvmap_new_with_hash(uint32_t n_buckets, int flags, enum lz_kvmap_hash_type type, lz_kvmap_hashfn hashfn);
+/* NOTE: lz_kvmap_add does not check for an existing key, use lz_kvmap_upsert for set semantics */
 LZ_EXPORT lz_kvmap_ent * lz_kvmap_add(lz_kvmap * map, const char * k, void * v, void (* freefn)(void *));
 LZ_EXPORT lz_kvmap_ent * lz_kvmap_add_wklen(lz_kvmap * map, const char * k, size_t l, void * val, void (* freefn)(void *));
 LZ_EXPORT lz_kvmap_ent * lz_kvmap_ent_find(lz_kvmap * map, const char * k);
@@ -24,3 +55,209 @@ LZ_EXPORT size_t         lz_kvmap_ent_get_klen(lz_kvmap_ent * ent);
 LZ_EXPORT size_t         lz_kvmap_get_size(lz_kvmap * map);
 LZ_EXPORT int            lz_kvmap_remove(lz_kvmap * map, const char * key);
 LZ_EXPORT int            lz_kvmap_remove_ent(lz_kvmap * map, lz_kvmap_ent * ent);
+
+/*
+ * length-aware variants: keys are compared by length and bytes, so they do
+ * not have to be NUL terminated and may contain NULs.
+ */
+LZ_EXPORT lz_kvmap_ent * lz_kvmap_ent_find_wklen(lz_kvmap * map, const char * k, size_t l);
+LZ_EXPORT void         * lz_kvmap_find_wklen(lz_kvmap * map, const char * k, size_t l);
+LZ_EXPORT int            lz_kvmap_remove_wklen(lz_kvmap * map, const char * k, size_t l);
+
+/*
+ * prehashed variants: hash a key once with lz_kvmap_hash_key() and pass the
+ * result along to any number of operations on the same map. The hash is only
+ * valid for the map (hash function) it was computed with.
+ */
+LZ_EXPORT uint32_t       lz_kvmap_hash_key(lz_kvmap * map, const char * k, size_t l);
+LZ_EXPORT lz_kvmap_ent * lz_kvmap_ent_find_wkhash(lz_kvmap * map, const char * k, size_t l, uint32_t hash);
+LZ_EXPORT void         * lz_kvmap_find_wkhash(lz_kvmap * map, const char * k, size_t l, uint32_t hash);
+LZ_EXPORT lz_kvmap_ent * lz_kvmap_add_wkhash(lz_kvmap * map, const char * k, size_t l, uint32_t hash, void * val, void (* freefn)(void *));
+LZ_EXPORT int            lz_kvmap_remove_wkhash(lz_kvmap * map, const char * k, size_t l, uint32_t hash);
+
+/**
+ * @brief returns the built-in hash function of `type`, or NULL for
+ *        LZ_KVMAP_HASH_CUSTOM / unknown types.
+ */
+LZ_EXPORT lz_kvmap_hashfn lz_kvmap_get_hashfn(enum lz_kvmap_hash_type type);
+
+/**
+ * @brief the 64-bit hash behind LZ_KVMAP_HASH_WY, for containers that want
+ *        to share the kvmap hashing.
+ */
+LZ_EXPORT uint64_t lz_kvmap_hash64(const void * key, size_t len, uint64_t seed);
+
+/**
+ * @brief looks up `k` and, if it is not in the map, inserts a new entry with a
+ *        NULL value. Either way the key is hashed once and the table probed
+ *        once; the caller can fill in a new entry with lz_kvmap_ent_set_val().
+ *
+ * @param created set to 1 if the entry was inserted, 0 if it already existed
+ *
+ * @return the entry, NULL on error
+ */
+LZ_EXPORT lz_kvmap_ent * lz_kvmap_find_or_insert(lz_kvmap * map, const char * k, size_t l, int * created);
+LZ_EXPORT lz_kvmap_ent * lz_kvmap_find_or_insert_wkhash(lz_kvmap * map, const char * k, size_t l, uint32_t hash, int * created);
+
+/**
+ * @brief inserts or replaces the value of `k` in a single probe. When a value
+ *        is replaced the old value's freefn is called on it.
+ *
+ * @param created set to 1 if the entry was inserted, 0 if it was replaced
+ */
+LZ_EXPORT lz_kvmap_ent * lz_kvmap_upsert(lz_kvmap * map, const char * k, size_t l, void * val, void (* freefn)(void *), int * created);
+
+/**
+ * @brief sets the value of an entry in place. The previous value is not
+ *        released.
+ */
+LZ_EXPORT void lz_kvmap_ent_set_val(lz_kvmap_ent * ent, void * val, void (* freefn)(void *));
+
+/**
+ * @brief looks up `n` keys at once. The keys are hashed and their buckets
+ *        and first entries prefetched a batch at a time before any of them
+ *        is resolved, so the cache misses of the batch overlap instead of
+ *        being taken one after the other.
+ *
+ * @param keys the keys, a NULL key is never found
+ * @param lens the key lengths, or NULL if the keys are NUL terminated
+ * @param out set to the value (or entry) of each key, NULL if not found
+ *
+ * @return the number of keys found
+ */
+LZ_EXPORT size_t lz_kvmap_find_batch(lz_kvmap * map, const char * const * keys, const size_t * lens, void ** out, size_t n);
+LZ_EXPORT size_t lz_kvmap_ent_find_batch(lz_kvmap * map, const char * const * keys, const size_t * lens, lz_kvmap_ent ** out, size_t n);
+
+/**
+ * @brief gives the entry a time to live in milliseconds, replacing any ttl it
+ *        had. A ttl of 0 makes the entry persistent again.
+ *
+ *        Expired entries are reclaimed lazily: a lookup (or find_or_insert /
+ *        upsert) that runs into one removes it and reports a miss. Expired
+ *        entries nobody looks up again are reclaimed by lz_kvmap_expire().
+ *        Until then they still show up in iteration and lz_kvmap_get_size().
+ */
+LZ_EXPORT void lz_kvmap_ent_set_ttl(lz_kvmap_ent * ent, uint64_t ttl);
+
+/**
+ * @return the milliseconds left to live, 0 if expired, -1 if it has no ttl
+ */
+LZ_EXPORT int64_t lz_kvmap_ent_get_ttl(lz_kvmap_ent * ent);
+
+/**
+ * @brief removes up to `max` expired entries. Entries with a ttl are kept in
+ *        a min-heap on their expiry time, so this only ever looks at entries
+ *        that are due and each removal is O(log n). Meant to be called
+ *        periodically, e.g. from a timer, with a small `max`.
+ *
+ * @return the number of entries removed
+ */
+LZ_EXPORT size_t lz_kvmap_expire(lz_kvmap * map, size_t max);
+
+/**
+ * @brief sets the clock ttls are measured against, in milliseconds. By
+ *        default this is CLOCK_MONOTONIC(_COARSE).
+ */
+LZ_EXPORT void lz_kvmap_set_clock(lz_kvmap * map, lz_kvmap_clockfn clockfn, void * arg);
+
+/**
+ * @brief incremental, stateless iteration: calls iterfn for at most `count`
+ *        entries, starting from `cursor` (0 to start a scan), and returns the
+ *        cursor to continue from, 0 once the scan is complete.
+ *
+ *        The map may be modified freely between calls, and iterfn may remove
+ *        the entry it is called with. Every entry present for the whole scan
+ *        is visited at least once, whatever was added, removed or resized in
+ *        between; an entry may be visited more than once, entries added or
+ *        removed during the scan may or may not be. A non-zero return from
+ *        iterfn ends the call early, the cursor returned resumes after that
+ *        entry.
+ */
+LZ_EXPORT uint64_t lz_kvmap_scan(lz_kvmap * map, uint64_t cursor, size_t count,
+    lz_kvmap_iterfn iterfn, void * arg);
+
+struct lz_kvmap_filter_stats {
+    uint64_t negatives;       /* lookups answered by the filter alone */
+    uint64_t positives;       /* lookups passed on to the table */
+    uint64_t false_positives; /* ...that did not find the key */
+    size_t   n_bytes;
+    uint32_t n_hashes;
+    uint32_t capacity;        /* keys the filter is currently sized for */
+    uint32_t n_stale;         /* removed keys still set in the filter */
+};
+
+/**
+ * @brief puts a blocked bloom filter in front of the map's lookups, for maps
+ *        where most lookups miss. A lookup the filter rules out returns
+ *        without touching the table; one that gets past it costs an extra
+ *        cache line. The filter is kept up to date by add / remove, and is
+ *        rebuilt from the map's entries (an O(n) step during an add) when it
+ *        fills up or most of the keys it holds have been removed.
+ *
+ * @param fp_rate the target false positive rate, e.g. 0.01
+ * @param max_bytes caps the filter's size, 0 for none. A capped filter
+ *        trades a higher false positive rate for memory.
+ *
+ * @return 0 on success, -1 on error. Enabling it again resizes it.
+ */
+LZ_EXPORT int  lz_kvmap_filter_enable(lz_kvmap * map, double fp_rate, size_t max_bytes);
+LZ_EXPORT void lz_kvmap_filter_disable(lz_kvmap * map);
+
+/**
+ * @return 0 on success, -1 if the map has no filter
+ */
+LZ_EXPORT int lz_kvmap_filter_get_stats(lz_kvmap * map, struct lz_kvmap_filter_stats * stats);
+
+/*
+ * hot path counters, only kept when liblz is built with LZ_KVMAP_STATS
+ * (cmake -DENABLE_KVMAP_STATS=On), zero otherwise. A map is only ever used
+ * by one thread at a time, so they are plain per-map increments.
+ */
+struct lz_kvmap_counters {
+    uint64_t lookups;         /* finds, including batched and find_or_insert, not removes */
+    uint64_t hits;
+    uint64_t probes;          /* entries compared (chained) or groups visited (open), by lookups and removes */
+    uint64_t inserts;
+    uint64_t removes;
+};
+
+#define LZ_KVMAP_STATS_HIST 16
+
+struct lz_kvmap_stats {
+    uint32_t n_entries;
+    uint32_t n_buckets;       /* buckets, or slots for open addressing, in both tables while resizing */
+    uint32_t n_empty;         /* empty buckets / EMPTY slots */
+    uint32_t n_tombstones;    /* DELETED slots, open addressing only */
+    uint32_t max_chain;       /* longest chain, or most groups probed to reach an entry */
+    double   avg_chain;       /* mean length of the non-empty chains, or mean groups probed */
+
+    /*
+     * chained: buckets by chain length, open addressing: entries by the
+     * number of groups probed to reach them, 1 being the home group. The last
+     * one counts that length and anything above it.
+     */
+    uint32_t chain_hist[LZ_KVMAP_STATS_HIST];
+
+    /* k entries sharing one hash (or key) count as k - 1: the extra ones */
+    uint32_t n_collisions;    /* entries whose 32 bit hash another entry already has */
+    uint32_t n_dup_keys;      /* entries whose key another entry already has (lz_kvmap_add allows them) */
+
+    uint32_t n_grows;         /* resizes started since the map was created */
+    uint32_t n_shrinks;
+    uint32_t n_purges;        /* open addressing rebuilds at the same size, to drop tombstones */
+    int      rehashing;
+
+    size_t   n_bytes;         /* tables, dense array, entries (or slabs), ttl heap and filter */
+
+    struct lz_kvmap_counters counters;
+};
+
+/**
+ * @brief fills in a snapshot of the map's occupancy. The structural figures
+ *        are computed by walking every bucket and entry, so this is O(n) and
+ *        meant for diagnostics, not the hot path.
+ *
+ * @return 0 on success, -1 on error
+ */
+LZ_EXPORT int  lz_kvmap_get_stats(lz_kvmap * map, struct lz_kvmap_stats * stats);
+LZ_EXPORT void lz_kvmap_reset_counters(lz_kvmap * map);
@@ -0,0 +1,667 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+/*
+ * file layout, every section starts 8 byte aligned:
+ *
+ *   header
+ *   uint32_t       disp[n_buckets]  per bucket pilot, or a direct slot index
+ *   frozen_slot    slots[n_entries] one per key, in hash order
+ *   blob                            per slot: u32 klen, u32 vlen, key, NUL,
+ *                                   value (8 byte aligned), NUL
+ *
+ * A key hashes (wyhash, with the seed in the header) to a bucket. The
+ * bucket's pilot, mixed with the hash, gives the key's slot. Buckets are
+ * placed largest first; buckets of a single key are placed last, straight
+ * into one of the remaining free slots, which is what makes a table with
+ * exactly one slot per key cheap to build.
+ */
+
+#define FROZEN_MAGIC         "LZKVFRZ1"
+#define FROZEN_VERSION       1
+
+/* average number of keys per bucket */
+#define FROZEN_BUCKET_LOAD   3
+
+/* marks a displacement as a direct slot index */
+#define FROZEN_DIRECT        0x80000000U
+
+/* pilots tried per bucket, and seeds tried per freeze, before giving up */
+#define FROZEN_MAX_PILOT     (1U << 20)
+#define FROZEN_MAX_SEEDS     16
+
+struct frozen_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t n_entries;
+    uint32_t n_buckets;
+    uint32_t reserved;
+    uint64_t seed;
+    uint64_t disp_off;
+    uint64_t slot_off;
+    uint64_t blob_off;
+    uint64_t file_len;
+};
+
+struct frozen_slot {
+    uint32_t fp;   /* low half of the key's hash */
+    uint32_t klen;
+    uint64_t off;  /* record offset from blob_off */
+};
+
+struct frozen_rec {
+    uint32_t klen;
+    uint32_t vlen;
+    char     data[];
+};
+
+struct lz_kvmap_frozen_s {
+    const char               * base;
+    size_t                     len;
+    const struct frozen_header * hdr;
+    const uint32_t           * disp;
+    const struct frozen_slot * slots;
+    const char               * blob;
+    uint64_t                   blob_len;
+};
+
+/* build state, indexed by the order the map iterates its entries */
+struct frozen_key {
+    lz_kvmap_ent * ent;
+    uint64_t       hash;
+    uint32_t       bucket;
+    const void   * val;
+    size_t         vlen;
+};
+
+/* records: the value starts at frozen_val_off_(), the next record at
+ * frozen_rec_len_() */
+#define frozen_val_off_(klen)       lz_align(sizeof(struct frozen_rec) + (uint64_t)(klen) + 1, 8)
+#define frozen_rec_len_(klen, vlen) lz_align(frozen_val_off_(klen) + (uint64_t)(vlen) + 1, 8)
+
+static inline uint32_t
+frozen_range_(uint64_t x, uint32_t n)
+{
+    return (uint32_t)(((x & 0xffffffff) * n) >> 32);
+}
+
+static inline uint32_t
+frozen_bucket_(uint64_t hash, uint32_t n_buckets)
+{
+    return frozen_range_(hash >> 32, n_buckets);
+}
+
+static inline uint32_t
+frozen_slot_(uint64_t hash, uint32_t pilot, uint32_t n_slots)
+{
+    uint64_t x = hash ^ (pilot * 0x9e3779b97f4a7c15ULL);
+
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+
+    return frozen_range_(x, n_slots);
+}
+
+#define frozen_bit_get_(bits, i) ((bits)[(i) >> 6] & (1ULL << ((i) & 63)))
+#define frozen_bit_set_(bits, i) ((bits)[(i) >> 6] |= (1ULL << ((i) & 63)))
+
+/**
+ * @brief finds a pilot for every bucket, or gives up so the caller can try
+ *        another seed.
+ *
+ * @param keys the keys, their hash and bucket already set
+ * @param order keys grouped per bucket, start[b] .. start[b + 1]
+ * @param disp[out] displacements
+ * @param slot_key[out] the key index stored in each slot
+ *
+ * @return 0 on success, -1 if no pilot was found for a bucket, -2 (with
+ *         errno set) if no seed can work: two equal keys (EINVAL), or out of
+ *         memory
+ */
+static int
+frozen_place_(struct frozen_key * keys, uint32_t n, uint32_t n_buckets,
+              const uint32_t * order, const uint32_t * start,
+              uint32_t * disp, uint32_t * slot_key)
+{
+    uint32_t * by_size;
+    uint32_t * cnt;
+    uint64_t * taken;
+    uint32_t   tried[64];
+    uint32_t   max_size = 0;
+    uint32_t   free_slot = 0;
+    uint32_t   b;
+    uint32_t   i;
+    int        res = -1;
+
+    for (b = 0; b < n_buckets; b++)
+    {
+        if (start[b + 1] - start[b] > max_size)
+        {
+            max_size = start[b + 1] - start[b];
+        }
+    }
+
+    /* a bucket this large means the hash is hopeless for this seed */
+    if (max_size > 64)
+    {
+        return -1;
+    }
+
+    by_size = malloc(sizeof(uint32_t) * n_buckets);
+    cnt     = calloc(max_size + 2, sizeof(uint32_t));
+    taken   = calloc(n / 64 + 1, sizeof(uint64_t));
+
+    if (!by_size || !cnt || !taken)
+    {
+        res = -2;
+        goto end;
+    }
+
+    /* counting sort, largest buckets first */
+    for (b = 0; b < n_buckets; b++)
+    {
+        cnt[max_size - (start[b + 1] - start[b]) + 1]++;
+    }
+
+    for (i = 1; i <= max_size + 1; i++)
+    {
+        cnt[i] += cnt[i - 1];
+    }
+
+    for (b = 0; b < n_buckets; b++)
+    {
+        by_size[cnt[max_size - (start[b + 1] - start[b])]++] = b;
+    }
+
+    for (i = 0; i < n_buckets; i++)
+    {
+        uint32_t bkt  = by_size[i];
+        uint32_t size = start[bkt + 1] - start[bkt];
+        uint32_t pilot;
+        uint32_t j;
+        uint32_t k;
+
+        if (size == 0)
+        {
+            disp[bkt] = 0;
+            continue;
+        }
+
+        if (size == 1)
+        {
+            while (frozen_bit_get_(taken, free_slot))
+            {
+                free_slot++;
+            }
+
+            disp[bkt] = FROZEN_DIRECT | free_slot;
+            slot_key[free_slot] = order[start[bkt]];
+            frozen_bit_set_(taken, free_slot);
+
+            continue;
+        }
+
+        /* keys with the same hash land on the same slot for every pilot:
+         * equal keys will do that under every seed too, so stop here rather
+         * than search for a pilot that does not exist */
+        for (j = 1; j < size; j++)
+        {
+            const struct frozen_key * a = &keys[order[start[bkt] + j]];
+
+            for (k = 0; k < j; k++)
+            {
+                const struct frozen_key * b = &keys[order[start[bkt] + k]];
+
+                if (a->hash != b->hash)
+                {
+                    continue;
+                }
+
+                if (lz_kvmap_ent_get_klen(a->ent) == lz_kvmap_ent_get_klen(b->ent) &&
+                    !memcmp(lz_kvmap_ent_key(a->ent), lz_kvmap_ent_key(b->ent),
+                            lz_kvmap_ent_get_klen(a->ent)))
+                {
+                    errno = EINVAL;
+                    res   = -2;
+                }
+
+                goto end;
+            }
+        }
+
+        for (pilot = 0; pilot < FROZEN_MAX_PILOT; pilot++)
+        {
+            for (j = 0; j < size; j++)
+            {
+                uint32_t s = frozen_slot_(keys[order[start[bkt] + j]].hash, pilot, n);
+
+                if (frozen_bit_get_(taken, s))
+                {
+                    break;
+                }
+
+                for (k = 0; k < j && tried[k] != s; k++)
+                {
+                }
+
+                if (k < j)
+                {
+                    break;
+                }
+
+                tried[j] = s;
+            }
+
+            if (j == size)
+            {
+                break;
+            }
+        }
+
+        if (pilot == FROZEN_MAX_PILOT)
+        {
+            goto end;
+        }
+
+        disp[bkt] = pilot;
+
+        for (j = 0; j < size; j++)
+        {
+            slot_key[tried[j]] = order[start[bkt] + j];
+            frozen_bit_set_(taken, tried[j]);
+        }
+    }
+
+    res = 0;
+end:
+    free(by_size);
+    free(cnt);
+    free(taken);
+
+    return res;
+} /* frozen_place_ */
+
+static int
+frozen_write_(const char * path, const struct frozen_header * hdr,
+              const uint32_t * disp, const struct frozen_key * keys,
+              const uint32_t * slot_key)
+{
+    static const char pad[8] = { 0 };
+    struct frozen_slot slot;
+    struct frozen_rec  rec;
+    FILE             * fp;
+    uint64_t           off;
+    uint32_t           i;
+
+    if (!(fp = fopen(path, "wb")))
+    {
+        return -1;
+    }
+
+    fwrite(hdr, sizeof(*hdr), 1, fp);
+    fwrite(disp, sizeof(uint32_t), hdr->n_buckets, fp);
+    fwrite(pad, 1, hdr->slot_off - hdr->disp_off - sizeof(uint32_t) * hdr->n_buckets, fp);
+
+    for (i = 0, off = 0; i < hdr->n_entries; i++)
+    {
+        const struct frozen_key * key = &keys[slot_key[i]];
+
+        slot.fp   = (uint32_t)key->hash;
+        slot.klen = (uint32_t)lz_kvmap_ent_get_klen(key->ent);
+        slot.off  = off;
+
+        fwrite(&slot, sizeof(slot), 1, fp);
+
+        off += frozen_rec_len_(slot.klen, key->vlen);
+    }
+
+    for (i = 0; i < hdr->n_entries; i++)
+    {
+        const struct frozen_key * key = &keys[slot_key[i]];
+        uint64_t                  val_off;
+
+        rec.klen = (uint32_t)lz_kvmap_ent_get_klen(key->ent);
+        rec.vlen = (uint32_t)key->vlen;
+        val_off  = frozen_val_off_(rec.klen);
+
+        fwrite(&rec, sizeof(rec), 1, fp);
+        fwrite(lz_kvmap_ent_key(key->ent), 1, rec.klen, fp);
+        fwrite(pad, 1, val_off - sizeof(rec) - rec.klen, fp);
+        fwrite(key->val, 1, rec.vlen, fp);
+        fwrite(pad, 1, frozen_rec_len_(rec.klen, rec.vlen) - val_off - rec.vlen, fp);
+    }
+
+    if (ferror(fp) | fclose(fp))
+    {
+        unlink(path);
+        return -1;
+    }
+
+    return 0;
+} /* frozen_write_ */
+
+static int
+frozen_valfn_str_(lz_kvmap_ent * ent, const void ** data, size_t * len, void * arg)
+{
+    const char * val = lz_kvmap_ent_val(ent);
+
+    (void)arg;
+
+    *data = val;
+    *len  = val ? strlen(val) : 0;
+
+    return 0;
+}
+
+static int
+kvmap_freeze_(lz_kvmap * map, const char * path, lz_kvmap_freeze_valfn valfn, void * arg)
+{
+    struct frozen_header hdr;
+    struct frozen_key  * keys     = NULL;
+    uint32_t           * order    = NULL;
+    uint32_t           * start    = NULL;
+    uint32_t           * disp     = NULL;
+    uint32_t           * slot_key = NULL;
+    lz_kvmap_ent       * ent;
+    char               * tmp      = NULL;
+    uint64_t             blob_len = 0;
+    size_t               n;
+    uint32_t             n_buckets;
+    uint32_t             i;
+    int                  try;
+    int                  placed;
+    int                  res = -1;
+
+    if (lz_unlikely(!map || !path))
+    {
+        return -1;
+    }
+
+    if ((n = lz_kvmap_get_size(map)) >= FROZEN_DIRECT)
+    {
+        errno = EFBIG;
+        return -1;
+    }
+
+    if (valfn == NULL)
+    {
+        valfn = frozen_valfn_str_;
+    }
+
+    n_buckets = n / FROZEN_BUCKET_LOAD + 1;
+
+    keys      = malloc(sizeof(struct frozen_key) * (n + 1));
+    order     = malloc(sizeof(uint32_t) * (n + 1));
+    start     = malloc(sizeof(uint32_t) * (n_buckets + 1));
+    disp      = malloc(sizeof(uint32_t) * n_buckets);
+    slot_key  = malloc(sizeof(uint32_t) * (n + 1));
+    tmp       = malloc(strlen(path) + sizeof(".tmp"));
+
+    if (!keys || !order || !start || !disp || !slot_key || !tmp)
+    {
+        goto end;
+    }
+
+    for (i = 0, ent = lz_kvmap_first(map); ent != NULL; ent = lz_kvmap_next(ent), i++)
+    {
+        keys[i].ent = ent;
+
+        if (valfn(ent, &keys[i].val, &keys[i].vlen, arg) != 0)
+        {
+            goto end;
+        }
+
+        if (lz_kvmap_ent_get_klen(ent) > UINT32_MAX || keys[i].vlen > UINT32_MAX)
+        {
+            errno = EFBIG;
+            goto end;
+        }
+
+        blob_len += frozen_rec_len_(lz_kvmap_ent_get_klen(ent), keys[i].vlen);
+    }
+
+    for (try = 0; try < FROZEN_MAX_SEEDS; try++)
+    {
+        uint64_t seed = lz_kvmap_hash64(&try, sizeof(try), 0x6c7a6b76667a6e31ULL);
+
+        memset(start, 0, sizeof(uint32_t) * (n_buckets + 1));
+
+        for (i = 0; i < n; i++)
+        {
+            keys[i].hash   = lz_kvmap_hash64(lz_kvmap_ent_key(keys[i].ent),
+                                             lz_kvmap_ent_get_klen(keys[i].ent), seed);
+            keys[i].bucket = frozen_bucket_(keys[i].hash, n_buckets);
+
+            start[keys[i].bucket + 1]++;
+        }
+
+        for (i = 0; i < n_buckets; i++)
+        {
+            start[i + 1] += start[i];
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            order[start[keys[i].bucket]++] = i;
+        }
+
+        /* the fill above moved each start to the next bucket's */
+        memmove(start + 1, start, sizeof(uint32_t) * n_buckets);
+        start[0] = 0;
+
+        if ((placed = frozen_place_(keys, n, n_buckets, order, start, disp, slot_key)) == 0)
+        {
+            hdr.seed = seed;
+            break;
+        }
+
+        if (placed == -2)
+        {
+            goto end;
+        }
+    }
+
+    if (try == FROZEN_MAX_SEEDS)
+    {
+        errno = EAGAIN;
+        goto end;
+    }
+
+    memcpy(hdr.magic, FROZEN_MAGIC, sizeof(hdr.magic));
+
+    hdr.version   = FROZEN_VERSION;
+    hdr.n_entries = (uint32_t)n;
+    hdr.n_buckets = n_buckets;
+    hdr.reserved  = 0;
+    hdr.disp_off  = sizeof(hdr);
+    hdr.slot_off  = lz_align(hdr.disp_off + sizeof(uint32_t) * n_buckets, 8);
+    hdr.blob_off  = hdr.slot_off + sizeof(struct frozen_slot) * n;
+    hdr.file_len  = hdr.blob_off + blob_len;
+
+    sprintf(tmp, "%s.tmp", path);
+
+    if (frozen_write_(tmp, &hdr, disp, keys, slot_key) != 0)
+    {
+        goto end;
+    }
+
+    if (rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+        goto end;
+    }
+
+    res = 0;
+end:
+    free(keys);
+    free(order);
+    free(start);
+    free(disp);
+    free(slot_key);
+    free(tmp);
+
+    return res;
+} /* kvmap_freeze_ */
+
+static lz_kvmap_frozen *
+kvmap_frozen_open_(const char * path)
+{
+    const struct frozen_header * hdr;
+    lz_kvmap_frozen            * frozen;
+    struct stat                  st;
+    void                       * base;
+    int                          fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+    {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct frozen_header))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    hdr = base;
+
+    if (memcmp(hdr->magic, FROZEN_MAGIC, sizeof(hdr->magic)) ||
+        hdr->version != FROZEN_VERSION ||
+        hdr->file_len != (uint64_t)st.st_size ||
+        hdr->n_buckets == 0 ||
+        hdr->disp_off + sizeof(uint32_t) * (uint64_t)hdr->n_buckets > hdr->slot_off ||
+        hdr->slot_off + sizeof(struct frozen_slot) * (uint64_t)hdr->n_entries != hdr->blob_off ||
+        hdr->blob_off > hdr->file_len)
+    {
+        munmap(base, st.st_size);
+        errno = EINVAL;
+
+        return NULL;
+    }
+
+    if (!(frozen = malloc(sizeof(lz_kvmap_frozen))))
+    {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    frozen->base  = base;
+    frozen->len   = st.st_size;
+    frozen->hdr   = hdr;
+    frozen->disp  = (const uint32_t *)(frozen->base + hdr->disp_off);
+    frozen->slots = (const struct frozen_slot *)(frozen->base + hdr->slot_off);
+    frozen->blob  = frozen->base + hdr->blob_off;
+
+    frozen->blob_len = hdr->file_len - hdr->blob_off;
+
+    return frozen;
+} /* kvmap_frozen_open_ */
+
+static void
+kvmap_frozen_close_(lz_kvmap_frozen * frozen)
+{
+    if (frozen == NULL)
+    {
+        return;
+    }
+
+    munmap((void *)frozen->base, frozen->len);
+    free(frozen);
+}
+
+static const void *
+kvmap_frozen_find_(lz_kvmap_frozen * frozen, const char * k, size_t l, size_t * vlen)
+{
+    const struct frozen_header * hdr = frozen->hdr;
+    const struct frozen_slot   * slot;
+    const struct frozen_rec    * rec;
+    uint64_t                     hash;
+    uint32_t                     d;
+
+    if (lz_unlikely(hdr->n_entries == 0))
+    {
+        return NULL;
+    }
+
+    hash = lz_kvmap_hash64(k, l, hdr->seed);
+    d    = frozen->disp[frozen_bucket_(hash, hdr->n_buckets)];
+
+    if (d & FROZEN_DIRECT)
+    {
+        if ((d &= ~FROZEN_DIRECT) >= hdr->n_entries)
+        {
+            return NULL;
+        }
+    } else {
+        d = frozen_slot_(hash, d, hdr->n_entries);
+    }
+
+    /* a key that is not in the table still lands on some slot */
+    slot = &frozen->slots[d];
+
+    if (slot->fp != (uint32_t)hash || slot->klen != l)
+    {
+        return NULL;
+    }
+
+    /* the whole record has to be inside the blob, checked without letting
+     * off + len wrap around */
+    if (lz_unlikely(slot->off > frozen->blob_len ||
+                    frozen->blob_len - slot->off < sizeof(*rec)))
+    {
+        return NULL;
+    }
+
+    rec = (const struct frozen_rec *)(frozen->blob + slot->off);
+
+    if (lz_unlikely(rec->klen != l ||
+                    frozen->blob_len - slot->off < frozen_rec_len_(rec->klen, rec->vlen)))
+    {
+        return NULL;
+    }
+
+    if (memcmp(rec->data, k, l))
+    {
+        return NULL;
+    }
+
+    if (vlen != NULL)
+    {
+        *vlen = rec->vlen;
+    }
+
+    return (const char *)rec + frozen_val_off_(rec->klen);
+}
+
+static size_t
+kvmap_frozen_get_size_(lz_kvmap_frozen * frozen)
+{
+    return frozen ? frozen->hdr->n_entries : 0;
+}
+
+lz_alias(kvmap_freeze_, lz_kvmap_freeze);
+lz_alias(kvmap_frozen_open_, lz_kvmap_frozen_open);
+lz_alias(kvmap_frozen_close_, lz_kvmap_frozen_close);
+lz_alias(kvmap_frozen_find_, lz_kvmap_frozen_find);
+lz_alias(kvmap_frozen_get_size_, lz_kvmap_frozen_get_size);
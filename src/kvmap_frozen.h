@@ -0,0 +1,79 @@
+#pragma once
+
+#include <liblz.h>
+
+/*
+ * lz_kvmap_frozen: a read-only snapshot of an lz_kvmap.
+ *
+ * lz_kvmap_freeze() writes the map out as a single file: a minimal perfect
+ * hash over the keys, a slot per key, and a blob with the keys and values.
+ * lz_kvmap_frozen_open() maps that file and serves lookups straight out of
+ * the mapping, with no per-entry allocation, so every process opening the
+ * same file shares one page cache copy of it.
+ *
+ * The file is in host byte order, and is only meant to be read on the kind
+ * of machine that wrote it.
+ */
+
+struct lz_kvmap_frozen_s;
+
+typedef struct lz_kvmap_frozen_s lz_kvmap_frozen;
+
+
+/**
+ * @brief called by lz_kvmap_freeze() for each entry to serialize its value.
+ *
+ * @param[in] ent the entry
+ * @param[out] data the bytes to store as the value, only read until the next
+ *                  call
+ * @param[out] len the number of bytes
+ * @param[in] arg the arg passed to lz_kvmap_freeze()
+ *
+ * @return 0 on success, -1 on error to abort the freeze
+ */
+typedef int (* lz_kvmap_freeze_valfn)(lz_kvmap_ent * ent, const void ** data,
+    size_t * len, void * arg);
+
+
+/**
+ * @brief writes a frozen copy of the map to path. The file is written next
+ *        to path and renamed over it, so processes that still have the old
+ *        one mapped are not affected.
+ *
+ * @param map the map, NUL bytes in keys are fine
+ * @param path where to write the file
+ * @param valfn serializes values, if NULL every value is taken to be a
+ *              NUL terminated string (or NULL, stored as an empty value)
+ * @param arg passed to valfn
+ *
+ * @return 0 on success, -1 on error. errno is EINVAL if the map holds the
+ *         same key more than once (lz_kvmap_add() allows it): a frozen map
+ *         has one value per key, so remove the duplicates first. EAGAIN
+ *         means no perfect hash was found for the keys.
+ */
+LZ_EXPORT int lz_kvmap_freeze(lz_kvmap * map, const char * path,
+    lz_kvmap_freeze_valfn valfn, void * arg);
+
+
+/**
+ * @brief maps a file written by lz_kvmap_freeze()
+ *
+ * @return NULL on error, or if the file is not a valid frozen map
+ */
+LZ_EXPORT lz_kvmap_frozen * lz_kvmap_frozen_open(const char * path);
+LZ_EXPORT void              lz_kvmap_frozen_close(lz_kvmap_frozen * frozen);
+
+
+/**
+ * @brief O(1) lookup, one probe into the displacement table and one slot.
+ *
+ * @param[out] vlen if not NULL, set to the length of the value
+ *
+ * @return a pointer into the mapping, valid until lz_kvmap_frozen_close(),
+ *         or NULL if the key is not found. Values are always followed by a
+ *         NUL byte, so string values can be used as they are.
+ */
+LZ_EXPORT const void * lz_kvmap_frozen_find(lz_kvmap_frozen * frozen,
+    const char * k, size_t l, size_t * vlen);
+
+LZ_EXPORT size_t lz_kvmap_frozen_get_size(lz_kvmap_frozen * frozen);
@@ -0,0 +1,730 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define KVMAP_MT_CACHELINE      64
+#define KVMAP_MT_SHARDS_DEFAULT 64
+#define KVMAP_MT_BUCKETS_MIN    16
+
+/* reader counters, threads are spread over these by a per-thread index */
+#define KVMAP_MT_READER_SLOTS   64
+
+/* number of retired entries after which a writer tries to reclaim them */
+#define KVMAP_MT_RETIRE_BATCH   256
+
+/* how many chain links a reader follows between checks for a resize */
+#define KVMAP_MT_SEQ_CHECK      64
+
+#define kvmap_mt_load_(p)       __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define kvmap_mt_store_(p, v)   __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+struct lz_kvmap_mt_ent_s {
+    lz_kvmap_mt_ent * next;          /* chain link, read without locks */
+    lz_kvmap_mt_ent * retired_next;  /* retire list link */
+    uint64_t          hash;
+    void           (* freefn)(void *);
+    void            * val;
+    size_t            klen;
+    char              key[];
+};
+
+struct kvmap_mt_tbl {
+    struct kvmap_mt_tbl * retired_next;
+    uint64_t              mask;
+    lz_kvmap_mt_ent     * buckets[];
+};
+
+struct kvmap_mt_shard {
+    pthread_mutex_t       lock;      /* serializes writers */
+    uint32_t              seq;       /* odd while the shard is being resized */
+    uint32_t              n_entries;
+    struct kvmap_mt_tbl * tbl;
+} __attribute__((aligned(KVMAP_MT_CACHELINE)));
+
+struct kvmap_mt_rslot {
+    uint64_t count[2];               /* readers in even / odd epochs */
+} __attribute__((aligned(KVMAP_MT_CACHELINE)));
+
+struct lz_kvmap_mt_s {
+    uint64_t                epoch __attribute__((aligned(KVMAP_MT_CACHELINE)));
+    struct kvmap_mt_rslot   rslots[KVMAP_MT_READER_SLOTS];
+
+    uint32_t                n_shards;
+    struct kvmap_mt_shard * shards;
+
+    pthread_mutex_t         gp_lock; /* one grace period at a time */
+    pthread_mutex_t         retire_lock;
+    lz_kvmap_mt_ent       * retired_ents;
+    struct kvmap_mt_tbl   * retired_tbls;
+    uint32_t                n_retired;
+};
+
+static uint32_t        kvmap_mt_next_tid_ = 0;
+static __thread int    kvmap_mt_tid_      = -1;
+static __thread int    kvmap_mt_depth_    = 0;
+
+static inline struct kvmap_mt_rslot *
+kvmap_mt_rslot_(lz_kvmap_mt * map)
+{
+    if (lz_unlikely(kvmap_mt_tid_ == -1))
+    {
+        kvmap_mt_tid_ = __atomic_fetch_add(&kvmap_mt_next_tid_, 1, __ATOMIC_RELAXED)
+                        % KVMAP_MT_READER_SLOTS;
+    }
+
+    return &map->rslots[kvmap_mt_tid_];
+}
+
+static inline struct kvmap_mt_shard *
+kvmap_mt_shard_(lz_kvmap_mt * map, uint64_t hash)
+{
+    /* buckets are indexed with the low bits, shards with the high ones */
+    return &map->shards[(hash >> 32) & (map->n_shards - 1)];
+}
+
+static struct kvmap_mt_tbl *
+kvmap_mt_tbl_new_(uint64_t n_buckets)
+{
+    struct kvmap_mt_tbl * tbl;
+
+    if (!(tbl = calloc(1, sizeof(*tbl) + n_buckets * sizeof(lz_kvmap_mt_ent *))))
+    {
+        return NULL;
+    }
+
+    tbl->mask = n_buckets - 1;
+
+    return tbl;
+}
+
+static lz_kvmap_mt_ent *
+kvmap_mt_ent_new_(const char * k, size_t l, uint64_t hash, void * val, void (* freefn)(void *))
+{
+    lz_kvmap_mt_ent * ent;
+
+    if (!(ent = malloc(sizeof(lz_kvmap_mt_ent) + l + 1)))
+    {
+        return NULL;
+    }
+
+    memcpy(ent->key, k, l);
+
+    ent->key[l]       = '\0';
+    ent->klen         = l;
+    ent->hash         = hash;
+    ent->val          = val;
+    ent->freefn       = freefn;
+    ent->next         = NULL;
+    ent->retired_next = NULL;
+
+    return ent;
+}
+
+static void
+kvmap_mt_ent_free_(lz_kvmap_mt_ent * ent)
+{
+    if (ent->freefn)
+    {
+        (ent->freefn)(ent->val);
+    }
+
+    free(ent);
+}
+
+static int
+kvmap_mt_read_enter_(lz_kvmap_mt * map)
+{
+    struct kvmap_mt_rslot * slot = kvmap_mt_rslot_(map);
+    uint64_t                epoch;
+
+    /*
+     * count ourselves in the current epoch, and make sure it still is the
+     * current one. A writer that flipped the epoch in between may not have
+     * seen our count, so try again with the new epoch.
+     */
+    for (;;)
+    {
+        epoch = __atomic_load_n(&map->epoch, __ATOMIC_SEQ_CST);
+
+        __atomic_fetch_add(&slot->count[epoch & 1], 1, __ATOMIC_SEQ_CST);
+
+        if (lz_likely(__atomic_load_n(&map->epoch, __ATOMIC_SEQ_CST) == epoch))
+        {
+            break;
+        }
+
+        __atomic_fetch_sub(&slot->count[epoch & 1], 1, __ATOMIC_RELEASE);
+    }
+
+    kvmap_mt_depth_ += 1;
+
+    return (int)(epoch & 1);
+}
+
+static void
+kvmap_mt_read_exit_(lz_kvmap_mt * map, int token)
+{
+    kvmap_mt_depth_ -= 1;
+
+    __atomic_fetch_sub(&kvmap_mt_rslot_(map)->count[token], 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief flips the epoch and waits for every reader counted in the previous
+ *        one to leave. Anything unlinked before the flip is then unreachable.
+ *        Must be called with gp_lock held.
+ */
+static void
+kvmap_mt_synchronize_(lz_kvmap_mt * map)
+{
+    uint64_t old;
+    int      i;
+
+    old = __atomic_fetch_add(&map->epoch, 1, __ATOMIC_SEQ_CST);
+
+    for (i = 0; i < KVMAP_MT_READER_SLOTS; i++)
+    {
+        while (__atomic_load_n(&map->rslots[i].count[old & 1], __ATOMIC_ACQUIRE) != 0)
+        {
+            sched_yield();
+        }
+    }
+}
+
+static void
+kvmap_mt_reclaim_locked_(lz_kvmap_mt * map)
+{
+    lz_kvmap_mt_ent     * ents;
+    struct kvmap_mt_tbl * tbls;
+    void                * save;
+
+    pthread_mutex_lock(&map->retire_lock);
+    {
+        ents              = map->retired_ents;
+        tbls              = map->retired_tbls;
+
+        map->retired_ents = NULL;
+        map->retired_tbls = NULL;
+        __atomic_store_n(&map->n_retired, 0, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&map->retire_lock);
+
+    if (ents == NULL && tbls == NULL)
+    {
+        return;
+    }
+
+    kvmap_mt_synchronize_(map);
+
+    for (; ents != NULL; ents = save)
+    {
+        save = ents->retired_next;
+        kvmap_mt_ent_free_(ents);
+    }
+
+    for (; tbls != NULL; tbls = save)
+    {
+        save = tbls->retired_next;
+        free(tbls);
+    }
+}
+
+static void
+kvmap_mt_reclaim_(lz_kvmap_mt * map)
+{
+    pthread_mutex_lock(&map->gp_lock);
+    {
+        kvmap_mt_reclaim_locked_(map);
+    }
+    pthread_mutex_unlock(&map->gp_lock);
+}
+
+/**
+ * @brief called by writers once they dropped their shard lock. Waiting for
+ *        readers from inside a read section would wait on ourselves, and
+ *        there is no point in queueing up behind a writer that is already
+ *        reclaiming, so both of those leave the work for later.
+ */
+static void
+kvmap_mt_maybe_reclaim_(lz_kvmap_mt * map)
+{
+    if (__atomic_load_n(&map->n_retired, __ATOMIC_RELAXED) < KVMAP_MT_RETIRE_BATCH)
+    {
+        return;
+    }
+
+    if (kvmap_mt_depth_ > 0 || pthread_mutex_trylock(&map->gp_lock) != 0)
+    {
+        return;
+    }
+
+    kvmap_mt_reclaim_locked_(map);
+
+    pthread_mutex_unlock(&map->gp_lock);
+}
+
+static void
+kvmap_mt_retire_ent_(lz_kvmap_mt * map, lz_kvmap_mt_ent * ent)
+{
+    pthread_mutex_lock(&map->retire_lock);
+    {
+        ent->retired_next = map->retired_ents;
+        map->retired_ents = ent;
+
+        __atomic_store_n(&map->n_retired, map->n_retired + 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&map->retire_lock);
+}
+
+static void
+kvmap_mt_retire_tbl_(lz_kvmap_mt * map, struct kvmap_mt_tbl * tbl)
+{
+    pthread_mutex_lock(&map->retire_lock);
+    {
+        tbl->retired_next = map->retired_tbls;
+        map->retired_tbls = tbl;
+    }
+    pthread_mutex_unlock(&map->retire_lock);
+}
+
+/**
+ * @brief doubles the shard's table, with the shard lock held. The entries
+ *        are relinked in place, so the sequence count is odd for the whole
+ *        move and readers that overlap it retry.
+ */
+static void
+kvmap_mt_shard_grow_(lz_kvmap_mt * map, struct kvmap_mt_shard * shard)
+{
+    struct kvmap_mt_tbl * old = shard->tbl;
+    struct kvmap_mt_tbl * tbl;
+    lz_kvmap_mt_ent     * ent;
+    lz_kvmap_mt_ent     * save;
+    uint64_t              i;
+
+    if (!(tbl = kvmap_mt_tbl_new_((old->mask + 1) * 2)))
+    {
+        /* not fatal, the chains just get longer */
+        return;
+    }
+
+    __atomic_store_n(&shard->seq, shard->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (i = 0; i <= old->mask; i++)
+    {
+        for (ent = old->buckets[i]; ent != NULL; ent = save)
+        {
+            lz_kvmap_mt_ent ** head = &tbl->buckets[ent->hash & tbl->mask];
+
+            save = ent->next;
+
+            __atomic_store_n(&ent->next, *head, __ATOMIC_RELAXED);
+            *head = ent;
+        }
+    }
+
+    kvmap_mt_store_(&shard->tbl, tbl);
+    kvmap_mt_store_(&shard->seq, shard->seq + 1);
+
+    kvmap_mt_retire_tbl_(map, old);
+}
+
+/**
+ * @brief lock-free lookup, the caller must be inside a read section.
+ */
+static lz_kvmap_mt_ent *
+kvmap_mt_shard_find_(struct kvmap_mt_shard * shard, const char * k, size_t l, uint64_t hash)
+{
+    struct kvmap_mt_tbl * tbl;
+    lz_kvmap_mt_ent     * ent;
+    uint32_t              seq;
+    uint32_t              steps;
+
+    for (;;)
+    {
+        seq = kvmap_mt_load_(&shard->seq);
+
+        if (lz_unlikely(seq & 1))
+        {
+            sched_yield();
+            continue;
+        }
+
+        tbl   = kvmap_mt_load_(&shard->tbl);
+        ent   = kvmap_mt_load_(&tbl->buckets[hash & tbl->mask]);
+        steps = 0;
+
+        while (ent != NULL)
+        {
+            if (ent->hash == hash && ent->klen == l && !memcmp(ent->key, k, l))
+            {
+                break;
+            }
+
+            ent = kvmap_mt_load_(&ent->next);
+
+            /* a resize can briefly send us around in circles */
+            if (lz_unlikely(++steps % KVMAP_MT_SEQ_CHECK == 0) &&
+                kvmap_mt_load_(&shard->seq) != seq)
+            {
+                break;
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (lz_likely(__atomic_load_n(&shard->seq, __ATOMIC_RELAXED) == seq))
+        {
+            return ent;
+        }
+    }
+}
+
+/**
+ * @brief returns the link pointing at the key's entry, or at the NULL ending
+ *        its chain. Called with the shard lock held.
+ */
+static lz_kvmap_mt_ent **
+kvmap_mt_shard_link_(struct kvmap_mt_shard * shard, const char * k, size_t l, uint64_t hash)
+{
+    lz_kvmap_mt_ent ** link = &shard->tbl->buckets[hash & shard->tbl->mask];
+    lz_kvmap_mt_ent  * ent;
+
+    for (; (ent = *link) != NULL; link = &ent->next)
+    {
+        if (ent->hash == hash && ent->klen == l && !memcmp(ent->key, k, l))
+        {
+            break;
+        }
+    }
+
+    return link;
+}
+
+static int
+kvmap_mt_set_(lz_kvmap_mt * map, const char * k, size_t l,
+              void * val, void (* freefn)(void *), int replace, int * created)
+{
+    struct kvmap_mt_shard * shard;
+    lz_kvmap_mt_ent      ** link;
+    lz_kvmap_mt_ent       * ent;
+    lz_kvmap_mt_ent       * old;
+    uint64_t                hash;
+    int                     res = 0;
+
+    hash  = lz_kvmap_hash64(k, l, 0);
+    shard = kvmap_mt_shard_(map, hash);
+
+    pthread_mutex_lock(&shard->lock);
+    {
+        link = kvmap_mt_shard_link_(shard, k, l, hash);
+        old  = *link;
+
+        if (old != NULL && !replace)
+        {
+            res = 1;
+        } else if (!(ent = kvmap_mt_ent_new_(k, l, hash, val, freefn)))
+        {
+            res = -1;
+        } else if (old != NULL)
+        {
+            /* entries are never modified in place, readers holding the old
+             * one keep seeing the old value */
+            ent->next = old->next;
+            kvmap_mt_store_(link, ent);
+
+            /* the value moved over to the new entry */
+            if (old->val == val)
+            {
+                old->freefn = NULL;
+            }
+        } else {
+            ent->next = *link;
+            kvmap_mt_store_(link, ent);
+
+            shard->n_entries += 1;
+
+            if (shard->n_entries > shard->tbl->mask + 1)
+            {
+                kvmap_mt_shard_grow_(map, shard);
+            }
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if (created != NULL)
+    {
+        *created = (res == 0 && old == NULL);
+    }
+
+    if (res == 0 && old != NULL)
+    {
+        kvmap_mt_retire_ent_(map, old);
+        kvmap_mt_maybe_reclaim_(map);
+    }
+
+    return res;
+} /* kvmap_mt_set_ */
+
+static void kvmap_mt_free_(lz_kvmap_mt * map);
+
+static lz_kvmap_mt *
+kvmap_mt_new_(size_t n_shards, size_t n_buckets)
+{
+    lz_kvmap_mt * map;
+    uint32_t      shards;
+    uint64_t      buckets;
+    uint32_t      i;
+
+    if (n_shards == 0)
+    {
+        n_shards = KVMAP_MT_SHARDS_DEFAULT;
+    }
+
+    for (shards = 1; shards < n_shards && shards < (1U << 16); shards <<= 1)
+    {
+    }
+
+    for (buckets = KVMAP_MT_BUCKETS_MIN; buckets < n_buckets; buckets <<= 1)
+    {
+    }
+
+    if (posix_memalign((void **)&map, KVMAP_MT_CACHELINE, sizeof(lz_kvmap_mt)) != 0)
+    {
+        return NULL;
+    }
+
+    memset(map, 0, sizeof(lz_kvmap_mt));
+
+    if (posix_memalign((void **)&map->shards, KVMAP_MT_CACHELINE,
+                       shards * sizeof(struct kvmap_mt_shard)) != 0)
+    {
+        free(map);
+        return NULL;
+    }
+
+    memset(map->shards, 0, shards * sizeof(struct kvmap_mt_shard));
+
+    pthread_mutex_init(&map->gp_lock, NULL);
+    pthread_mutex_init(&map->retire_lock, NULL);
+
+    for (i = 0; i < shards; i++)
+    {
+        if (!(map->shards[i].tbl = kvmap_mt_tbl_new_(buckets)))
+        {
+            kvmap_mt_free_(map);
+            return NULL;
+        }
+
+        pthread_mutex_init(&map->shards[i].lock, NULL);
+        map->n_shards = i + 1;
+    }
+
+    return map;
+} /* kvmap_mt_new_ */
+
+static void
+kvmap_mt_free_(lz_kvmap_mt * map)
+{
+    lz_kvmap_mt_ent * ent;
+    lz_kvmap_mt_ent * save;
+    uint32_t          i;
+    uint64_t          b;
+
+    if (map == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < map->n_shards; i++)
+    {
+        struct kvmap_mt_shard * shard = &map->shards[i];
+
+        for (b = 0; b <= shard->tbl->mask; b++)
+        {
+            for (ent = shard->tbl->buckets[b]; ent != NULL; ent = save)
+            {
+                save = ent->next;
+                kvmap_mt_ent_free_(ent);
+            }
+        }
+
+        free(shard->tbl);
+        pthread_mutex_destroy(&shard->lock);
+    }
+
+    /* nobody is reading anymore, so no need to wait */
+    for (ent = map->retired_ents; ent != NULL; ent = save)
+    {
+        save = ent->retired_next;
+        kvmap_mt_ent_free_(ent);
+    }
+
+    while (map->retired_tbls != NULL)
+    {
+        struct kvmap_mt_tbl * tbl = map->retired_tbls;
+
+        map->retired_tbls = tbl->retired_next;
+        free(tbl);
+    }
+
+    pthread_mutex_destroy(&map->gp_lock);
+    pthread_mutex_destroy(&map->retire_lock);
+
+    free(map->shards);
+    free(map);
+} /* kvmap_mt_free_ */
+
+static int
+kvmap_mt_add_(lz_kvmap_mt * map, const char * k, size_t l, void * val, void (* freefn)(void *))
+{
+    return kvmap_mt_set_(map, k, l, val, freefn, 0, NULL);
+}
+
+static int
+kvmap_mt_upsert_(lz_kvmap_mt * map, const char * k, size_t l,
+                 void * val, void (* freefn)(void *), int * created)
+{
+    return kvmap_mt_set_(map, k, l, val, freefn, 1, created);
+}
+
+static int
+kvmap_mt_remove_(lz_kvmap_mt * map, const char * k, size_t l)
+{
+    struct kvmap_mt_shard * shard;
+    lz_kvmap_mt_ent      ** link;
+    lz_kvmap_mt_ent       * ent;
+    uint64_t                hash;
+
+    hash  = lz_kvmap_hash64(k, l, 0);
+    shard = kvmap_mt_shard_(map, hash);
+
+    pthread_mutex_lock(&shard->lock);
+    {
+        link = kvmap_mt_shard_link_(shard, k, l, hash);
+
+        /* readers still on ent carry on through ent->next, which is kept */
+        if ((ent = *link) != NULL)
+        {
+            kvmap_mt_store_(link, ent->next);
+            shard->n_entries -= 1;
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if (ent == NULL)
+    {
+        return -1;
+    }
+
+    kvmap_mt_retire_ent_(map, ent);
+    kvmap_mt_maybe_reclaim_(map);
+
+    return 0;
+}
+
+static lz_kvmap_mt_ent *
+kvmap_mt_ent_find_(lz_kvmap_mt * map, const char * k, size_t l)
+{
+    uint64_t hash = lz_kvmap_hash64(k, l, 0);
+
+    return kvmap_mt_shard_find_(kvmap_mt_shard_(map, hash), k, l, hash);
+}
+
+static void *
+kvmap_mt_find_(lz_kvmap_mt * map, const char * k, size_t l)
+{
+    lz_kvmap_mt_ent * ent;
+    void            * val;
+    int               token;
+
+    /* ent may be reclaimed as soon as the read section ends */
+    token = kvmap_mt_read_enter_(map);
+    ent   = kvmap_mt_ent_find_(map, k, l);
+    val   = ent ? ent->val : NULL;
+    kvmap_mt_read_exit_(map, token);
+
+    return val;
+}
+
+static int
+kvmap_mt_for_each_(lz_kvmap_mt * map, lz_kvmap_mt_iterfn iterfn, void * arg)
+{
+    lz_kvmap_mt_ent * ent;
+    uint32_t          i;
+    uint64_t          b;
+    int               res = 0;
+
+    for (i = 0; i < map->n_shards && res == 0; i++)
+    {
+        struct kvmap_mt_shard * shard = &map->shards[i];
+
+        pthread_mutex_lock(&shard->lock);
+        {
+            for (b = 0; b <= shard->tbl->mask && res == 0; b++)
+            {
+                for (ent = shard->tbl->buckets[b]; ent != NULL && res == 0; ent = ent->next)
+                {
+                    res = (iterfn)(ent, arg);
+                }
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    return res;
+}
+
+static size_t
+kvmap_mt_get_size_(lz_kvmap_mt * map)
+{
+    size_t   n = 0;
+    uint32_t i;
+
+    for (i = 0; i < map->n_shards; i++)
+    {
+        n += __atomic_load_n(&map->shards[i].n_entries, __ATOMIC_RELAXED);
+    }
+
+    return n;
+}
+
+static void *
+kvmap_mt_ent_val_(lz_kvmap_mt_ent * ent)
+{
+    return ent ? ent->val : NULL;
+}
+
+static const char *
+kvmap_mt_ent_key_(lz_kvmap_mt_ent * ent)
+{
+    return ent ? ent->key : NULL;
+}
+
+static size_t
+kvmap_mt_ent_get_klen_(lz_kvmap_mt_ent * ent)
+{
+    return ent ? ent->klen : 0;
+}
+
+lz_alias(kvmap_mt_new_, lz_kvmap_mt_new);
+lz_alias(kvmap_mt_free_, lz_kvmap_mt_free);
+lz_alias(kvmap_mt_read_enter_, lz_kvmap_mt_read_enter);
+lz_alias(kvmap_mt_read_exit_, lz_kvmap_mt_read_exit);
+lz_alias(kvmap_mt_add_, lz_kvmap_mt_add);
+lz_alias(kvmap_mt_upsert_, lz_kvmap_mt_upsert);
+lz_alias(kvmap_mt_remove_, lz_kvmap_mt_remove);
+lz_alias(kvmap_mt_find_, lz_kvmap_mt_find);
+lz_alias(kvmap_mt_ent_find_, lz_kvmap_mt_ent_find);
+lz_alias(kvmap_mt_ent_val_, lz_kvmap_mt_ent_val);
+lz_alias(kvmap_mt_ent_key_, lz_kvmap_mt_ent_key);
+lz_alias(kvmap_mt_ent_get_klen_, lz_kvmap_mt_ent_get_klen);
+lz_alias(kvmap_mt_for_each_, lz_kvmap_mt_for_each);
+lz_alias(kvmap_mt_reclaim_, lz_kvmap_mt_reclaim);
+lz_alias(kvmap_mt_get_size_, lz_kvmap_mt_get_size);
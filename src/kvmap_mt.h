@@ -0,0 +1,122 @@
+#pragma once
+
+#include <liblz.h>
+
+/*
+ * lz_kvmap_mt: a thread-safe key/value map.
+ *
+ * Keys are spread over a power-of-two number of shards. Each shard has its
+ * own writer lock, so writers only contend when they hash to the same shard.
+ * Readers take no lock at all: they walk the bucket chains with acquire
+ * loads, and retry when a shard was resized underneath them (seqlock).
+ *
+ * Removed or replaced entries are not freed straight away. They are retired,
+ * and their memory (and value freefn) is released once every reader that
+ * could still see them has left its read section. Any lz_kvmap_mt_ent pointer
+ * or value obtained between lz_kvmap_mt_read_enter() and
+ * lz_kvmap_mt_read_exit() stays valid until the exit.
+ */
+
+struct lz_kvmap_mt_s;
+struct lz_kvmap_mt_ent_s;
+
+typedef struct lz_kvmap_mt_s     lz_kvmap_mt;
+typedef struct lz_kvmap_mt_ent_s lz_kvmap_mt_ent;
+
+typedef int (* lz_kvmap_mt_iterfn)(lz_kvmap_mt_ent * ent, void * arg);
+
+
+/**
+ * @brief creates a new concurrent map
+ *
+ * @param n_shards number of shards, rounded up to a power of two, 0 for the
+ *                 default (64)
+ * @param n_buckets initial number of buckets in each shard
+ *
+ * @return NULL on error
+ */
+LZ_EXPORT lz_kvmap_mt * lz_kvmap_mt_new(size_t n_shards, size_t n_buckets);
+
+
+/**
+ * @brief frees the map, its entries, and everything still waiting to be
+ *        reclaimed. No other thread may be using the map.
+ */
+LZ_EXPORT void lz_kvmap_mt_free(lz_kvmap_mt * map);
+
+
+/**
+ * @brief enters a read section, entries and values found until the matching
+ *        lz_kvmap_mt_read_exit() will not be reclaimed.
+ *
+ *        Read sections are cheap and may nest. A thread may write to the map
+ *        from within one, reclamation is then deferred to a later writer.
+ *
+ * @return a token to hand to lz_kvmap_mt_read_exit()
+ */
+LZ_EXPORT int  lz_kvmap_mt_read_enter(lz_kvmap_mt * map);
+LZ_EXPORT void lz_kvmap_mt_read_exit(lz_kvmap_mt * map, int token);
+
+
+/**
+ * @brief adds the key if it is not yet in the map
+ *
+ * @return 0 if added, 1 if the key already exists, -1 on error
+ */
+LZ_EXPORT int lz_kvmap_mt_add(lz_kvmap_mt * map, const char * k, size_t l,
+    void * val, void (* freefn)(void *));
+
+
+/**
+ * @brief sets the value of a key, adding it if needed. A replaced entry is
+ *        retired (and its freefn called) once no reader can see it.
+ *
+ * @param created if not NULL, set to 1 if the key was added, 0 if replaced
+ *
+ * @return 0 on success, -1 on error
+ */
+LZ_EXPORT int lz_kvmap_mt_upsert(lz_kvmap_mt * map, const char * k, size_t l,
+    void * val, void (* freefn)(void *), int * created);
+
+
+/**
+ * @brief removes the key, its entry is retired
+ *
+ * @return 0 on success, -1 if not found
+ */
+LZ_EXPORT int lz_kvmap_mt_remove(lz_kvmap_mt * map, const char * k, size_t l);
+
+
+/**
+ * @brief finds the value of a key. The returned value is only protected from
+ *        a concurrent remove when the caller is inside a read section.
+ */
+LZ_EXPORT void * lz_kvmap_mt_find(lz_kvmap_mt * map, const char * k, size_t l);
+
+
+/**
+ * @brief finds the entry of a key, must be called from within a read section.
+ */
+LZ_EXPORT lz_kvmap_mt_ent * lz_kvmap_mt_ent_find(lz_kvmap_mt * map, const char * k, size_t l);
+
+LZ_EXPORT void       * lz_kvmap_mt_ent_val(lz_kvmap_mt_ent * ent);
+LZ_EXPORT const char * lz_kvmap_mt_ent_key(lz_kvmap_mt_ent * ent);
+LZ_EXPORT size_t       lz_kvmap_mt_ent_get_klen(lz_kvmap_mt_ent * ent);
+
+
+/**
+ * @brief calls iterfn for each entry, one shard at a time. The shard being
+ *        visited is locked against writers, so iterfn must not modify the map.
+ *
+ * @return the first non-zero value returned by iterfn, or 0
+ */
+LZ_EXPORT int lz_kvmap_mt_for_each(lz_kvmap_mt * map, lz_kvmap_mt_iterfn iterfn, void * arg);
+
+
+/**
+ * @brief waits until every retired entry can be released, and releases them.
+ *        Must not be called from within a read section.
+ */
+LZ_EXPORT void lz_kvmap_mt_reclaim(lz_kvmap_mt * map);
+
+LZ_EXPORT size_t lz_kvmap_mt_get_size(lz_kvmap_mt * map);
@@ -7,6 +7,14 @@
 #endif
 
 #include <liblz/core/lz_heap.h>
+#include <liblz/core/lz_alloc.h>
 #include <liblz/core/lz_tailq.h>
 #include <liblz/core/lz_kvmap.h>
+#include <liblz/core/lz_kvmap_mt.h>
+#include <liblz/core/lz_kvmap_frozen.h>
+#include <liblz/core/lz_cache.h>
+#include <liblz/core/lz_imap.h>
+#include <liblz/core/lz_omap.h>
+#include <liblz/core/lz_sfxtrie.h>
+#include <liblz/core/lz_intern.h>
 #include <liblz/core/lz_file.h>
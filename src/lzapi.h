@@ -35,7 +35,7 @@
 
 #define lz_alloc_assert(x)                                \
     do {                                                  \
-        if (lz_unlikely(!x))                              \
+        if (lz_unlikely(!(x)))                            \
         {                                                 \
             fprintf(stderr, "Out of memory (%s:%s:%d)\n", \
                     __func__, __FILE__, __LINE__);        \
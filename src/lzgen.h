@@ -0,0 +1,448 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+/*
+ * type-specialized container generators.
+ *
+ * lz_kvmap and lz_tailq store every value as a boxed void * and release it
+ * through an indirect freefn call. The macros below instead expand to a
+ * container for one concrete type: keys and values are stored unboxed, in
+ * place, and hashing / comparison are plain expressions the compiler can
+ * inline. Everything is static inline, so a container only costs what the
+ * including file uses.
+ *
+ *    LZ_VEC_DECLARE(u32vec, uint32_t)
+ *    LZ_KVMAP_DECLARE(ipmap, uint32_t, struct peer, lz_gen_hash_u32, lz_gen_eq)
+ *
+ *    ipmap       * map = ipmap_new(0);
+ *    struct peer * p   = ipmap_put(map, addr, &added);
+ */
+
+/*
+ * ready-made hash and equality functions for LZ_KVMAP_DECLARE. A hash only
+ * needs to spread its low bits well enough to be multiplied; the map takes
+ * care of the rest.
+ */
+#define lz_gen_hash_u32(k) ((uint32_t)(k))
+#define lz_gen_hash_u64(k) ((uint32_t)((uint64_t)(k) ^ ((uint64_t)(k) >> 32)))
+#define lz_gen_hash_str(k) ((uint32_t)lz_kvmap_hash64((k), strlen(k), 0))
+#define lz_gen_eq(a, b)    ((a) == (b))
+#define lz_gen_eq_str(a, b) (strcmp((a), (b)) == 0)
+
+/* LZ_KVMAP_DECLARE maps stop growing here, n_slots is a uint32_t */
+#define LZ_GEN_MAX_SLOTS   (1u << 31)
+
+
+/**
+ * @brief declares a growable array of T, named `name`:
+ *
+ *   void   name_init(name * v)                     zeroes, nothing allocated
+ *   void   name_free(name * v)                     releases the items
+ *   int    name_reserve(name * v, size_t n)        0 on success, -1 on error
+ *   T    * name_push(name * v, T item)             the stored copy, NULL on error
+ *   T    * name_at(name * v, size_t i)             NULL if out of range
+ *   int    name_pop(name * v, T * out)             0 on success, -1 if empty
+ *   void   name_clear(name * v)                    keeps the allocation
+ *   size_t name_get_size(name * v)
+ */
+#define LZ_VEC_DECLARE(name, T)                                              \
+    typedef struct name ## _s {                                              \
+        T    * items;                                                        \
+        size_t n_items;                                                      \
+        size_t n_alloc;                                                      \
+    } name;                                                                  \
+                                                                             \
+    static inline void                                                       \
+    name ## _init(name * v)                                                  \
+    {                                                                        \
+        v->items   = NULL;                                                   \
+        v->n_items = 0;                                                      \
+        v->n_alloc = 0;                                                      \
+    }                                                                        \
+                                                                             \
+    static inline void                                                       \
+    name ## _free(name * v)                                                  \
+    {                                                                        \
+        free(v->items);                                                      \
+        name ## _init(v);                                                    \
+    }                                                                        \
+                                                                             \
+    static inline int                                                        \
+    name ## _reserve(name * v, size_t n)                                     \
+    {                                                                        \
+        T    * items;                                                        \
+        size_t n_alloc = v->n_alloc ? v->n_alloc : 8;                        \
+                                                                             \
+        if (n <= v->n_alloc)                                                 \
+        {                                                                    \
+            return 0;                                                        \
+        }                                                                    \
+                                                                             \
+        if (n > SIZE_MAX / sizeof(T))                                        \
+        {                                                                    \
+            return -1;                                                       \
+        }                                                                    \
+                                                                             \
+        /* doubles, without wrapping past what can be allocated */           \
+        while (n_alloc < n)                                                  \
+        {                                                                    \
+            n_alloc = n_alloc <= SIZE_MAX / sizeof(T) / 2 ? n_alloc * 2 : n; \
+        }                                                                    \
+                                                                             \
+        if (!(items = realloc(v->items, n_alloc * sizeof(T))))               \
+        {                                                                    \
+            return -1;                                                       \
+        }                                                                    \
+                                                                             \
+        v->items   = items;                                                  \
+        v->n_alloc = n_alloc;                                                \
+                                                                             \
+        return 0;                                                            \
+    }                                                                        \
+                                                                             \
+    static inline T *                                                        \
+    name ## _push(name * v, T item)                                          \
+    {                                                                        \
+        if (lz_unlikely(v->n_items == v->n_alloc))                           \
+        {                                                                    \
+            if (name ## _reserve(v, v->n_items + 1) == -1)                   \
+            {                                                                \
+                return NULL;                                                 \
+            }                                                                \
+        }                                                                    \
+                                                                             \
+        v->items[v->n_items] = item;                                         \
+                                                                             \
+        return &v->items[v->n_items++];                                      \
+    }                                                                        \
+                                                                             \
+    static inline T *                                                        \
+    name ## _at(name * v, size_t i)                                          \
+    {                                                                        \
+        return i < v->n_items ? &v->items[i] : NULL;                         \
+    }                                                                        \
+                                                                             \
+    static inline int                                                        \
+    name ## _pop(name * v, T * out)                                          \
+    {                                                                        \
+        if (v->n_items == 0)                                                 \
+        {                                                                    \
+            return -1;                                                       \
+        }                                                                    \
+                                                                             \
+        v->n_items -= 1;                                                     \
+                                                                             \
+        if (out)                                                             \
+        {                                                                    \
+            *out = v->items[v->n_items];                                     \
+        }                                                                    \
+                                                                             \
+        return 0;                                                            \
+    }                                                                        \
+                                                                             \
+    static inline void                                                       \
+    name ## _clear(name * v)                                                 \
+    {                                                                        \
+        v->n_items = 0;                                                      \
+    }                                                                        \
+                                                                             \
+    static inline size_t                                                     \
+    name ## _get_size(name * v)                                              \
+    {                                                                        \
+        return v->n_items;                                                   \
+    }
+
+
+/**
+ * @brief declares a hash map from key_t to val_t, named `name`. hashfn(key)
+ *        returns a uint32_t, eqfn(a, b) returns non-zero when two keys are
+ *        equal; either may be a macro.
+ *
+ *   name    * name_new(uint32_t n_entries)               NULL on error, or
+ *             if n_entries needs more than LZ_GEN_MAX_SLOTS
+ *   void      name_free(name * map)
+ *   val_t   * name_find(name * map, key_t key)           NULL if not found
+ *   val_t   * name_put(name * map, key_t key, int * added)
+ *             the value slot for key, inserted if missing (*added is set to
+ *             1, the value is left uninitialized), NULL on error or once
+ *             the map is full at LZ_GEN_MAX_SLOTS
+ *   int       name_remove(name * map, key_t key)         0, -1 if not found
+ *   int       name_next(name * map, uint32_t * iter, key_t ** key, val_t ** val)
+ *             iterates starting from *iter = 0, 0 once done
+ *   void      name_clear(name * map)
+ *   size_t    name_get_size(name * map)
+ *
+ * Slots are open addressed with linear probing and backward shift deletion.
+ * Each slot's hash is kept next to its key so probes reject mismatches and
+ * resizes move entries without calling hashfn again. Pointers returned by
+ * find / put / next are valid until the next put or remove. The map never
+ * owns anything the keys or values point to.
+ */
+#define LZ_KVMAP_DECLARE(name, key_t, val_t, hashfn, eqfn)                    \
+    struct name ## _slot {                                                    \
+        uint32_t hash;  /* 0 for an empty slot */                             \
+        key_t    key;                                                         \
+        val_t    val;                                                         \
+    };                                                                        \
+                                                                              \
+    typedef struct name ## _s {                                               \
+        struct name ## _slot * slots;                                         \
+        uint32_t               n_slots;                                       \
+        uint32_t               shift;                                         \
+        uint32_t               n_entries;                                     \
+    } name;                                                                   \
+                                                                              \
+    static inline uint32_t                                                    \
+    name ## _hash_(key_t key)                                                 \
+    {                                                                         \
+        /* never 0, that marks empty slots */                                 \
+        return (uint32_t)(hashfn(key)) | 0x80000000u;                         \
+    }                                                                         \
+                                                                              \
+    static inline uint32_t                                                    \
+    name ## _home_(name * map, uint32_t hash)                                 \
+    {                                                                         \
+        return (uint32_t)((hash * 0x9e3779b9u) >> map->shift);                \
+    }                                                                         \
+                                                                              \
+    static inline struct name ## _slot *                                      \
+    name ## _place_(name * map, uint32_t hash)                                \
+    {                                                                         \
+        uint32_t mask = map->n_slots - 1;                                     \
+        uint32_t i    = name ## _home_(map, hash);                            \
+                                                                              \
+        while (map->slots[i].hash != 0)                                       \
+        {                                                                     \
+            i = (i + 1) & mask;                                               \
+        }                                                                     \
+                                                                              \
+        return &map->slots[i];                                                \
+    }                                                                         \
+                                                                              \
+    static inline int                                                         \
+    name ## _resize_(name * map, uint32_t n_slots)                            \
+    {                                                                         \
+        struct name ## _slot * old   = map->slots;                            \
+        uint32_t               n_old = map->n_slots;                          \
+        uint32_t               i;                                             \
+                                                                              \
+        if (!(map->slots = calloc(n_slots, sizeof(struct name ## _slot))))    \
+        {                                                                     \
+            map->slots = old;                                                 \
+            return -1;                                                        \
+        }                                                                     \
+                                                                              \
+        map->n_slots = n_slots;                                               \
+        map->shift   = 32 - __builtin_ctz(n_slots);                           \
+                                                                              \
+        for (i = 0; i < n_old; i++)                                           \
+        {                                                                     \
+            if (old[i].hash != 0)                                             \
+            {                                                                 \
+                *name ## _place_(map, old[i].hash) = old[i];                  \
+            }                                                                 \
+        }                                                                     \
+                                                                              \
+        free(old);                                                            \
+                                                                              \
+        return 0;                                                             \
+    }                                                                         \
+                                                                              \
+    static inline name *                                                      \
+    name ## _new(uint32_t n_entries)                                          \
+    {                                                                         \
+        name   * map;                                                         \
+        uint32_t n_slots;                                                     \
+                                                                              \
+        if (n_entries > LZ_GEN_MAX_SLOTS - LZ_GEN_MAX_SLOTS / 4)              \
+        {                                                                     \
+            return NULL;                                                      \
+        }                                                                     \
+                                                                              \
+        if (!(map = calloc(1, sizeof(name))))                                 \
+        {                                                                     \
+            return NULL;                                                      \
+        }                                                                     \
+                                                                              \
+        for (n_slots = 16; n_slots - n_slots / 4 < n_entries; n_slots <<= 1)  \
+        {                                                                     \
+        }                                                                     \
+                                                                              \
+        if (name ## _resize_(map, n_slots) == -1)                             \
+        {                                                                     \
+            free(map);                                                        \
+            return NULL;                                                      \
+        }                                                                     \
+                                                                              \
+        return map;                                                           \
+    }                                                                         \
+                                                                              \
+    static inline void                                                        \
+    name ## _free(name * map)                                                 \
+    {                                                                         \
+        if (map)                                                              \
+        {                                                                     \
+            free(map->slots);                                                 \
+            free(map);                                                        \
+        }                                                                     \
+    }                                                                         \
+                                                                              \
+    static inline struct name ## _slot *                                      \
+    name ## _slot_find_(name * map, key_t key)                                \
+    {                                                                         \
+        uint32_t hash = name ## _hash_(key);                                  \
+        uint32_t mask = map->n_slots - 1;                                     \
+        uint32_t i    = name ## _home_(map, hash);                            \
+                                                                              \
+        for (;; i = (i + 1) & mask)                                           \
+        {                                                                     \
+            struct name ## _slot * slot = &map->slots[i];                     \
+                                                                              \
+            if (slot->hash == 0)                                              \
+            {                                                                 \
+                return NULL;                                                  \
+            }                                                                 \
+                                                                              \
+            if (slot->hash == hash && eqfn(slot->key, key))                   \
+            {                                                                 \
+                return slot;                                                  \
+            }                                                                 \
+        }                                                                     \
+    }                                                                         \
+                                                                              \
+    static inline val_t *                                                     \
+    name ## _find(name * map, key_t key)                                      \
+    {                                                                         \
+        struct name ## _slot * slot = name ## _slot_find_(map, key);          \
+                                                                              \
+        return slot ? &slot->val : NULL;                                      \
+    }                                                                         \
+                                                                              \
+    static inline val_t *                                                     \
+    name ## _put(name * map, key_t key, int * added)                          \
+    {                                                                         \
+        struct name ## _slot * slot;                                          \
+        val_t                * val;                                           \
+        uint32_t               hash;                                          \
+                                                                              \
+        if ((val = name ## _find(map, key)) != NULL)                          \
+        {                                                                     \
+            if (added)                                                        \
+            {                                                                 \
+                *added = 0;                                                   \
+            }                                                                 \
+                                                                              \
+            return val;                                                       \
+        }                                                                     \
+                                                                              \
+        if (map->n_entries + 1 > map->n_slots - map->n_slots / 4)             \
+        {                                                                     \
+            if (map->n_slots == LZ_GEN_MAX_SLOTS ||                           \
+                name ## _resize_(map, map->n_slots * 2) == -1)                \
+            {                                                                 \
+                return NULL;                                                  \
+            }                                                                 \
+        }                                                                     \
+                                                                              \
+        hash            = name ## _hash_(key);                                \
+        slot            = name ## _place_(map, hash);                         \
+        slot->hash      = hash;                                               \
+        slot->key       = key;                                                \
+        map->n_entries += 1;                                                  \
+                                                                              \
+        if (added)                                                            \
+        {                                                                     \
+            *added = 1;                                                       \
+        }                                                                     \
+                                                                              \
+        return &slot->val;                                                    \
+    }                                                                         \
+                                                                              \
+    static inline int                                                         \
+    name ## _remove(name * map, key_t key)                                    \
+    {                                                                         \
+        struct name ## _slot * slot;                                          \
+        uint32_t               mask = map->n_slots - 1;                       \
+        uint32_t               i;                                             \
+        uint32_t               j;                                             \
+                                                                              \
+        if (!(slot = name ## _slot_find_(map, key)))                          \
+        {                                                                     \
+            return -1;                                                        \
+        }                                                                     \
+                                                                              \
+        i = j = (uint32_t)(slot - map->slots);                                \
+                                                                              \
+        /* shift back entries whose home is not cyclically within (i, j] */   \
+        for (;;)                                                              \
+        {                                                                     \
+            uint32_t home;                                                    \
+                                                                              \
+            j = (j + 1) & mask;                                               \
+                                                                              \
+            if (map->slots[j].hash == 0)                                      \
+            {                                                                 \
+                break;                                                        \
+            }                                                                 \
+                                                                              \
+            home = name ## _home_(map, map->slots[j].hash);                   \
+                                                                              \
+            if ((i <= j) ? (home <= i || home > j) : (home <= i && home > j)) \
+            {                                                                 \
+                map->slots[i] = map->slots[j];                                \
+                i = j;                                                        \
+            }                                                                 \
+        }                                                                     \
+                                                                              \
+        map->slots[i].hash = 0;                                               \
+        map->n_entries    -= 1;                                               \
+                                                                              \
+        return 0;                                                             \
+    }                                                                         \
+                                                                              \
+    static inline int                                                         \
+    name ## _next(name * map, uint32_t * iter, key_t ** key, val_t ** val)    \
+    {                                                                         \
+        for (; *iter < map->n_slots; (*iter)++)                               \
+        {                                                                     \
+            struct name ## _slot * slot = &map->slots[*iter];                 \
+                                                                              \
+            if (slot->hash != 0)                                              \
+            {                                                                 \
+                (*iter)++;                                                    \
+                                                                              \
+                if (key)                                                      \
+                {                                                             \
+                    *key = &slot->key;                                        \
+                }                                                             \
+                                                                              \
+                if (val)                                                      \
+                {                                                             \
+                    *val = &slot->val;                                        \
+                }                                                             \
+                                                                              \
+                return 1;                                                     \
+            }                                                                 \
+        }                                                                     \
+                                                                              \
+        return 0;                                                             \
+    }                                                                         \
+                                                                              \
+    static inline void                                                        \
+    name ## _clear(name * map)                                                \
+    {                                                                         \
+        memset(map->slots, 0, sizeof(struct name ## _slot) * map->n_slots);   \
+        map->n_entries = 0;                                                   \
+    }                                                                         \
+                                                                              \
+    static inline size_t                                                      \
+    name ## _get_size(name * map)                                             \
+    {                                                                         \
+        return map->n_entries;                                                \
+    }
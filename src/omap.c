@@ -0,0 +1,873 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+/* entries per chunk */
+#define OMAP_CHUNK 64
+
+/* a chunk this empty is merged into a neighbour, if the result fits in 3/4 */
+#define OMAP_MERGE_BELOW (OMAP_CHUNK / 4)
+#define OMAP_MERGE_MAX   (OMAP_CHUNK - OMAP_CHUNK / 4)
+
+/* tree nodes per slab, a slab is just under 64KB */
+#define OMAP_SLAB_NODES  1023
+
+/*
+ * the first 16 bytes of a key as two big endian integers, zero padded, and
+ * its length. Keys that differ within their first 16 bytes, or where one of
+ * them is no longer than that, compare without looking at the key itself.
+ */
+struct omap_head {
+    uint64_t hi;
+    uint64_t lo;
+    uint32_t klen;
+};
+
+struct omap_ent {
+    char * key;
+    void * val;
+    void   (* freefn)(void *);
+};
+
+/*
+ * the tree indexes chunks by their first key. Its nodes are kept apart from
+ * the chunks, one cache line each with a copy of the first key's head, and
+ * are carved from slabs: a descent stays within a small, dense region
+ * instead of taking a cache and TLB miss on every chunk it passes.
+ */
+struct omap_node {
+    RB_ENTRY(omap_node) rb;
+    struct omap_head    min;
+    union {
+        struct lz_omap_chunk * chunk;
+        struct omap_node     * next_free;
+    };
+} __attribute__((aligned(64)));
+
+struct omap_node_slab {
+    struct omap_node        nodes[OMAP_SLAB_NODES];
+    struct omap_node_slab * next;
+};
+
+/*
+ * a sorted run of entries, heads apart from the rest so a binary search
+ * stays within a few cache lines.
+ */
+struct lz_omap_chunk {
+    uint32_t                n_ents;
+    struct omap_node      * node;
+    struct lz_omap_chunk  * prev;
+    struct lz_omap_chunk  * next;
+    struct omap_head        heads[OMAP_CHUNK];
+    struct omap_ent         ents[OMAP_CHUNK];
+};
+
+RB_HEAD(omap_tree, omap_node);
+
+struct lz_omap_s {
+    struct omap_tree        tree;
+    struct lz_omap_chunk  * first;
+    size_t                  n_entries;
+    struct omap_node_slab * slabs;
+    struct omap_node      * free_nodes;
+    uint32_t                n_slab_used; /* nodes handed out of slabs */
+};
+
+static inline uint64_t
+omap_be64_(const uint8_t * b)
+{
+    return ((uint64_t)b[0] << 56) | ((uint64_t)b[1] << 48) |
+           ((uint64_t)b[2] << 40) | ((uint64_t)b[3] << 32) |
+           ((uint64_t)b[4] << 24) | ((uint64_t)b[5] << 16) |
+           ((uint64_t)b[6] << 8)  | (uint64_t)b[7];
+}
+
+static inline struct omap_head
+omap_head_(const char * k, size_t l)
+{
+    struct omap_head h;
+    uint8_t          b[16] = { 0 };
+
+    memcpy(b, k, l < 16 ? l : 16);
+
+    h.hi   = omap_be64_(b);
+    h.lo   = omap_be64_(b + 8);
+    h.klen = (uint32_t)l;
+
+    return h;
+}
+
+/*
+ * zero padded heads order like the keys whenever they differ: a shorter key
+ * pads with the lowest byte there is. When they are equal the keys share
+ * their first min(length, 16) bytes, so unless both are longer than that
+ * the shorter key sorts first.
+ */
+static inline int
+omap_head_cmp_(const struct omap_head * ha, const struct omap_head * hb)
+{
+    if (ha->hi != hb->hi)
+    {
+        return ha->hi < hb->hi ? -1 : 1;
+    }
+
+    if (ha->lo != hb->lo)
+    {
+        return ha->lo < hb->lo ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static inline int
+omap_tail_cmp_(const struct omap_head * ha, const char * a,
+               const struct omap_head * hb, const char * b)
+{
+    int res;
+
+    if (ha->klen > 16 && hb->klen > 16)
+    {
+        res = memcmp(a + 16, b + 16, (ha->klen < hb->klen ? ha->klen : hb->klen) - 16);
+
+        if (res != 0)
+        {
+            return res;
+        }
+    }
+
+    return (ha->klen > hb->klen) - (ha->klen < hb->klen);
+}
+
+/*
+ * the stored key is only loaded on a tie: during a search it usually sits
+ * on a cache line nothing else needs.
+ */
+static inline int
+omap_ent_cmp_(struct lz_omap_chunk * c, uint32_t i, const char * k, const struct omap_head * hk)
+{
+    int res;
+
+    if ((res = omap_head_cmp_(&c->heads[i], hk)) != 0)
+    {
+        return res;
+    }
+
+    return omap_tail_cmp_(&c->heads[i], c->ents[i].key, hk, k);
+}
+
+static inline int
+omap_node_key_cmp_(struct omap_node * n, const char * k, const struct omap_head * hk)
+{
+    int res;
+
+    if ((res = omap_head_cmp_(&n->min, hk)) != 0)
+    {
+        return res;
+    }
+
+    return omap_tail_cmp_(&n->min, n->chunk->ents[0].key, hk, k);
+}
+
+static int
+omap_node_cmp_(struct omap_node * a, struct omap_node * b)
+{
+    return omap_node_key_cmp_(a, b->chunk->ents[0].key, &b->min);
+}
+
+RB_GENERATE_STATIC(omap_tree, omap_node, rb, omap_node_cmp_);
+
+/**
+ * @brief the chunk a key belongs in: the last one starting at or before the
+ *        key, or the first chunk if the key sorts before everything.
+ */
+static struct lz_omap_chunk *
+omap_chunk_find_(lz_omap * map, const char * k, const struct omap_head * hk)
+{
+    struct omap_node * n    = RB_ROOT(&map->tree);
+    struct omap_node * best = NULL;
+
+    while (n != NULL)
+    {
+        if (omap_node_key_cmp_(n, k, hk) <= 0)
+        {
+            best = n;
+            n    = RB_RIGHT(n, rb);
+        } else {
+            n = RB_LEFT(n, rb);
+        }
+    }
+
+    return best ? best->chunk : map->first;
+}
+
+/**
+ * @brief the index of the first entry of the chunk >= key, n_ents if none.
+ */
+static inline uint32_t
+omap_chunk_lb_(struct lz_omap_chunk * c, const char * k, const struct omap_head * hk)
+{
+    uint32_t lo = 0;
+    uint32_t hi = c->n_ents;
+    size_t   off;
+
+    /*
+     * fetch all the heads up front: the misses overlap, rather than the
+     * search taking them one at a time.
+     */
+    for (off = 0; off < sizeof(struct omap_head) * hi; off += 64)
+    {
+        __builtin_prefetch((char *)c->heads + off);
+    }
+
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+
+        if (omap_ent_cmp_(c, mid, k, hk) < 0)
+        {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+static inline void
+omap_ent_release_(struct omap_ent * ent)
+{
+    if (ent->freefn)
+    {
+        (ent->freefn)(ent->val);
+    }
+
+    free(ent->key);
+}
+
+/**
+ * @brief indexes a chunk that has its first entry
+ *
+ * @return 0 on success, -1 if no tree node could be allocated
+ */
+static int
+omap_chunk_link_(lz_omap * map, struct lz_omap_chunk * c)
+{
+    struct omap_node * node;
+
+    if ((node = map->free_nodes) != NULL)
+    {
+        map->free_nodes = node->next_free;
+    } else {
+        if (map->slabs == NULL || map->n_slab_used == OMAP_SLAB_NODES)
+        {
+            struct omap_node_slab * slab;
+
+            if (posix_memalign((void **)&slab, 64, sizeof(struct omap_node_slab)) != 0)
+            {
+                return -1;
+            }
+
+            slab->next       = map->slabs;
+            map->slabs       = slab;
+            map->n_slab_used = 0;
+        }
+
+        node = &map->slabs->nodes[map->n_slab_used++];
+    }
+
+    node->min   = c->heads[0];
+    node->chunk = c;
+    c->node     = node;
+
+    RB_INSERT(omap_tree, &map->tree, node);
+
+    return 0;
+}
+
+/**
+ * @brief takes a chunk out of the list and frees it
+ */
+static void
+omap_chunk_drop_(lz_omap * map, struct lz_omap_chunk * c)
+{
+    if (c->prev)
+    {
+        c->prev->next = c->next;
+    } else {
+        map->first = c->next;
+    }
+
+    if (c->next)
+    {
+        c->next->prev = c->prev;
+    }
+
+    free(c);
+}
+
+/**
+ * @brief takes a chunk out of the tree and the list, and frees it
+ */
+static void
+omap_chunk_unlink_(lz_omap * map, struct lz_omap_chunk * c)
+{
+    struct omap_node * node = c->node;
+
+    RB_REMOVE(omap_tree, &map->tree, node);
+
+    node->next_free = map->free_nodes;
+    map->free_nodes = node;
+
+    omap_chunk_drop_(map, c);
+}
+
+static struct lz_omap_chunk *
+omap_chunk_new_after_(struct lz_omap_chunk * prev)
+{
+    struct lz_omap_chunk * c;
+
+    if (!(c = malloc(sizeof(struct lz_omap_chunk))))
+    {
+        return NULL;
+    }
+
+    c->n_ents = 0;
+    c->node   = NULL;
+    c->prev   = prev;
+    c->next   = prev ? prev->next : NULL;
+
+    if (c->next)
+    {
+        c->next->prev = c;
+    }
+
+    if (prev)
+    {
+        prev->next = c;
+    }
+
+    return c;
+}
+
+/**
+ * @brief appends the entries of src to dst, which must have the room.
+ */
+static void
+omap_chunk_append_(struct lz_omap_chunk * dst, struct lz_omap_chunk * src,
+                   uint32_t from, uint32_t n)
+{
+    memcpy(&dst->heads[dst->n_ents], &src->heads[from], sizeof(struct omap_head) * n);
+    memcpy(&dst->ents[dst->n_ents], &src->ents[from], sizeof(struct omap_ent) * n);
+
+    dst->n_ents += n;
+}
+
+static lz_omap *
+omap_new_(void)
+{
+    lz_omap * map;
+
+    if (!(map = calloc(1, sizeof(lz_omap))))
+    {
+        return NULL;
+    }
+
+    RB_INIT(&map->tree);
+
+    return map;
+}
+
+static int
+omap_clear_(lz_omap * map)
+{
+    struct lz_omap_chunk * c;
+    struct lz_omap_chunk * save;
+    uint32_t               i;
+
+    if (map == NULL)
+    {
+        return -1;
+    }
+
+    for (c = map->first; c != NULL; c = save)
+    {
+        save = c->next;
+
+        for (i = 0; i < c->n_ents; i++)
+        {
+            omap_ent_release_(&c->ents[i]);
+        }
+
+        free(c);
+    }
+
+    while (map->slabs != NULL)
+    {
+        struct omap_node_slab * next = map->slabs->next;
+
+        free(map->slabs);
+        map->slabs = next;
+    }
+
+    RB_INIT(&map->tree);
+
+    map->first       = NULL;
+    map->n_entries   = 0;
+    map->free_nodes  = NULL;
+    map->n_slab_used = 0;
+
+    return 0;
+}
+
+static void
+omap_free_(lz_omap * map)
+{
+    if (map == NULL)
+    {
+        return;
+    }
+
+    omap_clear_(map);
+    free(map);
+}
+
+static size_t
+omap_get_size_(lz_omap * map)
+{
+    return map ? map->n_entries : 0;
+}
+
+static int
+omap_add_(lz_omap * map, const char * k, size_t l, void * val, void (* freefn)(void *))
+{
+    struct lz_omap_chunk * c;
+    struct omap_ent      * ent;
+    struct omap_head       hk;
+    uint32_t               i;
+    char                 * key;
+
+    if (lz_unlikely(map == NULL || k == NULL || l > UINT32_MAX))
+    {
+        return -1;
+    }
+
+    hk = omap_head_(k, l);
+
+    if ((c = omap_chunk_find_(map, k, &hk)) == NULL)
+    {
+        if (!(c = omap_chunk_new_after_(NULL)))
+        {
+            return -1;
+        }
+
+        map->first = c;
+        i          = 0;
+    } else {
+        i = omap_chunk_lb_(c, k, &hk);
+
+        if (i < c->n_ents && omap_ent_cmp_(c, i, k, &hk) == 0)
+        {
+            ent = &c->ents[i];
+
+            if (ent->freefn && ent->val != val)
+            {
+                (ent->freefn)(ent->val);
+            }
+
+            ent->val    = val;
+            ent->freefn = freefn;
+
+            return 0;
+        }
+    }
+
+    if (!(key = malloc(l + 1)))
+    {
+        if (c->n_ents == 0)
+        {
+            omap_chunk_drop_(map, c);
+        }
+
+        return -1;
+    }
+
+    memcpy(key, k, l);
+    key[l] = '\0';
+
+    if (c->n_ents == OMAP_CHUNK)
+    {
+        struct lz_omap_chunk * nc;
+        uint32_t               half = OMAP_CHUNK / 2;
+
+        if (!(nc = omap_chunk_new_after_(c)))
+        {
+            free(key);
+            return -1;
+        }
+
+        omap_chunk_append_(nc, c, half, OMAP_CHUNK - half);
+        c->n_ents = half;
+
+        if (omap_chunk_link_(map, nc) == -1)
+        {
+            omap_chunk_append_(c, nc, 0, nc->n_ents);
+            omap_chunk_drop_(map, nc);
+            free(key);
+            return -1;
+        }
+
+        if (i > half)
+        {
+            c  = nc;
+            i -= half;
+        }
+    }
+
+    memmove(&c->heads[i + 1], &c->heads[i], sizeof(struct omap_head) * (c->n_ents - i));
+    memmove(&c->ents[i + 1], &c->ents[i], sizeof(struct omap_ent) * (c->n_ents - i));
+
+    c->heads[i]       = hk;
+    c->ents[i].key    = key;
+    c->ents[i].val    = val;
+    c->ents[i].freefn = freefn;
+    c->n_ents        += 1;
+
+    if (c->node == NULL)
+    {
+        /* a brand new first chunk, it has its first key now */
+        if (omap_chunk_link_(map, c) == -1)
+        {
+            omap_chunk_drop_(map, c);
+            free(key);
+            return -1;
+        }
+    } else if (i == 0)
+    {
+        c->node->min = c->heads[0];
+    }
+
+    map->n_entries += 1;
+
+    return 0;
+} /* omap_add_ */
+
+static int
+omap_find_ent_(lz_omap * map, const char * k, size_t l, lz_omap_iter * it)
+{
+    struct lz_omap_chunk * c;
+    struct omap_head       hk;
+    uint32_t               i;
+
+    if (lz_unlikely(map == NULL || k == NULL))
+    {
+        return -1;
+    }
+
+    hk = omap_head_(k, l);
+
+    if ((c = omap_chunk_find_(map, k, &hk)) == NULL)
+    {
+        return -1;
+    }
+
+    i = omap_chunk_lb_(c, k, &hk);
+
+    if (i == c->n_ents || omap_ent_cmp_(c, i, k, &hk) != 0)
+    {
+        return -1;
+    }
+
+    it->chunk = c;
+    it->idx   = i;
+
+    return 0;
+}
+
+static void *
+omap_find_(lz_omap * map, const char * k, size_t l)
+{
+    lz_omap_iter it;
+
+    if (omap_find_ent_(map, k, l, &it) == -1)
+    {
+        return NULL;
+    }
+
+    return it.chunk->ents[it.idx].val;
+}
+
+static int
+omap_remove_(lz_omap * map, const char * k, size_t l)
+{
+    struct lz_omap_chunk * c;
+    struct lz_omap_chunk * next;
+    lz_omap_iter           it;
+    uint32_t               i;
+
+    if (omap_find_ent_(map, k, l, &it) == -1)
+    {
+        return -1;
+    }
+
+    c = it.chunk;
+    i = it.idx;
+
+    omap_ent_release_(&c->ents[i]);
+
+    memmove(&c->heads[i], &c->heads[i + 1], sizeof(struct omap_head) * (c->n_ents - i - 1));
+    memmove(&c->ents[i], &c->ents[i + 1], sizeof(struct omap_ent) * (c->n_ents - i - 1));
+
+    c->n_ents      -= 1;
+    map->n_entries -= 1;
+
+    if (c->n_ents == 0)
+    {
+        omap_chunk_unlink_(map, c);
+
+        return 0;
+    }
+
+    if (i == 0)
+    {
+        c->node->min = c->heads[0];
+    }
+
+    if (c->n_ents >= OMAP_MERGE_BELOW)
+    {
+        return 0;
+    }
+
+    /* merge with a neighbour, the first chunk of the two stays in the tree */
+    if ((next = c->next) && c->n_ents + next->n_ents <= OMAP_MERGE_MAX)
+    {
+        omap_chunk_append_(c, next, 0, next->n_ents);
+        omap_chunk_unlink_(map, next);
+    } else if (c->prev && c->prev->n_ents + c->n_ents <= OMAP_MERGE_MAX)
+    {
+        omap_chunk_append_(c->prev, c, 0, c->n_ents);
+        omap_chunk_unlink_(map, c);
+    }
+
+    return 0;
+} /* omap_remove_ */
+
+static inline int
+omap_iter_settle_(lz_omap_iter * it)
+{
+    while (it->chunk != NULL && it->idx >= it->chunk->n_ents)
+    {
+        it->chunk = it->chunk->next;
+        it->idx   = 0;
+    }
+
+    return it->chunk ? 0 : -1;
+}
+
+static int
+omap_first_(lz_omap * map, lz_omap_iter * it)
+{
+    if (map == NULL || it == NULL)
+    {
+        return -1;
+    }
+
+    it->chunk = map->first;
+    it->idx   = 0;
+
+    return omap_iter_settle_(it);
+}
+
+static int
+omap_bound_(lz_omap * map, const char * k, size_t l, lz_omap_iter * it, int upper)
+{
+    struct lz_omap_chunk * c;
+    struct omap_head       hk;
+    uint32_t               i;
+
+    if (map == NULL || k == NULL || it == NULL)
+    {
+        return -1;
+    }
+
+    hk = omap_head_(k, l);
+
+    if ((c = omap_chunk_find_(map, k, &hk)) == NULL)
+    {
+        it->chunk = NULL;
+        return -1;
+    }
+
+    i = omap_chunk_lb_(c, k, &hk);
+
+    if (upper && i < c->n_ents && omap_ent_cmp_(c, i, k, &hk) == 0)
+    {
+        i++;
+    }
+
+    it->chunk = c;
+    it->idx   = i;
+
+    return omap_iter_settle_(it);
+}
+
+static int
+omap_lower_bound_(lz_omap * map, const char * k, size_t l, lz_omap_iter * it)
+{
+    return omap_bound_(map, k, l, it, 0);
+}
+
+static int
+omap_upper_bound_(lz_omap * map, const char * k, size_t l, lz_omap_iter * it)
+{
+    return omap_bound_(map, k, l, it, 1);
+}
+
+static int
+omap_iter_next_(lz_omap_iter * it)
+{
+    if (it == NULL || it->chunk == NULL)
+    {
+        return -1;
+    }
+
+    it->idx += 1;
+
+    return omap_iter_settle_(it);
+}
+
+static const char *
+omap_iter_key_(lz_omap_iter * it, size_t * klen)
+{
+    if (it == NULL || it->chunk == NULL)
+    {
+        return NULL;
+    }
+
+    if (klen)
+    {
+        *klen = it->chunk->heads[it->idx].klen;
+    }
+
+    return it->chunk->ents[it->idx].key;
+}
+
+static void *
+omap_iter_val_(lz_omap_iter * it)
+{
+    if (it == NULL || it->chunk == NULL)
+    {
+        return NULL;
+    }
+
+    return it->chunk->ents[it->idx].val;
+}
+
+static int
+omap_range_(lz_omap * map, const char * lo, size_t lol,
+            const char * hi, size_t hil, lz_omap_iterfn iterfn, void * arg)
+{
+    lz_omap_iter     it;
+    struct omap_head hh;
+    int              res;
+
+    if (map == NULL || iterfn == NULL)
+    {
+        return -1;
+    }
+
+    if ((lo ? omap_lower_bound_(map, lo, lol, &it) : omap_first_(map, &it)) == -1)
+    {
+        return 0;
+    }
+
+    if (hi)
+    {
+        hh = omap_head_(hi, hil);
+    }
+
+    for (; it.chunk != NULL; it.chunk = it.chunk->next, it.idx = 0)
+    {
+        struct lz_omap_chunk * c = it.chunk;
+
+        for (; it.idx < c->n_ents; it.idx++)
+        {
+            struct omap_ent * ent = &c->ents[it.idx];
+
+            if (hi && omap_ent_cmp_(c, it.idx, hi, &hh) >= 0)
+            {
+                return 0;
+            }
+
+            if ((res = (iterfn)(ent->key, c->heads[it.idx].klen, ent->val, arg)) != 0)
+            {
+                return res;
+            }
+        }
+    }
+
+    return 0;
+} /* omap_range_ */
+
+static int
+omap_prefix_(lz_omap * map, const char * prefix, size_t l,
+             lz_omap_iterfn iterfn, void * arg)
+{
+    lz_omap_iter it;
+    int          res;
+
+    if (map == NULL || prefix == NULL || iterfn == NULL)
+    {
+        return -1;
+    }
+
+    if (omap_lower_bound_(map, prefix, l, &it) == -1)
+    {
+        return 0;
+    }
+
+    /* every key with the prefix sorts right after the prefix itself */
+    do {
+        struct omap_ent * ent  = &it.chunk->ents[it.idx];
+        uint32_t          klen = it.chunk->heads[it.idx].klen;
+
+        if (klen < l || memcmp(ent->key, prefix, l) != 0)
+        {
+            break;
+        }
+
+        if ((res = (iterfn)(ent->key, klen, ent->val, arg)) != 0)
+        {
+            return res;
+        }
+    } while (omap_iter_next_(&it) == 0);
+
+    return 0;
+}
+
+static int
+omap_for_each_(lz_omap * map, lz_omap_iterfn iterfn, void * arg)
+{
+    return omap_range_(map, NULL, 0, NULL, 0, iterfn, arg);
+}
+
+lz_alias(omap_new_, lz_omap_new);
+lz_alias(omap_free_, lz_omap_free);
+lz_alias(omap_clear_, lz_omap_clear);
+lz_alias(omap_get_size_, lz_omap_get_size);
+lz_alias(omap_add_, lz_omap_add);
+lz_alias(omap_find_, lz_omap_find);
+lz_alias(omap_remove_, lz_omap_remove);
+lz_alias(omap_first_, lz_omap_first);
+lz_alias(omap_lower_bound_, lz_omap_lower_bound);
+lz_alias(omap_upper_bound_, lz_omap_upper_bound);
+lz_alias(omap_iter_next_, lz_omap_iter_next);
+lz_alias(omap_iter_key_, lz_omap_iter_key);
+lz_alias(omap_iter_val_, lz_omap_iter_val);
+lz_alias(omap_range_, lz_omap_range);
+lz_alias(omap_prefix_, lz_omap_prefix);
+lz_alias(omap_for_each_, lz_omap_for_each);
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <liblz.h>
+
+/*
+ * lz_omap: an ordered key/value map, for range and prefix queries that would
+ * otherwise mean scanning (and sorting) a whole lz_kvmap.
+ *
+ * Keys are byte strings ordered like memcmp(), a key sorting before any
+ * longer key it is a prefix of. Entries are packed, sorted, into chunks of up
+ * to 64 which are kept in a red-black tree (sys/tree.h) and linked in order,
+ * so a lookup walks a tree of about n / 48 nodes and then binary searches a
+ * single chunk, and ordered iteration is mostly a walk through an array.
+ */
+
+struct lz_omap_s;
+struct lz_omap_chunk;
+
+typedef struct lz_omap_s lz_omap;
+
+typedef int (* lz_omap_iterfn)(const char * key, size_t klen, void * val, void * arg);
+
+/*
+ * a position in the map, as set by lz_omap_first() / lower_bound() /
+ * upper_bound(). It is invalidated by any add or remove.
+ */
+typedef struct lz_omap_iter {
+    struct lz_omap_chunk * chunk;
+    uint32_t               idx;
+} lz_omap_iter;
+
+
+LZ_EXPORT lz_omap * lz_omap_new(void);
+LZ_EXPORT void      lz_omap_free(lz_omap * map);
+LZ_EXPORT int       lz_omap_clear(lz_omap * map);
+LZ_EXPORT size_t    lz_omap_get_size(lz_omap * map);
+
+
+/**
+ * @brief adds the key, or replaces its value if it is already in the map. A
+ *        replaced value is released with its freefn, unless it is the same
+ *        value.
+ *
+ * @return 0 on success, -1 on error
+ */
+LZ_EXPORT int lz_omap_add(lz_omap * map, const char * k, size_t l, void * val, void (* freefn)(void *));
+
+/**
+ * @return the value of the key, NULL if not found
+ */
+LZ_EXPORT void * lz_omap_find(lz_omap * map, const char * k, size_t l);
+
+/**
+ * @brief removes the key, releasing its value with its freefn
+ *
+ * @return 0 on success, -1 if not found
+ */
+LZ_EXPORT int lz_omap_remove(lz_omap * map, const char * k, size_t l);
+
+
+/**
+ * @brief position `it` at the first entry, the first entry >= k
+ *        (lower_bound), or the first entry > k (upper_bound).
+ *
+ * @return 0 on success, -1 if there is no such entry
+ */
+LZ_EXPORT int lz_omap_first(lz_omap * map, lz_omap_iter * it);
+LZ_EXPORT int lz_omap_lower_bound(lz_omap * map, const char * k, size_t l, lz_omap_iter * it);
+LZ_EXPORT int lz_omap_upper_bound(lz_omap * map, const char * k, size_t l, lz_omap_iter * it);
+
+/**
+ * @brief moves `it` to the next entry in order
+ *
+ * @return 0 on success, -1 once past the last entry
+ */
+LZ_EXPORT int          lz_omap_iter_next(lz_omap_iter * it);
+LZ_EXPORT const char * lz_omap_iter_key(lz_omap_iter * it, size_t * klen);
+LZ_EXPORT void       * lz_omap_iter_val(lz_omap_iter * it);
+
+
+/**
+ * @brief calls iterfn, in order, for every entry with lo <= key < hi, until
+ *        it returns non-zero. A NULL lo / hi leaves that end unbounded.
+ *        iterfn must not modify the map.
+ *
+ * @return the first non-zero value returned by iterfn, or 0
+ */
+LZ_EXPORT int lz_omap_range(lz_omap * map, const char * lo, size_t lol,
+    const char * hi, size_t hil, lz_omap_iterfn iterfn, void * arg);
+
+/**
+ * @brief like lz_omap_range(), for every key starting with `prefix`
+ */
+LZ_EXPORT int lz_omap_prefix(lz_omap * map, const char * prefix, size_t l,
+    lz_omap_iterfn iterfn, void * arg);
+
+LZ_EXPORT int lz_omap_for_each(lz_omap * map, lz_omap_iterfn iterfn, void * arg);
@@ -0,0 +1,1529 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+/*
+ * every rule is stored under its key: the labels of the name in reverse
+ * order, lowercased, each followed by a '.' ("www.Example.com" becomes
+ * "com.example.www."). A rule is then a prefix of a name's key exactly when
+ * it is a suffix of the name on a label boundary, and since every key ends
+ * in a '.', a value can only sit at the end of a label.
+ */
+#define SFX_KEY_MAX (LZ_SFXTRIE_NAME_MAX + 1)
+
+#define sfx_min_(a, b) ((a) < (b) ? (a) : (b))
+
+enum {
+    SFX_NODE4 = 0,
+    SFX_NODE16,
+    SFX_NODE48,
+    SFX_NODE256
+};
+
+/*
+ * a node holds the compressed path leading to it (prefix, stored after the
+ * typed node), the value of the rule ending there if any, and its children
+ * keyed by the next byte of the key. node4 / node16 keep unsorted key
+ * arrays, node48 a 256 byte index into its child array, node256 a child per
+ * byte.
+ */
+struct sfx_node {
+    uint8_t  type;
+    uint8_t  has_val;
+    uint16_t n_children;
+    uint32_t plen;
+    void   * val;
+    void  (* freefn)(void *);
+};
+
+struct sfx_node4 {
+    struct sfx_node   hdr;
+    uint8_t           keys[4];
+    struct sfx_node * child[4];
+    uint8_t           prefix[];
+};
+
+struct sfx_node16 {
+    struct sfx_node   hdr;
+    uint8_t           keys[16];
+    struct sfx_node * child[16];
+    uint8_t           prefix[];
+};
+
+struct sfx_node48 {
+    struct sfx_node   hdr;
+    uint8_t           index[256]; /* child slot + 1, 0 if none */
+    struct sfx_node * child[48];
+    uint8_t           prefix[];
+};
+
+struct sfx_node256 {
+    struct sfx_node   hdr;
+    struct sfx_node * child[256];
+    uint8_t           prefix[];
+};
+
+static const uint32_t sfx_node_size_[] = {
+    offsetof(struct sfx_node4, prefix),
+    offsetof(struct sfx_node16, prefix),
+    offsetof(struct sfx_node48, prefix),
+    offsetof(struct sfx_node256, prefix),
+};
+
+static const uint32_t sfx_node_max_[] = { 4, 16, 48, 256 };
+
+#define sfx_prefix_(node) ((uint8_t *)(node) + sfx_node_size_[(node)->type])
+
+/* a node shrinks to the next smaller type once it is half empty there */
+#define sfx_node_shrink_at_(type) (sfx_node_max_[(type) - 1] / 2)
+
+struct lz_sfxtrie_s {
+    struct sfx_node * root;
+    size_t            n_entries;
+};
+
+static inline uint8_t
+sfx_lower_(uint8_t c)
+{
+    return (uint8_t)(c - 'A') < 26 ? c | 0x20 : c;
+}
+
+/**
+ * @brief writes the key of name into buf (SFX_KEY_MAX bytes)
+ *
+ * @return the key length, -1 if the name is too long or has an empty label
+ */
+static int
+sfx_key_(const char * name, size_t len, uint8_t * buf)
+{
+    const char * dot;
+    size_t       start = 0;
+    size_t       end;
+    size_t       i;
+
+    if (len > 0 && name == NULL)
+    {
+        return -1;
+    }
+
+    if (len > 0 && name[len - 1] == '.')
+    {
+        len--;
+    }
+
+    if (len > LZ_SFXTRIE_NAME_MAX)
+    {
+        return -1;
+    }
+
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    /* the label at [start, end) of the name goes to [len - end, len - start)
+     * of the key, followed by its '.', so the labels are found front to back
+     * with memchr() and copied whole */
+    do {
+        dot = memchr(name + start, '.', len - start);
+        end = dot ? (size_t)(dot - name) : len;
+
+        if (end == start)
+        {
+            return -1;
+        }
+
+        memcpy(buf + len - end, name + start, end - start);
+        buf[len - start] = '.';
+
+        start = end + 1;
+    } while (dot != NULL);
+
+    /* lowercased in a separate pass, which the compiler can vectorize */
+    for (i = 0; i < len; i++)
+    {
+        buf[i] = sfx_lower_(buf[i]);
+    }
+
+    return (int)len + 1;
+} /* sfx_key_ */
+
+static struct sfx_node *
+sfx_node_new_(uint8_t type, const uint8_t * prefix, uint32_t plen)
+{
+    struct sfx_node * node;
+
+    if (!(node = calloc(1, sfx_node_size_[type] + plen)))
+    {
+        return NULL;
+    }
+
+    node->type = type;
+    node->plen = plen;
+
+    memcpy(sfx_prefix_(node), prefix, plen);
+
+    return node;
+}
+
+static struct sfx_node **
+sfx_child_find_(struct sfx_node * node, uint8_t c)
+{
+    uint32_t i;
+
+    switch (node->type) {
+        case SFX_NODE4: {
+            struct sfx_node4 * n4 = (struct sfx_node4 *)node;
+
+            for (i = 0; i < node->n_children; i++)
+            {
+                if (n4->keys[i] == c)
+                {
+                    return &n4->child[i];
+                }
+            }
+
+            return NULL;
+        }
+        case SFX_NODE16: {
+            struct sfx_node16 * n16 = (struct sfx_node16 *)node;
+#ifdef __SSE2__
+            __m128i  keys = _mm_loadu_si128((const __m128i *)n16->keys);
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(keys, _mm_set1_epi8((char)c)));
+
+            mask &= (1U << node->n_children) - 1;
+
+            return mask ? &n16->child[__builtin_ctz(mask)] : NULL;
+#else
+            for (i = 0; i < node->n_children; i++)
+            {
+                if (n16->keys[i] == c)
+                {
+                    return &n16->child[i];
+                }
+            }
+
+            return NULL;
+#endif
+        }
+        case SFX_NODE48: {
+            struct sfx_node48 * n48 = (struct sfx_node48 *)node;
+
+            return n48->index[c] ? &n48->child[n48->index[c] - 1] : NULL;
+        }
+        default: {
+            struct sfx_node256 * n256 = (struct sfx_node256 *)node;
+
+            return n256->child[c] ? &n256->child[c] : NULL;
+        }
+    } /* switch */
+} /* sfx_child_find_ */
+
+/**
+ * @brief iterates the children of a node, *pos starting at 0
+ *
+ * @return the next child (its key byte in *c), NULL after the last one
+ */
+static struct sfx_node *
+sfx_child_next_(struct sfx_node * node, uint32_t * pos, uint8_t * c)
+{
+    switch (node->type) {
+        case SFX_NODE4:
+        case SFX_NODE16: {
+            uint8_t          * keys  = node->type == SFX_NODE4 ?
+                                       ((struct sfx_node4 *)node)->keys :
+                                       ((struct sfx_node16 *)node)->keys;
+            struct sfx_node ** child = node->type == SFX_NODE4 ?
+                                       ((struct sfx_node4 *)node)->child :
+                                       ((struct sfx_node16 *)node)->child;
+
+            if (*pos >= node->n_children)
+            {
+                return NULL;
+            }
+
+            *c = keys[*pos];
+
+            return child[(*pos)++];
+        }
+        case SFX_NODE48: {
+            struct sfx_node48 * n48 = (struct sfx_node48 *)node;
+
+            while (*pos < 256)
+            {
+                uint32_t b = (*pos)++;
+
+                if (n48->index[b])
+                {
+                    *c = (uint8_t)b;
+                    return n48->child[n48->index[b] - 1];
+                }
+            }
+
+            return NULL;
+        }
+        default: {
+            struct sfx_node256 * n256 = (struct sfx_node256 *)node;
+
+            while (*pos < 256)
+            {
+                uint32_t b = (*pos)++;
+
+                if (n256->child[b])
+                {
+                    *c = (uint8_t)b;
+                    return n256->child[b];
+                }
+            }
+
+            return NULL;
+        }
+    } /* switch */
+} /* sfx_child_next_ */
+
+/**
+ * @brief adds a child to a node with room for it
+ */
+static void
+sfx_child_put_(struct sfx_node * node, uint8_t c, struct sfx_node * child)
+{
+    uint32_t n = node->n_children;
+
+    switch (node->type) {
+        case SFX_NODE4:
+            ((struct sfx_node4 *)node)->keys[n]  = c;
+            ((struct sfx_node4 *)node)->child[n] = child;
+            break;
+        case SFX_NODE16:
+            ((struct sfx_node16 *)node)->keys[n]  = c;
+            ((struct sfx_node16 *)node)->child[n] = child;
+            break;
+        case SFX_NODE48:
+            ((struct sfx_node48 *)node)->index[c] = (uint8_t)(n + 1);
+            ((struct sfx_node48 *)node)->child[n] = child;
+            break;
+        default:
+            ((struct sfx_node256 *)node)->child[c] = child;
+            break;
+    }
+
+    node->n_children = (uint16_t)(n + 1);
+}
+
+/**
+ * @brief moves a node into a new one of another type, which must be large
+ *        enough for its children
+ */
+static struct sfx_node *
+sfx_node_retype_(struct sfx_node * node, uint8_t type)
+{
+    struct sfx_node * new;
+    struct sfx_node * child;
+    uint32_t          pos = 0;
+    uint8_t           c;
+
+    if (!(new = sfx_node_new_(type, sfx_prefix_(node), node->plen)))
+    {
+        return NULL;
+    }
+
+    new->has_val = node->has_val;
+    new->val     = node->val;
+    new->freefn  = node->freefn;
+
+    while ((child = sfx_child_next_(node, &pos, &c)))
+    {
+        sfx_child_put_(new, c, child);
+    }
+
+    free(node);
+
+    return new;
+}
+
+static int
+sfx_child_add_(struct sfx_node ** ref, uint8_t c, struct sfx_node * child)
+{
+    struct sfx_node * node = *ref;
+
+    if (node->n_children == sfx_node_max_[node->type])
+    {
+        if (!(node = sfx_node_retype_(node, node->type + 1)))
+        {
+            return -1;
+        }
+
+        *ref = node;
+    }
+
+    sfx_child_put_(node, c, child);
+
+    return 0;
+}
+
+static void
+sfx_child_del_(struct sfx_node ** ref, uint8_t c)
+{
+    struct sfx_node * node = *ref;
+    struct sfx_node * shrunk;
+    uint32_t          last = node->n_children - 1;
+    uint32_t          i;
+
+    switch (node->type) {
+        case SFX_NODE4:
+        case SFX_NODE16: {
+            uint8_t          * keys  = node->type == SFX_NODE4 ?
+                                       ((struct sfx_node4 *)node)->keys :
+                                       ((struct sfx_node16 *)node)->keys;
+            struct sfx_node ** child = node->type == SFX_NODE4 ?
+                                       ((struct sfx_node4 *)node)->child :
+                                       ((struct sfx_node16 *)node)->child;
+
+            for (i = 0; keys[i] != c; i++)
+            {
+            }
+
+            keys[i]  = keys[last];
+            child[i] = child[last];
+            break;
+        }
+        case SFX_NODE48: {
+            struct sfx_node48 * n48  = (struct sfx_node48 *)node;
+            uint32_t            slot = n48->index[c] - 1;
+
+            n48->index[c] = 0;
+
+            if (slot != last)
+            {
+                for (i = 0; n48->index[i] != last + 1; i++)
+                {
+                }
+
+                n48->child[slot] = n48->child[last];
+                n48->index[i]    = (uint8_t)(slot + 1);
+            }
+
+            break;
+        }
+        default:
+            ((struct sfx_node256 *)node)->child[c] = NULL;
+            break;
+    } /* switch */
+
+    node->n_children = (uint16_t)last;
+
+    /* a failed shrink just leaves the node larger than it needs to be */
+    if (node->type != SFX_NODE4 && last <= sfx_node_shrink_at_(node->type))
+    {
+        if ((shrunk = sfx_node_retype_(node, node->type - 1)))
+        {
+            *ref = shrunk;
+        }
+    }
+} /* sfx_child_del_ */
+
+/**
+ * @brief folds a node with no value and a single child into that child,
+ *        restoring the path compression after a removal
+ */
+static void
+sfx_node_merge_(struct sfx_node ** ref)
+{
+    struct sfx_node * node = *ref;
+    struct sfx_node * child;
+    uint32_t          pos  = 0;
+    uint32_t          plen;
+    uint8_t           c;
+
+    child = sfx_child_next_(node, &pos, &c);
+    plen  = node->plen + 1 + child->plen;
+
+    /* as with shrinking, failing to merge is harmless */
+    if (!(child = realloc(child, sfx_node_size_[child->type] + plen)))
+    {
+        return;
+    }
+
+    memmove(sfx_prefix_(child) + node->plen + 1, sfx_prefix_(child), child->plen);
+    memcpy(sfx_prefix_(child), sfx_prefix_(node), node->plen);
+
+    sfx_prefix_(child)[node->plen] = c;
+    child->plen = plen;
+
+    free(node);
+
+    *ref = child;
+}
+
+static void
+sfx_node_free_(struct sfx_node * node, int release)
+{
+    struct sfx_node * child;
+    uint32_t          pos = 0;
+    uint8_t           c;
+
+    if (node == NULL)
+    {
+        return;
+    }
+
+    while ((child = sfx_child_next_(node, &pos, &c)))
+    {
+        sfx_node_free_(child, release);
+    }
+
+    if (release && node->has_val && node->freefn)
+    {
+        (node->freefn)(node->val);
+    }
+
+    free(node);
+}
+
+static inline uint32_t
+sfx_mismatch_(const uint8_t * a, const uint8_t * b, uint32_t n)
+{
+    uint32_t i = 0;
+
+    while (i < n && a[i] == b[i])
+    {
+        i++;
+    }
+
+    return i;
+}
+
+/**
+ * @brief the node holding the rule for key, or the deepest node with a rule
+ *        on the way to it when `longest` is set
+ */
+static struct sfx_node *
+sfx_descend_(lz_sfxtrie * trie, const uint8_t * key, uint32_t klen, int longest, uint32_t * mlen)
+{
+    struct sfx_node  * node  = trie->root;
+    struct sfx_node  * best  = NULL;
+    struct sfx_node ** ref;
+    uint32_t           depth = 0;
+
+    while (node != NULL)
+    {
+        if (node->plen)
+        {
+            if (klen - depth < node->plen ||
+                memcmp(sfx_prefix_(node), key + depth, node->plen))
+            {
+                break;
+            }
+
+            depth += node->plen;
+        }
+
+        if (node->has_val && (longest || depth == klen))
+        {
+            best   = node;
+            *mlen  = depth;
+        }
+
+        if (depth == klen || !(ref = sfx_child_find_(node, key[depth])))
+        {
+            break;
+        }
+
+        node   = *ref;
+        depth += 1;
+    }
+
+    return best;
+}
+
+static lz_sfxtrie *
+sfxtrie_new_(void)
+{
+    return calloc(1, sizeof(lz_sfxtrie));
+}
+
+static void
+sfxtrie_free_(lz_sfxtrie * trie)
+{
+    if (trie == NULL)
+    {
+        return;
+    }
+
+    sfx_node_free_(trie->root, 1);
+    free(trie);
+}
+
+static size_t
+sfxtrie_get_size_(lz_sfxtrie * trie)
+{
+    return trie ? trie->n_entries : 0;
+}
+
+static int
+sfxtrie_add_(lz_sfxtrie * trie, const char * name, size_t len, void * val, void (* freefn)(void *))
+{
+    uint8_t            key[SFX_KEY_MAX];
+    struct sfx_node ** ref;
+    struct sfx_node  * node;
+    uint32_t           depth = 0;
+    int                klen;
+
+    if (lz_unlikely(trie == NULL) || (klen = sfx_key_(name, len, key)) == -1)
+    {
+        return -1;
+    }
+
+    for (ref = &trie->root; (node = *ref) != NULL; ref = sfx_child_find_(node, key[depth++]))
+    {
+        uint32_t m = sfx_mismatch_(sfx_prefix_(node), key + depth,
+                                   sfx_min_(node->plen, (uint32_t)klen - depth));
+
+        if (m < node->plen)
+        {
+            /* the key leaves (or ends inside) this node's prefix: split it */
+            struct sfx_node * split;
+            struct sfx_node * leaf = NULL;
+            uint8_t         * p    = sfx_prefix_(node);
+
+            if (depth + m < (uint32_t)klen &&
+                !(leaf = sfx_node_new_(SFX_NODE4, key + depth + m + 1, klen - depth - m - 1)))
+            {
+                return -1;
+            }
+
+            if (!(split = sfx_node_new_(SFX_NODE4, p, m)))
+            {
+                free(leaf);
+                return -1;
+            }
+
+            sfx_child_put_(split, p[m], node);
+
+            memmove(p, p + m + 1, node->plen - m - 1);
+            node->plen -= m + 1;
+
+            if (leaf != NULL)
+            {
+                sfx_child_put_(split, key[depth + m], leaf);
+                node = leaf;
+            } else {
+                node = split;
+            }
+
+            *ref = split;
+            break;
+        }
+
+        depth += node->plen;
+
+        if (depth == (uint32_t)klen)
+        {
+            if (node->has_val)
+            {
+                if (node->val != val && node->freefn)
+                {
+                    (node->freefn)(node->val);
+                }
+
+                node->val    = val;
+                node->freefn = freefn;
+
+                return 0;
+            }
+
+            break;
+        }
+
+        if (sfx_child_find_(node, key[depth]) == NULL)
+        {
+            struct sfx_node * leaf;
+
+            if (!(leaf = sfx_node_new_(SFX_NODE4, key + depth + 1, klen - depth - 1)))
+            {
+                return -1;
+            }
+
+            if (sfx_child_add_(ref, key[depth], leaf) == -1)
+            {
+                free(leaf);
+                return -1;
+            }
+
+            node = leaf;
+            break;
+        }
+    }
+
+    if (node == NULL)
+    {
+        if (!(node = sfx_node_new_(SFX_NODE4, key, klen)))
+        {
+            return -1;
+        }
+
+        *ref = node;
+    }
+
+    node->has_val    = 1;
+    node->val        = val;
+    node->freefn     = freefn;
+    trie->n_entries += 1;
+
+    return 0;
+} /* sfxtrie_add_ */
+
+static int
+sfx_remove_(struct sfx_node ** ref, const uint8_t * key, uint32_t klen, uint32_t depth)
+{
+    struct sfx_node  * node = *ref;
+    struct sfx_node ** cref;
+
+    if (node == NULL || klen - depth < node->plen ||
+        memcmp(sfx_prefix_(node), key + depth, node->plen))
+    {
+        return -1;
+    }
+
+    depth += node->plen;
+
+    if (depth == klen)
+    {
+        if (!node->has_val)
+        {
+            return -1;
+        }
+
+        if (node->freefn)
+        {
+            (node->freefn)(node->val);
+        }
+
+        node->has_val = 0;
+        node->val     = NULL;
+        node->freefn  = NULL;
+    } else {
+        if (!(cref = sfx_child_find_(node, key[depth])) ||
+            sfx_remove_(cref, key, klen, depth + 1) == -1)
+        {
+            return -1;
+        }
+
+        if (*cref == NULL)
+        {
+            sfx_child_del_(ref, key[depth]);
+            node = *ref;
+        }
+    }
+
+    if (!node->has_val)
+    {
+        if (node->n_children == 0)
+        {
+            free(node);
+            *ref = NULL;
+        } else if (node->n_children == 1) {
+            sfx_node_merge_(ref);
+        }
+    }
+
+    return 0;
+} /* sfx_remove_ */
+
+static int
+sfxtrie_remove_(lz_sfxtrie * trie, const char * name, size_t len)
+{
+    uint8_t key[SFX_KEY_MAX];
+    int     klen;
+
+    if (lz_unlikely(trie == NULL) || (klen = sfx_key_(name, len, key)) == -1)
+    {
+        return -1;
+    }
+
+    if (sfx_remove_(&trie->root, key, (uint32_t)klen, 0) == -1)
+    {
+        return -1;
+    }
+
+    trie->n_entries -= 1;
+
+    return 0;
+}
+
+static void *
+sfxtrie_find_(lz_sfxtrie * trie, const char * name, size_t len)
+{
+    uint8_t           key[SFX_KEY_MAX];
+    struct sfx_node * node;
+    uint32_t          depth;
+    int               klen;
+
+    if (lz_unlikely(trie == NULL) || (klen = sfx_key_(name, len, key)) == -1)
+    {
+        return NULL;
+    }
+
+    node = sfx_descend_(trie, key, (uint32_t)klen, 0, &depth);
+
+    return node ? node->val : NULL;
+}
+
+static void *
+sfxtrie_match_(lz_sfxtrie * trie, const char * name, size_t len, size_t * mlen)
+{
+    uint8_t           key[SFX_KEY_MAX];
+    struct sfx_node * node;
+    uint32_t          depth;
+    int               klen;
+
+    if (lz_unlikely(trie == NULL) || (klen = sfx_key_(name, len, key)) == -1)
+    {
+        return NULL;
+    }
+
+    if (!(node = sfx_descend_(trie, key, (uint32_t)klen, 1, &depth)))
+    {
+        return NULL;
+    }
+
+    if (mlen != NULL)
+    {
+        /* the key has a '.' after every label, the name one between them */
+        *mlen = depth ? depth - 1 : 0;
+    }
+
+    return node->val;
+}
+
+static int
+sfxtrie_cmp_(const char * a, size_t alen, const char * b, size_t blen)
+{
+    uint8_t ka[SFX_KEY_MAX];
+    uint8_t kb[SFX_KEY_MAX];
+    int     la  = sfx_key_(a, alen, ka);
+    int     lb  = sfx_key_(b, blen, kb);
+    int     res;
+
+    if (la == -1 || lb == -1)
+    {
+        return (lb == -1) - (la == -1);
+    }
+
+    if ((res = memcmp(ka, kb, (size_t)sfx_min_(la, lb))))
+    {
+        return res;
+    }
+
+    return (la > lb) - (la < lb);
+}
+
+/* bulk build: the keys of every name, sorted, and built into nodes
+ * recursively, each node's prefix being the common prefix of its range */
+struct sfx_bkey {
+    const uint8_t * key;
+    uint32_t        klen;
+    uint32_t        idx;
+};
+
+static int
+sfx_bkey_cmp_(const void * a, const void * b)
+{
+    const struct sfx_bkey * ka = a;
+    const struct sfx_bkey * kb = b;
+    int                     res;
+
+    if ((res = memcmp(ka->key, kb->key, sfx_min_(ka->klen, kb->klen))))
+    {
+        return res;
+    }
+
+    if (ka->klen != kb->klen)
+    {
+        return ka->klen < kb->klen ? -1 : 1;
+    }
+
+    /* keep duplicates in input order, so the last one wins */
+    return ka->idx < kb->idx ? -1 : ka->idx > kb->idx;
+}
+
+static struct sfx_node *
+sfx_build_(const struct sfx_bkey * keys, size_t lo, size_t hi, uint32_t depth,
+           void * const * vals, void (* freefn)(void *))
+{
+    const struct sfx_bkey * first = &keys[lo];
+    const struct sfx_bkey * last  = &keys[hi - 1];
+    struct sfx_node       * node;
+    uint32_t                plen;
+    uint32_t                n_children = 0;
+    uint8_t                 type;
+    size_t                  i;
+    size_t                  j;
+
+    plen = sfx_mismatch_(first->key + depth, last->key + depth,
+                         sfx_min_(first->klen, last->klen) - depth);
+    depth += plen;
+
+    /* after any keys ending here, the rest of the range is grouped by the
+     * byte that follows */
+    for (i = lo; i < hi && keys[i].klen == depth; i++)
+    {
+    }
+
+    for (j = i; j < hi; j++)
+    {
+        n_children += j == i || keys[j].key[depth] != keys[j - 1].key[depth];
+    }
+
+    for (type = SFX_NODE4; sfx_node_max_[type] < n_children; type++)
+    {
+    }
+
+    if (!(node = sfx_node_new_(type, first->key + depth - plen, plen)))
+    {
+        return NULL;
+    }
+
+    if (i > lo)
+    {
+        node->has_val = 1;
+        node->val     = vals[keys[i - 1].idx];
+        node->freefn  = freefn;
+    }
+
+    for (; i < hi; i = j)
+    {
+        struct sfx_node * child;
+
+        for (j = i + 1; j < hi && keys[j].key[depth] == keys[i].key[depth]; j++)
+        {
+        }
+
+        if (!(child = sfx_build_(keys, i, j, depth + 1, vals, freefn)))
+        {
+            sfx_node_free_(node, 0);
+            return NULL;
+        }
+
+        sfx_child_put_(node, keys[i].key[depth], child);
+    }
+
+    return node;
+} /* sfx_build_ */
+
+static lz_sfxtrie *
+sfxtrie_build_(const char * const * names, const size_t * lens, void * const * vals,
+               size_t n, void (* freefn)(void *))
+{
+    lz_sfxtrie      * trie;
+    struct sfx_bkey * keys;
+    uint8_t         * buf;
+    size_t            off    = 0;
+    size_t            i;
+    int               sorted = 1;
+
+    if (!(trie = sfxtrie_new_()) || n == 0)
+    {
+        return trie;
+    }
+
+    if (n > UINT32_MAX)
+    {
+        free(trie);
+        return NULL;
+    }
+
+    keys = malloc(sizeof(struct sfx_bkey) * n);
+    buf  = malloc(SFX_KEY_MAX * n);
+
+    if (!keys || !buf)
+    {
+        goto fail;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        int klen = sfx_key_(names[i], lens ? lens[i] : (names[i] ? strlen(names[i]) : 0), buf + off);
+
+        if (klen == -1)
+        {
+            errno = EINVAL;
+            goto fail;
+        }
+
+        keys[i].key  = buf + off;
+        keys[i].klen = (uint32_t)klen;
+        keys[i].idx  = (uint32_t)i;
+        off         += (size_t)klen;
+
+        if (i && sorted && sfx_bkey_cmp_(&keys[i - 1], &keys[i]) > 0)
+        {
+            sorted = 0;
+        }
+    }
+
+    if (!sorted)
+    {
+        qsort(keys, n, sizeof(struct sfx_bkey), sfx_bkey_cmp_);
+    }
+
+    if (!(trie->root = sfx_build_(keys, 0, n, 0, vals, freefn)))
+    {
+        goto fail;
+    }
+
+    /* only now that the build can no longer fail, release the values of
+     * duplicates that lost to a later one */
+    for (i = 0, trie->n_entries = n; i + 1 < n; i++)
+    {
+        if (keys[i].klen == keys[i + 1].klen &&
+            !memcmp(keys[i].key, keys[i + 1].key, keys[i].klen))
+        {
+            if (freefn && vals[keys[i].idx] != vals[keys[i + 1].idx])
+            {
+                (freefn)(vals[keys[i].idx]);
+            }
+
+            trie->n_entries -= 1;
+        }
+    }
+
+    free(keys);
+    free(buf);
+
+    return trie;
+fail:
+    free(keys);
+    free(buf);
+    free(trie);
+
+    return NULL;
+} /* sfxtrie_build_ */
+
+/*
+ * frozen file layout, every section 8 byte aligned:
+ *
+ *   header
+ *   nodes   the trie in preorder, the root first. Each sfx_fnode is followed
+ *           by its prefix (padded to 4 bytes), then either its key bytes
+ *           (padded to 4) and a child per key, or, with more than
+ *           SFX_FROZEN_SPARSE children, a child per byte value. Children are
+ *           offsets into the node section in 8 byte units, 0 (the root) for
+ *           none.
+ *   blob    per value: u32 vlen, u32 reserved, value, NUL (8 byte aligned)
+ */
+#define SFX_FROZEN_MAGIC   "LZSFXFZ1"
+#define SFX_FROZEN_VERSION 1
+#define SFX_FROZEN_SPARSE  16
+
+struct sfx_frozen_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t n_entries;
+    uint64_t node_off;
+    uint64_t blob_off;
+    uint64_t file_len;
+};
+
+struct sfx_fnode {
+    uint32_t plen;
+    uint16_t n_children;
+    uint8_t  dense;
+    uint8_t  has_val;
+    uint64_t val_off;  /* from blob_off */
+};
+
+struct sfx_frec {
+    uint32_t vlen;
+    uint32_t reserved;
+    char     data[];
+};
+
+struct lz_sfxtrie_frozen_s {
+    const char                     * base;
+    size_t                           len;
+    const struct sfx_frozen_header * hdr;
+    const char                     * nodes;
+    uint64_t                         nodes_len;
+    const char                     * blob;
+    uint64_t                         blob_len;
+};
+
+static inline uint64_t
+sfx_fnode_len_(uint32_t plen, uint32_t n_children, int dense)
+{
+    uint64_t len = sizeof(struct sfx_fnode) + lz_align((uint64_t)plen, 4);
+
+    len += dense ? sizeof(uint32_t) * 256 : lz_align(n_children, 4) + sizeof(uint32_t) * n_children;
+
+    return lz_align(len, 8);
+}
+
+#define sfx_frec_len_(vlen) lz_align(sizeof(struct sfx_frec) + (uint64_t)(vlen) + 1, 8)
+
+/* freeze state: both sections are built in memory, then written out */
+struct sfx_freeze {
+    char                  * nodes;
+    uint64_t                nodes_len;
+    uint64_t                nodes_size;
+    char                  * blob;
+    uint64_t                blob_len;
+    uint64_t                blob_size;
+    lz_sfxtrie_freeze_valfn valfn;
+    void                  * arg;
+};
+
+static int
+sfx_freeze_grow_(char ** buf, uint64_t * size, uint64_t need)
+{
+    uint64_t new_size = *size ? *size : 4096;
+    char   * new;
+
+    if (need <= *size)
+    {
+        return 0;
+    }
+
+    while (new_size < need)
+    {
+        new_size *= 2;
+    }
+
+    if (!(new = realloc(*buf, new_size)))
+    {
+        return -1;
+    }
+
+    *buf  = new;
+    *size = new_size;
+
+    return 0;
+}
+
+static int
+sfx_freeze_valfn_str_(void * val, const void ** data, size_t * len, void * arg)
+{
+    (void)arg;
+
+    *data = val;
+    *len  = val ? strlen(val) : 0;
+
+    return 0;
+}
+
+/**
+ * @return the offset of the frozen node, -1 on error
+ */
+static int64_t
+sfx_freeze_node_(struct sfx_freeze * fz, struct sfx_node * node)
+{
+    struct sfx_fnode * fn;
+    struct sfx_node  * child;
+    uint64_t           off   = fz->nodes_len;
+    uint64_t           len;
+    uint32_t           pos   = 0;
+    uint32_t           i     = 0;
+    int                dense = node->n_children > SFX_FROZEN_SPARSE;
+    uint8_t            c;
+
+    len = sfx_fnode_len_(node->plen, node->n_children, dense);
+
+    if (sfx_freeze_grow_(&fz->nodes, &fz->nodes_size, off + len) == -1)
+    {
+        return -1;
+    }
+
+    memset(fz->nodes + off, 0, len);
+    fz->nodes_len = off + len;
+
+    fn = (struct sfx_fnode *)(fz->nodes + off);
+    fn->plen       = node->plen;
+    fn->n_children = node->n_children;
+    fn->dense      = (uint8_t)dense;
+
+    memcpy(fn + 1, sfx_prefix_(node), node->plen);
+
+    if (node->has_val)
+    {
+        struct sfx_frec * rec;
+        const void      * data;
+        size_t            vlen;
+
+        if ((fz->valfn)(node->val, &data, &vlen, fz->arg) != 0 || vlen > UINT32_MAX ||
+            sfx_freeze_grow_(&fz->blob, &fz->blob_size, fz->blob_len + sfx_frec_len_(vlen)) == -1)
+        {
+            return -1;
+        }
+
+        rec = (struct sfx_frec *)(fz->blob + fz->blob_len);
+
+        memset(rec, 0, sfx_frec_len_(vlen));
+        memcpy(rec->data, data, vlen);
+
+        rec->vlen   = (uint32_t)vlen;
+        fn->has_val = 1;
+        fn->val_off = fz->blob_len;
+
+        fz->blob_len += sfx_frec_len_(vlen);
+    }
+
+    while ((child = sfx_child_next_(node, &pos, &c)))
+    {
+        uint64_t   hdr_len = sizeof(struct sfx_fnode) + lz_align((uint64_t)node->plen, 4);
+        uint32_t * links;
+        int64_t    coff;
+
+        if ((coff = sfx_freeze_node_(fz, child)) == -1 || coff / 8 > UINT32_MAX)
+        {
+            return -1;
+        }
+
+        /* the buffer may have moved */
+        fn = (struct sfx_fnode *)(fz->nodes + off);
+
+        if (dense)
+        {
+            links    = (uint32_t *)((char *)fn + hdr_len);
+            links[c] = (uint32_t)(coff / 8);
+        } else {
+            links    = (uint32_t *)((char *)fn + hdr_len + lz_align(node->n_children, 4));
+            links[i] = (uint32_t)(coff / 8);
+
+            ((uint8_t *)fn + hdr_len)[i] = c;
+        }
+
+        i++;
+    }
+
+    return (int64_t)off;
+} /* sfx_freeze_node_ */
+
+static int
+sfxtrie_freeze_(lz_sfxtrie * trie, const char * path, lz_sfxtrie_freeze_valfn valfn, void * arg)
+{
+    struct sfx_frozen_header hdr;
+    struct sfx_freeze        fz  = { 0 };
+    FILE                   * fp;
+    char                   * tmp = NULL;
+    int                      res = -1;
+
+    if (lz_unlikely(!trie || !path) || trie->n_entries > UINT32_MAX)
+    {
+        return -1;
+    }
+
+    fz.valfn = valfn ? valfn : sfx_freeze_valfn_str_;
+    fz.arg   = arg;
+
+    if (trie->root && sfx_freeze_node_(&fz, trie->root) == -1)
+    {
+        goto end;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SFX_FROZEN_MAGIC, sizeof(hdr.magic));
+
+    hdr.version   = SFX_FROZEN_VERSION;
+    hdr.n_entries = (uint32_t)trie->n_entries;
+    hdr.node_off  = sizeof(hdr);
+    hdr.blob_off  = hdr.node_off + fz.nodes_len;
+    hdr.file_len  = hdr.blob_off + fz.blob_len;
+
+    if (!(tmp = malloc(strlen(path) + sizeof(".tmp"))))
+    {
+        goto end;
+    }
+
+    sprintf(tmp, "%s.tmp", path);
+
+    if (!(fp = fopen(tmp, "wb")))
+    {
+        goto end;
+    }
+
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    fwrite(fz.nodes, 1, fz.nodes_len, fp);
+    fwrite(fz.blob, 1, fz.blob_len, fp);
+
+    if (ferror(fp) | fclose(fp))
+    {
+        unlink(tmp);
+        goto end;
+    }
+
+    if (rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+        goto end;
+    }
+
+    res = 0;
+end:
+    free(fz.nodes);
+    free(fz.blob);
+    free(tmp);
+
+    return res;
+} /* sfxtrie_freeze_ */
+
+static lz_sfxtrie_frozen *
+sfxtrie_frozen_open_(const char * path)
+{
+    const struct sfx_frozen_header * hdr;
+    lz_sfxtrie_frozen              * frozen;
+    struct stat                      st;
+    void                           * base;
+    int                              fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+    {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct sfx_frozen_header))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    hdr = base;
+
+    if (memcmp(hdr->magic, SFX_FROZEN_MAGIC, sizeof(hdr->magic)) ||
+        hdr->version != SFX_FROZEN_VERSION ||
+        hdr->file_len != (uint64_t)st.st_size ||
+        hdr->node_off != sizeof(*hdr) ||
+        hdr->blob_off < hdr->node_off ||
+        hdr->blob_off > hdr->file_len ||
+        hdr->blob_off % 8)
+    {
+        munmap(base, st.st_size);
+        errno = EINVAL;
+
+        return NULL;
+    }
+
+    if (!(frozen = malloc(sizeof(lz_sfxtrie_frozen))))
+    {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    frozen->base      = base;
+    frozen->len       = st.st_size;
+    frozen->hdr       = hdr;
+    frozen->nodes     = frozen->base + hdr->node_off;
+    frozen->nodes_len = hdr->blob_off - hdr->node_off;
+    frozen->blob      = frozen->base + hdr->blob_off;
+    frozen->blob_len  = hdr->file_len - hdr->blob_off;
+
+    return frozen;
+} /* sfxtrie_frozen_open_ */
+
+static void
+sfxtrie_frozen_close_(lz_sfxtrie_frozen * frozen)
+{
+    if (frozen == NULL)
+    {
+        return;
+    }
+
+    munmap((void *)frozen->base, frozen->len);
+    free(frozen);
+}
+
+static size_t
+sfxtrie_frozen_get_size_(lz_sfxtrie_frozen * frozen)
+{
+    return frozen ? frozen->hdr->n_entries : 0;
+}
+
+/**
+ * @brief sfx_descend_() over the frozen nodes, checking every offset
+ *        against the mapping
+ */
+static const struct sfx_fnode *
+sfx_frozen_descend_(lz_sfxtrie_frozen * frozen, const uint8_t * key, uint32_t klen,
+                    int longest, uint32_t * mlen)
+{
+    const struct sfx_fnode * best  = NULL;
+    uint64_t                 off   = 0;
+    uint32_t                 depth = 0;
+
+    while (off + sizeof(struct sfx_fnode) <= frozen->nodes_len)
+    {
+        const struct sfx_fnode * fn = (const struct sfx_fnode *)(frozen->nodes + off);
+        const uint8_t          * p  = (const uint8_t *)(fn + 1);
+        const uint32_t         * links;
+        uint32_t                 link = 0;
+        uint32_t                 i;
+
+        if (off + sfx_fnode_len_(fn->plen, fn->n_children, fn->dense) > frozen->nodes_len)
+        {
+            break;
+        }
+
+        if (fn->plen)
+        {
+            if (klen - depth < fn->plen || memcmp(p, key + depth, fn->plen))
+            {
+                break;
+            }
+
+            depth += fn->plen;
+        }
+
+        if (fn->has_val && (longest || depth == klen))
+        {
+            best  = fn;
+            *mlen = depth;
+        }
+
+        if (depth == klen)
+        {
+            break;
+        }
+
+        p += lz_align(fn->plen, 4);
+
+        if (fn->dense)
+        {
+            links = (const uint32_t *)p;
+            link  = links[key[depth]];
+        } else {
+            links = (const uint32_t *)(p + lz_align(fn->n_children, 4));
+
+            for (i = 0; i < fn->n_children; i++)
+            {
+                if (p[i] == key[depth])
+                {
+                    link = links[i];
+                    break;
+                }
+            }
+        }
+
+        /* children always follow their parent, which also rules out cycles */
+        if ((uint64_t)link * 8 <= off)
+        {
+            break;
+        }
+
+        off    = (uint64_t)link * 8;
+        depth += 1;
+    }
+
+    return best;
+} /* sfx_frozen_descend_ */
+
+static const void *
+sfx_frozen_val_(lz_sfxtrie_frozen * frozen, const struct sfx_fnode * fn, size_t * vlen)
+{
+    const struct sfx_frec * rec;
+
+    if (fn->val_off + sizeof(*rec) > frozen->blob_len)
+    {
+        return NULL;
+    }
+
+    rec = (const struct sfx_frec *)(frozen->blob + fn->val_off);
+
+    if (fn->val_off + sfx_frec_len_(rec->vlen) > frozen->blob_len)
+    {
+        return NULL;
+    }
+
+    if (vlen != NULL)
+    {
+        *vlen = rec->vlen;
+    }
+
+    return rec->data;
+}
+
+static const void *
+sfxtrie_frozen_find_(lz_sfxtrie_frozen * frozen, const char * name, size_t len, size_t * vlen)
+{
+    uint8_t                  key[SFX_KEY_MAX];
+    const struct sfx_fnode * fn;
+    uint32_t                 depth;
+    int                      klen;
+
+    if (lz_unlikely(frozen == NULL) || (klen = sfx_key_(name, len, key)) == -1)
+    {
+        return NULL;
+    }
+
+    if (!(fn = sfx_frozen_descend_(frozen, key, (uint32_t)klen, 0, &depth)))
+    {
+        return NULL;
+    }
+
+    return sfx_frozen_val_(frozen, fn, vlen);
+}
+
+static const void *
+sfxtrie_frozen_match_(lz_sfxtrie_frozen * frozen, const char * name, size_t len,
+                      size_t * mlen, size_t * vlen)
+{
+    uint8_t                  key[SFX_KEY_MAX];
+    const struct sfx_fnode * fn;
+    uint32_t                 depth;
+    int                      klen;
+
+    if (lz_unlikely(frozen == NULL) || (klen = sfx_key_(name, len, key)) == -1)
+    {
+        return NULL;
+    }
+
+    if (!(fn = sfx_frozen_descend_(frozen, key, (uint32_t)klen, 1, &depth)))
+    {
+        return NULL;
+    }
+
+    if (mlen != NULL)
+    {
+        *mlen = depth ? depth - 1 : 0;
+    }
+
+    return sfx_frozen_val_(frozen, fn, vlen);
+}
+
+lz_alias(sfxtrie_new_, lz_sfxtrie_new);
+lz_alias(sfxtrie_free_, lz_sfxtrie_free);
+lz_alias(sfxtrie_get_size_, lz_sfxtrie_get_size);
+lz_alias(sfxtrie_build_, lz_sfxtrie_build);
+lz_alias(sfxtrie_cmp_, lz_sfxtrie_cmp);
+lz_alias(sfxtrie_add_, lz_sfxtrie_add);
+lz_alias(sfxtrie_remove_, lz_sfxtrie_remove);
+lz_alias(sfxtrie_find_, lz_sfxtrie_find);
+lz_alias(sfxtrie_match_, lz_sfxtrie_match);
+lz_alias(sfxtrie_freeze_, lz_sfxtrie_freeze);
+lz_alias(sfxtrie_frozen_open_, lz_sfxtrie_frozen_open);
+lz_alias(sfxtrie_frozen_close_, lz_sfxtrie_frozen_close);
+lz_alias(sfxtrie_frozen_get_size_, lz_sfxtrie_frozen_get_size);
+lz_alias(sfxtrie_frozen_find_, lz_sfxtrie_frozen_find);
+lz_alias(sfxtrie_frozen_match_, lz_sfxtrie_frozen_match);
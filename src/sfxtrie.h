@@ -0,0 +1,133 @@
+#pragma once
+
+#include <liblz.h>
+
+/*
+ * lz_sfxtrie: longest matching suffix lookups over domain names.
+ *
+ * Each rule ("example.com") is stored under its labels in reverse order
+ * ("com.example."), lowercased, in a path compressed radix trie whose nodes
+ * grow from 4 to 16, 48 and 256 children as needed (the adaptive radix tree
+ * layout). Matching a name is then a single descent that remembers the last
+ * rule it passed, rather than one hash lookup per label boundary, and needs
+ * no allocation: the name is reversed into a buffer on the stack.
+ *
+ * A rule matches the name itself and every name below it, so "example.com"
+ * matches "www.example.com" but not "badexample.com". Names are compared
+ * case insensitively, a single trailing dot is ignored, and "." (or "") is
+ * the root rule, matching every name. Names longer than LZ_SFXTRIE_NAME_MAX
+ * or with empty labels are rejected.
+ */
+
+#define LZ_SFXTRIE_NAME_MAX 255
+
+struct lz_sfxtrie_s;
+struct lz_sfxtrie_frozen_s;
+
+typedef struct lz_sfxtrie_s        lz_sfxtrie;
+typedef struct lz_sfxtrie_frozen_s lz_sfxtrie_frozen;
+
+
+LZ_EXPORT lz_sfxtrie * lz_sfxtrie_new(void);
+LZ_EXPORT void         lz_sfxtrie_free(lz_sfxtrie * trie);
+LZ_EXPORT size_t       lz_sfxtrie_get_size(lz_sfxtrie * trie);
+
+/**
+ * @brief builds a trie from n rules in one pass, without the per-rule
+ *        descent of lz_sfxtrie_add(). Nodes are allocated at their final
+ *        size. The names are sorted into trie order first, which costs a
+ *        single pass when they already are (see lz_sfxtrie_cmp()). If a rule
+ *        is listed more than once the last value wins, and the others are
+ *        released with freefn.
+ *
+ * @param names the rules
+ * @param lens the length of each name, or NULL if they are NUL terminated
+ * @param vals the value of each rule
+ * @param freefn called on values when the trie is freed, may be NULL
+ *
+ * @return the trie, NULL on error (including an invalid name)
+ */
+LZ_EXPORT lz_sfxtrie * lz_sfxtrie_build(const char * const * names, const size_t * lens,
+    void * const * vals, size_t n, void (* freefn)(void *));
+
+/**
+ * @brief orders two names the way lz_sfxtrie_build() wants them, by their
+ *        reversed labels. Invalid names sort first.
+ */
+LZ_EXPORT int lz_sfxtrie_cmp(const char * a, size_t alen, const char * b, size_t blen);
+
+/**
+ * @brief adds a rule, or replaces its value if it is already in the trie. A
+ *        replaced value is released with its freefn, unless it is the same
+ *        value.
+ *
+ * @return 0 on success, -1 on error or if the name is invalid
+ */
+LZ_EXPORT int lz_sfxtrie_add(lz_sfxtrie * trie, const char * name, size_t len,
+    void * val, void (* freefn)(void *));
+
+/**
+ * @brief removes a rule, releasing its value with its freefn
+ *
+ * @return 0 on success, -1 if not found
+ */
+LZ_EXPORT int lz_sfxtrie_remove(lz_sfxtrie * trie, const char * name, size_t len);
+
+/**
+ * @return the value of the rule for exactly this name, NULL if there is none
+ */
+LZ_EXPORT void * lz_sfxtrie_find(lz_sfxtrie * trie, const char * name, size_t len);
+
+/**
+ * @brief finds the longest rule that is a suffix of name on a label boundary
+ *
+ * @param[out] mlen if not NULL, set to the length of the matched rule, which
+ *                  is the trailing mlen bytes of the name (0 for the root
+ *                  rule, not counting a trailing dot)
+ *
+ * @return the value of the rule, NULL if none matches
+ */
+LZ_EXPORT void * lz_sfxtrie_match(lz_sfxtrie * trie, const char * name, size_t len, size_t * mlen);
+
+
+/**
+ * @brief called by lz_sfxtrie_freeze() for each value to serialize it, see
+ *        lz_kvmap_freeze_valfn
+ */
+typedef int (* lz_sfxtrie_freeze_valfn)(void * val, const void ** data, size_t * len, void * arg);
+
+/**
+ * @brief writes a read-only copy of the trie to path, in the same way as
+ *        lz_kvmap_freeze(): the file is written next to path and renamed
+ *        over it, and is in host byte order.
+ *
+ * @param valfn serializes values, if NULL every value is taken to be a
+ *              NUL terminated string (or NULL, stored as an empty value)
+ *
+ * @return 0 on success, -1 on error
+ */
+LZ_EXPORT int lz_sfxtrie_freeze(lz_sfxtrie * trie, const char * path,
+    lz_sfxtrie_freeze_valfn valfn, void * arg);
+
+/**
+ * @brief maps a file written by lz_sfxtrie_freeze(), lookups are served
+ *        straight out of the mapping
+ *
+ * @return NULL on error, or if the file is not a valid frozen trie
+ */
+LZ_EXPORT lz_sfxtrie_frozen * lz_sfxtrie_frozen_open(const char * path);
+LZ_EXPORT void                lz_sfxtrie_frozen_close(lz_sfxtrie_frozen * frozen);
+LZ_EXPORT size_t              lz_sfxtrie_frozen_get_size(lz_sfxtrie_frozen * frozen);
+
+/**
+ * @brief lz_sfxtrie_find() / lz_sfxtrie_match() on a frozen trie
+ *
+ * @param[out] vlen if not NULL, set to the length of the value
+ *
+ * @return a pointer into the mapping, valid until lz_sfxtrie_frozen_close(),
+ *         or NULL. Values are always followed by a NUL byte.
+ */
+LZ_EXPORT const void * lz_sfxtrie_frozen_find(lz_sfxtrie_frozen * frozen,
+    const char * name, size_t len, size_t * vlen);
+LZ_EXPORT const void * lz_sfxtrie_frozen_match(lz_sfxtrie_frozen * frozen,
+    const char * name, size_t len, size_t * mlen, size_t * vlen);
@@ -3,15 +3,17 @@
 #include <string.h>
 #include <stdint.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/queue.h>
 
 #include <liblz.h>
 #include <liblz/lzapi.h>
 #include <liblz/core/lz_heap.h>
 
-#include "tailq.h"
-
-static __thread void * __elem_heap = NULL;
+/* shared by every thread, elements may be freed on another thread than the
+ * one that appended them */
+static lz_heap      * __elem_heap      = NULL;
+static pthread_once_t __elem_heap_once = PTHREAD_ONCE_INIT;
 
 struct lz_tailq_elem {
     lz_tailq      * tq_head;
@@ -26,6 +28,7 @@ TAILQ_HEAD(__lz_tailqhd, lz_tailq_elem);
 
 struct lz_tailq {
     size_t              n_elem;
+    int                 flags;
     struct __lz_tailqhd elems;
 };
 
@@ -55,21 +58,35 @@ tq_freefn_(void * data)
 }
 
 static lz_tailq *
-tq_new_(void)
+tq_new_flags_(int flags)
 {
     lz_tailq * tq;
 
-    if ((tq = malloc(sizeof(lz_tailq))) == NULL) {
+    if (flags & LZ_TAILQ_F_ALLOC)
+    {
+        tq = lz_alloc(sizeof(lz_tailq));
+    } else {
+        tq = malloc(sizeof(lz_tailq));
+    }
+
+    if (tq == NULL) {
         return NULL;
     }
 
     TAILQ_INIT(&tq->elems);
 
     tq->n_elem = 0;
+    tq->flags  = flags;
 
     return tq;
 }
 
+static lz_tailq *
+tq_new_(void)
+{
+    return tq_new_flags_(0);
+}
+
 static void
 tq_free_(lz_tailq * tq)
 {
@@ -89,7 +106,12 @@ tq_free_(lz_tailq * tq)
         lz_safe_free(elem, tq_elem_free_);
     }
 
-    lz_safe_free(tq, free);
+    if (tq->flags & LZ_TAILQ_F_ALLOC)
+    {
+        lz_free(tq, sizeof(lz_tailq));
+    } else {
+        lz_safe_free(tq, free);
+    }
 }
 
 static void
@@ -116,14 +138,22 @@ tq_clear_(lz_tailq * tq)
     TAILQ_INIT(&tq->elems);
 }
 
+static void
+tq_elem_heap_init_(void)
+{
+    __elem_heap = lz_heap_new_flags(sizeof(lz_tailq_elem), 1024, LZ_HEAP_F_MT);
+}
+
 static lz_tailq_elem *
 tq_elem_new_(void * data, size_t len, lz_tailq_freefn freefn)
 {
     lz_tailq_elem * elem;
 
+    pthread_once(&__elem_heap_once, tq_elem_heap_init_);
+
     if (lz_unlikely(__elem_heap == NULL))
     {
-        __elem_heap = lz_heap_new(sizeof(lz_tailq_elem), 1024);
+        return NULL;
     }
 
     elem = lz_heap_alloc(__elem_heap); /* malloc(sizeof(lz_tailq_elem)); */
@@ -345,6 +375,7 @@ tq_get_at_index_(lz_tailq * tq, int index)
 }
 
 lz_alias(tq_new_, lz_tailq_new);
+lz_alias(tq_new_flags_, lz_tailq_new_flags);
 lz_alias(tq_free_, lz_tailq_free);
 lz_alias(tq_size_, lz_tailq_size);
 lz_alias(tq_foreach_, lz_tailq_foreach);
@@ -9,7 +9,15 @@ typedef struct lz_tailq      lz_tailq;
 typedef void (*lz_tailq_freefn)(void *);
 typedef int (*lz_tailq_iterfn)(lz_tailq_elem * elem, void * arg);
 
+enum lz_tailq_flags {
+    /* the head comes from the size classes of lz_alloc() instead of
+     * malloc(), for code that creates and frees many short queues. The
+     * memory stays with lz_alloc until lz_alloc_trim() */
+    LZ_TAILQ_F_ALLOC = (1 << 0),
+};
+
 LZ_EXPORT lz_tailq * lz_tailq_new(void);
+LZ_EXPORT lz_tailq * lz_tailq_new_flags(int flags);
 LZ_EXPORT void       lz_tailq_free(lz_tailq * tq);
 LZ_EXPORT size_t     lz_tailq_size(lz_tailq * head);
 LZ_EXPORT int        lz_tailq_foreach(lz_tailq *, lz_tailq_iterfn, void *);
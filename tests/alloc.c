@@ -0,0 +1,232 @@
+/*
+ * lz_alloc from several threads at once: mixed class and large sizes, each
+ * thread freeing another's allocations, trims in between, a kvmap with
+ * LZ_KVMAP_F_ALLOC entries and LZ_TAILQ_F_ALLOC queues.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define N_THREADS 4
+#define N_BOX     4000
+#define N_ROUNDS  6
+#define N_KEYS    10000
+
+static void             * box[N_THREADS][N_BOX];
+static size_t             box_size[N_THREADS][N_BOX];
+static pthread_barrier_t  barrier;
+
+static void *
+worker_(void * arg)
+{
+    long     id = (long)arg;
+    uint64_t rs = (uint64_t)(id + 1) * 0x9e3779b97f4a7c15ULL;
+    int      r;
+    int      i;
+
+    for (r = 0; r < N_ROUNDS; r++)
+    {
+        long o = (id + r + 1) % N_THREADS;
+
+        for (i = 0; i < N_BOX; i++)
+        {
+            size_t size;
+
+            rs ^= rs << 13; rs ^= rs >> 7; rs ^= rs << 17;
+
+            /* one in a hundred above the largest class */
+            if (rs % 100 == 0)
+            {
+                size = LZ_ALLOC_CLASS_MAX + 1 + (rs >> 8) % 9000;
+            } else {
+                size = 1 + (rs >> 8) % ((rs >> 40) & 1 ? 300 : LZ_ALLOC_CLASS_MAX);
+            }
+
+            lz_assert(lz_alloc_size(size) >= size);
+            lz_assert((box[id][i] = lz_alloc(size)) != NULL);
+            lz_assert(((uintptr_t)box[id][i] & 15) == 0);
+
+            box_size[id][i] = size;
+            memset(box[id][i], (int)id, size);
+        }
+
+        pthread_barrier_wait(&barrier);
+
+        for (i = 0; i < N_BOX; i++)
+        {
+            unsigned char * p = box[o][i];
+
+            lz_assert(p[0] == (unsigned char)o);
+            lz_assert(p[box_size[o][i] - 1] == (unsigned char)o);
+
+            lz_free(p, box_size[o][i]);
+        }
+
+        pthread_barrier_wait(&barrier);
+
+        if (r & 1)
+        {
+            lz_alloc_trim();
+        }
+    }
+
+    return NULL;
+}
+
+static void
+test_threads_(void)
+{
+    struct lz_alloc_stats stats;
+    pthread_t             threads[N_THREADS];
+    long                  t;
+
+    lz_assert(pthread_barrier_init(&barrier, NULL, N_THREADS) == 0);
+
+    for (t = 0; t < N_THREADS; t++)
+    {
+        lz_assert(pthread_create(&threads[t], NULL, worker_, (void *)t) == 0);
+    }
+
+    for (t = 0; t < N_THREADS; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+
+    pthread_barrier_destroy(&barrier);
+
+    /* large allocations are unmapped on free */
+    lz_assert(lz_alloc_get_stats(&stats) == 0);
+    lz_assert(stats.n_large == 0 && stats.bytes_large == 0);
+}
+
+static void
+test_realloc_(void)
+{
+    char * p;
+    size_t i;
+
+    lz_assert((p = lz_alloc(10)) != NULL);
+    memcpy(p, "0123456789", 10);
+
+    /* same class, stays put */
+    lz_assert(lz_realloc(p, 10, 12) == p);
+
+    lz_assert((p = lz_realloc(p, 12, 5000)) != NULL);
+    lz_assert(memcmp(p, "0123456789", 10) == 0);
+
+    for (i = 10; i < 5000; i++)
+    {
+        p[i] = (char)i;
+    }
+
+    lz_assert((p = lz_realloc(p, 5000, LZ_ALLOC_CLASS_MAX * 2)) != NULL);
+    lz_assert(memcmp(p, "0123456789", 10) == 0);
+    lz_assert(p[4999] == (char)4999);
+
+    lz_assert((p = lz_realloc(p, LZ_ALLOC_CLASS_MAX * 2, 20)) != NULL);
+    lz_assert(memcmp(p, "0123456789", 10) == 0);
+
+    lz_free(p, 20);
+    lz_free(NULL, 20);
+}
+
+static void
+test_kvmap_(int flags)
+{
+    lz_kvmap * map = lz_kvmap_new_flags(16, flags | LZ_KVMAP_F_ALLOC);
+    char       key[32];
+    int        i;
+
+    lz_assert(map != NULL);
+
+    for (i = 0; i < N_KEYS; i++)
+    {
+        snprintf(key, sizeof(key), "key-%d.example.com", i);
+        lz_assert(lz_kvmap_add(map, key, NULL, NULL) != NULL);
+    }
+
+    for (i = 0; i < N_KEYS; i += 2)
+    {
+        snprintf(key, sizeof(key), "key-%d.example.com", i);
+        lz_assert(lz_kvmap_remove(map, key) == 0);
+    }
+
+    lz_assert(lz_kvmap_get_size(map) == N_KEYS / 2);
+
+    for (i = 0; i < N_KEYS; i++)
+    {
+        lz_kvmap_ent * ent;
+
+        snprintf(key, sizeof(key), "key-%d.example.com", i);
+        ent = lz_kvmap_ent_find(map, key);
+
+        lz_assert((ent != NULL) == (i & 1));
+        lz_assert(ent == NULL || strcmp(lz_kvmap_ent_key(ent), key) == 0);
+    }
+
+    lz_kvmap_free(map);
+}
+
+/* a NULL freefn would free() the data */
+static void
+nofree_(void * arg)
+{
+    (void)arg;
+}
+
+static void
+test_tailq_(void)
+{
+    lz_tailq            * tqs[64];
+    struct lz_alloc_stats before;
+    struct lz_alloc_stats after;
+    uintptr_t             i;
+    uintptr_t             j;
+
+    lz_assert(lz_alloc_get_stats(&before) == 0);
+
+    for (i = 0; i < 64; i++)
+    {
+        lz_assert((tqs[i] = lz_tailq_new_flags(LZ_TAILQ_F_ALLOC)) != NULL);
+
+        for (j = 0; j < i; j++)
+        {
+            lz_assert(lz_tailq_append(tqs[i], (void *)(j + 1), 0, nofree_) != NULL);
+        }
+    }
+
+    /* the heads came from lz_alloc */
+    lz_assert(lz_alloc_get_stats(&after) == 0);
+    lz_assert(after.bytes >= before.bytes);
+
+    for (i = 0; i < 64; i++)
+    {
+        lz_assert(lz_tailq_size(tqs[i]) == i);
+        lz_assert(i == 0 || (uintptr_t)lz_tailq_elem_data(lz_tailq_last(tqs[i])) == i);
+
+        lz_tailq_free(tqs[i]);
+    }
+
+    /* and a plain one next to them */
+    lz_assert((tqs[0] = lz_tailq_new()) != NULL);
+    lz_assert(lz_tailq_prepend(tqs[0], (void *)1, 0, nofree_) != NULL);
+    lz_tailq_free(tqs[0]);
+}
+
+int
+main(void)
+{
+    test_threads_();
+    test_realloc_();
+    test_kvmap_(0);
+    test_kvmap_(LZ_KVMAP_F_OPEN);
+    test_tailq_();
+
+    return 0;
+}
@@ -0,0 +1,341 @@
+/*
+ * lz_cache: the CLOCK eviction order and second chances, the byte cap on
+ * insert and on replace, the reason evictfn is given for each drop, clear
+ * and reuse, and random operations checked against the set evictfn says is
+ * cached. Short keys are stored inline, long ones separately.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define N_KEYS 2000
+
+struct drop_log {
+    char     keys[64][64];
+    int      n;
+    uint64_t n_reason[2];
+};
+
+static uint8_t cached[N_KEYS];
+
+static void
+log_drop_(const char * key, size_t klen, void * val, enum lz_cache_drop_reason reason, void * arg)
+{
+    struct drop_log * log = arg;
+
+    lz_assert(strlen(key) == klen);
+    lz_assert(val != NULL);
+
+    if (log->n < 64)
+    {
+        snprintf(log->keys[log->n], sizeof(log->keys[0]), "%s", key);
+    }
+
+    log->n++;
+    log->n_reason[reason]++;
+}
+
+/* the value is the key number + 1 */
+static void
+unmark_(const char * key, size_t klen, void * val, enum lz_cache_drop_reason reason, void * arg)
+{
+    (void)key;
+    (void)klen;
+    (void)reason;
+    (void)arg;
+
+    cached[(uintptr_t)val - 1] = 0;
+}
+
+static size_t
+key_(char * buf, int i, int long_key)
+{
+    if (long_key)
+    {
+        return (size_t)snprintf(buf, 64, "a-key-long-enough-not-to-fit-inline-%d", i);
+    }
+
+    return (size_t)snprintf(buf, 64, "k%d", i);
+}
+
+static void
+put_(lz_cache * cache, int i, size_t size)
+{
+    char   key[64];
+    size_t len = key_(key, i, 0);
+
+    lz_assert(lz_cache_put(cache, key, len, (void *)(uintptr_t)(i + 1), size) == 0);
+}
+
+static void *
+get_(lz_cache * cache, int i)
+{
+    char   key[64];
+    size_t len = key_(key, i, 0);
+
+    return lz_cache_get(cache, key, len);
+}
+
+static void
+test_clock_(void)
+{
+    struct drop_log log = { 0 };
+    lz_cache      * cache;
+    const char    * order[] = { "k0", "k2", "k3", "k4", "k1" };
+    int             i;
+
+    lz_assert((cache = lz_cache_new(4, 0, log_drop_, &log)) != NULL);
+
+    for (i = 0; i < 4; i++)
+    {
+        put_(cache, i, 1);
+    }
+
+    /* the hand finds k0 unreferenced */
+    put_(cache, 4, 1);
+
+    /* k1 gets a second chance: the hand clears its bit and takes k2 */
+    lz_assert(get_(cache, 1) == (void *)2);
+    put_(cache, 5, 1);
+    put_(cache, 6, 1);
+    put_(cache, 7, 1);
+
+    /* the hand is back at k1, its bit cleared on the last pass */
+    put_(cache, 8, 1);
+
+    lz_assert(log.n == 5);
+    lz_assert(log.n_reason[LZ_CACHE_EVICTED] == 5);
+
+    for (i = 0; i < 5; i++)
+    {
+        lz_assert(strcmp(log.keys[i], order[i]) == 0);
+    }
+
+    for (i = 0; i < 5; i++)
+    {
+        lz_assert(get_(cache, i) == NULL);
+    }
+
+    for (i = 5; i < 9; i++)
+    {
+        lz_assert(get_(cache, i) == (void *)(uintptr_t)(i + 1));
+    }
+
+    lz_assert(lz_cache_get_size(cache) == 4);
+
+    lz_cache_free(cache);
+}
+
+static void
+test_bytes_(void)
+{
+    struct drop_log       log = { 0 };
+    struct lz_cache_stats stats;
+    lz_cache            * cache;
+    int                   i;
+
+    lz_assert((cache = lz_cache_new(100, 1000, log_drop_, &log)) != NULL);
+
+    for (i = 0; i < 10; i++)
+    {
+        put_(cache, i, 100);
+    }
+
+    lz_cache_get_stats(cache, &stats);
+    lz_assert(stats.n_bytes == 1000 && stats.n_entries == 10);
+
+    /* 250 more bytes push out the three oldest */
+    put_(cache, 10, 250);
+
+    lz_cache_get_stats(cache, &stats);
+    lz_assert(stats.n_bytes == 950 && stats.n_entries == 8);
+    lz_assert(stats.evictions == 3);
+    lz_assert(log.n == 3 && strcmp(log.keys[2], "k2") == 0);
+
+    /* bigger than the whole cache */
+    lz_assert(lz_cache_put(cache, "big", 3, (void *)1, 1001) == -1);
+    lz_assert(lz_cache_get(cache, "big", 3) == NULL);
+
+    /* a replace that grows evicts others, never the entry itself */
+    lz_assert(lz_cache_put(cache, "k10", 3, (void *)99, 900) == 0);
+
+    lz_cache_get_stats(cache, &stats);
+    lz_assert(stats.n_bytes <= 1000);
+    lz_assert(stats.n_entries == 2);
+    lz_assert(get_(cache, 10) == (void *)99);
+    lz_assert(log.n_reason[LZ_CACHE_REMOVED] == 1);
+
+    /* and a shrinking one gives the bytes back */
+    lz_assert(lz_cache_put(cache, "k10", 3, (void *)99, 10) == 0);
+
+    lz_cache_get_stats(cache, &stats);
+    lz_assert(stats.n_bytes == 110);
+
+    lz_cache_free(cache);
+}
+
+static void
+test_reasons_(void)
+{
+    struct drop_log log = { 0 };
+    lz_cache      * cache;
+
+    lz_assert((cache = lz_cache_new(8, 0, log_drop_, &log)) != NULL);
+
+    put_(cache, 1, 0);
+    put_(cache, 2, 0);
+    put_(cache, 3, 0);
+
+    /* the same value again is not a drop, a new one is */
+    put_(cache, 1, 0);
+    lz_assert(log.n == 0);
+
+    lz_assert(lz_cache_put(cache, "k1", 2, (void *)100, 0) == 0);
+    lz_assert(log.n == 1 && strcmp(log.keys[0], "k1") == 0);
+
+    lz_assert(lz_cache_remove(cache, "k2", 2) == 0);
+    lz_assert(lz_cache_remove(cache, "k2", 2) == -1);
+    lz_assert(log.n == 2);
+
+    lz_cache_clear(cache);
+    lz_assert(log.n == 4);
+
+    put_(cache, 4, 0);
+    lz_cache_free(cache);
+
+    lz_assert(log.n == 5);
+    lz_assert(log.n_reason[LZ_CACHE_REMOVED] == 5);
+    lz_assert(log.n_reason[LZ_CACHE_EVICTED] == 0);
+}
+
+static void
+test_clear_(void)
+{
+    struct drop_log       log = { 0 };
+    struct lz_cache_stats stats;
+    lz_cache            * cache;
+    char                  key[64];
+    int                   round;
+    int                   i;
+
+    lz_assert((cache = lz_cache_new(64, 0, log_drop_, &log)) != NULL);
+
+    for (round = 0; round < 3; round++)
+    {
+        /* long keys the first time, short ones after */
+        for (i = 0; i < 100; i++)
+        {
+            size_t len = key_(key, i, round == 0);
+
+            lz_assert(lz_cache_put(cache, key, len, (void *)(uintptr_t)(i + 1), 1) == 0);
+        }
+
+        lz_assert(lz_cache_get_size(cache) == 64);
+
+        /* the last 64 in */
+        for (i = 0; i < 100; i++)
+        {
+            size_t len = key_(key, i, round == 0);
+
+            lz_assert((lz_cache_get(cache, key, len) != NULL) == (i >= 36));
+        }
+
+        lz_cache_clear(cache);
+
+        lz_cache_get_stats(cache, &stats);
+        lz_assert(stats.n_entries == 0 && stats.n_bytes == 0);
+
+        for (i = 0; i < 100; i++)
+        {
+            size_t len = key_(key, i, round == 0);
+
+            lz_assert(lz_cache_get(cache, key, len) == NULL);
+        }
+    }
+
+    lz_assert(log.n_reason[LZ_CACHE_EVICTED] == 3 * 36);
+    lz_assert(log.n_reason[LZ_CACHE_REMOVED] == 3 * 64);
+
+    lz_cache_free(cache);
+}
+
+static void
+test_random_(void)
+{
+    lz_cache            * cache;
+    struct lz_cache_stats stats;
+    uint64_t              rs = 88172645463325252ULL;
+    char                  key[64];
+    uint8_t               was;
+    int                   k;
+    int                   i;
+
+    lz_assert((cache = lz_cache_new(500, 20000, unmark_, NULL)) != NULL);
+    memset(cached, 0, sizeof(cached));
+
+    for (k = 0; k < 200000; k++)
+    {
+        size_t len;
+
+        rs ^= rs << 13; rs ^= rs >> 7; rs ^= rs << 17;
+        i   = (int)(rs % N_KEYS);
+        len = key_(key, i, i % 5 == 0);
+
+        switch ((rs >> 32) % 4) {
+            case 0:
+                lz_assert(lz_cache_put(cache, key, len, (void *)(uintptr_t)(i + 1),
+                                       (size_t)(rs >> 40) % 100) == 0);
+                cached[i] = 1;
+                break;
+            case 1:
+                /* evictfn clears cached[i] from inside the remove */
+                was = cached[i];
+                lz_assert((lz_cache_remove(cache, key, len) == 0) == was);
+                lz_assert(cached[i] == 0);
+                break;
+            default:
+                lz_assert(lz_cache_get(cache, key, len) ==
+                          (cached[i] ? (void *)(uintptr_t)(i + 1) : NULL));
+                break;
+        }
+
+        if (k % 10000 == 0)
+        {
+            size_t n = 0;
+
+            for (i = 0; i < N_KEYS; i++)
+            {
+                n += cached[i];
+            }
+
+            lz_cache_get_stats(cache, &stats);
+            lz_assert(stats.n_entries == n);
+            lz_assert(stats.n_entries <= 500);
+            lz_assert(stats.n_bytes <= 20000);
+        }
+    }
+
+    lz_cache_free(cache);
+
+    for (i = 0; i < N_KEYS; i++)
+    {
+        lz_assert(cached[i] == 0);
+    }
+}
+
+int
+main(void)
+{
+    test_clock_();
+    test_bytes_();
+    test_reasons_();
+    test_clear_();
+    test_random_();
+
+    return 0;
+}
@@ -0,0 +1,253 @@
+/*
+ * lz_file_readdir() and lz_file_recursive_readdir() over a temporary tree:
+ * every entry visited once with the right directory and full path, "." and
+ * ".." skipped but other dot files not, a callback stopping the walk, a
+ * missing directory, and lz_file_concat(). Path buffers from malloc() and
+ * from lz_alloc().
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define N_PATHS 16
+
+static char root[PATH_MAX];
+
+/* relative to root, directories end in '/' */
+static const char * tree[] = {
+    "a",
+    "b",
+    ".hidden",
+    "sub/",
+    "sub/c",
+    "sub/deeper/",
+    "sub/deeper/d",
+    "empty/",
+};
+
+#define N_TREE (sizeof(tree) / sizeof(tree[0]))
+
+static int seen[N_TREE];
+static int n_visits;
+
+static void
+path_(char * buf, const char * rel)
+{
+    size_t len;
+
+    snprintf(buf, PATH_MAX, "%s/%s", root, rel);
+
+    /* without the trailing '/' */
+    if ((len = strlen(buf)) > 0 && buf[len - 1] == '/')
+    {
+        buf[len - 1] = '\0';
+    }
+}
+
+static void
+make_tree_(void)
+{
+    char   buf[PATH_MAX];
+    size_t i;
+
+    snprintf(root, sizeof(root), "/tmp/lz_ffile.XXXXXX");
+    lz_assert(mkdtemp(root) != NULL);
+
+    for (i = 0; i < N_TREE; i++)
+    {
+        path_(buf, tree[i]);
+
+        if (tree[i][strlen(tree[i]) - 1] == '/')
+        {
+            lz_assert(mkdir(buf, 0700) == 0);
+        } else {
+            FILE * fp = fopen(buf, "w");
+
+            lz_assert(fp != NULL);
+            fclose(fp);
+        }
+    }
+}
+
+static void
+remove_tree_(void)
+{
+    char   buf[PATH_MAX];
+    size_t i;
+
+    /* children come after their parents */
+    for (i = N_TREE; i-- > 0;)
+    {
+        path_(buf, tree[i]);
+
+        if (tree[i][strlen(tree[i]) - 1] == '/')
+        {
+            lz_assert(rmdir(buf) == 0);
+        } else {
+            lz_assert(unlink(buf) == 0);
+        }
+    }
+
+    lz_assert(rmdir(root) == 0);
+}
+
+/* marks the tree entry the callback got, checking dir and fullpath agree */
+static int
+mark_(struct dirent * dent, const char * dir, const char * fullpath, void * arg)
+{
+    char   buf[PATH_MAX];
+    size_t i;
+
+    (void)arg;
+
+    lz_assert(dent != NULL);
+    lz_assert(fullpath != NULL);
+
+    snprintf(buf, sizeof(buf), "%s/%s", dir, dent->d_name);
+    lz_assert(strcmp(buf, fullpath) == 0);
+
+    n_visits++;
+
+    for (i = 0; i < N_TREE; i++)
+    {
+        path_(buf, tree[i]);
+
+        if (strcmp(buf, fullpath) == 0)
+        {
+            seen[i]++;
+            return 0;
+        }
+    }
+
+    /* not in the tree: "." or ".." got through, or a path is wrong */
+    lz_assert(0);
+
+    return -1;
+}
+
+/* stops the walk at the first entry */
+static int
+stop_(struct dirent * dent, const char * dir, const char * fullpath, void * arg)
+{
+    (void)dent;
+    (void)dir;
+    (void)fullpath;
+
+    (*(int *)arg)++;
+
+    return 7;
+}
+
+/* called with a NULL entry when the directory can not be opened */
+static int
+missing_(struct dirent * dent, const char * dir, const char * fullpath, void * arg)
+{
+    lz_assert(dent == NULL);
+    lz_assert(fullpath == NULL);
+    lz_assert(strcmp(dir, (const char *)arg) == 0);
+
+    return 3;
+}
+
+static void
+test_walk_(int flags)
+{
+    char   missing[PATH_MAX];
+    size_t i;
+    int    n;
+
+    /* flat: the top level only */
+    memset(seen, 0, sizeof(seen));
+    n_visits = 0;
+
+    lz_assert(lz_file_readdir_flags(root, mark_, NULL, flags) == 0);
+
+    for (i = 0; i < N_TREE; i++)
+    {
+        lz_assert(seen[i] == (strchr(tree[i], '/') == NULL ||
+                              strchr(tree[i], '/')[1] == '\0'));
+    }
+
+    lz_assert(n_visits == 5);
+
+    /* recursive: everything, directories included, once */
+    memset(seen, 0, sizeof(seen));
+    n_visits = 0;
+
+    lz_assert(lz_file_recursive_readdir_flags(root, mark_, NULL, flags) == 0);
+
+    for (i = 0; i < N_TREE; i++)
+    {
+        lz_assert(seen[i] == 1);
+    }
+
+    lz_assert(n_visits == (int)N_TREE);
+
+    /* a non-zero return stops either walk and is passed back */
+    n = 0;
+    lz_assert(lz_file_readdir_flags(root, stop_, &n, flags) == 7);
+    lz_assert(n == 1);
+
+    n = 0;
+    lz_assert(lz_file_recursive_readdir_flags(root, stop_, &n, flags) == 7);
+    lz_assert(n == 1);
+
+    /* a directory that is not there */
+    snprintf(missing, sizeof(missing), "%s/nope", root);
+
+    lz_assert(lz_file_readdir_flags(missing, missing_, missing, flags) == 3);
+    lz_assert(lz_file_recursive_readdir_flags(missing, mark_, NULL, flags) == -1);
+
+    lz_assert(lz_file_readdir_flags(root, NULL, NULL, flags) == -1);
+    lz_assert(lz_file_recursive_readdir_flags(NULL, mark_, NULL, flags) == -1);
+}
+
+static void
+test_concat_(void)
+{
+    char * out = NULL;
+    char   name[NAME_MAX + 1];
+
+    lz_assert(lz_file_concat(&out, "/usr/share", "dict") == 0);
+    lz_assert(strcmp(out, "/usr/share/dict") == 0);
+    free(out);
+
+    /* no double slash under the root */
+    lz_assert(lz_file_concat(&out, "/", "etc") == 0);
+    lz_assert(strcmp(out, "/etc") == 0);
+    free(out);
+
+    lz_assert(lz_file_concat(&out, "a", "b") == 0);
+    lz_assert(strcmp(out, "a/b") == 0);
+    free(out);
+
+    memset(name, 'x', NAME_MAX);
+    name[NAME_MAX] = '\0';
+
+    out = NULL;
+    lz_assert(lz_file_concat(&out, "/tmp", name) == -1);
+    lz_assert(out == NULL);
+    lz_assert(lz_file_concat(NULL, "/tmp", "x") == -1);
+}
+
+int
+main(void)
+{
+    make_tree_();
+
+    test_walk_(0);
+    test_walk_(LZ_FILE_F_ALLOC);
+    test_concat_();
+
+    remove_tree_();
+
+    return 0;
+}
@@ -0,0 +1,317 @@
+/*
+ * lz_heap on a single thread, for each kind of heap: elements spread over
+ * several slabs without overlapping, freed elements handed out again before
+ * the heap grows, lz_heap_trim() after everything has been freed, automatic
+ * release, and lz_heap_destroy() with elements still live.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define MAX_ELTS (1 << 16)
+
+static void * ptrs[MAX_ELTS];
+static void * sorted[MAX_ELTS];
+
+static int
+ptr_cmp_(const void * a, const void * b)
+{
+    uintptr_t pa = (uintptr_t)*(void * const *)a;
+    uintptr_t pb = (uintptr_t)*(void * const *)b;
+
+    return (pa > pb) - (pa < pb);
+}
+
+static struct lz_heap_stats
+stats_(lz_heap * heap)
+{
+    struct lz_heap_stats stats;
+
+    lz_assert(lz_heap_get_stats(heap, &stats) == 0);
+
+    return stats;
+}
+
+/*
+ * allocates into ptrs[] until the heap maps more than n_slabs slabs, filling
+ * each element with its index
+ *
+ * @return the number allocated, *per_slab the elements of one slab
+ */
+static size_t
+fill_(lz_heap * heap, size_t size, size_t n_slabs, size_t * per_slab)
+{
+    size_t i;
+    size_t grew_at = SIZE_MAX;
+    size_t last    = stats_(heap).n_slabs;
+
+    for (i = 0; stats_(heap).n_slabs <= n_slabs; i++)
+    {
+        size_t now;
+
+        lz_assert(i < MAX_ELTS);
+        lz_assert((ptrs[i] = lz_heap_alloc(heap)) != NULL);
+
+        memset(ptrs[i], (int)(i & 0xff), size);
+
+        /* the first slab may have been mapped up front, count between two
+         * later ones */
+        if ((now = stats_(heap).n_slabs) != last)
+        {
+            if (grew_at != SIZE_MAX && per_slab != NULL)
+            {
+                *per_slab = i - grew_at;
+            }
+
+            grew_at = i;
+            last    = now;
+        }
+    }
+
+    return i;
+}
+
+static int
+intact_(void * p, size_t i, size_t size)
+{
+    uint8_t * b = p;
+    size_t    k;
+
+    for (k = 0; k < size; k++)
+    {
+        if (b[k] != (uint8_t)(i & 0xff))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void
+test_slabs_(size_t size, int flags)
+{
+    lz_heap            * heap = lz_heap_new_flags(size, 1, flags);
+    struct lz_heap_stats stats;
+    size_t               align = size < 16 ? sizeof(void *) : 16;
+    size_t               per_slab = 0;
+    size_t               n_freed;
+    size_t               n;
+    size_t               i;
+
+    lz_assert(heap != NULL);
+
+    n = fill_(heap, size, 3, &per_slab);
+    lz_assert(per_slab > 0);
+
+    stats = stats_(heap);
+    lz_assert(stats.elt_size >= size);
+
+    /* aligned, and no two elements overlap, within a slab or across */
+    memcpy(sorted, ptrs, sizeof(void *) * n);
+    qsort(sorted, n, sizeof(void *), ptr_cmp_);
+
+    for (i = 0; i < n; i++)
+    {
+        lz_assert((uintptr_t)sorted[i] % align == 0);
+        lz_assert(i == 0 || (uintptr_t)sorted[i] - (uintptr_t)sorted[i - 1] >= stats.elt_size);
+    }
+
+    /* free every other one, the rest keep what was written into them */
+    for (i = 1, n_freed = 0; i < n; i += 2, n_freed++)
+    {
+        lz_heap_free(heap, ptrs[i]);
+        sorted[n_freed] = ptrs[i];
+    }
+
+    for (i = 0; i < n; i += 2)
+    {
+        lz_assert(intact_(ptrs[i], i, size));
+    }
+
+    /* the freed ones come back before the heap grows */
+    qsort(sorted, n_freed, sizeof(void *), ptr_cmp_);
+
+    for (i = 1; i < n; i += 2)
+    {
+        lz_assert((ptrs[i] = lz_heap_alloc(heap)) != NULL);
+        lz_assert(bsearch(&ptrs[i], sorted, n_freed, sizeof(void *), ptr_cmp_) != NULL);
+
+        memset(ptrs[i], (int)(i & 0xff), size);
+    }
+
+    lz_assert(stats_(heap).n_slabs == stats.n_slabs);
+
+    for (i = 0; i < n; i++)
+    {
+        lz_assert(intact_(ptrs[i], i, size));
+        lz_heap_free(heap, ptrs[i]);
+    }
+
+    /* every element of every slab is free again */
+    stats = stats_(heap);
+    lz_assert(stats.bytes_retained == stats.n_slabs * per_slab * stats.elt_size);
+
+    lz_heap_destroy(heap);
+}
+
+static void
+test_trim_(int flags)
+{
+    lz_heap            * heap = lz_heap_new_flags(64, 1, flags);
+    struct lz_heap_stats full;
+    struct lz_heap_stats stats;
+    size_t               per_slab = 0;
+    size_t               released;
+    size_t               n;
+    size_t               i;
+
+    lz_assert(heap != NULL);
+
+    n    = fill_(heap, 64, 7, &per_slab);
+    full = stats_(heap);
+
+    /* nothing can go while every slab has a live element */
+    lz_assert(lz_heap_trim(heap, 0) == 0);
+
+    for (i = 0; i < n; i++)
+    {
+        lz_heap_free(heap, ptrs[i]);
+    }
+
+    stats = stats_(heap);
+    lz_assert(stats.bytes == full.bytes);
+    lz_assert(stats.bytes_retained == stats.n_slabs * per_slab * stats.elt_size);
+
+    /* keeping two slabs' worth of free elements */
+    released = lz_heap_trim(heap, 2 * per_slab);
+    stats    = stats_(heap);
+
+    lz_assert(released > 0);
+    lz_assert(stats.bytes == full.bytes - released);
+    lz_assert(stats.bytes_released == released);
+    lz_assert(stats.bytes_retained >= 2 * per_slab * stats.elt_size);
+
+    /* and then everything that can go */
+    released += lz_heap_trim(heap, 0);
+    stats     = stats_(heap);
+
+    lz_assert(stats.n_slabs <= 1);
+    lz_assert(stats.bytes_released == released);
+    lz_assert(stats.bytes + released == full.bytes);
+    lz_assert(stats.bytes_peak == full.bytes_peak);
+    lz_assert(lz_heap_trim(heap, 0) == 0);
+
+    /* the heap grows back */
+    n = fill_(heap, 64, 3, NULL);
+
+    for (i = 0; i < n; i++)
+    {
+        lz_assert(intact_(ptrs[i], i, 64));
+        lz_heap_free(heap, ptrs[i]);
+    }
+
+    lz_assert(stats_(heap).bytes_peak == full.bytes_peak);
+
+    lz_heap_destroy(heap);
+}
+
+static void
+test_release_(int flags)
+{
+    lz_heap            * heap = lz_heap_new_flags(64, 1, flags);
+    struct lz_heap_stats full;
+    struct lz_heap_stats stats;
+    size_t               n;
+    size_t               i;
+
+    lz_assert(heap != NULL);
+
+    /* slabs go as they empty, once more than 16 elements are free */
+    lz_heap_set_release(heap, 16);
+
+    n    = fill_(heap, 64, 7, NULL);
+    full = stats_(heap);
+
+    for (i = 0; i < n; i++)
+    {
+        lz_heap_free(heap, ptrs[i]);
+    }
+
+    stats = stats_(heap);
+    lz_assert(stats.bytes_released > 0);
+    lz_assert(stats.n_slabs < full.n_slabs / 2);
+    lz_assert(stats.bytes + stats.bytes_released == full.bytes);
+
+    /* switched off, empty slabs stay */
+    lz_heap_set_release(heap, 0);
+
+    n    = fill_(heap, 64, 7, NULL);
+    full = stats_(heap);
+
+    for (i = 0; i < n; i++)
+    {
+        lz_heap_free(heap, ptrs[i]);
+    }
+
+    lz_assert(stats_(heap).bytes == full.bytes);
+    lz_assert(stats_(heap).bytes_released == stats.bytes_released);
+
+    lz_heap_destroy(heap);
+}
+
+static void
+test_destroy_(int flags)
+{
+    lz_heap * heap = lz_heap_new_flags(100, 1, flags);
+    size_t    n;
+    size_t    i;
+
+    lz_assert(heap != NULL);
+
+    /* a third freed, the rest still live when the heap goes */
+    n = fill_(heap, 100, 3, NULL);
+
+    for (i = 0; i < n; i += 3)
+    {
+        lz_heap_free(heap, ptrs[i]);
+    }
+
+    lz_heap_destroy(heap);
+
+    /* never used, and nothing at all */
+    lz_assert((heap = lz_heap_new_flags(100, 1000, flags)) != NULL);
+    lz_heap_destroy(heap);
+    lz_heap_destroy(NULL);
+}
+
+int
+main(void)
+{
+    static const size_t sizes[] = { 1, 24, 40, 100, 1000, 20000 };
+    static const int    flags[] = { 0, LZ_HEAP_F_MT, LZ_HEAP_F_SHARED };
+    size_t              s;
+    size_t              f;
+
+    for (f = 0; f < sizeof(flags) / sizeof(flags[0]); f++)
+    {
+        for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        {
+            test_slabs_(sizes[s], flags[f]);
+        }
+
+        test_trim_(flags[f]);
+        test_destroy_(flags[f]);
+    }
+
+    /* not available with LZ_HEAP_F_SHARED */
+    test_release_(0);
+    test_release_(LZ_HEAP_F_MT);
+
+    return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * LZ_HEAP_F_MT: elements handed between threads through a shared pool and
+ * freed wherever they land, threads exiting and their caches being adopted,
+ * and cross-thread frees while release is switched on and off and caches
+ * are trimmed.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define ELEM_SIZE 40
+#define N_THREADS 4
+#define N_ROUNDS  3
+#define POOL      4096
+#define N_OPS     100000
+#define N_BOX     20000
+
+static lz_heap       * heap;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t      * pool[POOL];
+static uint64_t        next_id;
+
+static void *
+handoff_(void * arg)
+{
+    uint64_t rs = (uintptr_t)arg * 0x9e3779b97f4a7c15ULL;
+    int      k;
+
+    for (k = 0; k < N_OPS; k++)
+    {
+        uint64_t * n = NULL;
+        uint64_t * o;
+        size_t     i;
+
+        rs ^= rs << 13; rs ^= rs >> 7; rs ^= rs << 17;
+        i = rs % POOL;
+
+        if (rs & 1)
+        {
+            lz_assert((n = lz_heap_alloc(heap)) != NULL);
+
+            n[0] = __atomic_add_fetch(&next_id, 1, __ATOMIC_RELAXED);
+            n[1] = ~n[0];
+        }
+
+        pthread_mutex_lock(&pool_lock);
+        o       = pool[i];
+        pool[i] = n;
+        pthread_mutex_unlock(&pool_lock);
+
+        if (o != NULL)
+        {
+            lz_assert(o[1] == ~o[0]);
+
+            o[1] = 0;
+            lz_heap_free(heap, o);
+        }
+    }
+
+    return NULL;
+}
+
+static void
+test_handoff_(void)
+{
+    struct lz_heap_stats stats;
+    pthread_t            threads[N_THREADS];
+    long                 round;
+    long                 t;
+    size_t               i;
+
+    lz_assert((heap = lz_heap_new_flags(ELEM_SIZE, 64, LZ_HEAP_F_MT)) != NULL);
+
+    /* every round's threads start after the last round's exited, and
+     * adopt the caches they left behind */
+    for (round = 0; round < N_ROUNDS; round++)
+    {
+        for (t = 0; t < N_THREADS; t++)
+        {
+            lz_assert(pthread_create(&threads[t], NULL, handoff_,
+                                     (void *)(round * N_THREADS + t + 1)) == 0);
+        }
+
+        for (t = 0; t < N_THREADS; t++)
+        {
+            pthread_join(threads[t], NULL);
+        }
+    }
+
+    for (i = 0; i < POOL; i++)
+    {
+        if (pool[i] != NULL)
+        {
+            lz_assert(pool[i][1] == ~pool[i][0]);
+            lz_heap_free(heap, pool[i]);
+            pool[i] = NULL;
+        }
+    }
+
+    /* nothing is live any more; the frees above went to the caches of
+     * exited threads, which this thread may still be holding back */
+    lz_assert(lz_heap_trim(heap, 0) > 0);
+    lz_assert(lz_heap_get_stats(heap, &stats) == 0);
+    lz_assert(stats.bytes_retained <= stats.bytes);
+    lz_assert(stats.bytes < stats.bytes_peak);
+
+    lz_heap_destroy(heap);
+}
+
+static void             * box[N_THREADS][N_BOX];
+static pthread_barrier_t  barrier;
+
+static void *
+remote_(void * arg)
+{
+    long     id = (long)arg;
+    long     o  = (id + 1) % N_THREADS;
+    uint64_t rs = (uint64_t)id * 0x9e3779b97f4a7c15ULL + 1;
+    int      r;
+    int      i;
+
+    for (r = 0; r < 6; r++)
+    {
+        for (i = 0; i < N_BOX; i++)
+        {
+            lz_assert((box[id][i] = lz_heap_alloc(heap)) != NULL);
+            memset(box[id][i], (int)id, ELEM_SIZE);
+        }
+
+        pthread_barrier_wait(&barrier);
+
+        /* free about half of the neighbour's elements */
+        for (i = 0; i < N_BOX; i++)
+        {
+            rs ^= rs << 13; rs ^= rs >> 7; rs ^= rs << 17;
+
+            if (rs & 1)
+            {
+                lz_assert(((unsigned char *)box[o][i])[ELEM_SIZE - 1] == (unsigned char)o);
+
+                lz_heap_free(heap, box[o][i]);
+                box[o][i] = NULL;
+            }
+        }
+
+        pthread_barrier_wait(&barrier);
+
+        for (i = 0; i < N_BOX; i++)
+        {
+            if (box[id][i] != NULL)
+            {
+                lz_heap_free(heap, box[id][i]);
+            }
+        }
+
+        if (r == 2)
+        {
+            lz_heap_set_release(heap, 100);
+        }
+
+        if (r == 4)
+        {
+            lz_heap_set_release(heap, 0);
+        }
+
+        lz_heap_trim(heap, id * 100);
+
+        pthread_barrier_wait(&barrier);
+    }
+
+    return NULL;
+}
+
+static void
+test_remote_(void)
+{
+    struct lz_heap_stats stats;
+    pthread_t            threads[N_THREADS];
+    long                 t;
+
+    lz_assert((heap = lz_heap_new_flags(ELEM_SIZE, 256, LZ_HEAP_F_MT)) != NULL);
+    lz_assert(pthread_barrier_init(&barrier, NULL, N_THREADS) == 0);
+
+    for (t = 0; t < N_THREADS; t++)
+    {
+        lz_assert(pthread_create(&threads[t], NULL, remote_, (void *)t) == 0);
+    }
+
+    for (t = 0; t < N_THREADS; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+
+    /* the threads have exited, trimming here reaches all of their caches */
+    lz_heap_trim(heap, 0);
+
+    lz_assert(lz_heap_get_stats(heap, &stats) == 0);
+    lz_assert(stats.bytes == 0);
+    lz_assert(stats.bytes_released > 0);
+
+    pthread_barrier_destroy(&barrier);
+    lz_heap_destroy(heap);
+}
+
+int
+main(void)
+{
+    test_handoff_();
+    test_remote_();
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * LZ_HEAP_F_SHARED: threads allocating and freeing through the one shared
+ * free list while the heap grows under them, elements freed on another
+ * thread than their allocator's, and short-lived threads coming and going.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define ELEM_SIZE 48
+#define N_THREADS 4
+#define N_ROUNDS  8
+#define N_BURST   64
+#define N_OPS     20000
+#define POOL      1024
+
+static lz_heap       * heap;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t      * pool[POOL];
+
+static void *
+worker_(void * arg)
+{
+    uint64_t   id = (uintptr_t)arg;
+    uint64_t   rs = id * 0x9e3779b97f4a7c15ULL;
+    uint64_t * burst[N_BURST];
+    int        k;
+    int        j;
+
+    for (k = 0; k < N_OPS; k++)
+    {
+        uint64_t * n;
+        uint64_t * o;
+        size_t     i;
+        int        len;
+
+        rs ^= rs << 13; rs ^= rs >> 7; rs ^= rs << 17;
+        len = 1 + (int)(rs % N_BURST);
+
+        /* no element is handed out twice while it is live */
+        for (j = 0; j < len; j++)
+        {
+            lz_assert((burst[j] = lz_heap_alloc(heap)) != NULL);
+
+            burst[j][0] = id;
+            burst[j][1] = (uint64_t)k << 8 | (uint64_t)j;
+        }
+
+        for (j = 0; j < len; j++)
+        {
+            lz_assert(burst[j][0] == id);
+            lz_assert(burst[j][1] == ((uint64_t)k << 8 | (uint64_t)j));
+        }
+
+        /* keep one back for another thread to free, free the rest here */
+        n = burst[0];
+        n[1] = ~id;
+
+        for (j = 1; j < len; j++)
+        {
+            lz_heap_free(heap, burst[j]);
+        }
+
+        i = (rs >> 32) % POOL;
+
+        pthread_mutex_lock(&pool_lock);
+        o       = pool[i];
+        pool[i] = n;
+        pthread_mutex_unlock(&pool_lock);
+
+        if (o != NULL)
+        {
+            lz_assert(o[1] == ~o[0]);
+            lz_heap_free(heap, o);
+        }
+    }
+
+    return NULL;
+}
+
+int
+main(void)
+{
+    struct lz_heap_stats stats;
+    pthread_t            threads[N_THREADS];
+    long                 round;
+    long                 t;
+    size_t               i;
+
+    /* a small reserve, so the heap grows while the threads race on it */
+    lz_assert((heap = lz_heap_new_flags(ELEM_SIZE, 16, LZ_HEAP_F_SHARED)) != NULL);
+
+    for (round = 0; round < N_ROUNDS; round++)
+    {
+        for (t = 0; t < N_THREADS; t++)
+        {
+            lz_assert(pthread_create(&threads[t], NULL, worker_,
+                                     (void *)(round * N_THREADS + t + 1)) == 0);
+        }
+
+        for (t = 0; t < N_THREADS; t++)
+        {
+            pthread_join(threads[t], NULL);
+        }
+    }
+
+    for (i = 0; i < POOL; i++)
+    {
+        if (pool[i] != NULL)
+        {
+            lz_assert(pool[i][1] == ~pool[i][0]);
+            lz_heap_free(heap, pool[i]);
+        }
+    }
+
+    /* no other thread is using it now, so it may be trimmed */
+    lz_assert(lz_heap_get_stats(heap, &stats) == 0);
+    lz_assert(stats.bytes > 0 && stats.bytes <= stats.bytes_peak);
+
+    lz_assert(lz_heap_trim(heap, 0) > 0);
+    lz_assert(lz_heap_get_stats(heap, &stats) == 0);
+    lz_assert(stats.bytes == 0);
+    lz_assert(stats.bytes_retained == 0);
+
+    lz_heap_destroy(heap);
+
+    return 0;
+}
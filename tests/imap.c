@@ -0,0 +1,120 @@
+/*
+ * lz_imap: add/replace/remove with freefns, key 0, removing during
+ * lz_imap_for_each(), and lz_imap_first() / lz_imap_next() walks.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define N_KEYS 10000
+
+static size_t n_freed;
+
+static void
+count_free_(void * arg)
+{
+    (void)arg;
+    n_freed++;
+}
+
+static uint64_t
+key_(size_t i)
+{
+    /* 0 and a spread of large keys */
+    return i * 0x100000001ULL;
+}
+
+static int
+remove_odd_(uint64_t key, void * val, void * arg)
+{
+    lz_imap * map = arg;
+
+    lz_assert(val == (void *)(uintptr_t)(key + 1));
+
+    if ((key / 0x100000001ULL) & 1)
+    {
+        lz_assert(lz_imap_remove(map, key) == 0);
+    }
+
+    return 0;
+}
+
+static void
+walk_(lz_imap * map, size_t expected)
+{
+    lz_imap_iter it;
+    uint64_t     key;
+    void       * val;
+    size_t       n = 0;
+    int          more;
+
+    for (more = lz_imap_first(map, &it, &key, &val); more; more = lz_imap_next(map, &it, &key, &val))
+    {
+        lz_assert(val == (void *)(uintptr_t)(key + 1));
+        lz_assert(lz_imap_contains(map, key));
+        n++;
+    }
+
+    lz_assert(n == expected);
+    lz_assert(lz_imap_next(map, &it, NULL, NULL) == 0);
+}
+
+int
+main(void)
+{
+    lz_imap * map = lz_imap_new(0);
+    size_t    i;
+
+    lz_assert(map != NULL);
+    walk_(map, 0);
+
+    for (i = 0; i < N_KEYS; i++)
+    {
+        lz_assert(lz_imap_add(map, key_(i), (void *)(uintptr_t)(key_(i) + 1), count_free_) == 0);
+    }
+
+    lz_assert(lz_imap_get_size(map) == N_KEYS);
+    walk_(map, N_KEYS);
+
+    /* replacing with the same value keeps it, another value frees it */
+    lz_assert(lz_imap_add(map, key_(3), (void *)(uintptr_t)(key_(3) + 1), count_free_) == 0);
+    lz_assert(n_freed == 0);
+    lz_assert(lz_imap_add(map, key_(3), (void *)(uintptr_t)(key_(3) + 1), NULL) == 0);
+    lz_assert(lz_imap_add(map, key_(3), (void *)(uintptr_t)(key_(3) + 1), count_free_) == 0);
+    lz_assert(n_freed == 0);
+
+    lz_assert(lz_imap_find(map, 0) == (void *)1);
+    lz_assert(lz_imap_find(map, 1) == NULL);
+    lz_assert(!lz_imap_contains(map, 1));
+
+    /* not found is not an error, as with lz_kvmap_remove() */
+    lz_assert(lz_imap_remove(map, 1) == 0);
+    lz_assert(lz_imap_get_size(map) == N_KEYS);
+
+    lz_assert(lz_imap_for_each(map, remove_odd_, map) == 0);
+    lz_assert(lz_imap_get_size(map) == N_KEYS / 2);
+    lz_assert(n_freed == N_KEYS / 2);
+    walk_(map, N_KEYS / 2);
+
+    for (i = 0; i < N_KEYS; i++)
+    {
+        lz_assert(lz_imap_contains(map, key_(i)) == !(i & 1));
+    }
+
+    lz_assert(lz_imap_remove(map, 0) == 0);
+    lz_assert(lz_imap_find(map, 0) == NULL);
+    walk_(map, N_KEYS / 2 - 1);
+
+    lz_imap_free(map);
+    lz_assert(n_freed == N_KEYS);
+
+    /* more than 2^31 slots */
+    lz_assert(lz_imap_new(UINT32_MAX) == NULL);
+
+    return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * lz_intern with lock-free readers running while two writers intern the
+ * same strings in opposite orders, starting from a small table so it grows
+ * many times under the readers.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define N_STRINGS 100000
+#define N_READERS 3
+
+static lz_intern * intern;
+static int         writers_done;
+
+static size_t
+str_(char * buf, uint32_t i)
+{
+    return (size_t)snprintf(buf, 32, "string-%u", i);
+}
+
+static void *
+writer_(void * arg)
+{
+    int      down = (int)(uintptr_t)arg;
+    char     buf[32];
+    uint32_t n;
+
+    for (n = 0; n < N_STRINGS; n++)
+    {
+        uint32_t     i   = down ? N_STRINGS - 1 - n : n;
+        size_t       len = str_(buf, i);
+        const char * s   = lz_intern_str(intern, buf, len);
+        uint32_t     id;
+
+        lz_assert(s != NULL && memcmp(s, buf, len + 1) == 0);
+        lz_assert(lz_intern_get_len(s) == len);
+
+        /* whoever interned it first, both see the same copy and id */
+        id = lz_intern_id(intern, buf, len);
+        lz_assert(id == lz_intern_get_id(s));
+        lz_assert(lz_intern_get_str(intern, id) == s);
+    }
+
+    return NULL;
+}
+
+static void *
+reader_(void * arg)
+{
+    uint64_t rs = (uintptr_t)arg * 0x9e3779b97f4a7c15ULL;
+    char     buf[32];
+
+    while (!__atomic_load_n(&writers_done, __ATOMIC_ACQUIRE))
+    {
+        const char * s;
+        size_t       n;
+        size_t       len;
+        uint32_t     id;
+
+        rs ^= rs << 13; rs ^= rs >> 7; rs ^= rs << 17;
+
+        /* every id below the published size has its string */
+        if ((n = lz_intern_get_size(intern)) > 0)
+        {
+            id = (uint32_t)(rs % n);
+
+            lz_assert((s = lz_intern_get_str(intern, id)) != NULL);
+            lz_assert(lz_intern_get_id(s) == id);
+            lz_assert(lz_intern_find(intern, s, lz_intern_get_len(s)) == s);
+            lz_assert(lz_intern_find_id(intern, s, lz_intern_get_len(s)) == id);
+        }
+
+        /* a string that is not in yet may show up, but never changes */
+        len = str_(buf, (uint32_t)((rs >> 32) % N_STRINGS));
+
+        if ((s = lz_intern_find(intern, buf, len)) != NULL)
+        {
+            lz_assert(memcmp(s, buf, len + 1) == 0);
+            lz_assert(lz_intern_get_str(intern, lz_intern_get_id(s)) == s);
+        }
+    }
+
+    return NULL;
+}
+
+int
+main(void)
+{
+    pthread_t writers[2];
+    pthread_t readers[N_READERS];
+    char      buf[32];
+    uint32_t  i;
+    long      t;
+
+    intern = lz_intern_new(16);
+    lz_assert(intern != NULL);
+
+    for (t = 0; t < N_READERS; t++)
+    {
+        lz_assert(pthread_create(&readers[t], NULL, reader_, (void *)(t + 1)) == 0);
+    }
+
+    for (t = 0; t < 2; t++)
+    {
+        lz_assert(pthread_create(&writers[t], NULL, writer_, (void *)t) == 0);
+    }
+
+    for (t = 0; t < 2; t++)
+    {
+        pthread_join(writers[t], NULL);
+    }
+
+    __atomic_store_n(&writers_done, 1, __ATOMIC_RELEASE);
+
+    for (t = 0; t < N_READERS; t++)
+    {
+        pthread_join(readers[t], NULL);
+    }
+
+    /* each string once, with dense ids */
+    lz_assert(lz_intern_get_size(intern) == N_STRINGS);
+
+    for (i = 0; i < N_STRINGS; i++)
+    {
+        size_t       len = str_(buf, i);
+        const char * s   = lz_intern_find(intern, buf, len);
+
+        lz_assert(s != NULL && lz_intern_get_id(s) < N_STRINGS);
+        lz_assert(lz_intern_get_str(intern, lz_intern_get_id(s)) == s);
+    }
+
+    lz_assert(lz_intern_get_str(intern, N_STRINGS) == NULL);
+    lz_assert(lz_intern_find_id(intern, "nope", 4) == LZ_INTERN_ID_NONE);
+
+    lz_intern_free(intern);
+
+    return 0;
+}
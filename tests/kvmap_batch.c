@@ -0,0 +1,129 @@
+/*
+ * lz_kvmap_find_batch() and lz_kvmap_ent_find_batch() agree with one
+ * lz_kvmap_find() per key: hits and misses mixed, NULL keys, explicit and
+ * NUL terminated lengths, batches of every size, and maps caught in the
+ * middle of an incremental resize. Chained and open addressing.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define N_KEYS  3000
+#define N_BATCH 300
+
+static char   keys[2 * N_KEYS][16];
+static size_t lens[2 * N_KEYS];
+
+static void
+check_batch_(lz_kvmap * map, uint64_t * rs)
+{
+    const char   * batch[N_BATCH];
+    size_t         batch_lens[N_BATCH];
+    void         * vals[N_BATCH];
+    lz_kvmap_ent * ents[N_BATCH];
+    size_t         n;
+    size_t         n_found;
+    size_t         i;
+
+    for (n = 0; n <= N_BATCH; n += 1 + n / 4)
+    {
+        for (i = 0, n_found = 0; i < n; i++)
+        {
+            size_t k;
+
+            *rs ^= *rs << 13; *rs ^= *rs >> 7; *rs ^= *rs << 17;
+            k = *rs % (2 * N_KEYS);
+
+            /* one in fifty is a NULL key */
+            batch[i]      = *rs % 50 == 0 ? NULL : keys[k];
+            batch_lens[i] = lens[k];
+
+            n_found += batch[i] != NULL && lz_kvmap_find(map, batch[i]) != NULL;
+        }
+
+        lz_assert(lz_kvmap_find_batch(map, batch, NULL, vals, n) == n_found);
+        lz_assert(lz_kvmap_ent_find_batch(map, batch, batch_lens, ents, n) == n_found);
+
+        for (i = 0; i < n; i++)
+        {
+            if (batch[i] == NULL)
+            {
+                lz_assert(vals[i] == NULL && ents[i] == NULL);
+                continue;
+            }
+
+            lz_assert(vals[i] == lz_kvmap_find(map, batch[i]));
+            lz_assert(ents[i] == lz_kvmap_ent_find(map, batch[i]));
+        }
+    }
+}
+
+static void
+test_batch_(int flags)
+{
+    lz_kvmap            * map = lz_kvmap_new_flags(16, flags);
+    struct lz_kvmap_stats stats;
+    uint64_t              rs  = 88172645463325252ULL;
+    int                   n_rehashing = 0;
+    uintptr_t             i;
+
+    lz_assert(map != NULL);
+
+    /* the first half go in, the second half are misses */
+    for (i = 0; i < N_KEYS; i++)
+    {
+        lz_assert(lz_kvmap_add(map, keys[i], (void *)(i + 1), NULL) != NULL);
+
+        if (i % 97 == 0)
+        {
+            lz_assert(lz_kvmap_get_stats(map, &stats) == 0);
+            n_rehashing += stats.rehashing;
+
+            check_batch_(map, &rs);
+        }
+    }
+
+    check_batch_(map, &rs);
+
+    /* and while it shrinks again */
+    for (i = 0; i < N_KEYS - 10; i++)
+    {
+        lz_assert(lz_kvmap_remove(map, keys[i]) == 0);
+
+        if (i % 97 == 0)
+        {
+            lz_assert(lz_kvmap_get_stats(map, &stats) == 0);
+            n_rehashing += stats.rehashing;
+
+            check_batch_(map, &rs);
+        }
+    }
+
+    check_batch_(map, &rs);
+
+    /* some of the batches ran against two tables */
+    lz_assert(n_rehashing > 0);
+
+    lz_kvmap_free(map);
+}
+
+int
+main(void)
+{
+    size_t i;
+
+    for (i = 0; i < 2 * N_KEYS; i++)
+    {
+        lens[i] = (size_t)snprintf(keys[i], sizeof(keys[i]), "key-%zu", i);
+    }
+
+    test_batch_(0);
+    test_batch_(LZ_KVMAP_F_OPEN);
+
+    return 0;
+}
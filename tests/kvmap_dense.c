@@ -0,0 +1,143 @@
+/*
+ * the dense entry array behind lz_kvmap iteration: removing entries from
+ * inside lz_kvmap_for_each(), removing them during a lz_kvmap_first()/next()
+ * walk while compactions happen under it, and insertion order surviving
+ * both. Chained and open addressing.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define N_KEYS 10000
+
+static uint8_t seen[N_KEYS];
+
+static void
+key_(char * buf, uint32_t i)
+{
+    snprintf(buf, 16, "key%u", i);
+}
+
+/* removes the entry it is called with when its value is even */
+static int
+remove_even_(lz_kvmap_ent * ent, void * arg)
+{
+    uintptr_t i = (uintptr_t)lz_kvmap_ent_val(ent);
+
+    lz_assert(seen[i] == 0);
+    seen[i] = 1;
+
+    if (i % 2 == 0)
+    {
+        lz_assert(lz_kvmap_remove_ent((lz_kvmap *)arg, ent) == 0);
+    }
+
+    return 0;
+}
+
+/* values come back in insertion order, which is ascending here */
+static size_t
+check_order_(lz_kvmap * map)
+{
+    lz_kvmap_ent * ent;
+    uintptr_t      last = 0;
+    size_t         n    = 0;
+
+    for (ent = lz_kvmap_first(map); ent != NULL; ent = lz_kvmap_next(ent))
+    {
+        uintptr_t i = (uintptr_t)lz_kvmap_ent_val(ent);
+
+        lz_assert(n == 0 || i > last);
+
+        last = i;
+        n++;
+    }
+
+    lz_assert(n == lz_kvmap_get_size(map));
+
+    return n;
+}
+
+static void
+test_dense_(int flags)
+{
+    lz_kvmap            * map = lz_kvmap_new_flags(16, flags);
+    struct lz_kvmap_stats stats;
+    lz_kvmap_ent        * ent;
+    lz_kvmap_ent        * next;
+    char                  key[16];
+    uintptr_t             i;
+    size_t                n;
+
+    lz_assert(map != NULL);
+
+    for (i = 1; i < N_KEYS; i++)
+    {
+        key_(key, (uint32_t)i);
+        lz_assert(lz_kvmap_add(map, key, (void *)i, NULL) != NULL);
+    }
+
+    /* half of them removed from inside the walk, every entry seen once */
+    memset(seen, 0, sizeof(seen));
+    lz_assert(lz_kvmap_for_each(map, remove_even_, map) == 0);
+
+    for (i = 1; i < N_KEYS; i++)
+    {
+        key_(key, (uint32_t)i);
+
+        lz_assert(seen[i] == 1);
+        lz_assert((lz_kvmap_find(map, key) != NULL) == (i % 2 == 1));
+    }
+
+    lz_assert(check_order_(map) == N_KEYS / 2);
+
+    /* remove all but every tenth during a walk, enough to compact the
+     * array more than once; next is taken before the remove */
+    memset(seen, 0, sizeof(seen));
+
+    for (n = 0, ent = lz_kvmap_first(map); ent != NULL; ent = next)
+    {
+        i    = (uintptr_t)lz_kvmap_ent_val(ent);
+        next = lz_kvmap_next(ent);
+
+        lz_assert(seen[i] == 0);
+        seen[i] = 1;
+        n++;
+
+        if (i % 10 != 1)
+        {
+            lz_assert(lz_kvmap_remove_ent(map, ent) == 0);
+        }
+    }
+
+    lz_assert(n == N_KEYS / 2);
+    lz_assert(check_order_(map) == N_KEYS / 10);
+
+    /* new entries go after the old ones */
+    for (i = N_KEYS; i < N_KEYS + 100; i++)
+    {
+        key_(key, (uint32_t)i);
+        lz_assert(lz_kvmap_add(map, key, (void *)i, NULL) != NULL);
+    }
+
+    lz_assert(check_order_(map) == N_KEYS / 10 + 100);
+
+    lz_assert(lz_kvmap_get_stats(map, &stats) == 0);
+    lz_assert(stats.n_entries == N_KEYS / 10 + 100);
+
+    lz_kvmap_free(map);
+}
+
+int
+main(void)
+{
+    test_dense_(0);
+    test_dense_(LZ_KVMAP_F_OPEN);
+
+    return 0;
+}
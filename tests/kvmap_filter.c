@@ -0,0 +1,161 @@
+/*
+ * lz_kvmap_filter_enable(): no key in the map is ever ruled out by the
+ * filter, through random adds and removes, the rebuilds they cause, a
+ * re-enable, a size cap and a clear. And a rebuild during an add counts the
+ * new key once.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define N_KEYS 20000
+#define N_OPS  200000
+
+static uint8_t in_map[N_KEYS];
+
+static void
+key_(char * buf, uint32_t i)
+{
+    snprintf(buf, 16, "key%u", i);
+}
+
+/* every key in the map gets past the filter, every other one is a miss */
+static void
+check_all_(lz_kvmap * map)
+{
+    char     key[16];
+    size_t   n = 0;
+    uint32_t i;
+
+    for (i = 0; i < N_KEYS; i++)
+    {
+        key_(key, i);
+
+        lz_assert((lz_kvmap_find(map, key) != NULL) == in_map[i]);
+        n += in_map[i];
+    }
+
+    lz_assert(lz_kvmap_get_size(map) == n);
+}
+
+static void
+churn_(lz_kvmap * map, uint64_t * rs, uint32_t range)
+{
+    char     key[16];
+    uint32_t i;
+    int      k;
+
+    for (k = 0; k < N_OPS; k++)
+    {
+        *rs ^= *rs << 13; *rs ^= *rs >> 7; *rs ^= *rs << 17;
+        i    = (uint32_t)(*rs % range);
+        key_(key, i);
+
+        if (in_map[i])
+        {
+            lz_assert(lz_kvmap_remove(map, key) == 0);
+            in_map[i] = 0;
+        } else {
+            lz_assert(lz_kvmap_add(map, key, (void *)1, NULL) != NULL);
+            in_map[i] = 1;
+        }
+    }
+}
+
+static void
+test_no_false_negatives_(int flags)
+{
+    lz_kvmap                   * map = lz_kvmap_new_flags(16, flags);
+    struct lz_kvmap_filter_stats stats;
+    uint64_t                     rs  = 88172645463325252ULL;
+    uint32_t                     capacity;
+
+    memset(in_map, 0, sizeof(in_map));
+
+    lz_assert(map != NULL);
+    lz_assert(lz_kvmap_filter_enable(map, 0.01, 0) == 0);
+    lz_assert(lz_kvmap_filter_get_stats(map, &stats) == 0);
+    capacity = stats.capacity;
+
+    /* a growing key set rebuilds it bigger */
+    churn_(map, &rs, N_KEYS);
+    check_all_(map);
+
+    lz_assert(lz_kvmap_filter_get_stats(map, &stats) == 0);
+    lz_assert(stats.capacity > capacity);
+
+    /* a small set churned in place fills it with stale keys, rebuilt at
+     * the same size */
+    churn_(map, &rs, 1000);
+    check_all_(map);
+
+    /* enabling it again builds a fresh one from the entries */
+    lz_assert(lz_kvmap_filter_enable(map, 0.001, 0) == 0);
+    check_all_(map);
+
+    /* capped far below what it needs: more false positives, no negatives */
+    lz_assert(lz_kvmap_filter_enable(map, 0.01, 256) == 0);
+    churn_(map, &rs, N_KEYS);
+    check_all_(map);
+
+    lz_assert(lz_kvmap_filter_get_stats(map, &stats) == 0);
+    lz_assert(stats.n_bytes <= 256);
+
+    lz_assert(lz_kvmap_clear(map) == 0);
+    memset(in_map, 0, sizeof(in_map));
+    check_all_(map);
+
+    churn_(map, &rs, N_KEYS);
+    check_all_(map);
+
+    lz_kvmap_free(map);
+}
+
+static void
+test_rebuild_count_(void)
+{
+    lz_kvmap                   * map = lz_kvmap_new(16);
+    struct lz_kvmap_filter_stats stats;
+    char                         key[16];
+    uint32_t                     capacity;
+    uint32_t                     i;
+
+    lz_assert(map != NULL);
+    lz_assert(lz_kvmap_filter_enable(map, 0.01, 0) == 0);
+    lz_assert(lz_kvmap_filter_get_stats(map, &stats) == 0);
+    capacity = stats.capacity;
+
+    /* the first rebuild doubles it; the key that caused it is counted once,
+     * so it takes exactly twice the keys to fill again */
+    for (i = 0; i < 2 * capacity; i++)
+    {
+        key_(key, i);
+        lz_assert(lz_kvmap_add(map, key, NULL, NULL) != NULL);
+    }
+
+    lz_assert(lz_kvmap_filter_get_stats(map, &stats) == 0);
+    lz_assert(stats.capacity == 2 * capacity);
+
+    key_(key, i);
+    lz_assert(lz_kvmap_add(map, key, NULL, NULL) != NULL);
+
+    lz_assert(lz_kvmap_filter_get_stats(map, &stats) == 0);
+    lz_assert(stats.capacity == 4 * capacity);
+
+    lz_kvmap_free(map);
+}
+
+int
+main(void)
+{
+    test_no_false_negatives_(0);
+    test_no_false_negatives_(LZ_KVMAP_F_OPEN);
+    test_rebuild_count_();
+
+    return 0;
+}
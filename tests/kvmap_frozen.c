@@ -0,0 +1,162 @@
+/*
+ * lz_kvmap_freeze() and lookups in the frozen file, including a map with
+ * duplicate keys and files whose slots point outside the blob.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define N_KEYS 1000
+
+/* offsets of slot_off in the header and of off in a slot */
+#define HDR_SLOT_OFF 40
+#define SLOT_SIZE    16
+#define SLOT_OFF     8
+
+static char path[64];
+
+static void
+key_(char * buf, int i)
+{
+    snprintf(buf, 16, "key%d", i);
+}
+
+static lz_kvmap *
+map_new_(void)
+{
+    lz_kvmap * map = lz_kvmap_new(64);
+    char       key[16];
+    int        i;
+
+    lz_assert(map != NULL);
+
+    for (i = 0; i < N_KEYS; i++)
+    {
+        key_(key, i);
+        lz_assert(lz_kvmap_add(map, key, strdup(key), free) != NULL);
+    }
+
+    return map;
+}
+
+static void
+test_find_(void)
+{
+    lz_kvmap        * map = map_new_();
+    lz_kvmap_frozen * frozen;
+    const char      * val;
+    char              key[16];
+    size_t            vlen;
+    int               i;
+
+    lz_assert(lz_kvmap_freeze(map, path, NULL, NULL) == 0);
+    lz_assert((frozen = lz_kvmap_frozen_open(path)) != NULL);
+    lz_assert(lz_kvmap_frozen_get_size(frozen) == N_KEYS);
+
+    for (i = 0; i < N_KEYS; i++)
+    {
+        key_(key, i);
+
+        lz_assert((val = lz_kvmap_frozen_find(frozen, key, strlen(key), &vlen)) != NULL);
+        lz_assert(vlen == strlen(key) && strcmp(val, key) == 0);
+    }
+
+    lz_assert(lz_kvmap_frozen_find(frozen, "nokey", 5, NULL) == NULL);
+
+    lz_kvmap_frozen_close(frozen);
+    lz_kvmap_free(map);
+}
+
+static void
+test_dup_keys_(void)
+{
+    lz_kvmap * map = map_new_();
+
+    lz_assert(lz_kvmap_add(map, "key7", strdup("again"), free) != NULL);
+
+    errno = 0;
+    lz_assert(lz_kvmap_freeze(map, path, NULL, NULL) == -1);
+    lz_assert(errno == EINVAL);
+
+    lz_kvmap_free(map);
+}
+
+/* points every slot at off, or at off from the end of the blob */
+static void
+corrupt_slots_(uint64_t off, int from_end)
+{
+    FILE   * fp;
+    uint64_t slot_off;
+    uint64_t blob_len;
+    long     len;
+    int      i;
+
+    lz_assert((fp = fopen(path, "r+b")) != NULL);
+    lz_assert(fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) > 0);
+    lz_assert(fseek(fp, HDR_SLOT_OFF, SEEK_SET) == 0);
+    lz_assert(fread(&slot_off, sizeof(slot_off), 1, fp) == 1);
+
+    blob_len = len - (slot_off + (uint64_t)SLOT_SIZE * N_KEYS);
+
+    if (from_end)
+    {
+        off = blob_len - off;
+    }
+
+    for (i = 0; i < N_KEYS; i++)
+    {
+        lz_assert(fseek(fp, slot_off + (uint64_t)i * SLOT_SIZE + SLOT_OFF, SEEK_SET) == 0);
+        lz_assert(fwrite(&off, sizeof(off), 1, fp) == 1);
+    }
+
+    lz_assert(fclose(fp) == 0);
+}
+
+static void
+test_bad_slots_(uint64_t off, int from_end)
+{
+    lz_kvmap        * map = map_new_();
+    lz_kvmap_frozen * frozen;
+    char              key[16];
+    int               i;
+
+    lz_assert(lz_kvmap_freeze(map, path, NULL, NULL) == 0);
+    corrupt_slots_(off, from_end);
+
+    lz_assert((frozen = lz_kvmap_frozen_open(path)) != NULL);
+
+    for (i = 0; i < N_KEYS; i++)
+    {
+        key_(key, i);
+        lz_assert(lz_kvmap_frozen_find(frozen, key, strlen(key), NULL) == NULL);
+    }
+
+    lz_kvmap_frozen_close(frozen);
+    lz_kvmap_free(map);
+}
+
+int
+main(void)
+{
+    snprintf(path, sizeof(path), "/tmp/lz_test_frozen.%d", (int)getpid());
+
+    test_find_();
+    test_dup_keys_();
+
+    /* past the end, wrapping around, and a record header that fits with a
+     * key and value that do not */
+    test_bad_slots_(1ULL << 40, 0);
+    test_bad_slots_(UINT64_MAX - 7, 0);
+    test_bad_slots_(8, 1);
+
+    unlink(path);
+
+    return 0;
+}
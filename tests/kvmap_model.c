@@ -0,0 +1,246 @@
+/*
+ * lz_kvmap, chained and open addressing, against a plain array of what it
+ * should hold: random adds, upserts, find-or-inserts and removes, with the
+ * key set growing and then draining again so both engines resize up and
+ * down, and every value released exactly once.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define N_KEYS 50000
+#define N_OPS  400000
+
+static uint32_t * model[N_KEYS];
+static size_t     n_model;
+static long       n_vals;
+
+static size_t
+key_(char * buf, uint32_t i)
+{
+    return (size_t)snprintf(buf, 24, "key-%u", i);
+}
+
+static uint32_t *
+val_new_(uint32_t i)
+{
+    uint32_t * v = malloc(sizeof(*v));
+
+    lz_alloc_assert(v);
+
+    *v      = i;
+    n_vals += 1;
+
+    return v;
+}
+
+static void
+val_free_(void * arg)
+{
+    lz_assert(*(uint32_t *)arg < N_KEYS);
+
+    *(uint32_t *)arg = UINT32_MAX;
+    n_vals          -= 1;
+
+    free(arg);
+}
+
+static int
+count_(lz_kvmap_ent * ent, void * arg)
+{
+    uint32_t * v = lz_kvmap_ent_val(ent);
+
+    lz_assert(model[*v] == v);
+    (*(size_t *)arg)++;
+
+    return 0;
+}
+
+static void
+check_(lz_kvmap * map)
+{
+    lz_kvmap_ent * ent;
+    char           key[24];
+    size_t         n = 0;
+    uint32_t       i;
+
+    lz_assert(lz_kvmap_get_size(map) == n_model);
+    lz_assert((size_t)n_vals == n_model);
+
+    for (i = 0; i < N_KEYS; i++)
+    {
+        size_t len = key_(key, i);
+
+        lz_assert(lz_kvmap_find(map, key) == model[i]);
+        lz_assert(lz_kvmap_find_wkhash(map, key, len, lz_kvmap_hash_key(map, key, len)) == model[i]);
+    }
+
+    lz_kvmap_for_each(map, count_, &n);
+    lz_assert(n == n_model);
+
+    for (n = 0, ent = lz_kvmap_first(map); ent != NULL; ent = lz_kvmap_next(ent))
+    {
+        n++;
+    }
+
+    lz_assert(n == n_model);
+}
+
+static void
+step_(lz_kvmap * map, uint64_t * rs, int add_bias)
+{
+    lz_kvmap_ent * ent;
+    char           key[24];
+    uint32_t       i;
+    size_t         len;
+    int            created;
+    int            op;
+
+    *rs ^= *rs << 13; *rs ^= *rs >> 7; *rs ^= *rs << 17;
+    i    = (uint32_t)(*rs % N_KEYS);
+    len  = key_(key, i);
+    op   = (int)((*rs >> 32) % 8);
+
+    /* add_bias of the 8 ops insert, the rest look up or remove */
+    if (op < add_bias)
+    {
+        switch (op % 3) {
+            case 0:
+                if (model[i] == NULL)
+                {
+                    model[i] = val_new_(i);
+                    n_model += 1;
+                    lz_assert(lz_kvmap_add_wklen(map, key, len, model[i], val_free_) != NULL);
+                }
+                break;
+            case 1:
+                ent = lz_kvmap_upsert(map, key, len, val_new_(i), val_free_, &created);
+
+                lz_assert(ent != NULL);
+                lz_assert(created == (model[i] == NULL));
+
+                n_model  += created;
+                model[i]  = lz_kvmap_ent_val(ent);
+                break;
+            default:
+                ent = lz_kvmap_find_or_insert(map, key, len, &created);
+
+                lz_assert(ent != NULL);
+                lz_assert(created == (model[i] == NULL));
+
+                if (created)
+                {
+                    model[i] = val_new_(i);
+                    n_model += 1;
+                    lz_kvmap_ent_set_val(ent, model[i], val_free_);
+                }
+
+                lz_assert(lz_kvmap_ent_val(ent) == model[i]);
+                break;
+        }
+
+        return;
+    }
+
+    switch (op % 3) {
+        case 0:
+            lz_assert(lz_kvmap_find_wklen(map, key, len) == model[i]);
+            break;
+        case 1:
+            if ((ent = lz_kvmap_ent_find(map, key)) != NULL)
+            {
+                lz_assert(lz_kvmap_ent_val(ent) == model[i]);
+                lz_assert(lz_kvmap_remove_ent(map, ent) == 0);
+
+                model[i] = NULL;
+                n_model -= 1;
+            } else {
+                lz_assert(model[i] == NULL);
+            }
+            break;
+        default:
+            lz_kvmap_remove_wklen(map, key, len);
+
+            if (model[i] != NULL)
+            {
+                model[i] = NULL;
+                n_model -= 1;
+            }
+
+            lz_assert(lz_kvmap_find_wklen(map, key, len) == NULL);
+            break;
+    }
+}
+
+static void
+test_engine_(int flags)
+{
+    lz_kvmap            * map = lz_kvmap_new_flags(16, flags);
+    struct lz_kvmap_stats stats;
+    uint64_t              rs  = 88172645463325252ULL + (uint64_t)flags;
+    int                   k;
+
+    lz_assert(map != NULL);
+
+    memset(model, 0, sizeof(model));
+    n_model = 0;
+
+    /* mostly inserting: grows */
+    for (k = 0; k < N_OPS; k++)
+    {
+        step_(map, &rs, 6);
+    }
+
+    check_(map);
+
+    /* churning at a steady size */
+    for (k = 0; k < N_OPS; k++)
+    {
+        step_(map, &rs, 4);
+    }
+
+    check_(map);
+
+    /* only removing: drains and shrinks */
+    for (k = 0; k < N_OPS; k++)
+    {
+        step_(map, &rs, 0);
+    }
+
+    check_(map);
+
+    lz_assert(lz_kvmap_get_stats(map, &stats) == 0);
+    lz_assert(stats.n_grows > 0);
+    lz_assert(stats.n_shrinks > 0);
+
+    lz_assert(lz_kvmap_clear(map) == 0);
+    lz_assert(n_vals == 0);
+
+    memset(model, 0, sizeof(model));
+    n_model = 0;
+    check_(map);
+
+    for (k = 0; k < N_OPS / 4; k++)
+    {
+        step_(map, &rs, 5);
+    }
+
+    check_(map);
+
+    lz_kvmap_free(map);
+    lz_assert(n_vals == 0);
+}
+
+int
+main(void)
+{
+    test_engine_(0);
+    test_engine_(LZ_KVMAP_F_OPEN);
+
+    return 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * lz_kvmap_mt under concurrent finds, adds, upserts and removes. Readers
+ * check every value they find inside a read section; values poison
+ * themselves when freed, so a value reclaimed too early is caught. Other
+ * readers call lz_kvmap_mt_find() without a read section, which must not
+ * touch an entry once it may be reclaimed. Small shards make resizes
+ * frequent.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define N_KEYS     4096
+#define N_READERS  4
+#define N_BARE     2
+#define N_WRITERS  3
+#define N_OPS      200000
+
+#define VAL_ALIVE  0x11223344
+#define VAL_DEAD   0xdeaddead
+
+struct val {
+    uint32_t magic;
+    uint32_t idx;
+};
+
+static lz_kvmap_mt * map;
+static long          n_vals;
+
+static void
+key_(char * buf, uint32_t idx)
+{
+    snprintf(buf, 16, "key%05u", idx);
+}
+
+static struct val *
+val_new_(uint32_t idx)
+{
+    struct val * v = malloc(sizeof(*v));
+
+    lz_alloc_assert(v);
+
+    v->magic = VAL_ALIVE;
+    v->idx   = idx;
+
+    __atomic_fetch_add(&n_vals, 1, __ATOMIC_RELAXED);
+
+    return v;
+}
+
+static void
+val_free_(void * arg)
+{
+    struct val * v = arg;
+
+    lz_assert(v->magic == VAL_ALIVE);
+
+    v->magic = VAL_DEAD;
+    __atomic_fetch_sub(&n_vals, 1, __ATOMIC_RELAXED);
+
+    free(v);
+}
+
+static void *
+reader_(void * arg)
+{
+    uint64_t rs = (uintptr_t)arg * 0x9e3779b97f4a7c15ULL;
+    char     key[16];
+    size_t   i;
+
+    for (i = 0; i < N_OPS; i++)
+    {
+        lz_kvmap_mt_ent * ent;
+        struct val      * v;
+        uint32_t          idx;
+        int               token;
+
+        rs ^= rs << 13; rs ^= rs >> 7; rs ^= rs << 17;
+        idx = rs % N_KEYS;
+        key_(key, idx);
+
+        token = lz_kvmap_mt_read_enter(map);
+
+        if ((ent = lz_kvmap_mt_ent_find(map, key, strlen(key))) != NULL)
+        {
+            lz_assert(lz_kvmap_mt_ent_get_klen(ent) == strlen(key));
+            lz_assert(memcmp(lz_kvmap_mt_ent_key(ent), key, strlen(key)) == 0);
+
+            v = lz_kvmap_mt_ent_val(ent);
+            lz_assert(v->magic == VAL_ALIVE);
+            lz_assert(v->idx == idx);
+        }
+
+        if ((v = lz_kvmap_mt_find(map, key, strlen(key))) != NULL)
+        {
+            lz_assert(v->magic == VAL_ALIVE);
+            lz_assert(v->idx == idx);
+        }
+
+        lz_kvmap_mt_read_exit(map, token);
+    }
+
+    return NULL;
+}
+
+/* the value may be freed the moment find returns, only the pointer is safe */
+static void *
+bare_reader_(void * arg)
+{
+    uint64_t rs = (uintptr_t)arg * 0x9e3779b97f4a7c15ULL;
+    char     key[16];
+    size_t   n  = 0;
+    size_t   i;
+
+    for (i = 0; i < N_OPS; i++)
+    {
+        rs ^= rs << 13; rs ^= rs >> 7; rs ^= rs << 17;
+        key_(key, rs % N_KEYS);
+
+        n += lz_kvmap_mt_find(map, key, strlen(key)) != NULL;
+    }
+
+    return (void *)n;
+}
+
+static void *
+writer_(void * arg)
+{
+    uint64_t rs = (uintptr_t)arg * 0x9e3779b97f4a7c15ULL;
+    char     key[16];
+    size_t   i;
+
+    for (i = 0; i < N_OPS; i++)
+    {
+        struct val * v;
+        uint32_t     idx;
+
+        rs ^= rs << 13; rs ^= rs >> 7; rs ^= rs << 17;
+        idx = rs % N_KEYS;
+        key_(key, idx);
+
+        switch ((rs >> 32) % 3)
+        {
+            case 0:
+                v = val_new_(idx);
+
+                if (lz_kvmap_mt_add(map, key, strlen(key), v, val_free_) != 0)
+                {
+                    val_free_(v);
+                }
+                break;
+            case 1:
+                lz_assert(lz_kvmap_mt_upsert(map, key, strlen(key), val_new_(idx), val_free_, NULL) == 0);
+                break;
+            default:
+                lz_kvmap_mt_remove(map, key, strlen(key));
+                break;
+        }
+    }
+
+    return NULL;
+}
+
+static int
+count_(lz_kvmap_mt_ent * ent, void * arg)
+{
+    struct val * v = lz_kvmap_mt_ent_val(ent);
+
+    lz_assert(v->magic == VAL_ALIVE);
+    (*(size_t *)arg)++;
+
+    return 0;
+}
+
+int
+main(void)
+{
+    pthread_t threads[N_READERS + N_BARE + N_WRITERS];
+    size_t    n = 0;
+    long      i;
+
+    map = lz_kvmap_mt_new(4, 4);
+    lz_assert(map != NULL);
+
+    for (i = 0; i < N_READERS + N_BARE + N_WRITERS; i++)
+    {
+        void * (* fn)(void *) = i < N_READERS ? reader_ :
+                                i < N_READERS + N_BARE ? bare_reader_ : writer_;
+
+        lz_assert(pthread_create(&threads[i], NULL, fn, (void *)(i + 1)) == 0);
+    }
+
+    for (i = 0; i < N_READERS + N_BARE + N_WRITERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    lz_kvmap_mt_reclaim(map);
+    lz_kvmap_mt_for_each(map, count_, &n);
+
+    /* everything retired is gone, what is left is in the map */
+    lz_assert(n == lz_kvmap_mt_get_size(map));
+    lz_assert((size_t)__atomic_load_n(&n_vals, __ATOMIC_RELAXED) == n);
+
+    lz_kvmap_mt_free(map);
+    lz_assert(__atomic_load_n(&n_vals, __ATOMIC_RELAXED) == 0);
+
+    return 0;
+}
@@ -0,0 +1,255 @@
+/*
+ * lz_kvmap_scan(): every entry present for the whole scan is visited, while
+ * between calls the map grows, shrinks and compacts its dense array, and
+ * while the callback removes entries or stops early. Chained and open
+ * addressing.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define N_STABLE 2000
+#define N_CHURN  40000
+#define N_ALL    (N_STABLE + N_CHURN)
+
+static uint32_t seen[N_ALL];
+static uint8_t  in_map[N_ALL];
+
+static void
+key_(char * buf, uint32_t i)
+{
+    snprintf(buf, 16, "key%u", i);
+}
+
+static void
+add_(lz_kvmap * map, uint32_t i)
+{
+    char key[16];
+
+    if (!in_map[i])
+    {
+        key_(key, i);
+        lz_assert(lz_kvmap_add(map, key, (void *)(uintptr_t)i, NULL) != NULL);
+        in_map[i] = 1;
+    }
+}
+
+static void
+remove_(lz_kvmap * map, uint32_t i)
+{
+    char key[16];
+
+    if (in_map[i])
+    {
+        key_(key, i);
+        lz_assert(lz_kvmap_remove(map, key) == 0);
+        in_map[i] = 0;
+    }
+}
+
+static int
+mark_(lz_kvmap_ent * ent, void * arg)
+{
+    (void)arg;
+
+    seen[(uintptr_t)lz_kvmap_ent_val(ent)] += 1;
+
+    return 0;
+}
+
+/* churn keys are removed as they are visited */
+static int
+mark_remove_(lz_kvmap_ent * ent, void * arg)
+{
+    uintptr_t i = (uintptr_t)lz_kvmap_ent_val(ent);
+
+    seen[i] += 1;
+
+    if (i >= N_STABLE)
+    {
+        lz_assert(lz_kvmap_remove_ent((lz_kvmap *)arg, ent) == 0);
+        in_map[i] = 0;
+    }
+
+    return 0;
+}
+
+/* stops after every third entry */
+static int
+mark_stop_(lz_kvmap_ent * ent, void * arg)
+{
+    seen[(uintptr_t)lz_kvmap_ent_val(ent)] += 1;
+
+    return ++(*(int *)arg) % 3 == 0;
+}
+
+static void
+check_stable_(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < N_STABLE; i++)
+    {
+        lz_assert(seen[i] >= 1);
+    }
+}
+
+/*
+ * scans the map in steps of `count`, calling between() after each step
+ */
+static void
+scan_(lz_kvmap * map, size_t count, lz_kvmap_iterfn fn, void * arg,
+      void (* between)(lz_kvmap * map, int step))
+{
+    uint64_t cursor = 0;
+    int      step   = 0;
+
+    memset(seen, 0, sizeof(seen));
+
+    do {
+        cursor = lz_kvmap_scan(map, cursor, count, fn, arg);
+
+        if (between != NULL)
+        {
+            between(map, step++);
+        }
+    } while (cursor != 0);
+
+    check_stable_();
+}
+
+/* adds churn keys: grows the tables */
+static void
+grow_(lz_kvmap * map, int step)
+{
+    uint32_t i;
+
+    for (i = 0; i < 200; i++)
+    {
+        add_(map, N_STABLE + ((uint32_t)step * 200 + i) % N_CHURN);
+    }
+}
+
+/* removes churn keys: shrinks the tables and compacts the dense array */
+static void
+shrink_(lz_kvmap * map, int step)
+{
+    uint32_t i;
+
+    for (i = 0; i < 2000; i++)
+    {
+        remove_(map, N_STABLE + ((uint32_t)step * 2000 + i) % N_CHURN);
+    }
+}
+
+/*
+ * a new map with the stable keys scattered among churn keys in the dense
+ * array, so a compaction moves them
+ */
+static lz_kvmap *
+interleaved_(int flags)
+{
+    lz_kvmap * map = lz_kvmap_new_flags(16, flags);
+    uint32_t   stable = 0;
+    uint32_t   churn  = N_STABLE;
+
+    lz_assert(map != NULL);
+    memset(in_map, 0, sizeof(in_map));
+
+    /* one stable key, then 20 churn keys */
+    while (stable < N_STABLE || churn < N_ALL)
+    {
+        if (stable < N_STABLE && (churn == N_ALL || (stable + churn) % 21 == 0))
+        {
+            add_(map, stable++);
+        } else {
+            add_(map, churn++);
+        }
+    }
+
+    lz_assert(lz_kvmap_get_size(map) == N_ALL);
+
+    return map;
+}
+
+static void
+test_scan_(int flags)
+{
+    lz_kvmap            * map = lz_kvmap_new_flags(16, flags);
+    struct lz_kvmap_stats before;
+    struct lz_kvmap_stats after;
+    uint32_t              i;
+    int                   n = 0;
+
+    lz_assert(map != NULL);
+    memset(in_map, 0, sizeof(in_map));
+
+    for (i = 0; i < N_STABLE; i++)
+    {
+        add_(map, i);
+    }
+
+    /* a plain scan sees each entry exactly once */
+    scan_(map, 100, mark_, NULL, NULL);
+
+    for (i = 0; i < N_STABLE; i++)
+    {
+        lz_assert(seen[i] == 1);
+    }
+
+    lz_assert(lz_kvmap_get_stats(map, &before) == 0);
+    scan_(map, 50, mark_, NULL, grow_);
+    lz_assert(lz_kvmap_get_stats(map, &after) == 0);
+    lz_assert(after.n_grows > before.n_grows);
+
+    lz_kvmap_free(map);
+
+    /* a full map, drained while it is scanned: it shrinks, and the dense
+     * array is compacted under the cursor */
+    map = interleaved_(flags);
+    lz_assert(lz_kvmap_get_stats(map, &before) == 0);
+    scan_(map, 500, mark_, NULL, shrink_);
+    lz_assert(lz_kvmap_get_stats(map, &after) == 0);
+    lz_assert(after.n_shrinks > before.n_shrinks);
+    lz_kvmap_free(map);
+
+    /* bigger steps, compacted at a different point */
+    map = interleaved_(flags);
+    scan_(map, 1000, mark_, NULL, shrink_);
+    lz_kvmap_free(map);
+
+    /* the callback removing what it visits */
+    map = interleaved_(flags);
+    scan_(map, 300, mark_remove_, map, NULL);
+
+    for (i = N_STABLE; i < N_ALL; i++)
+    {
+        lz_assert(!in_map[i]);
+    }
+
+    lz_assert(lz_kvmap_get_size(map) == N_STABLE);
+
+    /* stopping early resumes after the entry it stopped on */
+    scan_(map, 100, mark_stop_, &n, NULL);
+
+    for (i = 0; i < N_STABLE; i++)
+    {
+        lz_assert(seen[i] == 1);
+    }
+
+    lz_kvmap_free(map);
+}
+
+int
+main(void)
+{
+    test_scan_(0);
+    test_scan_(LZ_KVMAP_F_OPEN);
+
+    return 0;
+}
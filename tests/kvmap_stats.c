@@ -0,0 +1,109 @@
+/*
+ * lz_kvmap_get_stats() collision and duplicate counts, and removes not
+ * counting as lookups, filter ones included.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define N_KEYS 1000
+
+/* "a..." keys all share one hash */
+static uint32_t
+hash_(const char * key, size_t len)
+{
+    return key[0] == 'a' ? 42 : lz_kvmap_hash64(key, len, 0);
+}
+
+static void
+test_collisions_(int flags)
+{
+    lz_kvmap            * map = lz_kvmap_new_with_hash(16, flags, LZ_KVMAP_HASH_CUSTOM, hash_);
+    struct lz_kvmap_stats stats;
+
+    lz_assert(map != NULL);
+
+    lz_assert(lz_kvmap_add(map, "a1", NULL, NULL) != NULL);
+    lz_assert(lz_kvmap_add(map, "a2", NULL, NULL) != NULL);
+    lz_assert(lz_kvmap_add(map, "a3", NULL, NULL) != NULL);
+    lz_assert(lz_kvmap_add(map, "b1", NULL, NULL) != NULL);
+    lz_assert(lz_kvmap_add(map, "b1", NULL, NULL) != NULL);
+
+    /* three share a hash, two of them extra; b1 twice, once extra */
+    lz_assert(lz_kvmap_get_stats(map, &stats) == 0);
+    lz_assert(stats.n_entries == 5);
+    lz_assert(stats.n_collisions == 3);
+    lz_assert(stats.n_dup_keys == 1);
+
+    lz_kvmap_free(map);
+}
+
+static void
+test_filter_removes_(void)
+{
+    lz_kvmap                   * map = lz_kvmap_new(16);
+    struct lz_kvmap_filter_stats before;
+    struct lz_kvmap_filter_stats after;
+    struct lz_kvmap_stats        stats_before;
+    struct lz_kvmap_stats        stats_after;
+    char                         key[16];
+    int                          i;
+
+    lz_assert(map != NULL);
+    lz_assert(lz_kvmap_filter_enable(map, 0.01, 0) == 0);
+
+    for (i = 0; i < N_KEYS; i++)
+    {
+        snprintf(key, sizeof(key), "key%d", i);
+        lz_assert(lz_kvmap_add(map, key, NULL, NULL) != NULL);
+    }
+
+    lz_assert(lz_kvmap_ent_find(map, "key2") != NULL);
+    lz_assert(lz_kvmap_ent_find(map, "key1") != NULL);
+    lz_assert(lz_kvmap_filter_get_stats(map, &before) == 0);
+    lz_assert(before.positives == 2);
+    lz_assert(lz_kvmap_get_stats(map, &stats_before) == 0);
+
+    for (i = 0; i < N_KEYS; i += 2)
+    {
+        snprintf(key, sizeof(key), "key%d", i);
+        lz_assert(lz_kvmap_remove(map, key) == 0);
+
+        snprintf(key, sizeof(key), "nokey%d", i);
+        lz_assert(lz_kvmap_remove(map, key) == 0);
+    }
+
+    lz_assert(lz_kvmap_get_size(map) == N_KEYS / 2);
+    lz_assert(lz_kvmap_filter_get_stats(map, &after) == 0);
+    lz_assert(after.negatives == before.negatives);
+    lz_assert(after.positives == before.positives);
+    lz_assert(after.false_positives == before.false_positives);
+    lz_assert(after.n_stale == N_KEYS / 2);
+
+    /* zero unless built with ENABLE_KVMAP_STATS, unchanged either way */
+    lz_assert(lz_kvmap_get_stats(map, &stats_after) == 0);
+    lz_assert(stats_after.counters.lookups == stats_before.counters.lookups);
+    lz_assert(stats_after.counters.hits == stats_before.counters.hits);
+    lz_assert(stats_after.counters.removes == stats_before.counters.removes +
+              (stats_before.counters.lookups ? N_KEYS / 2 : 0));
+
+    lz_assert(lz_kvmap_ent_find(map, "key0") == NULL);
+    lz_assert(lz_kvmap_ent_find(map, "key1") != NULL);
+
+    lz_kvmap_free(map);
+}
+
+int
+main(void)
+{
+    test_collisions_(0);
+    test_collisions_(LZ_KVMAP_F_OPEN);
+    test_filter_removes_();
+
+    return 0;
+}
@@ -0,0 +1,251 @@
+/*
+ * lz_kvmap entry ttls on a clock the test controls: lazy expiry on lookup,
+ * lz_kvmap_expire() only ever taking what is due and in expiry order,
+ * ttls replaced or cleared, and entries with a ttl removed by hand. Chained
+ * and open addressing.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define N_KEYS 5000
+
+static uint64_t now_ms;
+static long     n_freed;
+static uint64_t expire_at[N_KEYS]; /* 0: not in the map, UINT64_MAX: no ttl */
+
+static uint64_t
+clock_(void * arg)
+{
+    (void)arg;
+
+    return now_ms;
+}
+
+static void
+val_free_(void * arg)
+{
+    (void)arg;
+
+    n_freed += 1;
+}
+
+static void
+key_(char * buf, uint32_t i)
+{
+    snprintf(buf, 16, "key%u", i);
+}
+
+static lz_kvmap_ent *
+add_(lz_kvmap * map, uint32_t i, uint64_t ttl)
+{
+    lz_kvmap_ent * ent;
+    char           key[16];
+
+    key_(key, i);
+    lz_assert((ent = lz_kvmap_add(map, key, (void *)(uintptr_t)(i + 1), val_free_)) != NULL);
+
+    lz_kvmap_ent_set_ttl(ent, ttl);
+    expire_at[i] = ttl ? now_ms + ttl : UINT64_MAX;
+
+    return ent;
+}
+
+static void
+test_lazy_(int flags)
+{
+    lz_kvmap     * map = lz_kvmap_new_flags(16, flags);
+    lz_kvmap_ent * ent;
+    int            created;
+
+    lz_assert(map != NULL);
+    lz_kvmap_set_clock(map, clock_, NULL);
+
+    now_ms  = 1000;
+    n_freed = 0;
+
+    ent = add_(map, 1, 100);
+    add_(map, 2, 0);
+
+    lz_assert(lz_kvmap_ent_get_ttl(ent) == 100);
+    lz_assert(lz_kvmap_ent_get_ttl(lz_kvmap_ent_find(map, "key2")) == -1);
+
+    now_ms += 60;
+    lz_assert(lz_kvmap_ent_get_ttl(ent) == 40);
+    lz_assert(lz_kvmap_find(map, "key1") != NULL);
+
+    /* due: still counted until something runs into it */
+    now_ms += 40;
+    lz_assert(lz_kvmap_ent_get_ttl(ent) == 0);
+    lz_assert(lz_kvmap_get_size(map) == 2);
+    lz_assert(lz_kvmap_find(map, "key1") == NULL);
+    lz_assert(lz_kvmap_get_size(map) == 1);
+    lz_assert(n_freed == 1);
+
+    /* an upsert on an expired key creates it afresh */
+    ent = add_(map, 3, 10);
+    now_ms += 10;
+    lz_assert(lz_kvmap_upsert(map, "key3", 4, (void *)3, val_free_, &created) != NULL);
+    lz_assert(created == 1);
+    lz_assert(n_freed == 2);
+
+    /* cleared and replaced ttls */
+    ent = lz_kvmap_ent_find(map, "key3");
+    lz_kvmap_ent_set_ttl(ent, 5);
+    lz_kvmap_ent_set_ttl(ent, 0);
+    now_ms += 1000;
+    lz_assert(lz_kvmap_find(map, "key3") != NULL);
+    lz_assert(lz_kvmap_expire(map, 100) == 0);
+
+    lz_kvmap_ent_set_ttl(ent, 5);
+    lz_kvmap_ent_set_ttl(ent, 500);
+    now_ms += 100;
+    lz_assert(lz_kvmap_find(map, "key3") != NULL);
+    now_ms += 400;
+    lz_assert(lz_kvmap_find(map, "key3") == NULL);
+
+    lz_kvmap_free(map);
+}
+
+static void
+test_heap_(int flags)
+{
+    lz_kvmap * map = lz_kvmap_new_flags(16, flags);
+    uint64_t   rs  = 88172645463325252ULL;
+    char       key[16];
+    size_t     n_live;
+    uint32_t   i;
+    int        round;
+
+    lz_assert(map != NULL);
+    lz_kvmap_set_clock(map, clock_, NULL);
+
+    now_ms  = 1;
+    n_freed = 0;
+
+    for (i = 0; i < N_KEYS; i++)
+    {
+        rs ^= rs << 13; rs ^= rs >> 7; rs ^= rs << 17;
+
+        /* a tenth without a ttl */
+        add_(map, i, rs % 10 == 0 ? 0 : 1 + (rs >> 8) % 10000);
+    }
+
+    /* some removed by hand, some given a new ttl */
+    for (i = 0; i < N_KEYS; i += 7)
+    {
+        key_(key, i);
+        lz_assert(lz_kvmap_remove(map, key) == 0);
+        expire_at[i] = 0;
+    }
+
+    for (i = 3; i < N_KEYS; i += 11)
+    {
+        if (expire_at[i] != 0)
+        {
+            key_(key, i);
+            lz_kvmap_ent_set_ttl(lz_kvmap_ent_find(map, key), 5000);
+            expire_at[i] = now_ms + 5000;
+        }
+    }
+
+    n_freed = 0;
+
+    /* step the clock, expiring a few at a time as a timer would */
+    for (round = 0; round < 120; round++)
+    {
+        now_ms += 100;
+
+        while (lz_kvmap_expire(map, 16) > 0)
+        {
+        }
+
+        /* exactly what is due is gone */
+        for (i = 0, n_live = 0; i < N_KEYS; i++)
+        {
+            lz_kvmap_ent * ent;
+
+            key_(key, i);
+            ent = lz_kvmap_ent_find(map, key);
+
+            if (expire_at[i] != 0 && expire_at[i] > now_ms)
+            {
+                lz_assert(ent != NULL);
+                n_live++;
+
+                if (expire_at[i] != UINT64_MAX)
+                {
+                    lz_assert((uint64_t)lz_kvmap_ent_get_ttl(ent) == expire_at[i] - now_ms);
+                }
+            } else {
+                lz_assert(ent == NULL);
+            }
+        }
+
+        lz_assert(lz_kvmap_get_size(map) == n_live);
+    }
+
+    /* only the entries without a ttl are left, the others freed once */
+    lz_assert(lz_kvmap_expire(map, SIZE_MAX) == 0);
+
+    for (i = 0, n_live = 0; i < N_KEYS; i++)
+    {
+        n_live += expire_at[i] == UINT64_MAX;
+    }
+
+    lz_assert(lz_kvmap_get_size(map) == n_live);
+    lz_assert((size_t)n_freed == N_KEYS - N_KEYS / 7 - 1 - n_live);
+
+    lz_kvmap_free(map);
+}
+
+static void
+test_expire_order_(int flags)
+{
+    lz_kvmap     * map = lz_kvmap_new_flags(16, flags);
+    lz_kvmap_ent * ent;
+    uint32_t       i;
+
+    lz_assert(map != NULL);
+    lz_kvmap_set_clock(map, clock_, NULL);
+
+    now_ms = 1;
+
+    /* added latest first: the heap has to sort them */
+    for (i = 0; i < 100; i++)
+    {
+        add_(map, i, 1000 - i * 10);
+    }
+
+    now_ms += 1000;
+
+    /* a capped expire takes the earliest due ones; a lookup would expire
+     * the rest, a walk does not */
+    lz_assert(lz_kvmap_expire(map, 10) == 10);
+    lz_assert(lz_kvmap_get_size(map) == 90);
+
+    for (ent = lz_kvmap_first(map); ent != NULL; ent = lz_kvmap_next(ent))
+    {
+        lz_assert((uintptr_t)lz_kvmap_ent_val(ent) <= 90);
+    }
+
+    lz_kvmap_free(map);
+}
+
+int
+main(void)
+{
+    test_lazy_(0);
+    test_lazy_(LZ_KVMAP_F_OPEN);
+    test_heap_(0);
+    test_heap_(LZ_KVMAP_F_OPEN);
+    test_expire_order_(0);
+    test_expire_order_(LZ_KVMAP_F_OPEN);
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * LZ_VEC_DECLARE and LZ_KVMAP_DECLARE: basic operations, and sizes too
+ * large to be allocated failing instead of wrapping.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+#include <liblz/lzgen.h>
+
+#define N_KEYS 10000
+
+LZ_VEC_DECLARE(u32vec, uint32_t)
+LZ_KVMAP_DECLARE(u32map, uint32_t, uint64_t, lz_gen_hash_u32, lz_gen_eq)
+
+static void
+test_vec_(void)
+{
+    u32vec   v;
+    uint32_t x;
+    uint32_t i;
+
+    u32vec_init(&v);
+
+    for (i = 0; i < N_KEYS; i++)
+    {
+        lz_assert(u32vec_push(&v, i) != NULL);
+    }
+
+    lz_assert(u32vec_get_size(&v) == N_KEYS);
+    lz_assert(*u32vec_at(&v, 17) == 17);
+    lz_assert(u32vec_at(&v, N_KEYS) == NULL);
+    lz_assert(u32vec_pop(&v, &x) == 0 && x == N_KEYS - 1);
+
+    /* would overflow n_alloc * sizeof(T) */
+    lz_assert(u32vec_reserve(&v, SIZE_MAX / 2) == -1);
+    lz_assert(u32vec_get_size(&v) == N_KEYS - 1);
+
+    u32vec_free(&v);
+}
+
+static void
+test_map_(void)
+{
+    u32map   * map = u32map_new(0);
+    uint32_t   iter = 0;
+    uint32_t * key;
+    uint64_t * val;
+    size_t     n    = 0;
+    uint32_t   i;
+    int        added;
+
+    lz_assert(map != NULL);
+
+    for (i = 0; i < N_KEYS; i++)
+    {
+        lz_assert((val = u32map_put(map, i * 7, &added)) != NULL && added == 1);
+        *val = i;
+    }
+
+    lz_assert(u32map_put(map, 7, &added) != NULL && added == 0);
+    lz_assert(u32map_get_size(map) == N_KEYS);
+
+    for (i = 0; i < N_KEYS; i += 2)
+    {
+        lz_assert(u32map_remove(map, i * 7) == 0);
+    }
+
+    lz_assert(u32map_remove(map, 0) == -1);
+
+    while (u32map_next(map, &iter, &key, &val))
+    {
+        lz_assert(*key == *val * 7 && (*val & 1));
+        n++;
+    }
+
+    lz_assert(n == N_KEYS / 2);
+
+    u32map_free(map);
+
+    /* more than LZ_GEN_MAX_SLOTS */
+    lz_assert(u32map_new(UINT32_MAX) == NULL);
+}
+
+int
+main(void)
+{
+    test_vec_();
+    test_map_();
+
+    return 0;
+}
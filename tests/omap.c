@@ -0,0 +1,470 @@
+/*
+ * lz_omap against a sorted array of what it should hold: random binary keys
+ * (0x00 and 0xff bytes, shared prefixes past the 16 bytes kept in a head),
+ * lower and upper bounds, ranges and prefixes, including prefixes ending in
+ * 0xff, while enough adds and removes happen to split and merge chunks many
+ * times over. Also values released through their freefn.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define N_KEYS  6000
+#define MAX_KEY 48
+
+struct key {
+    uint8_t b[MAX_KEY];
+    size_t  len;
+};
+
+static struct key keys[N_KEYS];  /* sorted, unique */
+static size_t     n_keys;
+static uint8_t    present[N_KEYS];
+static size_t     next_present[N_KEYS + 1];
+static long       n_vals;
+
+static uint64_t rs = 88172645463325252ULL;
+
+static uint64_t
+rand_(void)
+{
+    rs ^= rs << 13; rs ^= rs >> 7; rs ^= rs << 17;
+
+    return rs;
+}
+
+static int
+cmp_(const void * a, size_t al, const void * b, size_t bl)
+{
+    int res = memcmp(a, b, al < bl ? al : bl);
+
+    if (res != 0)
+    {
+        return res;
+    }
+
+    return (al > bl) - (al < bl);
+}
+
+static int
+key_cmp_(const void * a, const void * b)
+{
+    const struct key * ka = a;
+    const struct key * kb = b;
+
+    return cmp_(ka->b, ka->len, kb->b, kb->len);
+}
+
+static void
+make_keys_(void)
+{
+    static const uint8_t alpha[] = { 0x00, 'a', 'b', 0x7f, 0x80, 0xff };
+    size_t               i;
+    size_t               j;
+
+    for (i = 0; i < N_KEYS; i++)
+    {
+        struct key * k = &keys[i];
+
+        /* half extend or change an earlier key: long shared prefixes */
+        if (i > 0 && rand_() % 2)
+        {
+            *k = keys[rand_() % i];
+
+            if (k->len < MAX_KEY && rand_() % 2)
+            {
+                k->b[k->len++] = alpha[rand_() % sizeof(alpha)];
+            } else if (k->len > 0) {
+                k->b[rand_() % k->len] = alpha[rand_() % sizeof(alpha)];
+            }
+
+            continue;
+        }
+
+        k->len = rand_() % 24;
+
+        for (j = 0; j < k->len; j++)
+        {
+            k->b[j] = alpha[rand_() % sizeof(alpha)];
+        }
+    }
+
+    qsort(keys, N_KEYS, sizeof(struct key), key_cmp_);
+
+    for (i = 1, n_keys = 1; i < N_KEYS; i++)
+    {
+        if (key_cmp_(&keys[i], &keys[n_keys - 1]) != 0)
+        {
+            keys[n_keys++] = keys[i];
+        }
+    }
+}
+
+static void *
+val_new_(size_t i)
+{
+    size_t * v = malloc(sizeof(*v));
+
+    lz_alloc_assert(v);
+
+    *v      = i;
+    n_vals += 1;
+
+    return v;
+}
+
+static void
+val_free_(void * arg)
+{
+    n_vals -= 1;
+    free(arg);
+}
+
+static void
+add_(lz_omap * map, size_t i)
+{
+    lz_assert(lz_omap_add(map, (char *)keys[i].b, keys[i].len, val_new_(i), val_free_) == 0);
+    present[i] = 1;
+}
+
+static void
+remove_(lz_omap * map, size_t i)
+{
+    lz_assert((lz_omap_remove(map, (char *)keys[i].b, keys[i].len) == 0) == present[i]);
+    present[i] = 0;
+}
+
+/* the model's answer for lower_bound(keys[i]) is next_present[i] */
+static void
+index_model_(void)
+{
+    size_t i;
+
+    next_present[n_keys] = n_keys;
+
+    for (i = n_keys; i-- > 0;)
+    {
+        next_present[i] = present[i] ? i : next_present[i + 1];
+    }
+}
+
+static void
+check_at_(lz_omap_iter * it, int res, size_t expect)
+{
+    const char * k;
+    size_t       klen;
+
+    if (expect == n_keys)
+    {
+        lz_assert(res == -1);
+        return;
+    }
+
+    lz_assert(res == 0);
+    lz_assert((k = lz_omap_iter_key(it, &klen)) != NULL);
+    lz_assert(cmp_(k, klen, keys[expect].b, keys[expect].len) == 0);
+    lz_assert(*(size_t *)lz_omap_iter_val(it) == expect);
+}
+
+struct walk {
+    size_t next;   /* the model index expected next */
+    size_t end;    /* stop expecting past this one */
+    size_t n;
+};
+
+/* entries must come in model order, from walk->next on */
+static int
+walk_(const char * key, size_t klen, void * val, void * arg)
+{
+    struct walk * w = arg;
+
+    lz_assert(w->next < w->end);
+    lz_assert(cmp_(key, klen, keys[w->next].b, keys[w->next].len) == 0);
+    lz_assert(*(size_t *)val == w->next);
+
+    w->next = next_present[w->next + 1];
+    w->n++;
+
+    return 0;
+}
+
+static void
+check_(lz_omap * map)
+{
+    lz_omap_iter it;
+    struct walk  w;
+    size_t       n;
+    size_t       i;
+
+    index_model_();
+
+    for (i = 0, n = 0; i < n_keys; i++)
+    {
+        n += present[i];
+    }
+
+    lz_assert(lz_omap_get_size(map) == n);
+    lz_assert((size_t)n_vals == n);
+
+    /* everything in order, through for_each and through an iterator */
+    w.next = next_present[0];
+    w.end  = n_keys;
+    w.n    = 0;
+    lz_assert(lz_omap_for_each(map, walk_, &w) == 0);
+    lz_assert(w.n == n && w.next == n_keys);
+
+    check_at_(&it, lz_omap_first(map, &it), next_present[0]);
+
+    for (i = next_present[0]; i < n_keys; i = next_present[i + 1])
+    {
+        check_at_(&it, lz_omap_iter_next(&it), next_present[i + 1]);
+    }
+
+    /* every key as a bound, whether it is in the map or not */
+    for (i = 0; i < n_keys; i++)
+    {
+        const char * k = (char *)keys[i].b;
+
+        check_at_(&it, lz_omap_lower_bound(map, k, keys[i].len, &it), next_present[i]);
+        check_at_(&it, lz_omap_upper_bound(map, k, keys[i].len, &it), next_present[i + 1]);
+
+        lz_assert((lz_omap_find(map, k, keys[i].len) != NULL) == present[i]);
+    }
+
+    /* random ranges, unbounded on either side now and then */
+    for (i = 0; i < 200; i++)
+    {
+        size_t lo = rand_() % n_keys;
+        size_t hi = lo + rand_() % (n_keys - lo);
+        int    no_lo = rand_() % 10 == 0;
+        int    no_hi = rand_() % 10 == 0;
+
+        w.next = next_present[no_lo ? 0 : lo];
+        w.end  = no_hi ? n_keys : hi;
+        w.n    = 0;
+
+        lz_assert(lz_omap_range(map,
+                                no_lo ? NULL : (char *)keys[lo].b, keys[lo].len,
+                                no_hi ? NULL : (char *)keys[hi].b, keys[hi].len,
+                                walk_, &w) == 0);
+
+        /* it stopped where the model does */
+        lz_assert(w.next >= w.end);
+    }
+
+    /* prefixes: every truncation of a few keys */
+    for (i = 0; i < 100; i++)
+    {
+        struct key * k = &keys[rand_() % n_keys];
+        size_t       l;
+
+        for (l = 0; l <= k->len; l++)
+        {
+            size_t j = next_present[0];
+            size_t last;
+
+            /* the keys with the prefix are a contiguous run in the model */
+            while (j < n_keys && cmp_(keys[j].b, keys[j].len < l ? keys[j].len : l, k->b, l) < 0)
+            {
+                j = next_present[j + 1];
+            }
+
+            for (last = j; last < n_keys && keys[last].len >= l &&
+                 memcmp(keys[last].b, k->b, l) == 0; last++)
+            {
+            }
+
+            w.next = j;
+            w.end  = last;
+            w.n    = 0;
+
+            lz_assert(lz_omap_prefix(map, (char *)k->b, l, walk_, &w) == 0);
+            lz_assert(w.next >= w.end);
+        }
+    }
+}
+
+static int
+count_(const char * key, size_t klen, void * val, void * arg)
+{
+    (void)key;
+    (void)klen;
+    (void)val;
+
+    (*(size_t *)arg)++;
+
+    return 0;
+}
+
+/* keys at the top of the byte range, where a prefix can not be turned into
+ * an upper bound by incrementing its last byte */
+static void
+test_ff_(void)
+{
+    static const char * ks[] = {
+        "a", "a\xfe", "a\xff", "a\xff\xff", "a\xff\xff\x00", "b",
+        "\xff", "\xff\xff", "\xff\xff\xff",
+    };
+    lz_omap           * map = lz_omap_new();
+    lz_omap_iter        it;
+    size_t              n;
+    size_t              i;
+
+    lz_assert(map != NULL);
+
+    for (i = 0; i < sizeof(ks) / sizeof(ks[0]); i++)
+    {
+        /* "a\xff\xff\x00" is 4 bytes long */
+        size_t l = strlen(ks[i]) + (i == 4);
+
+        lz_assert(lz_omap_add(map, ks[i], l, (void *)(i + 1), NULL) == 0);
+    }
+
+    n = 0;
+    lz_assert(lz_omap_prefix(map, "a\xff", 2, count_, &n) == 0);
+    lz_assert(n == 3);
+
+    n = 0;
+    lz_assert(lz_omap_prefix(map, "a\xff\xff", 3, count_, &n) == 0);
+    lz_assert(n == 2);
+
+    n = 0;
+    lz_assert(lz_omap_prefix(map, "\xff", 1, count_, &n) == 0);
+    lz_assert(n == 3);
+
+    n = 0;
+    lz_assert(lz_omap_prefix(map, "\xff\xff\xff\xff", 4, count_, &n) == 0);
+    lz_assert(n == 0);
+
+    n = 0;
+    lz_assert(lz_omap_prefix(map, "", 0, count_, &n) == 0);
+    lz_assert(n == 9);
+
+    /* past the last key */
+    lz_assert(lz_omap_upper_bound(map, "\xff\xff\xff", 3, &it) == -1);
+    lz_assert(lz_omap_lower_bound(map, "\xff\xff\xff\x00", 4, &it) == -1);
+    lz_assert(lz_omap_lower_bound(map, "\xff\xff\xff", 3, &it) == 0);
+    lz_assert(lz_omap_iter_val(&it) == (void *)9);
+
+    /* a range ending at a 0xff key excludes it */
+    n = 0;
+    lz_assert(lz_omap_range(map, "a\xff", 2, "\xff", 1, count_, &n) == 0);
+    lz_assert(n == 4);
+
+    lz_omap_free(map);
+}
+
+static void
+test_model_(void)
+{
+    lz_omap * map = lz_omap_new();
+    size_t    i;
+    int       round;
+
+    lz_assert(map != NULL);
+
+    memset(present, 0, sizeof(present));
+    check_(map);
+
+    /* ascending: always splitting the last chunk */
+    for (i = 0; i < n_keys; i += 2)
+    {
+        add_(map, i);
+    }
+
+    check_(map);
+
+    /* descending: always in front of a chunk's first key */
+    for (i = n_keys; i-- > 0;)
+    {
+        if (i % 2)
+        {
+            add_(map, i);
+        }
+    }
+
+    check_(map);
+
+    /* random churn, draining down to a tenth then filling back up: the
+     * chunks emptied out get merged */
+    for (round = 0; round < 4; round++)
+    {
+        for (i = 0; i < 3 * n_keys; i++)
+        {
+            size_t k = rand_() % n_keys;
+
+            if (round % 2 == 0 ? rand_() % 10 != 0 : rand_() % 10 == 0)
+            {
+                remove_(map, k);
+            } else {
+                add_(map, k);
+            }
+        }
+
+        check_(map);
+    }
+
+    /* replacing with the same value keeps it, a new one frees the old */
+    for (i = 0; i < n_keys && !present[i]; i++)
+    {
+    }
+
+    if (i < n_keys)
+    {
+        void * v = lz_omap_find(map, (char *)keys[i].b, keys[i].len);
+        long   n = n_vals;
+
+        lz_assert(lz_omap_add(map, (char *)keys[i].b, keys[i].len, v, val_free_) == 0);
+        lz_assert(n_vals == n);
+
+        add_(map, i);
+        lz_assert(n_vals == n);
+    }
+
+    /* empty it by hand, then clear a full one */
+    for (i = 0; i < n_keys; i++)
+    {
+        remove_(map, i);
+    }
+
+    check_(map);
+
+    for (i = 0; i < n_keys; i++)
+    {
+        add_(map, i);
+    }
+
+    check_(map);
+
+    lz_assert(lz_omap_clear(map) == 0);
+    lz_assert(n_vals == 0);
+
+    memset(present, 0, sizeof(present));
+    check_(map);
+
+    for (i = 0; i < n_keys; i += 3)
+    {
+        add_(map, i);
+    }
+
+    check_(map);
+
+    lz_omap_free(map);
+    lz_assert(n_vals == 0);
+}
+
+int
+main(void)
+{
+    make_keys_();
+
+    test_ff_();
+    test_model_();
+
+    return 0;
+}
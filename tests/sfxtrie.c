@@ -0,0 +1,545 @@
+/*
+ * lz_sfxtrie against a per-label reference, one lz_kvmap lookup for every
+ * suffix of the name: longest matches and their length, exact finds, case
+ * and trailing dots, the root rule, invalid names, removes, and enough
+ * distinct label bytes to grow nodes to every size. A trie made by
+ * lz_sfxtrie_build() must answer like one made by lz_sfxtrie_add(), and a
+ * frozen copy like the trie it was frozen from.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <liblz.h>
+#include <liblz/lzapi.h>
+
+#define N_RULES   4000
+#define N_QUERIES 20000
+#define NAME_BUF  (LZ_SFXTRIE_NAME_MAX + 8)
+
+struct rule {
+    char   name[NAME_BUF];
+    size_t len;
+    char * val;
+};
+
+static struct rule rules[N_RULES];
+static char        path[64];
+static long        n_vals;
+static uint64_t    rs = 88172645463325252ULL;
+
+/* what the trie should hold: normalized rule -> value, the root apart */
+static lz_kvmap * ref;
+static char     * ref_root;
+
+static uint64_t
+rand_(void)
+{
+    rs ^= rs << 13; rs ^= rs >> 7; rs ^= rs << 17;
+
+    return rs;
+}
+
+static char *
+val_new_(size_t i)
+{
+    char * v = malloc(16);
+
+    lz_alloc_assert(v);
+    snprintf(v, 16, "v%zu", i);
+
+    n_vals += 1;
+
+    return v;
+}
+
+static void
+val_free_(void * arg)
+{
+    n_vals -= 1;
+    free(arg);
+}
+
+/* appends a label: mostly words in random case, sometimes a single byte of
+ * any value but '.', so that nodes get up to 256 children */
+static size_t
+label_(char * buf)
+{
+    static const char * words[] = {
+        "com", "net", "org", "example", "www", "mail", "a", "b", "cdn", "x-y",
+    };
+    const char * w;
+    size_t       len;
+    size_t       i;
+
+    if (rand_() % 4 == 0)
+    {
+        uint8_t c;
+
+        do {
+            c = (uint8_t)(1 + rand_() % 255);
+        } while (c == '.');
+
+        buf[0] = (char)c;
+
+        return 1;
+    }
+
+    w   = words[rand_() % (sizeof(words) / sizeof(words[0]))];
+    len = strlen(w);
+
+    for (i = 0; i < len; i++)
+    {
+        buf[i] = rand_() % 3 == 0 && w[i] >= 'a' && w[i] <= 'z' ? (char)(w[i] - 32) : w[i];
+    }
+
+    return len;
+}
+
+/* n labels, prepended to the suffix already in buf at [0, len) */
+static size_t
+name_(char * buf, size_t len, int n)
+{
+    char   tmp[NAME_BUF];
+    size_t l;
+
+    while (n-- > 0)
+    {
+        l = label_(tmp);
+
+        if (len > 0)
+        {
+            tmp[l++] = '.';
+        }
+
+        lz_assert(l + len < NAME_BUF);
+
+        memmove(buf + l, buf, len);
+        memcpy(buf, tmp, l);
+
+        len += l;
+    }
+
+    buf[len] = '\0';
+
+    return len;
+}
+
+/* a single trailing dot off, A-Z lowercased */
+static size_t
+norm_(const char * name, size_t len, char * out)
+{
+    size_t i;
+
+    if (len > 0 && name[len - 1] == '.')
+    {
+        len--;
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        out[i] = name[i] >= 'A' && name[i] <= 'Z' ? (char)(name[i] + 32) : name[i];
+    }
+
+    out[len] = '\0';
+
+    return len;
+}
+
+static void
+ref_set_(const char * name, size_t len, char * val)
+{
+    char   key[NAME_BUF];
+    size_t l = norm_(name, len, key);
+
+    if (l == 0)
+    {
+        ref_root = val;
+        return;
+    }
+
+    lz_assert(lz_kvmap_upsert(ref, key, l, val, NULL, NULL) != NULL);
+}
+
+static void
+ref_del_(const char * name, size_t len)
+{
+    char   key[NAME_BUF];
+    size_t l = norm_(name, len, key);
+
+    if (l == 0)
+    {
+        ref_root = NULL;
+        return;
+    }
+
+    lz_kvmap_remove_wklen(ref, key, l);
+}
+
+/* the name itself, then each suffix after a '.', then the root */
+static char *
+ref_match_(const char * name, size_t len, size_t * mlen)
+{
+    char   key[NAME_BUF];
+    char * val;
+    size_t l = norm_(name, len, key);
+    size_t i;
+
+    for (i = 0; i < l; i++)
+    {
+        if (i == 0 || key[i - 1] == '.')
+        {
+            if ((val = lz_kvmap_find_wklen(ref, key + i, l - i)) != NULL)
+            {
+                *mlen = l - i;
+                return val;
+            }
+        }
+    }
+
+    *mlen = 0;
+
+    return ref_root;
+}
+
+static char *
+ref_find_(const char * name, size_t len)
+{
+    char   key[NAME_BUF];
+    size_t l = norm_(name, len, key);
+
+    return l ? lz_kvmap_find_wklen(ref, key, l) : ref_root;
+}
+
+/* copies a rule into buf without its trailing dot */
+static size_t
+rule_copy_(char * buf, size_t i)
+{
+    size_t len = rules[i].len;
+
+    if (len > 0 && rules[i].name[len - 1] == '.')
+    {
+        len--;
+    }
+
+    memcpy(buf, rules[i].name, len);
+
+    return len;
+}
+
+/* a query: a rule with 0 to 2 labels in front, or something random */
+static size_t
+query_(char * buf)
+{
+    if (rand_() % 5 == 0)
+    {
+        return name_(buf, 0, 1 + (int)(rand_() % 4));
+    }
+
+    return name_(buf, rule_copy_(buf, rand_() % N_RULES), (int)(rand_() % 3));
+}
+
+static void
+make_rules_(void)
+{
+    size_t i;
+
+    for (i = 0; i < N_RULES; i++)
+    {
+        /* some rules are suffixes of earlier ones */
+        if (i > 0 && rand_() % 3 == 0)
+        {
+            rules[i].len = rule_copy_(rules[i].name, rand_() % i);
+            rules[i].len = name_(rules[i].name, rules[i].len, 1);
+        } else {
+            rules[i].len = name_(rules[i].name, 0, 1 + (int)(rand_() % 3));
+        }
+
+        /* a trailing dot on a few */
+        if (rand_() % 10 == 0)
+        {
+            rules[i].name[rules[i].len++] = '.';
+            rules[i].name[rules[i].len]   = '\0';
+        }
+    }
+}
+
+static void
+check_(lz_sfxtrie * trie, lz_sfxtrie * other)
+{
+    char   name[NAME_BUF];
+    size_t len;
+    size_t mlen;
+    size_t ref_mlen;
+    size_t other_mlen;
+    char * val;
+    int    k;
+
+    for (k = 0; k < N_QUERIES; k++)
+    {
+        len = query_(name);
+
+        /* and now and then with a trailing dot */
+        if (k % 7 == 0)
+        {
+            name[len++] = '.';
+            name[len]   = '\0';
+        }
+
+        mlen = SIZE_MAX;
+        val  = lz_sfxtrie_match(trie, name, len, &mlen);
+
+        lz_assert(val == ref_match_(name, len, &ref_mlen));
+        lz_assert(val == NULL || mlen == ref_mlen);
+        lz_assert(lz_sfxtrie_find(trie, name, len) == ref_find_(name, len));
+
+        if (other != NULL)
+        {
+            const char * oval = lz_sfxtrie_match(other, name, len, &other_mlen);
+
+            lz_assert(oval == NULL ? val == NULL : val != NULL && strcmp(oval, val) == 0);
+            lz_assert(val == NULL || other_mlen == mlen);
+        }
+    }
+}
+
+static void
+test_invalid_(lz_sfxtrie * trie)
+{
+    char   name[NAME_BUF + 8];
+    char * val = val_new_(0);
+
+    lz_assert(lz_sfxtrie_add(trie, "a..b", 4, val, val_free_) == -1);
+    lz_assert(lz_sfxtrie_add(trie, ".a", 2, val, val_free_) == -1);
+    lz_assert(lz_sfxtrie_add(trie, "a..", 3, val, val_free_) == -1);
+    lz_assert(lz_sfxtrie_match(trie, "x..com", 6, NULL) == NULL);
+    lz_assert(lz_sfxtrie_find(trie, "..", 2) == NULL);
+
+    /* 255 bytes is the longest name, a trailing dot not counted */
+    memset(name, 'a', LZ_SFXTRIE_NAME_MAX + 2);
+    name[LZ_SFXTRIE_NAME_MAX] = '.';
+
+    lz_assert(lz_sfxtrie_add(trie, name, LZ_SFXTRIE_NAME_MAX + 1, val, NULL) == 0);
+    lz_assert(lz_sfxtrie_find(trie, name, LZ_SFXTRIE_NAME_MAX) == val);
+    lz_assert(lz_sfxtrie_remove(trie, name, LZ_SFXTRIE_NAME_MAX) == 0);
+
+    lz_assert(lz_sfxtrie_add(trie, name, LZ_SFXTRIE_NAME_MAX + 2, val, NULL) == -1);
+    lz_assert(lz_sfxtrie_remove(trie, name, LZ_SFXTRIE_NAME_MAX) == -1);
+
+    val_free_(val);
+}
+
+/* adds the rules one at a time, removing some again */
+static lz_sfxtrie *
+added_(void)
+{
+    lz_sfxtrie * trie = lz_sfxtrie_new();
+    size_t       i;
+    size_t       n;
+
+    lz_assert(trie != NULL);
+
+    for (i = 0; i < N_RULES; i++)
+    {
+        rules[i].val = val_new_(i);
+        lz_assert(lz_sfxtrie_add(trie, rules[i].name, rules[i].len, rules[i].val, val_free_) == 0);
+        ref_set_(rules[i].name, rules[i].len, rules[i].val);
+    }
+
+    /* every rule added once, replaced ones freed */
+    n = lz_kvmap_get_size(ref) + (ref_root != NULL);
+    lz_assert(lz_sfxtrie_get_size(trie) == n);
+    lz_assert((size_t)n_vals == n);
+
+    return trie;
+}
+
+static void
+test_add_(void)
+{
+    lz_sfxtrie * trie = added_();
+    char       * root = val_new_(N_RULES);
+    size_t       mlen;
+    size_t       i;
+
+    check_(trie, NULL);
+    test_invalid_(trie);
+
+    lz_assert(lz_sfxtrie_match(trie, "nothing.invalid", 15, &mlen) == NULL);
+
+    /* the root rule catches everything else */
+    lz_assert(lz_sfxtrie_add(trie, ".", 1, root, val_free_) == 0);
+    ref_set_(".", 1, root);
+
+    lz_assert(lz_sfxtrie_match(trie, "nothing.invalid", 15, &mlen) == root);
+    lz_assert(mlen == 0);
+    lz_assert(lz_sfxtrie_find(trie, "", 0) == root);
+    lz_assert(lz_sfxtrie_find(trie, "nothing.invalid", 15) == NULL);
+
+    check_(trie, NULL);
+
+    /* a third of the rules removed, then the root */
+    for (i = 0; i < N_RULES; i += 3)
+    {
+        int in_ref = ref_find_(rules[i].name, rules[i].len) != NULL;
+
+        lz_assert((lz_sfxtrie_remove(trie, rules[i].name, rules[i].len) == 0) == in_ref);
+        ref_del_(rules[i].name, rules[i].len);
+    }
+
+    check_(trie, NULL);
+
+    lz_assert(lz_sfxtrie_remove(trie, "", 0) == 0);
+    ref_del_("", 0);
+
+    check_(trie, NULL);
+
+    lz_assert(lz_sfxtrie_get_size(trie) == lz_kvmap_get_size(ref));
+    lz_assert((size_t)n_vals == lz_kvmap_get_size(ref));
+
+    lz_sfxtrie_free(trie);
+    lz_assert(n_vals == 0);
+}
+
+static int
+rule_cmp_(const void * a, const void * b)
+{
+    const struct rule * ra = &rules[*(const size_t *)a];
+    const struct rule * rb = &rules[*(const size_t *)b];
+
+    return lz_sfxtrie_cmp(ra->name, ra->len, rb->name, rb->len);
+}
+
+/*
+ * all the rules in the order they were added, duplicates and all, or only
+ * those that won, sorted into trie order
+ */
+static void
+test_build_(int sorted)
+{
+    lz_sfxtrie * trie = added_();
+    lz_sfxtrie * built;
+    const char * names[N_RULES];
+    size_t       lens[N_RULES];
+    void       * vals[N_RULES];
+    size_t       idx[N_RULES];
+    size_t       n;
+    size_t       i;
+
+    for (i = 0, n = 0; i < N_RULES; i++)
+    {
+        char won[16];
+
+        /* by its string, a replaced value's address may be reused */
+        snprintf(won, sizeof(won), "v%zu", i);
+
+        if (!sorted || strcmp(ref_find_(rules[i].name, rules[i].len), won) == 0)
+        {
+            idx[n++] = i;
+        }
+    }
+
+    if (sorted)
+    {
+        lz_assert(n == lz_sfxtrie_get_size(trie));
+        qsort(idx, n, sizeof(size_t), rule_cmp_);
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        names[i] = rules[idx[i]].name;
+        lens[i]  = rules[idx[i]].len;
+        vals[i]  = val_new_(idx[i]);
+    }
+
+    /* the values of the duplicates are released right away */
+    lz_assert((built = lz_sfxtrie_build(names, lens, vals, n, val_free_)) != NULL);
+    lz_assert(lz_sfxtrie_get_size(built) == lz_sfxtrie_get_size(trie));
+    lz_assert((size_t)n_vals == 2 * lz_sfxtrie_get_size(trie));
+
+    check_(trie, built);
+
+    lz_sfxtrie_free(built);
+    lz_sfxtrie_free(trie);
+    lz_assert(n_vals == 0);
+}
+
+static void
+test_frozen_(void)
+{
+    lz_sfxtrie        * trie = added_();
+    lz_sfxtrie_frozen * frozen;
+    char                name[NAME_BUF];
+    FILE              * fp;
+    int                 k;
+
+    lz_assert(lz_sfxtrie_freeze(trie, path, NULL, NULL) == 0);
+    lz_assert((frozen = lz_sfxtrie_frozen_open(path)) != NULL);
+    lz_assert(lz_sfxtrie_frozen_get_size(frozen) == lz_sfxtrie_get_size(trie));
+
+    for (k = 0; k < N_QUERIES; k++)
+    {
+        const char * fval;
+        char       * val;
+        size_t       len   = query_(name);
+        size_t       mlen  = 0;
+        size_t       fmlen = 0;
+        size_t       vlen  = 0;
+
+        val  = lz_sfxtrie_match(trie, name, len, &mlen);
+        fval = lz_sfxtrie_frozen_match(frozen, name, len, &fmlen, &vlen);
+
+        lz_assert(fval == NULL ? val == NULL : val != NULL && strcmp(fval, val) == 0);
+        lz_assert(val == NULL || (fmlen == mlen && vlen == strlen(val)));
+
+        val  = lz_sfxtrie_find(trie, name, len);
+        fval = lz_sfxtrie_frozen_find(frozen, name, len, NULL);
+
+        lz_assert(fval == NULL ? val == NULL : val != NULL && strcmp(fval, val) == 0);
+    }
+
+    lz_sfxtrie_frozen_close(frozen);
+
+    /* not a frozen trie */
+    lz_assert((fp = fopen(path, "w")) != NULL);
+    fputs("not a trie, not even close to one, but long enough for a header", fp);
+    fclose(fp);
+
+    lz_assert(lz_sfxtrie_frozen_open(path) == NULL);
+
+    lz_sfxtrie_free(trie);
+    lz_assert(n_vals == 0);
+}
+
+static void
+ref_reset_(void)
+{
+    lz_assert(lz_kvmap_clear(ref) == 0);
+    ref_root = NULL;
+}
+
+int
+main(void)
+{
+    snprintf(path, sizeof(path), "/tmp/lz_test_sfxtrie.%d", (int)getpid());
+
+    lz_assert((ref = lz_kvmap_new(1024)) != NULL);
+
+    make_rules_();
+
+    test_add_();
+    ref_reset_();
+    test_build_(0);
+    ref_reset_();
+    test_build_(1);
+    ref_reset_();
+    test_frozen_();
+
+    lz_kvmap_free(ref);
+    unlink(path);
+
+    return 0;
+}